@@ -0,0 +1,152 @@
+/* libldm
+ * Copyright 2012 Red Hat Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+
+#include <endian.h>
+#include <string.h>
+
+#include "cbor.h"
+
+/* Major types */
+#define CBOR_UINT   0
+#define CBOR_NINT   1
+#define CBOR_BYTES  2
+#define CBOR_STRING 3
+#define CBOR_ARRAY  4
+#define CBOR_MAP    5
+#define CBOR_TAG    6
+#define CBOR_SIMPLE 7
+
+#define CBOR_FALSE  20
+#define CBOR_TRUE   21
+#define CBOR_NULL   22
+#define CBOR_DOUBLE 27
+
+/* Write an item header using the shortest encoding of the argument */
+static void
+_write_head(GByteArray * const buf, const uint8_t major, const uint64_t arg)
+{
+    uint8_t head[9];
+    size_t len;
+
+    head[0] = major << 5;
+    if (arg < 24) {
+        head[0] |= arg;
+        len = 1;
+    } else if (arg <= UINT8_MAX) {
+        head[0] |= 24;
+        head[1] = arg;
+        len = 2;
+    } else if (arg <= UINT16_MAX) {
+        const uint16_t be = htobe16(arg);
+        head[0] |= 25;
+        memcpy(&head[1], &be, sizeof(be));
+        len = 3;
+    } else if (arg <= UINT32_MAX) {
+        const uint32_t be = htobe32(arg);
+        head[0] |= 26;
+        memcpy(&head[1], &be, sizeof(be));
+        len = 5;
+    } else {
+        const uint64_t be = htobe64(arg);
+        head[0] |= 27;
+        memcpy(&head[1], &be, sizeof(be));
+        len = 9;
+    }
+
+    g_byte_array_append(buf, head, len);
+}
+
+void
+cbor_write_uint(GByteArray * const buf, const uint64_t v)
+{
+    _write_head(buf, CBOR_UINT, v);
+}
+
+void
+cbor_write_int(GByteArray * const buf, const int64_t v)
+{
+    if (v >= 0) {
+        _write_head(buf, CBOR_UINT, v);
+    } else {
+        /* -1 - n, computed without overflowing INT64_MIN */
+        _write_head(buf, CBOR_NINT, ~(uint64_t) v);
+    }
+}
+
+void
+cbor_write_bytes(GByteArray * const buf, const void * const data,
+                 const size_t len)
+{
+    _write_head(buf, CBOR_BYTES, len);
+    g_byte_array_append(buf, data, len);
+}
+
+void
+cbor_write_string(GByteArray * const buf, const char * const str,
+                  const size_t len)
+{
+    _write_head(buf, CBOR_STRING, len);
+    g_byte_array_append(buf, (const uint8_t *) str, len);
+}
+
+void
+cbor_write_array(GByteArray * const buf, const size_t n)
+{
+    _write_head(buf, CBOR_ARRAY, n);
+}
+
+void
+cbor_write_map(GByteArray * const buf, const size_t n)
+{
+    _write_head(buf, CBOR_MAP, n);
+}
+
+void
+cbor_write_tag(GByteArray * const buf, const uint64_t tag)
+{
+    _write_head(buf, CBOR_TAG, tag);
+}
+
+void
+cbor_write_bool(GByteArray * const buf, const int v)
+{
+    const uint8_t b = (CBOR_SIMPLE << 5) | (v ? CBOR_TRUE : CBOR_FALSE);
+    g_byte_array_append(buf, &b, 1);
+}
+
+void
+cbor_write_null(GByteArray * const buf)
+{
+    const uint8_t b = (CBOR_SIMPLE << 5) | CBOR_NULL;
+    g_byte_array_append(buf, &b, 1);
+}
+
+void
+cbor_write_double(GByteArray * const buf, const double v)
+{
+    uint8_t item[9];
+    uint64_t bits;
+
+    memcpy(&bits, &v, sizeof(bits));
+    bits = htobe64(bits);
+
+    item[0] = (CBOR_SIMPLE << 5) | CBOR_DOUBLE;
+    memcpy(&item[1], &bits, sizeof(bits));
+    g_byte_array_append(buf, item, sizeof(item));
+}
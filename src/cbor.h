@@ -0,0 +1,38 @@
+/* libldm
+ * Copyright 2012 Red Hat Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* A minimal CBOR (RFC 7049) encoder. Only definite-length items are
+ * generated. */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <glib.h>
+
+/* Tag for a 16 byte binary UUID (RFC 4122) */
+#define CBOR_TAG_UUID 37
+
+void cbor_write_uint(GByteArray *buf, uint64_t v);
+void cbor_write_int(GByteArray *buf, int64_t v);
+void cbor_write_bytes(GByteArray *buf, const void *data, size_t len);
+void cbor_write_string(GByteArray *buf, const char *str, size_t len);
+void cbor_write_array(GByteArray *buf, size_t n);
+void cbor_write_map(GByteArray *buf, size_t n);
+void cbor_write_tag(GByteArray *buf, uint64_t tag);
+void cbor_write_bool(GByteArray *buf, int v);
+void cbor_write_null(GByteArray *buf);
+void cbor_write_double(GByteArray *buf, double v);
@@ -0,0 +1,120 @@
+/* libldm
+ * Copyright 2012 Red Hat Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdint.h>
+#include <glib.h>
+#include <libdevmapper.h>
+
+/* A volume's devices are planned before any of them is created. A plan is an
+ * array of struct _dm_plan_dev in creation order: each device is stacked only
+ * on disks and on devices earlier in the plan, and the volume's own device is
+ * last. */
+
+typedef enum {
+    _DM_SEG_LINEAR,
+    _DM_SEG_STRIPED,
+    _DM_SEG_RAID
+} _dm_seg_type;
+
+/* The device under a segment, or under one member of a raid segment */
+struct _dm_plan_area
+{
+    const gchar *disk;  /* The path of a disk, or NULL */
+    gint dev;           /* If disk is NULL, the index of a planned device, or
+                         * -1 for a missing raid member */
+    guint64 offset;
+};
+
+struct _dm_plan_seg
+{
+    _dm_seg_type type;
+    guint64 size;
+    guint32 stripe_size;                    /* _DM_SEG_STRIPED */
+    struct dm_tree_node_raid_params raid;   /* _DM_SEG_RAID */
+    GArray *areas;                          /* struct _dm_plan_area */
+};
+
+struct _dm_plan_dev
+{
+    GString *name;
+    GString *uuid;
+    gboolean read_only;
+    GArray *segs;                           /* struct _dm_plan_seg */
+};
+
+/* The device mapper operations used by ldm.c. The default backend calls
+ * libdevmapper. Errors are reported in the LDM_ERROR domain. Operations are
+ * never called from several threads at once. */
+typedef struct _dm_backend dm_backend_t;
+
+struct _dm_backend
+{
+    /* Returns a snapshot of the host's devices, or NULL on error */
+    gpointer (*list)(const dm_backend_t *backend, GError **err);
+    void (*list_free)(const dm_backend_t *backend, gpointer snapshot);
+
+    /* Returns the name of the device with the given uuid in snapshot, or NULL
+     * if there isn't one */
+    const gchar *(*info)(const dm_backend_t *backend, gpointer snapshot,
+                         const gchar *uuid);
+
+    /* Create and resume every device of plan. If any step fails, every
+     * device which was created is removed again. */
+    gboolean (*create)(const dm_backend_t *backend, const GArray *plan,
+                       uint32_t cookie, GError **err);
+
+    /* Remove the device with the given uuid in snapshot, then every device
+     * under it which is no longer in use */
+    gboolean (*remove)(const dm_backend_t *backend, gpointer snapshot,
+                       const gchar *uuid, uint32_t cookie, GError **err);
+
+    /* Returns the live table of the device with the given uuid as the kernel
+     * reports it: a "start size type params" line for each target, with the
+     * devices under it given as major:minor. Sets *read_only. Returns NULL if
+     * there is no such device, or its table can't be read. */
+    gchar *(*table)(const dm_backend_t *backend, gpointer snapshot,
+                    const gchar *uuid, gboolean *read_only);
+
+    /* Sets *major and *minor to the device number of the disk at path disk,
+     * or if disk is NULL, of the device with the given uuid in snapshot.
+     * Returns FALSE if it isn't known. */
+    gboolean (*dev_number)(const dm_backend_t *backend, gpointer snapshot,
+                           const gchar *disk, const gchar *uuid,
+                           guint *major, guint *minor);
+
+    /* Bring the existing devices of the volume planned by plan, whose own
+     * device is in snapshot, up to date. A device whose live table differs
+     * from the planned one is reloaded and resumed in place, a missing one is
+     * created, and one the volume no longer uses is removed. Identical tables
+     * are left alone. Sets *changed if any device was changed. It is only
+     * called when some device of plan is missing, or differs from its live
+     * table or mode. */
+    gboolean (*reload)(const dm_backend_t *backend, gpointer snapshot,
+                       const GArray *plan, gboolean *changed, uint32_t cookie,
+                       GError **err);
+
+    /* A udev cookie groups the events of several operations, which are all
+     * waited for at once */
+    gboolean (*cookie_create)(const dm_backend_t *backend, uint32_t *cookie,
+                              GError **err);
+    void (*udev_wait)(const dm_backend_t *backend, uint32_t cookie);
+};
+
+/* Set the backend used by LDM objects created afterwards. NULL restores the
+ * libdevmapper backend. For tests only: it is exported from libldm, but isn't
+ * part of its API. */
+void _ldm_dm_backend_set(const dm_backend_t *backend);
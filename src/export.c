@@ -0,0 +1,471 @@
+/* libldm
+ * Copyright 2012 Red Hat Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <uuid/uuid.h>
+
+#include "export.h"
+#include "simd.h"
+
+#define SECTOR_SIZE UINT64_C(512)
+
+/* The amount of the volume copied by a reader at a time */
+#define EXPORT_UNIT (4 * 1024 * 1024)
+
+/* Blocks of zeros of this size are left as holes in the output */
+#define EXPORT_BLOCK 4096
+
+struct _export_stats
+{
+    guint64 done;
+    guint64 written;            /* Written from userspace */
+    guint64 copied;             /* Copied in the kernel by copy_file_range */
+    guint64 holes;              /* Left as holes */
+};
+
+struct _export
+{
+    LDMVolumeInfo info;
+    gchar guid[37];
+    guint64 size;
+
+    LDMVolume *vol;
+    LDMVolumeHandle *h;
+
+    /* Per column. Disks which are image files rather than block devices can
+     * be copied from directly. Otherwise the column is -1. */
+    GArray *parts;
+    int *images;
+
+    const gchar *path;
+    int out;
+    gboolean sparse;            /* out is a regular file */
+    gint copy;                  /* copy_file_range works between images and
+                                   out */
+
+    GMutex lock;
+    GCond cond;
+    guint64 next;
+    guint running;
+    struct _export_stats stats;
+    GError *err;
+};
+
+static gboolean
+_write_all(const struct _export * const e, const guint8 * const buf,
+           const gsize len, const guint64 offset, GError ** const err)
+{
+    gsize written = 0;
+    while (written < len) {
+        const ssize_t out = pwrite(e->out, buf + written, len - written,
+                                   offset + written);
+        if (out == -1) {
+            if (errno == EINTR) continue;
+            g_set_error(err, LDM_ERROR, LDM_ERROR_IO,
+                        "Error writing to %s: %m", e->path);
+            return FALSE;
+        }
+        written += out;
+    }
+
+    return TRUE;
+}
+
+/* Read a unit through the volume handle, and write everything except blocks
+ * of zeros */
+static gboolean
+_export_read(struct _export * const e, guint8 * const buf,
+             const guint64 offset, const gsize len,
+             struct _export_stats * const stats, GError ** const err)
+{
+    if (ldm_volume_pread(e->h, buf, len, offset, err) == -1) return FALSE;
+
+    if (!e->sparse) {
+        if (!_write_all(e, buf, len, offset, err)) return FALSE;
+        stats->written += len;
+        return TRUE;
+    }
+
+    gsize run = 0;              /* Start of the current run of data */
+    gsize i = 0;
+    for (; i < len; i += EXPORT_BLOCK) {
+        const gsize block = MIN(EXPORT_BLOCK, len - i);
+        if (!_ldm_simd_is_zero(buf + i, block)) continue;
+
+        if (i > run) {
+            if (!_write_all(e, buf + run, i - run, offset + run, err)) {
+                return FALSE;
+            }
+            stats->written += i - run;
+        }
+        stats->holes += block;
+        run = i + block;
+    }
+
+    if (len > run) {
+        if (!_write_all(e, buf + run, len - run, offset + run, err)) {
+            return FALSE;
+        }
+        stats->written += len - run;
+    }
+
+    return TRUE;
+}
+
+#ifdef HAVE_COPY_FILE_RANGE
+
+typedef enum {
+    COPY_ERROR,
+    COPY_DONE,
+    COPY_READ,                  /* This unit must be read instead */
+    COPY_UNSUPPORTED            /* copy_file_range doesn't work for out */
+} _copy_result;
+
+/* Copy length bytes of image at src to dst in the output, skipping holes in
+ * the image */
+static _copy_result
+_copy_range(struct _export * const e, const int image, const guint64 src,
+            const guint64 dst, const guint64 length,
+            struct _export_stats * const stats, GError ** const err)
+{
+    const guint64 end = src + length;
+    guint64 pos = src;
+
+    while (pos < end) {
+        /* Only the return value of lseek is used, so sharing the file
+         * position between threads doesn't matter */
+        off_t data = lseek(image, pos, SEEK_DATA);
+        if (data == -1 && errno == ENXIO) data = end;
+        else if (data == -1) data = pos;
+
+        off_t hole = end;
+        if ((guint64) data < end) {
+            hole = lseek(image, data, SEEK_HOLE);
+            if (hole == -1 || (guint64) hole > end) hole = end;
+        } else {
+            data = end;
+        }
+        stats->holes += data - pos;
+
+        loff_t in_off = data;
+        loff_t out_off = dst + (data - src);
+        while (in_off < hole) {
+            const ssize_t copied = copy_file_range(image, &in_off,
+                                                   e->out, &out_off,
+                                                   hole - in_off, 0);
+            if (copied == -1) {
+                if (errno == EINTR) continue;
+                if (errno == EXDEV || errno == EINVAL || errno == ENOSYS ||
+                    errno == EOPNOTSUPP || errno == EBADF)
+                {
+                    return COPY_UNSUPPORTED;
+                }
+
+                g_set_error(err, LDM_ERROR, LDM_ERROR_IO,
+                            "Error copying to %s: %m", e->path);
+                return COPY_ERROR;
+            }
+
+            if (copied == 0) {
+                g_set_error(err, LDM_ERROR, LDM_ERROR_IO,
+                            "Unexpected end of image copying to %s", e->path);
+                return COPY_ERROR;
+            }
+            stats->copied += copied;
+        }
+
+        pos = hole;
+    }
+
+    return COPY_DONE;
+}
+
+/* Copy a unit directly between disk images and the output. A unit which
+ * touches a missing disk or a block device is read instead. */
+static _copy_result
+_export_copy(struct _export * const e, const guint64 offset, const gsize len,
+             struct _export_stats * const stats, GError ** const err)
+{
+    const gssize n = ldm_volume_map(e->vol, offset, len, NULL, 0, err);
+    if (n == -1) return COPY_ERROR;
+
+    LDMExtent * const extents = g_new(LDMExtent, n);
+    _copy_result r = COPY_ERROR;
+    if (ldm_volume_map(e->vol, offset, len, extents, n, err) == -1) goto out;
+
+    r = COPY_READ;
+    for (gssize i = 0; i < n; i++) {
+        const LDMExtent * const x = &extents[i];
+        if (x->type == LDM_EXTENT_TYPE_DATA && e->images[x->column] == -1) {
+            goto out;
+        }
+    }
+
+    /* The stats of a unit are only counted if all of it was copied */
+    struct _export_stats unit = { 0, };
+    for (gssize i = 0; i < n; i++) {
+        const LDMExtent * const x = &extents[i];
+        if (x->type != LDM_EXTENT_TYPE_DATA) continue;
+
+        r = _copy_range(e, e->images[x->column], x->disk_offset, x->offset,
+                        x->length, &unit, err);
+        if (r != COPY_DONE) goto out;
+    }
+
+    stats->copied += unit.copied;
+    stats->holes += unit.holes;
+
+out:
+    g_free(extents);
+    return r;
+}
+
+#endif /* HAVE_COPY_FILE_RANGE */
+
+static gboolean
+_export_unit(struct _export * const e, guint8 * const buf,
+             const guint64 offset, const gsize len,
+             struct _export_stats * const stats, GError ** const err)
+{
+#ifdef HAVE_COPY_FILE_RANGE
+    if (g_atomic_int_get(&e->copy)) {
+        switch (_export_copy(e, offset, len, stats, err)) {
+        case COPY_ERROR:
+            return FALSE;
+        case COPY_DONE:
+            return TRUE;
+        case COPY_READ:
+            break;
+        case COPY_UNSUPPORTED:
+            g_atomic_int_set(&e->copy, FALSE);
+            break;
+        }
+    }
+#endif
+
+    return _export_read(e, buf, offset, len, stats, err);
+}
+
+static void
+_export_run(gpointer const data, gpointer const user_data)
+{
+    struct _export * const e = data;
+    guint8 * const buf = g_malloc(EXPORT_UNIT);
+
+    g_mutex_lock(&e->lock);
+    while (e->err == NULL && e->next < e->size) {
+        const guint64 offset = e->next;
+        const gsize len = MIN(EXPORT_UNIT, e->size - offset);
+        e->next += len;
+        g_mutex_unlock(&e->lock);
+
+        struct _export_stats stats = { 0, };
+        GError *err = NULL;
+        _export_unit(e, buf, offset, len, &stats, &err);
+
+        g_mutex_lock(&e->lock);
+        if (err && e->err == NULL) e->err = err;
+        else if (err) g_error_free(err);
+
+        e->stats.done += len;
+        e->stats.written += stats.written;
+        e->stats.copied += stats.copied;
+        e->stats.holes += stats.holes;
+        g_cond_signal(&e->cond);
+    }
+    e->running--;
+    g_cond_signal(&e->cond);
+    g_mutex_unlock(&e->lock);
+
+    g_free(buf);
+}
+
+static void
+_export_progress(const struct _export * const e, const gboolean final)
+{
+    fprintf(stderr, "\r%s: %" PRIu64 "/%" PRIu64 " MiB (%u%%)%s",
+            e->info.name, e->stats.done >> 20, e->size >> 20,
+            e->size > 0 ? (guint) (e->stats.done * 100 / e->size) : 100,
+            final ? "\n" : "");
+}
+
+static gboolean
+_export_init(struct _export * const e, LDMVolume * const vol,
+             const gchar * const path, GError ** const err)
+{
+    g_mutex_init(&e->lock);
+    g_cond_init(&e->cond);
+    e->out = -1;
+
+    e->vol = vol;
+    ldm_volume_get_info(vol, &e->info);
+    uuid_unparse(e->info.guid, e->guid);
+    e->size = e->info.size * SECTOR_SIZE;
+    e->path = path;
+
+    e->parts = ldm_volume_get_partitions(vol);
+    e->images = g_new(int, e->parts->len);
+    for (guint i = 0; i < e->parts->len; i++) e->images[i] = -1;
+
+    e->h = ldm_volume_open(vol, err);
+    if (e->h == NULL) return FALSE;
+
+    e->out = open(path, O_WRONLY | O_CREAT | O_CLOEXEC, 0666);
+    if (e->out == -1) {
+        g_set_error(err, LDM_ERROR, LDM_ERROR_IO,
+                    "Error opening %s: %m", path);
+        return FALSE;
+    }
+
+    struct stat st;
+    if (fstat(e->out, &st) == -1) {
+        g_set_error(err, LDM_ERROR, LDM_ERROR_IO,
+                    "Error on fstat %s: %m", path);
+        return FALSE;
+    }
+
+    /* A regular file is emptied and then extended to the size of the volume,
+     * so anything which isn't written is a hole */
+    if (S_ISREG(st.st_mode)) {
+        if (ftruncate(e->out, 0) == -1 || ftruncate(e->out, e->size) == -1) {
+            g_set_error(err, LDM_ERROR, LDM_ERROR_IO,
+                        "Error truncating %s: %m", path);
+            return FALSE;
+        }
+        e->sparse = TRUE;
+    }
+
+#ifdef HAVE_COPY_FILE_RANGE
+    for (guint i = 0; e->sparse && i < e->parts->len; i++) {
+        LDMPartitionInfo part;
+        ldm_partition_get_info(g_array_index(e->parts, LDMPartition *, i),
+                               &part);
+
+        const gchar * const device = ldm_disk_peek_device(part.disk);
+        if (device == NULL) continue;
+
+        struct stat dst;
+        if (stat(device, &dst) == -1 || !S_ISREG(dst.st_mode)) continue;
+
+        e->images[i] = open(device, O_RDONLY | O_CLOEXEC);
+        if (e->images[i] != -1) e->copy = TRUE;
+    }
+#endif
+
+    return TRUE;
+}
+
+static void
+_export_clear(struct _export * const e)
+{
+    for (guint i = 0; i < e->parts->len; i++) {
+        if (e->images[i] != -1) close(e->images[i]);
+    }
+    g_free(e->images);
+    g_array_unref(e->parts);
+
+    ldm_volume_close(e->h);
+    if (e->out != -1) close(e->out);
+
+    g_mutex_clear(&e->lock);
+    g_cond_clear(&e->cond);
+}
+
+gboolean
+export_volume(LDMVolume * const vol, const gchar * const path,
+              const ExportOptions * const opts, JsonBuilder * const jb,
+              GError ** const err)
+{
+    struct _export e = { 0, };
+    if (!_export_init(&e, vol, path, err)) {
+        _export_clear(&e);
+        return FALSE;
+    }
+
+    const guint threads = opts->threads > 0 ? opts->threads : e.parts->len;
+    GThreadPool * const pool = g_thread_pool_new(_export_run, NULL, threads,
+                                                 FALSE, err);
+    if (pool == NULL) {
+        _export_clear(&e);
+        return FALSE;
+    }
+
+    const gboolean progress = isatty(STDERR_FILENO);
+
+    g_mutex_lock(&e.lock);
+    for (guint i = 0; i < threads; i++) {
+        e.running++;
+        g_thread_pool_push(pool, &e, NULL);
+    }
+
+    gint64 shown = g_get_monotonic_time();
+    while (e.running > 0) {
+        g_cond_wait_until(&e.cond, &e.lock, shown + G_USEC_PER_SEC);
+
+        const gint64 now = g_get_monotonic_time();
+        if (progress && now - shown >= G_USEC_PER_SEC) {
+            _export_progress(&e, FALSE);
+            shown = now;
+        }
+    }
+    g_mutex_unlock(&e.lock);
+
+    g_thread_pool_free(pool, FALSE, TRUE);
+
+    if (progress) _export_progress(&e, TRUE);
+
+    if (e.err == NULL && fsync(e.out) == -1 && errno != EINVAL) {
+        g_set_error(&e.err, LDM_ERROR, LDM_ERROR_IO,
+                    "Error flushing %s: %m", path);
+    }
+
+    if (e.err) {
+        g_propagate_error(err, e.err);
+        _export_clear(&e);
+        return FALSE;
+    }
+
+    json_builder_begin_object(jb);
+
+    json_builder_set_member_name(jb, "name");
+    json_builder_add_string_value(jb, e.info.name);
+    json_builder_set_member_name(jb, "guid");
+    json_builder_add_string_value(jb, e.guid);
+    json_builder_set_member_name(jb, "file");
+    json_builder_add_string_value(jb, path);
+    json_builder_set_member_name(jb, "size");
+    json_builder_add_int_value(jb, e.size);
+    json_builder_set_member_name(jb, "written");
+    json_builder_add_int_value(jb, e.stats.written);
+    json_builder_set_member_name(jb, "copied");
+    json_builder_add_int_value(jb, e.stats.copied);
+    json_builder_set_member_name(jb, "holes");
+    json_builder_add_int_value(jb, e.stats.holes);
+
+    json_builder_end_object(jb);
+
+    _export_clear(&e);
+    return TRUE;
+}
@@ -0,0 +1,36 @@
+/* libldm
+ * Copyright 2012 Red Hat Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Copy the contents of a volume to a raw image, reading directly from the
+ * member disks. */
+
+#include <glib.h>
+#include <json-glib/json-glib.h>
+
+#include "ldm.h"
+
+typedef struct {
+    guint threads;              /* Reader threads, 0 for one per partition */
+} ExportOptions;
+
+/* Write the contents of vol to path. If path is a regular file it is
+ * truncated, and blocks of zeros are left as holes. Progress is written to
+ * stderr if it is a terminal. A summary of the export is added to jb as an
+ * object. */
+gboolean export_volume(LDMVolume *vol, const gchar *path,
+                       const ExportOptions *opts, JsonBuilder *jb,
+                       GError **err);
@@ -0,0 +1,443 @@
+/* libldm
+ * Copyright 2012 Red Hat Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+
+#include <endian.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "fsprobe.h"
+
+#define BOOT_SECTOR_SIZE 512
+
+/* The BIOS parameter block shared by FAT, NTFS and BitLocker */
+struct _bpb {
+    uint8_t     jump[3];
+    char        oem[8];
+    uint16_t    bytes_per_sector;
+    uint8_t     sectors_per_cluster;
+    uint16_t    reserved_sectors;
+    uint8_t     n_fats;
+    uint16_t    root_entries;
+    uint16_t    sectors16;
+    uint8_t     media;
+    uint16_t    fat_size16;
+    uint16_t    sectors_per_track;
+    uint16_t    heads;
+    uint32_t    hidden_sectors;
+    uint32_t    sectors32;
+} __attribute__((__packed__));
+
+/* The extended BPB of FAT12/16, which follows the BPB, and of FAT32, which
+ * follows the FAT32 fields */
+struct _fat_ebpb {
+    uint8_t     drive;
+    uint8_t     reserved;
+    uint8_t     signature;
+    uint32_t    serial;
+    char        label[11];
+    char        fs_type[8];
+} __attribute__((__packed__));
+
+struct _fat16 {
+    struct _bpb bpb;
+    struct _fat_ebpb ebpb;
+} __attribute__((__packed__));
+
+struct _fat32 {
+    struct _bpb bpb;
+    uint32_t    fat_size32;
+    uint16_t    flags;
+    uint16_t    version;
+    uint32_t    root_cluster;
+    uint16_t    fsinfo_sector;
+    uint16_t    backup_sector;
+    uint8_t     reserved[12];
+    struct _fat_ebpb ebpb;
+} __attribute__((__packed__));
+
+struct _ntfs {
+    struct _bpb bpb;
+    uint32_t    unused;
+    uint64_t    total_sectors;
+    uint64_t    mft_lcn;
+    uint64_t    mftmirr_lcn;
+    int8_t      clusters_per_record;
+    uint8_t     pad1[3];
+    int8_t      clusters_per_index;
+    uint8_t     pad2[3];
+    uint64_t    serial;
+    uint32_t    checksum;
+} __attribute__((__packed__));
+
+struct _exfat {
+    uint8_t     jump[3];
+    char        name[8];
+    uint8_t     zero[53];
+    uint64_t    partition_offset;
+    uint64_t    volume_length;
+    uint32_t    fat_offset;
+    uint32_t    fat_length;
+    uint32_t    cluster_heap_offset;
+    uint32_t    cluster_count;
+    uint32_t    root_cluster;
+    uint32_t    serial;
+    uint16_t    revision;
+    uint16_t    flags;
+    uint8_t     bytes_per_sector_shift;
+    uint8_t     sectors_per_cluster_shift;
+} __attribute__((__packed__));
+
+struct _refs {
+    uint8_t     jump[3];
+    char        name[8];
+    uint8_t     zero[5];
+    char        identifier[4];
+    uint16_t    length;
+    uint16_t    checksum;
+    uint64_t    sectors;
+    uint32_t    bytes_per_sector;
+    uint32_t    sectors_per_cluster;
+    uint8_t     major;
+    uint8_t     minor;
+    uint8_t     reserved[14];
+    uint64_t    serial;
+} __attribute__((__packed__));
+
+/* NTFS MFT record 3 is $Volume, whose $VOLUME_NAME attribute is the label */
+#define NTFS_MFT_VOLUME         3
+#define NTFS_ATTR_VOLUME_NAME   0x60
+#define NTFS_ATTR_END           0xFFFFFFFF
+#define NTFS_MAX_RECORD         65536
+
+#define EXFAT_ENTRY_END         0x00
+#define EXFAT_ENTRY_LABEL       0x83
+#define EXFAT_ROOT_SCAN         4096
+
+static int
+_is_pow2(const uint32_t v)
+{
+    return v != 0 && (v & (v - 1)) == 0;
+}
+
+/* Fields of NTFS MFT records are read at offsets taken from the record itself,
+ * which need not be aligned */
+static uint16_t
+_get_le16(const uint8_t * const p)
+{
+    uint16_t v;
+    memcpy(&v, p, sizeof(v));
+    return le16toh(v);
+}
+
+static uint32_t
+_get_le32(const uint8_t * const p)
+{
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return le32toh(v);
+}
+
+/* Convert n UTF-16LE code units to NUL-terminated UTF-8, truncating to fit */
+static void
+_utf16le_to_utf8(const uint8_t * const src, const size_t n,
+                 char * const dst, const size_t dst_len)
+{
+    size_t out = 0;
+    for (size_t i = 0; i < n; i++) {
+        uint32_t c = src[i * 2] | (src[i * 2 + 1] << 8);
+
+        if (c >= 0xD800 && c < 0xDC00 && i + 1 < n) {
+            const uint32_t lo = src[i * 2 + 2] | (src[i * 2 + 3] << 8);
+            if (lo >= 0xDC00 && lo < 0xE000) {
+                c = 0x10000 + ((c - 0xD800) << 10) + (lo - 0xDC00);
+                i++;
+            }
+        }
+        if (c >= 0xD800 && c < 0xE000) c = 0xFFFD;
+
+        char buf[4];
+        size_t len;
+        if (c < 0x80) {
+            buf[0] = c;
+            len = 1;
+        } else if (c < 0x800) {
+            buf[0] = 0xC0 | (c >> 6);
+            buf[1] = 0x80 | (c & 0x3F);
+            len = 2;
+        } else if (c < 0x10000) {
+            buf[0] = 0xE0 | (c >> 12);
+            buf[1] = 0x80 | ((c >> 6) & 0x3F);
+            buf[2] = 0x80 | (c & 0x3F);
+            len = 3;
+        } else {
+            buf[0] = 0xF0 | (c >> 18);
+            buf[1] = 0x80 | ((c >> 12) & 0x3F);
+            buf[2] = 0x80 | ((c >> 6) & 0x3F);
+            buf[3] = 0x80 | (c & 0x3F);
+            len = 4;
+        }
+
+        if (out + len >= dst_len) break;
+        memcpy(dst + out, buf, len);
+        out += len;
+    }
+    dst[out] = '\0';
+}
+
+/* FAT labels are in an OEM code page, which isn't known. Anything outside
+ * ASCII is replaced. */
+static void
+_fat_label(const char * const src, char * const dst)
+{
+    size_t len = 11;
+    while (len > 0 && src[len - 1] == ' ') len--;
+
+    if (len == 7 && memcmp(src, "NO NAME", 7) == 0) len = 0;
+
+    for (size_t i = 0; i < len; i++) {
+        const unsigned char c = src[i];
+        dst[i] = c >= 0x20 && c < 0x7F ? c : '?';
+    }
+    dst[len] = '\0';
+}
+
+static int
+_bpb_valid(const struct _bpb * const bpb)
+{
+    const uint16_t bps = le16toh(bpb->bytes_per_sector);
+    return _is_pow2(bps) && bps >= 256 && bps <= 4096;
+}
+
+/* Returns 0 if the cluster size is invalid */
+static uint32_t
+_bpb_cluster_size(const struct _bpb * const bpb)
+{
+    /* NTFS encodes large clusters as a negative power of two */
+    uint64_t spc = bpb->sectors_per_cluster;
+    if (spc > 0x80) {
+        const unsigned shift = 256 - spc;
+        if (shift >= 32) return 0;
+        spc = UINT64_C(1) << shift;
+    }
+
+    const uint64_t size = spc * le16toh(bpb->bytes_per_sector);
+    return size <= UINT32_MAX ? size : 0;
+}
+
+static int
+_probe_ntfs(const fsprobe_read_t read, void * const data, const uint64_t size,
+            const struct _ntfs * const ntfs, fsprobe_t * const fs)
+{
+    fs->type = FSPROBE_NTFS;
+    fs->serial = le64toh(ntfs->serial);
+    fs->cluster_size = _bpb_cluster_size(&ntfs->bpb);
+
+    const uint32_t bps = le16toh(ntfs->bpb.bytes_per_sector);
+    const int8_t cpr = ntfs->clusters_per_record;
+    if (fs->cluster_size == 0 || cpr < -31) return 0;
+    const uint64_t record_size = cpr > 0 ? (uint64_t) cpr * fs->cluster_size
+                                         : UINT64_C(1) << -cpr;
+    if (record_size < bps || record_size > NTFS_MAX_RECORD) return 0;
+
+    const uint64_t offset = le64toh(ntfs->mft_lcn) * fs->cluster_size +
+                            NTFS_MFT_VOLUME * record_size;
+    if (offset > size || size - offset < record_size) return 0;
+
+    uint8_t * const rec = malloc(record_size);
+    if (rec == NULL) return 0;
+    if (read(data, rec, record_size, offset) != 0) {
+        free(rec);
+        return -FSPROBE_ERROR_READ;
+    }
+
+    if (memcmp(rec, "FILE", 4) != 0) goto out;
+
+    /* Undo the update sequence, which replaces the last 2 bytes of every
+     * sector of the record */
+    const uint16_t usa_offset = _get_le16(rec + 4);
+    const uint16_t usa_count = _get_le16(rec + 6);
+    if (usa_count == 0 ||
+        usa_offset + (uint64_t) usa_count * 2 > record_size) goto out;
+    for (uint16_t i = 1; i < usa_count; i++) {
+        const uint64_t pos = (uint64_t) i * bps - 2;
+        if (pos + 2 > record_size) goto out;
+        if (memcmp(rec + pos, rec + usa_offset, 2) != 0) goto out;
+        memcpy(rec + pos, rec + usa_offset + i * 2, 2);
+    }
+
+    uint64_t pos = _get_le16(rec + 0x14);
+    while (pos + 0x18 <= record_size) {
+        const uint32_t type = _get_le32(rec + pos);
+        const uint32_t len = _get_le32(rec + pos + 4);
+        if (type == NTFS_ATTR_END || len == 0 || pos + len > record_size) {
+            break;
+        }
+
+        /* $VOLUME_NAME is always resident */
+        if (type == NTFS_ATTR_VOLUME_NAME && rec[pos + 8] == 0) {
+            const uint32_t vlen = _get_le32(rec + pos + 0x10);
+            const uint16_t voff = _get_le16(rec + pos + 0x14);
+            if (vlen <= len && voff <= len - vlen) {
+                _utf16le_to_utf8(rec + pos + voff, vlen / 2,
+                                 fs->label, sizeof(fs->label));
+            }
+            break;
+        }
+
+        pos += len;
+    }
+
+out:
+    free(rec);
+    return 0;
+}
+
+static int
+_probe_exfat(const fsprobe_read_t read, void * const data,
+             const uint64_t size, const struct _exfat * const exfat,
+             fsprobe_t * const fs)
+{
+    if (exfat->bytes_per_sector_shift < 9 ||
+        exfat->bytes_per_sector_shift > 12 ||
+        exfat->bytes_per_sector_shift + exfat->sectors_per_cluster_shift > 25)
+    {
+        return 0;
+    }
+
+    fs->type = FSPROBE_EXFAT;
+    fs->serial = le32toh(exfat->serial);
+    fs->cluster_size = 1U << (exfat->bytes_per_sector_shift +
+                              exfat->sectors_per_cluster_shift);
+
+    const uint32_t root = le32toh(exfat->root_cluster);
+    if (root < 2) return 0;
+
+    /* The label is an entry near the start of the root directory */
+    const uint64_t offset =
+        ((uint64_t) le32toh(exfat->cluster_heap_offset)
+                    << exfat->bytes_per_sector_shift) +
+        (uint64_t) (root - 2) * fs->cluster_size;
+    const size_t len = fs->cluster_size < EXFAT_ROOT_SCAN ? fs->cluster_size
+                                                          : EXFAT_ROOT_SCAN;
+    if (offset > size || size - offset < len) return 0;
+
+    uint8_t dir[EXFAT_ROOT_SCAN];
+    if (read(data, dir, len, offset) != 0) return -FSPROBE_ERROR_READ;
+
+    for (size_t i = 0; i + 32 <= len; i += 32) {
+        if (dir[i] == EXFAT_ENTRY_END) break;
+        if (dir[i] == EXFAT_ENTRY_LABEL) {
+            const uint8_t n = dir[i + 1] <= 11 ? dir[i + 1] : 11;
+            _utf16le_to_utf8(dir + i + 2, n, fs->label, sizeof(fs->label));
+            break;
+        }
+    }
+
+    return 0;
+}
+
+static void
+_probe_fat(const uint8_t * const sector, fsprobe_t * const fs)
+{
+    const struct _bpb * const bpb = (const struct _bpb *) sector;
+
+    if (bpb->jump[0] != 0xEB && bpb->jump[0] != 0xE9) return;
+    if (!_bpb_valid(bpb) || !_is_pow2(bpb->sectors_per_cluster) ||
+        le16toh(bpb->reserved_sectors) == 0 || bpb->n_fats == 0) return;
+
+    const struct _fat_ebpb *ebpb;
+    uint32_t fat_size = le16toh(bpb->fat_size16);
+    if (fat_size == 0) {
+        const struct _fat32 * const fat32 = (const struct _fat32 *) sector;
+        fat_size = le32toh(fat32->fat_size32);
+        ebpb = &fat32->ebpb;
+    } else {
+        ebpb = &((const struct _fat16 *) sector)->ebpb;
+    }
+    if (fat_size == 0) return;
+
+    const uint32_t bps = le16toh(bpb->bytes_per_sector);
+    const uint32_t sectors = bpb->sectors16 ? le16toh(bpb->sectors16)
+                                            : le32toh(bpb->sectors32);
+    const uint32_t root_sectors =
+        (le16toh(bpb->root_entries) * 32 + bps - 1) / bps;
+    const uint32_t meta = le16toh(bpb->reserved_sectors) +
+                          bpb->n_fats * fat_size + root_sectors;
+    if (sectors <= meta) return;
+
+    /* The FAT type is determined by the number of clusters alone */
+    const uint32_t clusters = (sectors - meta) / bpb->sectors_per_cluster;
+    if (clusters < 4085) fs->type = FSPROBE_FAT12;
+    else if (clusters < 65525) fs->type = FSPROBE_FAT16;
+    else fs->type = FSPROBE_FAT32;
+
+    fs->cluster_size = _bpb_cluster_size(bpb);
+
+    if (ebpb->signature == 0x29) {
+        fs->serial = le32toh(ebpb->serial);
+        _fat_label(ebpb->label, fs->label);
+    }
+}
+
+int
+fsprobe(const fsprobe_read_t read, void * const data, const uint64_t size,
+        fsprobe_t * const fs)
+{
+    memset(fs, 0, sizeof(*fs));
+    fs->type = FSPROBE_UNKNOWN;
+
+    if (size < BOOT_SECTOR_SIZE) return FSPROBE_ERROR_OK;
+
+    uint8_t sector[BOOT_SECTOR_SIZE];
+    if (read(data, sector, sizeof(sector), 0) != 0) return -FSPROBE_ERROR_READ;
+
+    const struct _bpb * const bpb = (const struct _bpb *) sector;
+
+    /* ReFS has no boot signature */
+    if (memcmp(bpb->oem, "ReFS\0\0\0\0", 8) == 0 &&
+        memcmp(((const struct _refs *) sector)->identifier, "FSRS", 4) == 0)
+    {
+        const struct _refs * const refs = (const struct _refs *) sector;
+        fs->type = FSPROBE_REFS;
+        fs->serial = le64toh(refs->serial);
+        fs->cluster_size = le32toh(refs->bytes_per_sector) *
+                           le32toh(refs->sectors_per_cluster);
+        return FSPROBE_ERROR_OK;
+    }
+
+    if (sector[510] != 0x55 || sector[511] != 0xAA) return FSPROBE_ERROR_OK;
+
+    if (memcmp(bpb->oem, "-FVE-FS-", 8) == 0) {
+        fs->type = FSPROBE_BITLOCKER;
+        if (_bpb_valid(bpb)) fs->cluster_size = _bpb_cluster_size(bpb);
+        return FSPROBE_ERROR_OK;
+    }
+
+    if (memcmp(bpb->oem, "NTFS    ", 8) == 0 && _bpb_valid(bpb)) {
+        return _probe_ntfs(read, data, size, (const struct _ntfs *) sector, fs);
+    }
+
+    if (memcmp(bpb->oem, "EXFAT   ", 8) == 0) {
+        return _probe_exfat(read, data, size, (const struct _exfat *) sector,
+                            fs);
+    }
+
+    _probe_fat(sector, fs);
+    return FSPROBE_ERROR_OK;
+}
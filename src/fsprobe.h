@@ -0,0 +1,51 @@
+/* libldm
+ * Copyright 2012 Red Hat Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+typedef enum {
+    FSPROBE_ERROR_OK,
+    FSPROBE_ERROR_READ
+} fsprobe_error_t;
+
+typedef enum {
+    FSPROBE_UNKNOWN,
+    FSPROBE_NTFS,
+    FSPROBE_REFS,
+    FSPROBE_FAT12,
+    FSPROBE_FAT16,
+    FSPROBE_FAT32,
+    FSPROBE_EXFAT,
+    FSPROBE_BITLOCKER
+} fsprobe_type_t;
+
+typedef struct {
+    fsprobe_type_t type;
+    char label[128];            /* UTF-8, empty if there is none */
+    uint64_t serial;
+    uint32_t cluster_size;      /* In bytes, 0 if not known */
+} fsprobe_t;
+
+/* Read len bytes at offset from the start of the device being probed into
+ * buf. Returns 0 on success. */
+typedef int (*fsprobe_read_t)(void *data, void *buf, size_t len,
+                              uint64_t offset);
+
+/* Identify the contents of a device of size bytes from its first sectors. An
+ * unrecognised device is not an error: its type is FSPROBE_UNKNOWN. */
+int fsprobe(fsprobe_read_t read, void *data, uint64_t size, fsprobe_t *fs);
@@ -29,15 +29,23 @@
 #include <stdlib.h>
 #include <string.h>
 #include <sys/ioctl.h>
+#include <sys/eventfd.h>
 #include <sys/mman.h>
 #include <sys/stat.h>
 #include <sys/sysmacros.h>
 #include <unistd.h>
 #include <uuid/uuid.h>
 
+#ifdef HAVE_LIBURING
+#include <liburing.h>
+#endif
+
 #include "mbr.h"
 #include "gpt.h"
+#include "fsprobe.h"
 #include "ldm.h"
+#include "simd.h"
+#include "dmbackend.h"
 
 #define DM_UUID_PREFIX "LDM-"
 
@@ -199,10 +207,23 @@ _free_pointer(gpointer const data)
     g_free(*(gpointer *)data);
 }
 
-static void
-_free_gstring(gpointer const data)
+/* Hash table functions for keys which are a uuid_t */
+
+static guint
+_guid_hash(gconstpointer const key)
+{
+    const guint8 * const guid = key;
+
+    /* GUIDs are already well distributed */
+    guint h;
+    memcpy(&h, guid + sizeof(uuid_t) - sizeof(h), sizeof(h));
+    return h;
+}
+
+static gboolean
+_guid_equal(gconstpointer const a, gconstpointer const b)
 {
-    g_string_free(*(GString **)data, TRUE);
+    return uuid_compare(a, b) == 0;
 }
 
 /* GLIB error handling */
@@ -237,12 +258,38 @@ ldm_error_get_type(void)
 }
 
 /* We catch log messages generated by device mapper with errno != 0 and store
- * them here */
-static int _dm_err_last_level = 0;
-static const char *_dm_err_last_file = NULL;
-static int _dm_err_last_line = 0;
-static int _dm_err_last_errno = 0;
-static char *_dm_err_last_msg = NULL;
+ * them here. Device mapper calls the log function in the thread which made the
+ * failing call, so the last error is kept per thread. */
+struct _dm_err
+{
+    int level;
+    const char *file;
+    int line;
+    int err;
+    char *msg;
+};
+
+static void
+_dm_err_free(gpointer const data)
+{
+    struct _dm_err * const dm_err = data;
+
+    free(dm_err->msg);
+    g_free(dm_err);
+}
+
+static GPrivate _dm_err_key = G_PRIVATE_INIT(_dm_err_free);
+
+static struct _dm_err *
+_dm_err(void)
+{
+    struct _dm_err *dm_err = g_private_get(&_dm_err_key);
+    if (dm_err == NULL) {
+        dm_err = g_new0(struct _dm_err, 1);
+        g_private_set(&_dm_err_key, dm_err);
+    }
+    return dm_err;
+}
 
 static void
 _dm_log_fn(const int level, const char * const file, const int line,
@@ -250,27 +297,117 @@ _dm_log_fn(const int level, const char * const file, const int line,
 {
     if (dm_errno == 0) return;
 
-    _dm_err_last_level = level;
-    _dm_err_last_file = file;
-    _dm_err_last_line = line;
-
     /* device-mapper doesn't set dm_errno usefully (it only seems to use
      * EUNCLASSIFIED), so we capture errno directly and cross our fingers */
-    _dm_err_last_errno = errno;
+    const int err = errno;
+
+    struct _dm_err * const dm_err = _dm_err();
+    dm_err->level = level;
+    dm_err->file = file;
+    dm_err->line = line;
+    dm_err->err = err;
 
-    if (_dm_err_last_msg) {
-        free(_dm_err_last_msg);
-        _dm_err_last_msg = NULL;
+    if (dm_err->msg) {
+        free(dm_err->msg);
+        dm_err->msg = NULL;
     }
 
     va_list ap;
     va_start(ap, f);
-    if (vasprintf(&_dm_err_last_msg, f, ap) == -1) {
+    if (vasprintf(&dm_err->msg, f, ap) == -1) {
         g_error("vasprintf");
     }
     va_end(ap);
 }
 
+/* The device mapper log function is process-wide. Install ours while any LDM
+ * object exists. */
+G_LOCK_DEFINE_STATIC(_dm_log_users);
+static guint _dm_log_users = 0;
+
+static void
+_dm_log_ref(void)
+{
+    G_LOCK(_dm_log_users);
+    if (_dm_log_users++ == 0) {
+        dm_log_with_errno_init(_dm_log_fn);
+        dm_set_name_mangling_mode(DM_STRING_MANGLING_AUTO);
+        dm_set_uuid_prefix(DM_UUID_PREFIX);
+    }
+    G_UNLOCK(_dm_log_users);
+}
+
+static void
+_dm_log_unref(void)
+{
+    G_LOCK(_dm_log_users);
+    /* Restore default logging function. */
+    if (--_dm_log_users == 0) dm_log_with_errno_init(NULL);
+    G_UNLOCK(_dm_log_users);
+}
+
+/* A snapshot of the host's device mapper devices, shared by an LDM object and
+ * all of its volumes and partitions so that looking up the device of each
+ * doesn't list every device on the host again. It is built on first use, and
+ * dropped by ldm_dm_refresh_cache() and whenever devices are created or
+ * removed. */
+struct _dm_cache
+{
+    gint ref;
+    GMutex lock;
+    const dm_backend_t *backend;
+    gpointer snapshot;      /* NULL until it is next needed */
+};
+
+/* Defined below with the operations it calls */
+static const dm_backend_t _dm_libdm_backend;
+
+/* The backend of caches created from now on */
+static const dm_backend_t *_dm_backend = &_dm_libdm_backend;
+
+/* libdevmapper isn't thread-safe, so the backend is only used by one thread at
+ * a time, whichever LDM object it is working for. This is taken after the lock
+ * of a cache, and every backend call is made with both held. */
+static GMutex _dm_backend_lock;
+
+void
+_ldm_dm_backend_set(const dm_backend_t * const backend)
+{
+    _dm_backend = backend ? backend : &_dm_libdm_backend;
+}
+
+static struct _dm_cache *
+_dm_cache_new(void)
+{
+    struct _dm_cache * const cache = g_new0(struct _dm_cache, 1);
+    cache->ref = 1;
+    g_mutex_init(&cache->lock);
+    cache->backend = _dm_backend;
+
+    return cache;
+}
+
+static struct _dm_cache *
+_dm_cache_ref(struct _dm_cache * const cache)
+{
+    g_atomic_int_inc(&cache->ref);
+    return cache;
+}
+
+static void
+_dm_cache_unref(struct _dm_cache * const cache)
+{
+    if (cache == NULL || !g_atomic_int_dec_and_test(&cache->ref)) return;
+
+    if (cache->snapshot) {
+        g_mutex_lock(&_dm_backend_lock);
+        cache->backend->list_free(cache->backend, cache->snapshot);
+        g_mutex_unlock(&_dm_backend_lock);
+    }
+    g_mutex_clear(&cache->lock);
+    g_free(cache);
+}
+
 /* Macros for exporting object properties */
 
 #define EXPORT_PROP_STRING(object, klass, property)                            \
@@ -295,6 +432,20 @@ ldm_ ## object ## _get_guid(const klass * const o)                             \
     return r;                                                                  \
 }
 
+#define EXPORT_PROP_STRING_PEEK(object, klass, property)                       \
+const gchar *                                                                  \
+ldm_ ## object ## _peek_ ## property(const klass * const o)                    \
+{                                                                              \
+    return o->priv->property;                                                  \
+}
+
+#define EXPORT_PROP_GUID_BYTES(object, klass)                                  \
+const guint8 *                                                                 \
+ldm_ ## object ## _get_guid_bytes(const klass * const o)                       \
+{                                                                              \
+    return o->priv->guid;                                                      \
+}
+
 #define EXPORT_PROP_SCALAR(object, klass, property, type)                      \
 type                                                                           \
 ldm_ ## object ## _get_ ## property(const klass * const o)                     \
@@ -307,24 +458,142 @@ ldm_ ## object ## _get_ ## property(const klass * const o)                     \
 #define LDM_GET_PRIVATE(obj)       (G_TYPE_INSTANCE_GET_PRIVATE \
         ((obj), LDM_TYPE, LDMPrivate))
 
-struct _LDMPrivate
+/* The disk groups known to an LDM object. A state is never modified once it
+ * has been published: writers build a new state and swap it in, so a reader can
+ * walk the state it holds without locking. Getting the state only takes a lock
+ * for as long as it takes to reference it, see _ldm_get_state(). */
+struct _ldm_state
 {
+    gint ref;
+
     GArray *disk_groups;
+
+    /* Index of disk_groups by GUID */
+    GHashTable *disk_groups_by_guid;
+};
+
+struct _LDMPrivate
+{
+    /* Held while loading state and referencing it, or swapping it */
+    GMutex state_lock;
+    struct _ldm_state *state;
+
+    /* Serialises writers */
+    GMutex write_lock;
+
+    struct _dm_cache *dm_cache;
 };
 
 G_DEFINE_TYPE_WITH_PRIVATE(LDM, ldm, G_TYPE_OBJECT)
 
+static void
+_ldm_state_unref(struct _ldm_state * const state)
+{
+    if (!g_atomic_int_dec_and_test(&state->ref)) return;
+
+    g_hash_table_unref(state->disk_groups_by_guid);
+    g_array_unref(state->disk_groups);
+    g_free(state);
+}
+
+/* Add a disk group to a state which has not been published yet, replacing any
+ * disk group with the same GUID */
+static void
+_ldm_state_set_disk_group(struct _ldm_state * const state,
+                          LDMDiskGroup * const dg_o)
+{
+    g_object_ref(dg_o);
+
+    const guint8 * const guid = ldm_disk_group_get_guid_bytes(dg_o);
+    LDMDiskGroup * const old =
+        g_hash_table_lookup(state->disk_groups_by_guid, guid);
+
+    /* Replace the key as well as the value: the old key belongs to old */
+    g_hash_table_replace(state->disk_groups_by_guid, (gpointer) guid, dg_o);
+
+    if (old == NULL) {
+        g_array_append_val(state->disk_groups, dg_o);
+        return;
+    }
+
+    for (guint i = 0; i < state->disk_groups->len; i++) {
+        if (g_array_index(state->disk_groups, LDMDiskGroup *, i) == old) {
+            g_array_index(state->disk_groups, LDMDiskGroup *, i) = dg_o;
+            g_object_unref(old);
+            break;
+        }
+    }
+}
+
+/* Create a new unpublished state containing the disk groups of old, if any */
+static struct _ldm_state *
+_ldm_state_new(const struct _ldm_state * const old)
+{
+    const guint len = old ? old->disk_groups->len : 0;
+
+    struct _ldm_state * const state = g_new(struct _ldm_state, 1);
+    state->ref = 1;
+    state->disk_groups = g_array_sized_new(FALSE, FALSE,
+                                           sizeof(LDMDiskGroup *), len + 1);
+    g_array_set_clear_func(state->disk_groups, _unref_object);
+    state->disk_groups_by_guid = g_hash_table_new(_guid_hash, _guid_equal);
+
+    for (guint i = 0; i < len; i++) {
+        _ldm_state_set_disk_group(state,
+            g_array_index(old->disk_groups, LDMDiskGroup *, i));
+    }
+
+    return state;
+}
+
+/* Returns a reference to the current state, or NULL if o has been disposed.
+ * The lock only keeps the state from being dropped between loading the pointer
+ * and referencing it, so neither readers nor a writer wait on it for long. */
+static struct _ldm_state *
+_ldm_get_state(LDM * const o)
+{
+    g_mutex_lock(&o->priv->state_lock);
+    struct _ldm_state * const state = o->priv->state;
+    if (state) g_atomic_int_inc(&state->ref);
+    g_mutex_unlock(&o->priv->state_lock);
+
+    return state;
+}
+
+/* Takes ownership of state. Readers still holding the previous state keep a
+ * consistent view of it until they release it. Must only be called by one
+ * thread at a time. */
+static void
+_ldm_publish_state(LDM * const o, struct _ldm_state * const state)
+{
+    g_mutex_lock(&o->priv->state_lock);
+    struct _ldm_state * const old = o->priv->state;
+    o->priv->state = state;
+    g_mutex_unlock(&o->priv->state_lock);
+
+    if (old) _ldm_state_unref(old);
+}
+
 static void
 ldm_dispose(GObject * const object)
 {
     LDM *ldm = LDM_CAST(object);
 
-    if (ldm->priv->disk_groups) {
-        g_array_unref(ldm->priv->disk_groups); ldm->priv->disk_groups = NULL;
-    }
+    g_mutex_lock(&ldm->priv->write_lock);
+    _ldm_publish_state(ldm, NULL);
+    g_mutex_unlock(&ldm->priv->write_lock);
+}
 
-    /* Restore default logging function. */
-    dm_log_with_errno_init(NULL);
+static void
+ldm_finalize(GObject * const object)
+{
+    LDM *ldm = LDM_CAST(object);
+
+    g_mutex_clear(&ldm->priv->write_lock);
+    g_mutex_clear(&ldm->priv->state_lock);
+    _dm_cache_unref(ldm->priv->dm_cache);
+
+    _dm_log_unref();
 }
 
 static void
@@ -333,10 +602,12 @@ ldm_init(LDM * const o)
     o->priv = LDM_GET_PRIVATE(o);
     bzero(o->priv, sizeof(*o->priv));
 
+    g_mutex_init(&o->priv->write_lock);
+    g_mutex_init(&o->priv->state_lock);
+    o->priv->dm_cache = _dm_cache_new();
+
     /* Provide our logging function. */
-    dm_log_with_errno_init(_dm_log_fn);
-    dm_set_name_mangling_mode(DM_STRING_MANGLING_AUTO);
-    dm_set_uuid_prefix(DM_UUID_PREFIX);
+    _dm_log_ref();
 }
 
 static void
@@ -344,6 +615,7 @@ ldm_class_init(LDMClass * const klass)
 {
     GObjectClass *object_class = G_OBJECT_CLASS(klass);
     object_class->dispose = ldm_dispose;
+    object_class->finalize = ldm_finalize;
 
 }
 
@@ -368,6 +640,14 @@ struct _LDMDiskGroupPrivate
     /* We don't expose components, so they're no GObjects */
     uint32_t n_comps;
     GArray *comps;
+
+    /* Indexes of the above arrays, built once after parsing. Values are not
+     * referenced: they are owned by the arrays. */
+    GHashTable *vols_by_name;
+    GHashTable *vols_by_guid;
+    GHashTable *parts_by_name;
+    GHashTable *disks_by_name;
+    GHashTable *disks_by_guid;
 };
 
 G_DEFINE_TYPE_WITH_PRIVATE(LDMDiskGroup, ldm_disk_group, G_TYPE_OBJECT)
@@ -403,13 +683,36 @@ ldm_disk_group_get_property(GObject * const o, const guint property_id,
 }
 
 EXPORT_PROP_STRING(disk_group, LDMDiskGroup, name)
+EXPORT_PROP_STRING_PEEK(disk_group, LDMDiskGroup, name)
 EXPORT_PROP_GUID(disk_group, LDMDiskGroup)
+EXPORT_PROP_GUID_BYTES(disk_group, LDMDiskGroup)
+
+void
+ldm_disk_group_get_info(const LDMDiskGroup * const o,
+                        LDMDiskGroupInfo * const info)
+{
+    const LDMDiskGroupPrivate * const priv = o->priv;
+
+    info->name = priv->name;
+    info->guid = priv->guid;
+}
 
 static void
 ldm_disk_group_dispose(GObject * const object)
 {
     LDMDiskGroup *dg = LDM_DISK_GROUP(object);
 
+    GHashTable ** const indexes[] = {
+        &dg->priv->vols_by_name, &dg->priv->vols_by_guid,
+        &dg->priv->parts_by_name,
+        &dg->priv->disks_by_name, &dg->priv->disks_by_guid
+    };
+    for (guint i = 0; i < G_N_ELEMENTS(indexes); i++) {
+        if (*indexes[i]) {
+            g_hash_table_unref(*indexes[i]); *indexes[i] = NULL;
+        }
+    }
+
     if (dg->priv->vols) {
         g_array_unref(dg->priv->vols); dg->priv->vols = NULL;
     }
@@ -498,6 +801,59 @@ ldm_volume_type_get_type(void)
     return etype;
 }
 
+/* LDMExtentType */
+
+GType
+ldm_extent_type_get_type(void)
+{
+    static GType etype = 0;
+    if (etype == 0) {
+        static const GEnumValue values[] = {
+            { LDM_EXTENT_TYPE_DATA, "LDM_EXTENT_TYPE_DATA", "data" },
+            { LDM_EXTENT_TYPE_MIRROR, "LDM_EXTENT_TYPE_MIRROR", "mirror" },
+            { LDM_EXTENT_TYPE_PARITY, "LDM_EXTENT_TYPE_PARITY", "parity" },
+            { 0, NULL, NULL }
+        };
+        etype = g_enum_register_static("LDMExtentType", values);
+    }
+    return etype;
+}
+
+GType
+ldm_fs_type_get_type(void)
+{
+    static GType etype = 0;
+    if (etype == 0) {
+        static const GEnumValue values[] = {
+            { LDM_FS_TYPE_UNKNOWN, "LDM_FS_TYPE_UNKNOWN", "unknown" },
+            { LDM_FS_TYPE_NTFS, "LDM_FS_TYPE_NTFS", "ntfs" },
+            { LDM_FS_TYPE_REFS, "LDM_FS_TYPE_REFS", "refs" },
+            { LDM_FS_TYPE_FAT12, "LDM_FS_TYPE_FAT12", "fat12" },
+            { LDM_FS_TYPE_FAT16, "LDM_FS_TYPE_FAT16", "fat16" },
+            { LDM_FS_TYPE_FAT32, "LDM_FS_TYPE_FAT32", "fat32" },
+            { LDM_FS_TYPE_EXFAT, "LDM_FS_TYPE_EXFAT", "exfat" },
+            { LDM_FS_TYPE_BITLOCKER, "LDM_FS_TYPE_BITLOCKER", "bitlocker" },
+            { 0, NULL, NULL }
+        };
+        etype = g_enum_register_static("LDMFsType", values);
+    }
+    return etype;
+}
+
+GType
+ldm_dm_flags_get_type(void)
+{
+    static GType etype = 0;
+    if (etype == 0) {
+        static const GFlagsValue values[] = {
+            { LDM_DM_READ_ONLY, "LDM_DM_READ_ONLY", "read-only" },
+            { 0, NULL, NULL }
+        };
+        etype = g_flags_register_static("LDMDmFlags", values);
+    }
+    return etype;
+}
+
 /* LDMVolume */
 
 #define LDM_VOLUME_GET_PRIVATE(obj) (G_TYPE_INSTANCE_GET_PRIVATE \
@@ -524,6 +880,8 @@ struct _LDMVolumePrivate
     guint64 size2;      /* Not exposed: unclear what it means */
     gchar *hint;
 
+    struct _dm_cache *dm_cache; /* Shared with the LDM object holding it */
+
     /* Derived */
     LDMVolumeType type;
     GArray *parts;
@@ -588,10 +946,13 @@ ldm_volume_get_property(GObject * const o, const guint property_id,
 }
 
 EXPORT_PROP_STRING(volume, LDMVolume, name)
+EXPORT_PROP_STRING_PEEK(volume, LDMVolume, name)
 EXPORT_PROP_GUID(volume, LDMVolume)
+EXPORT_PROP_GUID_BYTES(volume, LDMVolume)
 EXPORT_PROP_SCALAR(volume, LDMVolume, size, guint64)
 EXPORT_PROP_SCALAR(volume, LDMVolume, part_type, guint8)
 EXPORT_PROP_STRING(volume, LDMVolume, hint)
+EXPORT_PROP_STRING_PEEK(volume, LDMVolume, hint)
 EXPORT_PROP_SCALAR(volume, LDMVolume, chunk_size, guint64)
 
 /* Sigh... another conflict with glib's _get_type() */
@@ -601,6 +962,21 @@ ldm_volume_get_voltype(const LDMVolume * const o)
     return o->priv->type;
 }
 
+void
+ldm_volume_get_info(const LDMVolume * const o, LDMVolumeInfo * const info)
+{
+    const LDMVolumePrivate * const priv = o->priv;
+
+    info->name = priv->name;
+    info->guid = priv->guid;
+    info->type = priv->type;
+    info->size = priv->size;
+    info->part_type = priv->part_type;
+    info->hint = priv->hint;
+    info->chunk_size = priv->chunk_size;
+    info->n_partitions = priv->parts ? priv->parts->len : 0;
+}
+
 static void
 ldm_volume_dispose(GObject * const object)
 {
@@ -621,6 +997,7 @@ ldm_volume_finalize(GObject * const object)
     g_free(vol->id1); vol->id1 = NULL;
     g_free(vol->id2); vol->id2 = NULL;
     g_free(vol->hint); vol->hint = NULL;
+    _dm_cache_unref(vol->dm_cache); vol->dm_cache = NULL;
 }
 
 static void
@@ -800,6 +1177,8 @@ struct _LDMPartitionPrivate
 
     guint32 disk_id;
     LDMDisk *disk;
+
+    struct _dm_cache *dm_cache; /* Shared with the LDM object holding it */
 };
 
 G_DEFINE_TYPE_WITH_PRIVATE(LDMPartition, ldm_partition, G_TYPE_OBJECT)
@@ -834,9 +1213,22 @@ ldm_partition_get_property(GObject * const o, const guint property_id,
 }
 
 EXPORT_PROP_STRING(partition, LDMPartition, name)
+EXPORT_PROP_STRING_PEEK(partition, LDMPartition, name)
 EXPORT_PROP_SCALAR(partition, LDMPartition, start, guint64)
 EXPORT_PROP_SCALAR(partition, LDMPartition, size, guint64)
 
+void
+ldm_partition_get_info(const LDMPartition * const o,
+                       LDMPartitionInfo * const info)
+{
+    const LDMPartitionPrivate * const priv = o->priv;
+
+    info->name = priv->name;
+    info->start = priv->start;
+    info->size = priv->size;
+    info->disk = priv->disk;
+}
+
 static void
 ldm_partition_dispose(GObject * const object)
 {
@@ -853,6 +1245,7 @@ ldm_partition_finalize(GObject * const object)
     LDMPartitionPrivate * const part = part_o->priv;
 
     g_free(part->name); part->name = NULL;
+    _dm_cache_unref(part->dm_cache); part->dm_cache = NULL;
 }
 
 static void
@@ -934,6 +1327,7 @@ struct _LDMDiskPrivate
 
     uuid_t guid;
     gchar *device; // NULL until device is found
+    guint secsize; // 0 until device is found
 };
 
 G_DEFINE_TYPE_WITH_PRIVATE(LDMDisk, ldm_disk, G_TYPE_OBJECT)
@@ -989,13 +1383,30 @@ ldm_disk_get_property(GObject * const o, const guint property_id,
 }
 
 EXPORT_PROP_STRING(disk, LDMDisk, name)
+EXPORT_PROP_STRING_PEEK(disk, LDMDisk, name)
 EXPORT_PROP_GUID(disk, LDMDisk)
+EXPORT_PROP_GUID_BYTES(disk, LDMDisk)
 EXPORT_PROP_STRING(disk, LDMDisk, device)
+EXPORT_PROP_STRING_PEEK(disk, LDMDisk, device)
 EXPORT_PROP_SCALAR(disk, LDMDisk, data_start, guint64)
 EXPORT_PROP_SCALAR(disk, LDMDisk, data_size, guint64)
 EXPORT_PROP_SCALAR(disk, LDMDisk, metadata_start, guint64)
 EXPORT_PROP_SCALAR(disk, LDMDisk, metadata_size, guint64)
 
+void
+ldm_disk_get_info(const LDMDisk * const o, LDMDiskInfo * const info)
+{
+    const LDMDiskPrivate * const priv = o->priv;
+
+    info->name = priv->name;
+    info->guid = priv->guid;
+    info->device = priv->device;
+    info->data_start = priv->data_start;
+    info->data_size = priv->data_size;
+    info->metadata_start = priv->metadata_start;
+    info->metadata_size = priv->metadata_size;
+}
+
 static void
 ldm_disk_finalize(GObject * const object)
 {
@@ -1233,6 +1644,32 @@ _find_vmdb(const void * const config, const gchar * const path,
     return TRUE;
 }
 
+static gboolean
+_pread_all(const int fd, const gchar * const path, void * const buf,
+           const size_t size, const uint64_t offset, GError ** const err)
+{
+    size_t read = 0;
+    while (read < size) {
+        ssize_t in = pread(fd, (char *) buf + read, size - read,
+                           offset + read);
+        if (in == 0) {
+            g_set_error(err, LDM_ERROR, LDM_ERROR_INVALID,
+                        "%s contains invalid LDM metadata", path);
+            return FALSE;
+        }
+
+        if (in == -1) {
+            g_set_error(err, LDM_ERROR, LDM_ERROR_IO,
+                        "Error reading from %s: %m", path);
+            return FALSE;
+        }
+
+        read += in;
+    }
+
+    return TRUE;
+}
+
 static gboolean
 _read_config(const int fd, const gchar * const path,
              const guint secsize, const struct _privhead * const privhead,
@@ -1274,30 +1711,12 @@ _read_config(const int fd, const gchar * const path,
     }
 
     *config = g_malloc(config_size);
-    size_t read = 0;
-    while (read < config_size) {
-        ssize_t in = pread(fd, *config + read, config_size - read,
-                           config_start + read);
-        if (in == 0) {
-            g_set_error(err, LDM_ERROR, LDM_ERROR_INVALID,
-                        "%s contains invalid LDM metadata", path);
-            goto error;
-        }
-
-        if (in == -1) {
-            g_set_error(err, LDM_ERROR, LDM_ERROR_IO,
-                        "Error reading from %s: %m", path);
-            goto error;
-        }
-
-        read += in;
+    if (!_pread_all(fd, path, *config, config_size, config_start, err)) {
+        g_free(*config); *config = NULL;
+        return FALSE;
     }
 
     return TRUE;
-
-error:
-    g_free(*config); *config = NULL;
-    return FALSE;
 }
 
 static gboolean
@@ -1305,25 +1724,8 @@ _read_privhead_off(const int fd, const gchar * const path,
                    const uint64_t ph_start,
                    struct _privhead * const privhead, GError **err)
 {
-    size_t read = 0;
-    while (read < sizeof(*privhead)) {
-        ssize_t in = pread(fd, (char *) privhead + read,
-                           sizeof(*privhead) - read,
-                           ph_start + read);
-        if (in == 0) {
-            g_set_error(err, LDM_ERROR, LDM_ERROR_INVALID,
-                        "%s contains invalid LDM metadata", path);
-            return FALSE;
-        }
-
-        if (in == -1) {
-            g_set_error(err, LDM_ERROR, LDM_ERROR_IO,
-                        "Error reading from %s: %m", path);
-            return FALSE;
-        }
-
-        read += in;
-    }
+    if (!_pread_all(fd, path, privhead, sizeof(*privhead), ph_start, err))
+        return FALSE;
 
     if (memcmp(privhead->magic, "PRIVHEAD", 8) != 0) {
         g_set_error(err, LDM_ERROR, LDM_ERROR_INVALID,
@@ -1469,6 +1871,56 @@ _read_privhead(const int fd, const gchar * const path, const guint secsize,
     }
 }
 
+/* Read only the committed sequence number from the VMDB of a device whose
+ * PRIVHEAD has already been read. This is much cheaper than _read_config, which
+ * reads the whole config area. */
+static gboolean
+_read_committed_seq(const int fd, const gchar * const path,
+                    const guint secsize,
+                    const struct _privhead * const privhead,
+                    uint64_t * const seq, GError ** const err)
+{
+    const uint64_t config_start =
+        be64toh(privhead->ldm_config_start) * secsize;
+
+    struct _tocblock tocblock;
+    if (!_pread_all(fd, path, &tocblock, sizeof(tocblock),
+                    config_start + secsize * 2, err)) return FALSE;
+    if (memcmp(tocblock.magic, "TOCBLOCK", 8) != 0) {
+        g_set_error(err, LDM_ERROR, LDM_ERROR_INVALID,
+                    "Didn't find TOCBLOCK at config offset %" PRIX64
+                    " in %s", (uint64_t) secsize * 2, path);
+        return FALSE;
+    }
+
+    uint64_t vmdb_start = 0;
+    for (int i = 0; i < 2; i++) {
+        const struct _tocblock_bitmap *bitmap = &tocblock.bitmap[i];
+        if (strncmp(bitmap->name, "config", sizeof(bitmap->name)) == 0) {
+            vmdb_start = config_start + be64toh(bitmap->start) * secsize;
+            break;
+        }
+    }
+    if (vmdb_start == 0) {
+        g_set_error(err, LDM_ERROR, LDM_ERROR_INVALID,
+                    "TOCBLOCK doesn't contain config bitmap");
+        return FALSE;
+    }
+
+    struct _vmdb vmdb;
+    if (!_pread_all(fd, path, &vmdb, sizeof(vmdb), vmdb_start, err))
+        return FALSE;
+    if (memcmp(vmdb.magic, "VMDB", 4) != 0) {
+        g_set_error(err, LDM_ERROR, LDM_ERROR_INVALID,
+                    "Didn't find VMDB at config offset %" PRIX64 " in %s",
+                    vmdb_start - config_start, path);
+        return FALSE;
+    }
+
+    *seq = be64toh(vmdb.committed_seq);
+    return TRUE;
+}
+
 #define PARSE_VAR_INT(func_name, out_type)                                     \
 static gboolean                                                                \
 func_name(const guint8 ** const var, out_type * const out,                     \
@@ -1921,6 +2373,31 @@ _cmp_component_parts(gconstpointer a, gconstpointer b)
     return 0;
 }
 
+/* Index a hash table by a key taken from each object in array. If 2 objects
+ * have the same key, only the first is indexed. */
+#define INDEX_OBJECTS(table, array, type, key)                                 \
+    for (guint i = 0; i < (array)->len; i++) {                                 \
+        type * const o = g_array_index((array), type *, i);                    \
+        if (!g_hash_table_contains((table), o->priv->key))                     \
+            g_hash_table_insert((table), o->priv->key, o);                     \
+    }
+
+static void
+_index_disk_group(LDMDiskGroupPrivate * const dg)
+{
+    dg->vols_by_name = g_hash_table_new(g_str_hash, g_str_equal);
+    dg->vols_by_guid = g_hash_table_new(_guid_hash, _guid_equal);
+    dg->parts_by_name = g_hash_table_new(g_str_hash, g_str_equal);
+    dg->disks_by_name = g_hash_table_new(g_str_hash, g_str_equal);
+    dg->disks_by_guid = g_hash_table_new(_guid_hash, _guid_equal);
+
+    INDEX_OBJECTS(dg->vols_by_name, dg->vols, LDMVolume, name)
+    INDEX_OBJECTS(dg->vols_by_guid, dg->vols, LDMVolume, guid)
+    INDEX_OBJECTS(dg->parts_by_name, dg->parts, LDMPartition, name)
+    INDEX_OBJECTS(dg->disks_by_name, dg->disks, LDMDisk, name)
+    INDEX_OBJECTS(dg->disks_by_guid, dg->disks, LDMDisk, guid)
+}
+
 static gboolean
 _parse_vblks(const void * const config, const gchar * const path,
              const struct _vmdb * const vmdb,
@@ -2233,6 +2710,8 @@ _parse_vblks(const void * const config, const gchar * const path,
 
     g_array_unref(comps);
 
+    _index_disk_group(dg);
+
     return TRUE;
 
 error:
@@ -2261,19 +2740,147 @@ ldm_add(LDM * const o, const gchar * const path, GError ** const err)
     return ldm_add_fd(o, fd, secsize, path, err);
 }
 
-gboolean
-ldm_add_fd(LDM * const o, const int fd, const guint secsize,
-           const gchar * const path, GError ** const err)
+/* Copy a published disk group, so that the device of one of its disks can be
+ * set without reparsing its metadata. Components are only used during parsing,
+ * so they aren't copied. */
+static LDMDiskGroup *
+_copy_disk_group(const LDMDiskGroupPrivate * const old)
 {
-    GArray *disk_groups = o->priv->disk_groups;
+    LDMDiskGroup * const dg_o =
+        LDM_DISK_GROUP(g_object_new(LDM_TYPE_DISK_GROUP, NULL));
+    LDMDiskGroupPrivate * const dg = dg_o->priv;
 
-    /* The GObject documentation states quite clearly that method calls on an
-     * object which has been disposed should *not* result in an error. Seems
-     * weird, but...
+    uuid_copy(dg->guid, old->guid);
+    dg->id = old->id;
+    dg->name = g_strdup(old->name);
+    dg->sequence = old->sequence;
+
+    dg->disks = g_array_sized_new(FALSE, FALSE, sizeof(LDMDisk *),
+                                  old->disks->len);
+    dg->parts = g_array_sized_new(FALSE, FALSE, sizeof(LDMPartition *),
+                                  old->parts->len);
+    dg->vols = g_array_sized_new(FALSE, FALSE, sizeof(LDMVolume *),
+                                 old->vols->len);
+    g_array_set_clear_func(dg->disks, _unref_object);
+    g_array_set_clear_func(dg->parts, _unref_object);
+    g_array_set_clear_func(dg->vols, _unref_object);
+
+    /* Maps each old disk and partition to its copy */
+    GHashTable * const copies = g_hash_table_new(g_direct_hash, g_direct_equal);
+
+    for (guint i = 0; i < old->disks->len; i++) {
+        LDMDisk * const old_disk_o = g_array_index(old->disks, LDMDisk *, i);
+        const LDMDiskPrivate * const old_disk = old_disk_o->priv;
+
+        LDMDisk * const disk_o = LDM_DISK(g_object_new(LDM_TYPE_DISK, NULL));
+        g_array_append_val(dg->disks, disk_o);
+        g_hash_table_insert(copies, old_disk_o, disk_o);
+        LDMDiskPrivate * const disk = disk_o->priv;
+
+        *disk = *old_disk;
+        disk->name = g_strdup(old_disk->name);
+        disk->dgname = g_strdup(old_disk->dgname);
+        disk->device = g_strdup(old_disk->device);
+    }
+
+    for (guint i = 0; i < old->parts->len; i++) {
+        LDMPartition * const old_part_o =
+            g_array_index(old->parts, LDMPartition *, i);
+        const LDMPartitionPrivate * const old_part = old_part_o->priv;
+
+        LDMPartition * const part_o =
+            LDM_PARTITION(g_object_new(LDM_TYPE_PARTITION, NULL));
+        g_array_append_val(dg->parts, part_o);
+        g_hash_table_insert(copies, old_part_o, part_o);
+        LDMPartitionPrivate * const part = part_o->priv;
+
+        *part = *old_part;
+        part->name = g_strdup(old_part->name);
+        part->disk = g_hash_table_lookup(copies, old_part->disk);
+        if (part->disk) g_object_ref(part->disk);
+        part->dm_cache = NULL;
+    }
+
+    for (guint i = 0; i < old->vols->len; i++) {
+        const LDMVolume * const old_vol_o =
+            g_array_index(old->vols, LDMVolume *, i);
+        const LDMVolumePrivate * const old_vol = old_vol_o->priv;
+
+        LDMVolume * const vol_o =
+            LDM_VOLUME(g_object_new(LDM_TYPE_VOLUME, NULL));
+        g_array_append_val(dg->vols, vol_o);
+        LDMVolumePrivate * const vol = vol_o->priv;
+
+        GArray * const parts = vol->parts;
+        *vol = *old_vol;
+        vol->parts = parts;
+        vol->name = g_strdup(old_vol->name);
+        vol->dgname = g_strdup(old_vol->dgname);
+        vol->id1 = g_strdup(old_vol->id1);
+        vol->id2 = g_strdup(old_vol->id2);
+        vol->hint = g_strdup(old_vol->hint);
+        vol->dm_cache = NULL;
+
+        for (guint j = 0; j < old_vol->parts->len; j++) {
+            LDMPartition * const part_o = g_hash_table_lookup(copies,
+                g_array_index(old_vol->parts, LDMPartition *, j));
+            g_object_ref(part_o);
+            g_array_append_val(vol->parts, part_o);
+        }
+    }
+
+    g_hash_table_unref(copies);
+
+    _index_disk_group(dg);
+
+    return dg_o;
+}
+
+/* Share the dm cache of o with the volumes and partitions of dg_o */
+static void
+_ldm_attach_disk_group(LDM * const o, LDMDiskGroup * const dg_o)
+{
+    struct _dm_cache * const cache = o->priv->dm_cache;
+    const LDMDiskGroupPrivate * const dg = dg_o->priv;
+
+    for (guint i = 0; i < dg->vols->len; i++) {
+        LDMVolumePrivate * const vol =
+            g_array_index(dg->vols, LDMVolume *, i)->priv;
+        if (vol->dm_cache == cache) continue;
+
+        _dm_cache_unref(vol->dm_cache);
+        vol->dm_cache = _dm_cache_ref(cache);
+    }
+
+    for (guint i = 0; i < dg->parts->len; i++) {
+        LDMPartitionPrivate * const part =
+            g_array_index(dg->parts, LDMPartition *, i)->priv;
+        if (part->dm_cache == cache) continue;
+
+        _dm_cache_unref(part->dm_cache);
+        part->dm_cache = _dm_cache_ref(cache);
+    }
+}
+
+gboolean
+ldm_add_fd(LDM * const o, const int fd, const guint secsize,
+           const gchar * const path, GError ** const err)
+{
+    g_mutex_lock(&o->priv->write_lock);
+
+    struct _ldm_state * const state = _ldm_get_state(o);
+
+    /* The GObject documentation states quite clearly that method calls on an
+     * object which has been disposed should *not* result in an error. Seems
+     * weird, but...
      */
-    if (!disk_groups) return TRUE;
+    if (!state) {
+        g_mutex_unlock(&o->priv->write_lock);
+        return TRUE;
+    }
 
     void *config = NULL;
+    LDMDiskGroup *dg_o = NULL;
 
     struct _privhead privhead;
     if (!_read_privhead(fd, path, secsize, &privhead, err)) goto error;
@@ -2298,68 +2905,81 @@ ldm_add_fd(LDM * const o, const int fd, const guint secsize,
         goto error;
     }
 
-    LDMDiskGroup *dg_o = NULL;
-    LDMDiskGroupPrivate *dg = NULL;
-    for (guint i = 0; i < disk_groups->len; i++) {
-        LDMDiskGroup *c = g_array_index(disk_groups,
-                                            LDMDiskGroup *, i);
+    const LDMDiskGroup * const old_dg_o =
+        g_hash_table_lookup(state->disk_groups_by_guid, disk_group_guid);
 
-        if (uuid_compare(disk_group_guid, c->priv->guid) == 0) {
-            dg_o = c;
-        }
-    }
+    if (old_dg_o == NULL) {
+        g_debug("Found new disk group: " UUID_FMT, UUID_VALS(disk_group_guid));
 
-    if (dg_o == NULL) {
         dg_o = LDM_DISK_GROUP(g_object_new(LDM_TYPE_DISK_GROUP, NULL));
-        dg = dg_o->priv;
-
         uuid_copy(dg_o->priv->guid, disk_group_guid);
 
-        g_debug("Found new disk group: " UUID_FMT, UUID_VALS(disk_group_guid));
-
-        if (!_parse_vblks(config, path, vmdb, dg_o, err)) {
-            g_object_unref(dg_o); dg_o = NULL;
-            goto error;
-        }
-
-        g_array_append_val(disk_groups, dg_o);
+        if (!_parse_vblks(config, path, vmdb, dg_o, err)) goto error;
     } else {
-        dg = dg_o->priv;
-
         /* Check this disk is consistent with other disks */
         uint64_t committed = be64toh(vmdb->committed_seq);
-        if (committed != dg->sequence) {
+        if (committed != old_dg_o->priv->sequence) {
             g_set_error(err, LDM_ERROR, LDM_ERROR_INCONSISTENT,
                         "Members of disk group " UUID_FMT " are inconsistent: "
                         "disk %s has committed sequence %" PRIu64 ", "
                         "group has committed sequence %" PRIu64,
                         UUID_VALS(disk_group_guid),
-                        path, committed, dg->sequence);
+                        path, committed, old_dg_o->priv->sequence);
             goto error;
         }
+
+        /* Every member holds the same metadata, so the disk group doesn't need
+         * to be parsed again. It only needs to be copied if this disk's device
+         * has to be recorded in it: published disk groups are never
+         * modified. */
+        const LDMDisk * const old_disk_o =
+            g_hash_table_lookup(old_dg_o->priv->disks_by_guid, disk_guid);
+        if (old_disk_o == NULL ||
+            (old_disk_o->priv->device &&
+             strcmp(old_disk_o->priv->device, path) == 0 &&
+             old_disk_o->priv->secsize == secsize))
+            goto done;
+
+        dg_o = _copy_disk_group(old_dg_o->priv);
     }
 
     /* Find the disk VBLK for the current disk and add additional information
      * from PRIVHEAD */
-    for (guint i = 0; i < dg->disks->len; i++) {
-        LDMDisk * const disk_o = g_array_index(dg->disks, LDMDisk *, i);
+    LDMDisk * const disk_o = g_hash_table_lookup(dg_o->priv->disks_by_guid,
+                                                 disk_guid);
+    if (disk_o) {
         LDMDiskPrivate * const disk = disk_o->priv;
 
-        if (uuid_compare(disk_guid, disk->guid) == 0) {
-            disk->device = g_strdup(path);
-            disk->data_start = be64toh(privhead.logical_disk_start);
-            disk->data_size = be64toh(privhead.logical_disk_size);
-            disk->metadata_start = be64toh(privhead.ldm_config_start);
-            disk->metadata_size = be64toh(privhead.ldm_config_size);
-            break;
-        }
+        g_free(disk->device);
+        disk->device = g_strdup(path);
+        disk->secsize = secsize;
+        disk->data_start = be64toh(privhead.logical_disk_start);
+        disk->data_size = be64toh(privhead.logical_disk_size);
+        disk->metadata_start = be64toh(privhead.ldm_config_start);
+        disk->metadata_size = be64toh(privhead.ldm_config_size);
     }
 
+    _ldm_attach_disk_group(o, dg_o);
+
+    struct _ldm_state * const new_state = _ldm_state_new(state);
+    _ldm_state_set_disk_group(new_state, dg_o);
+    _ldm_publish_state(o, new_state);
+
+    g_object_unref(dg_o);
+
+done:
+    _ldm_state_unref(state);
+    g_mutex_unlock(&o->priv->write_lock);
+
     g_free(config);
     close(fd);
     return TRUE;
 
 error:
+    if (dg_o) g_object_unref(dg_o);
+    _ldm_state_unref(state);
+    g_mutex_unlock(&o->priv->write_lock);
+
     g_free(config);
     close(fd);
     return FALSE;
@@ -2369,721 +2989,4122 @@ LDM *
 ldm_new()
 {
     LDM *ldm = LDM_CAST(g_object_new(LDM_TYPE, NULL));
-    ldm->priv->disk_groups = g_array_sized_new(FALSE, FALSE,
-                                               sizeof (LDMDiskGroup *), 1);
-    g_array_set_clear_func(ldm->priv->disk_groups, _unref_object);
+    ldm->priv->state = _ldm_state_new(NULL);
 
     return ldm;
 }
 
-GArray *
-ldm_get_disk_groups(LDM * const o)
-{
-    if (o->priv->disk_groups) g_array_ref(o->priv->disk_groups);
-    return o->priv->disk_groups;
-}
+/* Snapshots
+ *
+ * A snapshot is a flat image of the model built by scanning, stored in little
+ * endian byte order. It contains no pointers: objects refer to each other by
+ * index into the tables of their disk group, and strings are offsets into a
+ * single string table, so the file can be mapped at any address and shared by
+ * any number of readers. Offset 0 in the string table is reserved for NULL.
+ *
+ * All records are multiples of 8 bytes, so every field of a mapped snapshot
+ * is naturally aligned.
+ *
+ * Loading doesn't use the mapped records in place: it copies them into the
+ * same GObjects a scan builds, then unmaps the file. The API hands out those
+ * objects with their own references, mutable state such as the device mapper
+ * cache, and strings which callers may keep, none of which a read-only
+ * mapping can provide without changing every accessor. The copy is a single
+ * pass over fixed-size records with no VBLK parsing, and unmapping means a
+ * loaded model doesn't pin a file which has since been replaced.
+ */
 
-GArray *
-ldm_disk_group_get_volumes(LDMDiskGroup * const o)
-{
-    if (o->priv->vols) g_array_ref(o->priv->vols);
-    return o->priv->vols;
-}
+#define SNAPSHOT_MAGIC "LDMSNAP"
+#define SNAPSHOT_VERSION 1
 
-GArray *
-ldm_disk_group_get_partitions(LDMDiskGroup * const o)
+struct _snap_header
 {
-    if (o->priv->parts) g_array_ref(o->priv->parts);
-    return o->priv->parts;
-}
+    char magic[8]; // "LDMSNAP\0"
+    uint32_t version;
+    uint32_t header_size;
+    uint64_t file_size;
 
-GArray *
-ldm_disk_group_get_disks(LDMDiskGroup * const o)
-{
-    if (o->priv->disks) g_array_ref(o->priv->disks);
-    return o->priv->disks;
-}
+    uint32_t n_disk_groups;
+    uint32_t n_vols;
+    uint32_t n_parts;
+    uint32_t n_disks;
+    uint32_t n_vol_parts;
+    uint32_t strings_size;
+
+    uint64_t disk_groups_off;
+    uint64_t vols_off;
+    uint64_t parts_off;
+    uint64_t disks_off;
+    uint64_t vol_parts_off;
+    uint64_t strings_off;
+} __attribute__((__packed__));
 
-GArray *
-ldm_volume_get_partitions(LDMVolume * const o)
+struct _snap_disk_group
 {
-    if (o->priv->parts) g_array_ref(o->priv->parts);
-    return o->priv->parts;
-}
+    uuid_t guid;
+    uint32_t id;
+    uint32_t name;
+    uint64_t sequence;
 
-LDMDisk *
-ldm_partition_get_disk(LDMPartition * const o)
-{
-    if (o->priv->disk) g_object_ref(o->priv->disk);
-    return o->priv->disk;
-}
+    /* Ranges of the global vol, part and disk tables */
+    uint32_t vols_first;
+    uint32_t n_vols;
+    uint32_t parts_first;
+    uint32_t n_parts;
+    uint32_t disks_first;
+    uint32_t n_disks;
+} __attribute__((__packed__));
 
-static GString *
-_dm_part_name(const LDMPartitionPrivate * const part)
+struct _snap_vol
 {
-    const LDMDiskPrivate * const disk = part->disk->priv;
-
-    GString * name = g_string_new("");
-    g_string_printf(name, "ldm_part_%s_%s", disk->dgname, part->name);
-
-    return name;
-}
+    uuid_t guid;
+    uint32_t id;
+    uint32_t name;
+    uint32_t hint;
+    uint32_t id1;
+    uint32_t id2;
+    uint8_t type;
+    uint8_t part_type;
+    uint8_t flags;
+    uint8_t padding;
+    uint64_t size;
+    uint64_t size2;
+    uint64_t chunk_size;
+
+    /* Range of the vol_parts table, whose entries are indexes of partitions
+     * in the disk group */
+    uint32_t vol_parts_first;
+    uint32_t n_vol_parts;
+} __attribute__((__packed__));
 
-static GString *
-_dm_part_uuid(const LDMPartitionPrivate * const part)
+struct _snap_part
 {
-    const LDMDiskPrivate * const disk = part->disk->priv;
-
-    char ldm_disk_guid[37];
-    uuid_unparse_lower(disk->guid, ldm_disk_guid);
-
-    GString * dm_uuid = g_string_new("");
-    g_string_printf(dm_uuid, "%s%s-%s",
-                    DM_UUID_PREFIX, part->name, ldm_disk_guid);
+    uint32_t id;
+    uint32_t parent_id;
+    uint32_t name;
+    uint32_t index;
+    uint32_t disk_id;
+    uint32_t disk; // Index of the disk in the disk group
+    uint64_t start;
+    uint64_t vol_offset;
+    uint64_t size;
+} __attribute__((__packed__));
 
-    return dm_uuid;
-}
+struct _snap_disk
+{
+    uuid_t guid;
+    uint32_t id;
+    uint32_t name;
+    uint32_t device;
+    uint32_t secsize;
+    uint64_t data_start;
+    uint64_t data_size;
+    uint64_t metadata_start;
+    uint64_t metadata_size;
+} __attribute__((__packed__));
 
-static GString *
-_dm_vol_name(const LDMVolumePrivate * const vol)
+struct _snap_writer
 {
-    GString * r = g_string_new("");
-    g_string_printf(r, "ldm_vol_%s_%s", vol->dgname, vol->name);
-    return r;
-}
+    GByteArray *dgs;
+    GByteArray *vols;
+    GByteArray *parts;
+    GByteArray *disks;
+    GByteArray *vol_parts;
+    GByteArray *strings;
+
+    /* Offsets of strings already in the string table */
+    GHashTable *string_offs;
+};
 
-static GString *
-_dm_vol_uuid(const LDMVolumePrivate * const vol)
+static uint32_t
+_snap_add_string(struct _snap_writer * const w, const gchar * const str)
 {
-    char ldm_vol_uuid[37];
-    uuid_unparse_lower(vol->guid, ldm_vol_uuid);
+    if (str == NULL) return 0;
 
-    GString * dm_uuid = g_string_new("");
-    g_string_printf(dm_uuid, "%s%s-%s",
-                    DM_UUID_PREFIX, vol->name, ldm_vol_uuid);
+    gpointer off;
+    if (g_hash_table_lookup_extended(w->string_offs, str, NULL, &off))
+        return GPOINTER_TO_UINT(off);
 
-    return dm_uuid;
+    const uint32_t r = w->strings->len;
+    g_byte_array_append(w->strings, (const guint8 *) str, strlen(str) + 1);
+    g_hash_table_insert(w->string_offs, (gpointer) str, GUINT_TO_POINTER(r));
+    return r;
 }
 
-struct dm_target {
-    guint64 start;
-    guint64 size;
-    const gchar * type;
-    GString *params;
-};
-
-static struct dm_tree *
-_dm_get_device_tree(GError **err)
+static void
+_snap_add_disk_group(struct _snap_writer * const w,
+                     const LDMDiskGroupPrivate * const dg)
 {
-    struct dm_tree *tree;
-    tree = dm_tree_create();
-    if (!tree) {
-        g_set_error(err, LDM_ERROR, LDM_ERROR_EXTERNAL,
-                    "dm_tree_create: %s", _dm_err_last_msg);
-        return NULL;
-    }
+    struct _snap_disk_group sdg;
+    bzero(&sdg, sizeof(sdg));
 
-    struct dm_task *task;
-    task = dm_task_create(DM_DEVICE_LIST);
-    if (!task) {
-        g_set_error(err, LDM_ERROR, LDM_ERROR_EXTERNAL,
-                    "dm_task_create: %s", _dm_err_last_msg);
-        goto error;
-    }
+    memcpy(sdg.guid, dg->guid, sizeof(uuid_t));
+    sdg.id = htole32(dg->id);
+    sdg.name = htole32(_snap_add_string(w, dg->name));
+    sdg.sequence = htole64(dg->sequence);
 
-    if (!dm_task_run(task)) {
-        g_set_error_literal(err, LDM_ERROR, LDM_ERROR_EXTERNAL,
-                            _dm_err_last_msg);
-        goto error;
-    }
+    /* Positions of disks and partitions in their disk group, which is how
+     * snapshot records refer to them */
+    GHashTable * const disk_idx = g_hash_table_new(NULL, NULL);
+    GHashTable * const part_idx = g_hash_table_new(NULL, NULL);
 
-    struct dm_names *names;
-    names = dm_task_get_names(task);
-    if (!task) {
-        g_set_error(err, LDM_ERROR, LDM_ERROR_EXTERNAL,
-                    "dm_task_get_names: %s", _dm_err_last_msg);
-        goto error;
+    sdg.disks_first = htole32(w->disks->len / sizeof(struct _snap_disk));
+    sdg.n_disks = htole32(dg->disks->len);
+    for (guint i = 0; i < dg->disks->len; i++) {
+        const LDMDisk * const disk_o = g_array_index(dg->disks, LDMDisk *, i);
+        const LDMDiskPrivate * const disk = disk_o->priv;
+
+        struct _snap_disk sd;
+        bzero(&sd, sizeof(sd));
+        memcpy(sd.guid, disk->guid, sizeof(uuid_t));
+        sd.id = htole32(disk->id);
+        sd.name = htole32(_snap_add_string(w, disk->name));
+        sd.device = htole32(_snap_add_string(w, disk->device));
+        sd.secsize = htole32(disk->secsize);
+        sd.data_start = htole64(disk->data_start);
+        sd.data_size = htole64(disk->data_size);
+        sd.metadata_start = htole64(disk->metadata_start);
+        sd.metadata_size = htole64(disk->metadata_size);
+        g_byte_array_append(w->disks, (const guint8 *) &sd, sizeof(sd));
+
+        g_hash_table_insert(disk_idx, (gpointer) disk_o, GUINT_TO_POINTER(i));
     }
 
-    if (names->dev != 0) {
-        for (;;) {
-            if (!dm_tree_add_dev(tree, major(names->dev), minor(names->dev))) {
-                g_set_error(err, LDM_ERROR, LDM_ERROR_EXTERNAL,
-                            "dm_tree_add_dev: %s", _dm_err_last_msg);
-                goto error;
-            }
+    sdg.parts_first = htole32(w->parts->len / sizeof(struct _snap_part));
+    sdg.n_parts = htole32(dg->parts->len);
+    for (guint i = 0; i < dg->parts->len; i++) {
+        const LDMPartition * const part_o =
+            g_array_index(dg->parts, LDMPartition *, i);
+        const LDMPartitionPrivate * const part = part_o->priv;
 
-            if (names->next == 0) break;
+        struct _snap_part sp;
+        bzero(&sp, sizeof(sp));
+        sp.id = htole32(part->id);
+        sp.parent_id = htole32(part->parent_id);
+        sp.name = htole32(_snap_add_string(w, part->name));
+        sp.index = htole32(part->index);
+        sp.disk_id = htole32(part->disk_id);
+        sp.disk = htole32(GPOINTER_TO_UINT(
+            g_hash_table_lookup(disk_idx, part->disk)));
+        sp.start = htole64(part->start);
+        sp.vol_offset = htole64(part->vol_offset);
+        sp.size = htole64(part->size);
+        g_byte_array_append(w->parts, (const guint8 *) &sp, sizeof(sp));
+
+        g_hash_table_insert(part_idx, (gpointer) part_o, GUINT_TO_POINTER(i));
+    }
 
-            names = (struct dm_names *)((char *)names + names->next);
+    sdg.vols_first = htole32(w->vols->len / sizeof(struct _snap_vol));
+    sdg.n_vols = htole32(dg->vols->len);
+    for (guint i = 0; i < dg->vols->len; i++) {
+        const LDMVolume * const vol_o = g_array_index(dg->vols, LDMVolume *, i);
+        const LDMVolumePrivate * const vol = vol_o->priv;
+
+        struct _snap_vol sv;
+        bzero(&sv, sizeof(sv));
+        memcpy(sv.guid, vol->guid, sizeof(uuid_t));
+        sv.id = htole32(vol->id);
+        sv.name = htole32(_snap_add_string(w, vol->name));
+        sv.hint = htole32(_snap_add_string(w, vol->hint));
+        sv.id1 = htole32(_snap_add_string(w, vol->id1));
+        sv.id2 = htole32(_snap_add_string(w, vol->id2));
+        sv.type = vol->type;
+        sv.part_type = vol->part_type;
+        sv.flags = vol->flags;
+        sv.size = htole64(vol->size);
+        sv.size2 = htole64(vol->size2);
+        sv.chunk_size = htole64(vol->chunk_size);
+
+        sv.vol_parts_first = htole32(w->vol_parts->len / sizeof(uint32_t));
+        sv.n_vol_parts = htole32(vol->parts->len);
+        for (guint j = 0; j < vol->parts->len; j++) {
+            const LDMPartition * const part_o =
+                g_array_index(vol->parts, LDMPartition *, j);
+            const uint32_t idx = htole32(GPOINTER_TO_UINT(
+                g_hash_table_lookup(part_idx, part_o)));
+            g_byte_array_append(w->vol_parts, (const guint8 *) &idx,
+                                sizeof(idx));
         }
+
+        g_byte_array_append(w->vols, (const guint8 *) &sv, sizeof(sv));
     }
 
-    dm_task_destroy(task);
-    return tree;
+    g_byte_array_append(w->dgs, (const guint8 *) &sdg, sizeof(sdg));
 
-error:
-    if (tree) dm_tree_free(tree);
-    if (task) dm_task_destroy(task);
-    return NULL;
+    g_hash_table_unref(disk_idx);
+    g_hash_table_unref(part_idx);
 }
 
-/* Returns TRUE if device with specified UUID is found or FALSE otherwise.
- *
- * Found device node is returned if dm_node is not NULL. In this case dm_tree
- * MUST not be NULL as well. And the caller is responsible to free device tree
- * by calling dm_tree_free function.
- */
 gboolean
-_dm_find_tree_node_by_uuid(const gchar * const uuid,
-                                struct dm_tree_node ** dm_node,
-                                struct dm_tree ** dm_tree,
-                                GError ** const err)
+ldm_save_snapshot(LDM * const o, const gchar * const path, GError ** const err)
 {
-    gboolean r = FALSE;
+    struct _ldm_state * const state = _ldm_get_state(o);
+
+    struct _snap_writer w;
+    w.dgs = g_byte_array_new();
+    w.vols = g_byte_array_new();
+    w.parts = g_byte_array_new();
+    w.disks = g_byte_array_new();
+    w.vol_parts = g_byte_array_new();
+    w.strings = g_byte_array_new();
+    w.string_offs = g_hash_table_new(g_str_hash, g_str_equal);
+
+    /* Reserve offset 0 for NULL */
+    const guint8 nul = '\0';
+    g_byte_array_append(w.strings, &nul, 1);
+
+    for (guint i = 0; state && i < state->disk_groups->len; i++) {
+        const LDMDiskGroup * const dg_o =
+            g_array_index(state->disk_groups, LDMDiskGroup *, i);
+        _snap_add_disk_group(&w, dg_o->priv);
+    }
 
-    if (dm_node) {
-        g_assert(dm_tree != NULL);
-        *dm_node = NULL;
+    /* Keep the string table, which is the only table not made of 8 byte
+     * records, at the end */
+    struct _snap_header header;
+    bzero(&header, sizeof(header));
+    memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic));
+    header.version = htole32(SNAPSHOT_VERSION);
+    header.header_size = htole32(sizeof(header));
+
+    GByteArray * const tables[] = {
+        w.dgs, w.vols, w.parts, w.disks, w.vol_parts, w.strings
+    };
+    uint64_t offsets[G_N_ELEMENTS(tables)];
+
+    uint64_t off = sizeof(header);
+    for (guint i = 0; i < G_N_ELEMENTS(tables); i++) {
+        offsets[i] = off;
+        off += tables[i]->len;
     }
-    if (dm_tree) *dm_tree = NULL;
 
-    struct dm_tree *tree = _dm_get_device_tree(err);
-    if (tree) {
-        struct dm_tree_node *node = dm_tree_find_node_by_uuid(tree, uuid);
-        if (node) r = TRUE;
+    header.file_size = htole64(off);
+    header.disk_groups_off = htole64(offsets[0]);
+    header.vols_off = htole64(offsets[1]);
+    header.parts_off = htole64(offsets[2]);
+    header.disks_off = htole64(offsets[3]);
+    header.vol_parts_off = htole64(offsets[4]);
+    header.strings_off = htole64(offsets[5]);
+
+    header.n_disk_groups = htole32(w.dgs->len / sizeof(struct _snap_disk_group));
+    header.n_vols = htole32(w.vols->len / sizeof(struct _snap_vol));
+    header.n_parts = htole32(w.parts->len / sizeof(struct _snap_part));
+    header.n_disks = htole32(w.disks->len / sizeof(struct _snap_disk));
+    header.n_vol_parts = htole32(w.vol_parts->len / sizeof(uint32_t));
+    header.strings_size = htole32(w.strings->len);
+
+    GByteArray * const data = g_byte_array_sized_new(off);
+    g_byte_array_append(data, (const guint8 *) &header, sizeof(header));
+    for (guint i = 0; i < G_N_ELEMENTS(tables); i++) {
+        g_byte_array_append(data, tables[i]->data, tables[i]->len);
+        g_byte_array_unref(tables[i]);
+    }
+    g_hash_table_unref(w.string_offs);
+    if (state) _ldm_state_unref(state);
 
-        if (dm_tree)
-            *dm_tree = tree;
-        else
-            dm_tree_free(tree);
+    /* g_file_set_contents writes a temporary file and renames it over path,
+     * so concurrent readers see either the old or the new snapshot */
+    GError *file_err = NULL;
+    const gboolean r = g_file_set_contents(path, (const gchar *) data->data,
+                                           data->len, &file_err);
+    g_byte_array_unref(data);
 
-        if (dm_node) *dm_node = node;
+    if (!r) {
+        g_set_error(err, LDM_ERROR, LDM_ERROR_IO,
+                    "Error writing snapshot %s: %s", path, file_err->message);
+        g_error_free(file_err);
     }
 
     return r;
 }
 
-gchar *
-_dm_get_device(const gchar * const uuid, GError ** const err)
+struct _snap_reader
 {
-    GString *r = NULL;
-
-    struct dm_tree_node *node = NULL;
-    struct dm_tree *tree = NULL;
-    struct dm_task *task = NULL;
-
-    if (_dm_find_tree_node_by_uuid(uuid, &node, &tree, err)) {
-        const struct dm_info *info = dm_tree_node_get_info(node);
-
-        task = dm_task_create(DM_DEVICE_INFO);
-        if (!task) {
-            g_set_error(err, LDM_ERROR, LDM_ERROR_EXTERNAL,
-                        "dm_task_create: %s", _dm_err_last_msg);
-            goto error;
-        }
-
-        if (!dm_task_set_major(task, info->major)) {
-            g_set_error(err, LDM_ERROR, LDM_ERROR_EXTERNAL,
-                        "DM_DEVICE_INFO: dm_task_set_major(%d) failed: %s",
-                        info->major, _dm_err_last_msg);
-            goto error;
-        }
-
-        if (!dm_task_set_minor(task, info->minor)) {
-            g_set_error(err, LDM_ERROR, LDM_ERROR_EXTERNAL,
-                        "DM_DEVICE_INFO: dm_task_set_major(%d) failed: %s",
-                        info->minor, _dm_err_last_msg);
-            goto error;
-        }
+    const gchar *path;
+
+    const struct _snap_header *header;
+    const struct _snap_disk_group *dgs;
+    const struct _snap_vol *vols;
+    const struct _snap_part *parts;
+    const struct _snap_disk *disks;
+    const uint32_t *vol_parts;
+    const gchar *strings;
+};
 
-        if (!dm_task_run(task)) {
-            g_set_error_literal(err, LDM_ERROR, LDM_ERROR_EXTERNAL,
-                                _dm_err_last_msg);
-            goto error;
-        }
+static gboolean
+_snap_check_range(const struct _snap_reader * const r,
+                  const uint32_t first, const uint32_t n, const uint32_t len,
+                  GError ** const err)
+{
+    if ((uint64_t) first + n > len) {
+        g_set_error(err, LDM_ERROR, LDM_ERROR_INVALID,
+                    "Snapshot %s is corrupt: record range %u+%u exceeds "
+                    "table size %u", r->path, first, n, len);
+        return FALSE;
+    }
+    return TRUE;
+}
 
-        const char *dir = dm_dir();
-        char *mangled_name = dm_task_get_name_mangled(task);
-        r = g_string_new("");
-        g_string_printf(r, "%s/%s", dir, mangled_name);
-        dm_free(mangled_name);
+static gboolean
+_snap_get_string(const struct _snap_reader * const r, const uint32_t off_le,
+                 gchar ** const out, GError ** const err)
+{
+    const uint32_t off = le32toh(off_le);
+    if (off == 0) {
+        *out = NULL;
+        return TRUE;
     }
 
-error:
-    if (tree) dm_tree_free(tree);
-    if (task) dm_task_destroy(task);
+    /* The string table is known to end with a nul */
+    if (off >= le32toh(r->header->strings_size)) {
+        g_set_error(err, LDM_ERROR, LDM_ERROR_INVALID,
+                    "Snapshot %s is corrupt: string offset %u is outside "
+                    "string table", r->path, off);
+        return FALSE;
+    }
 
-    /* Really FALSE here - don't free but return the character data. */
-    return r ? g_string_free(r, FALSE) : NULL;
+    *out = g_strdup(r->strings + off);
+    return TRUE;
 }
 
-gboolean
-_dm_create(const gchar * const name, const gchar * const uuid,
-           uint32_t udev_cookie, const guint n_targets,
-           const struct dm_target * const targets,
-           GString **mangled_name, GError ** const err)
+static LDMDiskGroup *
+_snap_load_disk_group(const struct _snap_reader * const r,
+                      const struct _snap_disk_group * const sdg,
+                      GError ** const err)
 {
-    gboolean r = TRUE;
+    const struct _snap_header * const h = r->header;
 
-    if (mangled_name) *mangled_name = NULL;
+    LDMDiskGroup * const dg_o =
+        LDM_DISK_GROUP(g_object_new(LDM_TYPE_DISK_GROUP, NULL));
+    LDMDiskGroupPrivate * const dg = dg_o->priv;
 
-    struct dm_task * const task = dm_task_create(DM_DEVICE_CREATE);
-    if (!task) {
-        g_set_error(err, LDM_ERROR, LDM_ERROR_EXTERNAL,
-                    "dm_task_create(DM_DEVICE_CREATE) failed: %s",
-                    _dm_err_last_msg);
-        return FALSE;
+    const uint32_t vols_first = le32toh(sdg->vols_first);
+    const uint32_t n_vols = le32toh(sdg->n_vols);
+    const uint32_t parts_first = le32toh(sdg->parts_first);
+    const uint32_t n_parts = le32toh(sdg->n_parts);
+    const uint32_t disks_first = le32toh(sdg->disks_first);
+    const uint32_t n_disks = le32toh(sdg->n_disks);
+
+    if (!_snap_check_range(r, vols_first, n_vols, le32toh(h->n_vols), err) ||
+        !_snap_check_range(r, parts_first, n_parts, le32toh(h->n_parts), err) ||
+        !_snap_check_range(r, disks_first, n_disks, le32toh(h->n_disks), err))
+        goto error;
+
+    memcpy(dg->guid, sdg->guid, sizeof(uuid_t));
+    dg->id = le32toh(sdg->id);
+    dg->sequence = le64toh(sdg->sequence);
+    if (!_snap_get_string(r, sdg->name, &dg->name, err)) goto error;
+
+    dg->disks = g_array_sized_new(FALSE, FALSE, sizeof(LDMDisk *), n_disks);
+    dg->parts = g_array_sized_new(FALSE, FALSE,
+                                  sizeof(LDMPartition *), n_parts);
+    dg->vols = g_array_sized_new(FALSE, FALSE, sizeof(LDMVolume *), n_vols);
+    g_array_set_clear_func(dg->disks, _unref_object);
+    g_array_set_clear_func(dg->parts, _unref_object);
+    g_array_set_clear_func(dg->vols, _unref_object);
+
+    for (uint32_t i = 0; i < n_disks; i++) {
+        const struct _snap_disk * const sd = &r->disks[disks_first + i];
+
+        LDMDisk * const disk_o = LDM_DISK(g_object_new(LDM_TYPE_DISK, NULL));
+        g_array_append_val(dg->disks, disk_o);
+        LDMDiskPrivate * const disk = disk_o->priv;
+
+        memcpy(disk->guid, sd->guid, sizeof(uuid_t));
+        disk->id = le32toh(sd->id);
+        disk->secsize = le32toh(sd->secsize);
+        disk->data_start = le64toh(sd->data_start);
+        disk->data_size = le64toh(sd->data_size);
+        disk->metadata_start = le64toh(sd->metadata_start);
+        disk->metadata_size = le64toh(sd->metadata_size);
+        disk->dgname = g_strdup(dg->name);
+        if (!_snap_get_string(r, sd->name, &disk->name, err) ||
+            !_snap_get_string(r, sd->device, &disk->device, err))
+            goto error;
+    }
+
+    for (uint32_t i = 0; i < n_parts; i++) {
+        const struct _snap_part * const sp = &r->parts[parts_first + i];
+
+        LDMPartition * const part_o =
+            LDM_PARTITION(g_object_new(LDM_TYPE_PARTITION, NULL));
+        g_array_append_val(dg->parts, part_o);
+        LDMPartitionPrivate * const part = part_o->priv;
+
+        part->id = le32toh(sp->id);
+        part->parent_id = le32toh(sp->parent_id);
+        part->index = le32toh(sp->index);
+        part->disk_id = le32toh(sp->disk_id);
+        part->start = le64toh(sp->start);
+        part->vol_offset = le64toh(sp->vol_offset);
+        part->size = le64toh(sp->size);
+        if (!_snap_get_string(r, sp->name, &part->name, err)) goto error;
+
+        const uint32_t disk = le32toh(sp->disk);
+        if (!_snap_check_range(r, disk, 1, n_disks, err)) goto error;
+        part->disk = g_array_index(dg->disks, LDMDisk *, disk);
+        g_object_ref(part->disk);
+    }
+
+    for (uint32_t i = 0; i < n_vols; i++) {
+        const struct _snap_vol * const sv = &r->vols[vols_first + i];
+
+        LDMVolume * const vol_o =
+            LDM_VOLUME(g_object_new(LDM_TYPE_VOLUME, NULL));
+        g_array_append_val(dg->vols, vol_o);
+        LDMVolumePrivate * const vol = vol_o->priv;
+
+        if (sv->type > LDM_VOLUME_TYPE_RAID5) {
+            g_set_error(err, LDM_ERROR, LDM_ERROR_INVALID,
+                        "Snapshot %s is corrupt: invalid volume type %u",
+                        r->path, sv->type);
+            goto error;
+        }
+
+        memcpy(vol->guid, sv->guid, sizeof(uuid_t));
+        vol->id = le32toh(sv->id);
+        vol->type = sv->type;
+        vol->part_type = sv->part_type;
+        vol->flags = sv->flags;
+        vol->size = le64toh(sv->size);
+        vol->size2 = le64toh(sv->size2);
+        vol->chunk_size = le64toh(sv->chunk_size);
+        vol->dgname = g_strdup(dg->name);
+        if (!_snap_get_string(r, sv->name, &vol->name, err) ||
+            !_snap_get_string(r, sv->hint, &vol->hint, err) ||
+            !_snap_get_string(r, sv->id1, &vol->id1, err) ||
+            !_snap_get_string(r, sv->id2, &vol->id2, err))
+            goto error;
+
+        const uint32_t vol_parts_first = le32toh(sv->vol_parts_first);
+        const uint32_t n_vol_parts = le32toh(sv->n_vol_parts);
+        if (!_snap_check_range(r, vol_parts_first, n_vol_parts,
+                               le32toh(h->n_vol_parts), err))
+            goto error;
+
+        for (uint32_t j = 0; j < n_vol_parts; j++) {
+            const uint32_t part = le32toh(r->vol_parts[vol_parts_first + j]);
+            if (!_snap_check_range(r, part, 1, n_parts, err)) goto error;
+
+            LDMPartition * const part_o =
+                g_array_index(dg->parts, LDMPartition *, part);
+            g_object_ref(part_o);
+            g_array_append_val(vol->parts, part_o);
+        }
+    }
+
+    _index_disk_group(dg);
+
+    return dg_o;
+
+error:
+    g_object_unref(dg_o);
+    return NULL;
+}
+
+/* Check that every present member disk of a disk group still contains the
+ * metadata the snapshot was taken from */
+static gboolean
+_snap_check_fresh(const LDMDiskGroupPrivate * const dg, GError ** const err)
+{
+    for (guint i = 0; i < dg->disks->len; i++) {
+        const LDMDisk * const disk_o = g_array_index(dg->disks, LDMDisk *, i);
+        const LDMDiskPrivate * const disk = disk_o->priv;
+
+        if (disk->device == NULL) continue;
+
+        const int fd = open(disk->device, O_RDONLY);
+        if (fd == -1) {
+            g_set_error(err, LDM_ERROR, LDM_ERROR_IO,
+                        "Error opening %s for reading: %m", disk->device);
+            return FALSE;
+        }
+
+        struct _privhead privhead;
+        uint64_t committed;
+        const gboolean r =
+            _read_privhead(fd, disk->device, disk->secsize, &privhead, err) &&
+            _read_committed_seq(fd, disk->device, disk->secsize, &privhead,
+                                &committed, err);
+        close(fd);
+        if (!r) return FALSE;
+
+        uuid_t disk_guid;
+        if (uuid_parse(privhead.disk_guid, disk_guid) == -1 ||
+            uuid_compare(disk_guid, disk->guid) != 0)
+        {
+            g_set_error(err, LDM_ERROR, LDM_ERROR_INCONSISTENT,
+                        "Snapshot is out of date: %s no longer contains "
+                        "disk " UUID_FMT,
+                        disk->device, UUID_VALS(disk->guid));
+            return FALSE;
+        }
+
+        if (committed != dg->sequence) {
+            g_set_error(err, LDM_ERROR, LDM_ERROR_INCONSISTENT,
+                        "Snapshot is out of date: disk %s has committed "
+                        "sequence %" PRIu64 ", snapshot has committed "
+                        "sequence %" PRIu64,
+                        disk->device, committed, dg->sequence);
+            return FALSE;
+        }
+    }
+
+    return TRUE;
+}
+
+static gboolean
+_snap_map_tables(struct _snap_reader * const r, const void * const map,
+                 const uint64_t size, GError ** const err)
+{
+    const struct _snap_header * const h = map;
+
+    if (size < sizeof(*h) ||
+        memcmp(h->magic, SNAPSHOT_MAGIC, sizeof(h->magic)) != 0)
+    {
+        g_set_error(err, LDM_ERROR, LDM_ERROR_INVALID,
+                    "%s is not an LDM snapshot", r->path);
+        return FALSE;
+    }
+
+    if (le32toh(h->version) != SNAPSHOT_VERSION) {
+        g_set_error(err, LDM_ERROR, LDM_ERROR_NOTSUPPORTED,
+                    "Unsupported snapshot version %u in %s",
+                    le32toh(h->version), r->path);
+        return FALSE;
+    }
+
+    if (le32toh(h->header_size) < sizeof(*h) ||
+        le64toh(h->file_size) != size)
+    {
+        g_set_error(err, LDM_ERROR, LDM_ERROR_INVALID,
+                    "Snapshot %s is truncated or corrupt", r->path);
+        return FALSE;
+    }
+
+    const struct {
+        uint64_t off;
+        uint64_t len;
+        const void **table;
+    } tables[] = {
+        { le64toh(h->disk_groups_off),
+          (uint64_t) le32toh(h->n_disk_groups) *
+          sizeof(struct _snap_disk_group),
+          (const void **) &r->dgs },
+        { le64toh(h->vols_off),
+          (uint64_t) le32toh(h->n_vols) * sizeof(struct _snap_vol),
+          (const void **) &r->vols },
+        { le64toh(h->parts_off),
+          (uint64_t) le32toh(h->n_parts) * sizeof(struct _snap_part),
+          (const void **) &r->parts },
+        { le64toh(h->disks_off),
+          (uint64_t) le32toh(h->n_disks) * sizeof(struct _snap_disk),
+          (const void **) &r->disks },
+        { le64toh(h->vol_parts_off),
+          (uint64_t) le32toh(h->n_vol_parts) * sizeof(uint32_t),
+          (const void **) &r->vol_parts },
+        { le64toh(h->strings_off), le32toh(h->strings_size),
+          (const void **) &r->strings }
+    };
+
+    for (guint i = 0; i < G_N_ELEMENTS(tables); i++) {
+        if (tables[i].off > size || tables[i].len > size - tables[i].off) {
+            g_set_error(err, LDM_ERROR, LDM_ERROR_INVALID,
+                        "Snapshot %s is corrupt: table %u is outside file",
+                        r->path, i);
+            return FALSE;
+        }
+        *tables[i].table = map + tables[i].off;
+    }
+
+    const uint32_t strings_size = le32toh(h->strings_size);
+    if (strings_size == 0 || r->strings[strings_size - 1] != '\0') {
+        g_set_error(err, LDM_ERROR, LDM_ERROR_INVALID,
+                    "Snapshot %s is corrupt: unterminated string table",
+                    r->path);
+        return FALSE;
+    }
+
+    r->header = h;
+    return TRUE;
+}
+
+LDM *
+ldm_load_snapshot(const gchar * const path, GError ** const err)
+{
+    const int fd = open(path, O_RDONLY);
+    if (fd == -1) {
+        g_set_error(err, LDM_ERROR, LDM_ERROR_IO,
+                    "Error opening %s for reading: %m", path);
+        return NULL;
+    }
+
+    struct stat stat;
+    if (fstat(fd, &stat) == -1) {
+        g_set_error(err, LDM_ERROR, LDM_ERROR_IO,
+                    "Unable to stat %s: %m", path);
+        close(fd);
+        return NULL;
+    }
+    if (stat.st_size == 0) {
+        g_set_error(err, LDM_ERROR, LDM_ERROR_INVALID,
+                    "%s is not an LDM snapshot", path);
+        close(fd);
+        return NULL;
+    }
+
+    void * const map = mmap(NULL, stat.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        g_set_error(err, LDM_ERROR, LDM_ERROR_IO,
+                    "Unable to map %s: %m", path);
+        return NULL;
+    }
+
+    struct _snap_reader r;
+    bzero(&r, sizeof(r));
+    r.path = path;
+
+    LDM *ldm = NULL;
+    if (!_snap_map_tables(&r, map, stat.st_size, err)) goto out;
+
+    struct _ldm_state * const state = _ldm_state_new(NULL);
+    for (uint32_t i = 0; i < le32toh(r.header->n_disk_groups); i++) {
+        LDMDiskGroup * const dg_o = _snap_load_disk_group(&r, &r.dgs[i], err);
+        if (dg_o == NULL) goto error;
+
+        _ldm_state_set_disk_group(state, dg_o);
+        g_object_unref(dg_o);
+
+        if (!_snap_check_fresh(dg_o->priv, err)) goto error;
+    }
+
+    ldm = ldm_new();
+    for (guint i = 0; i < state->disk_groups->len; i++) {
+        _ldm_attach_disk_group(ldm,
+            g_array_index(state->disk_groups, LDMDiskGroup *, i));
+    }
+    _ldm_publish_state(ldm, state);
+
+out:
+    munmap(map, stat.st_size);
+    return ldm;
+
+error:
+    _ldm_state_unref(state);
+    goto out;
+}
+
+GArray *
+ldm_get_disk_groups(LDM * const o)
+{
+    struct _ldm_state * const state = _ldm_get_state(o);
+    if (state == NULL) return NULL;
+
+    /* The array is never modified after it has been published */
+    GArray * const disk_groups = g_array_ref(state->disk_groups);
+    _ldm_state_unref(state);
+
+    return disk_groups;
+}
+
+GArray *
+ldm_disk_group_get_volumes(LDMDiskGroup * const o)
+{
+    if (o->priv->vols) g_array_ref(o->priv->vols);
+    return o->priv->vols;
+}
+
+GArray *
+ldm_disk_group_get_partitions(LDMDiskGroup * const o)
+{
+    if (o->priv->parts) g_array_ref(o->priv->parts);
+    return o->priv->parts;
+}
+
+GArray *
+ldm_disk_group_get_disks(LDMDiskGroup * const o)
+{
+    if (o->priv->disks) g_array_ref(o->priv->disks);
+    return o->priv->disks;
+}
+
+GArray *
+ldm_volume_get_partitions(LDMVolume * const o)
+{
+    if (o->priv->parts) g_array_ref(o->priv->parts);
+    return o->priv->parts;
+}
+
+LDMDisk *
+ldm_partition_get_disk(LDMPartition * const o)
+{
+    if (o->priv->disk) g_object_ref(o->priv->disk);
+    return o->priv->disk;
+}
+
+/* Look up an object by name, or failing that by the string representation of
+ * its GUID */
+static gpointer
+_find_object(GHashTable * const by_name, GHashTable * const by_guid,
+             const gchar * const id)
+{
+    gpointer o = NULL;
+    if (by_name != NULL) o = g_hash_table_lookup(by_name, id);
+
+    uuid_t guid;
+    if (o == NULL && by_guid != NULL && uuid_parse(id, guid) == 0)
+        o = g_hash_table_lookup(by_guid, guid);
+
+    if (o) g_object_ref(o);
+    return o;
+}
+
+LDMDiskGroup *
+ldm_find_disk_group(LDM * const o, const gchar * const guid)
+{
+    struct _ldm_state * const state = _ldm_get_state(o);
+    if (state == NULL) return NULL;
+
+    LDMDiskGroup * const dg = _find_object(NULL, state->disk_groups_by_guid,
+                                           guid);
+    _ldm_state_unref(state);
+
+    return dg;
+}
+
+LDMVolume *
+ldm_disk_group_find_volume(LDMDiskGroup * const o, const gchar * const id)
+{
+    return _find_object(o->priv->vols_by_name, o->priv->vols_by_guid, id);
+}
+
+LDMPartition *
+ldm_disk_group_find_partition(LDMDiskGroup * const o, const gchar * const name)
+{
+    return _find_object(o->priv->parts_by_name, NULL, name);
+}
+
+LDMDisk *
+ldm_disk_group_find_disk(LDMDiskGroup * const o, const gchar * const id)
+{
+    return _find_object(o->priv->disks_by_name, o->priv->disks_by_guid, id);
+}
+
+/* Address translation */
+
+/* Volume layouts are described in device mapper sectors */
+#define SECTOR_SIZE UINT64_C(512)
+
+struct _vol_layout
+{
+    const LDMVolumePrivate *vol;
+    const LDMPartition * const *parts;
+    guint n_parts;
+
+    guint64 size;       /* Mappable size of the volume in bytes */
+    guint64 chunk;      /* Chunk size in bytes of striped and raid5 volumes */
+    guint64 *part_ends; /* Volume offsets of the ends of spanned partitions */
+};
+
+static gboolean
+_vol_layout_init(struct _vol_layout * const l,
+                 const LDMVolumePrivate * const vol, GError ** const err)
+{
+    bzero(l, sizeof(*l));
+    l->vol = vol;
+    l->parts = (const LDMPartition * const *) vol->parts->data;
+    l->n_parts = vol->parts->len;
+    l->size = vol->size * SECTOR_SIZE;
+    l->chunk = vol->chunk_size * SECTOR_SIZE;
+
+    if (l->n_parts == 0) {
+        g_set_error(err, LDM_ERROR, LDM_ERROR_INVALID,
+                    "Volume %s has no partitions", vol->name);
+        return FALSE;
+    }
+
+    switch (vol->type) {
+    case LDM_VOLUME_TYPE_SIMPLE:
+    case LDM_VOLUME_TYPE_SPANNED:
+        l->part_ends = g_new(guint64, l->n_parts);
+
+        guint64 end = 0;
+        for (guint i = 0; i < l->n_parts; i++) {
+            end += l->parts[i]->priv->size * SECTOR_SIZE;
+            l->part_ends[i] = end;
+        }
+        if (end < l->size) l->size = end;
+        break;
+
+    case LDM_VOLUME_TYPE_STRIPED:
+    case LDM_VOLUME_TYPE_RAID5:
+        if (l->chunk == 0) {
+            g_set_error(err, LDM_ERROR, LDM_ERROR_INVALID,
+                        "Volume %s has no chunk size", vol->name);
+            return FALSE;
+        }
+        if (vol->type == LDM_VOLUME_TYPE_RAID5 && l->n_parts < 2) {
+            g_set_error(err, LDM_ERROR, LDM_ERROR_INVALID,
+                        "RAID5 volume %s has fewer than 2 partitions",
+                        vol->name);
+            return FALSE;
+        }
+        break;
+
+    case LDM_VOLUME_TYPE_MIRRORED:
+        break;
+    }
+
+    return TRUE;
+}
+
+static void
+_vol_layout_clear(struct _vol_layout * const l)
+{
+    g_free(l->part_ends); l->part_ends = NULL;
+}
+
+/* Extents are either stored in a fixed size buffer, or appended to an array */
+struct _extent_sink
+{
+    LDMExtent *extents;
+    gsize n_extents;
+    GArray *array;
+
+    gsize count;
+};
+
+static void
+_extent_emit(struct _extent_sink * const sink,
+             const struct _vol_layout * const l,
+             const guint column, const LDMExtentType type,
+             const guint64 offset, const guint64 length,
+             const guint64 part_offset)
+{
+    const LDMPartition * const part_o = l->parts[column];
+    const LDMPartitionPrivate * const part = part_o->priv;
+
+    const LDMExtent e = {
+        .offset = offset,
+        .length = length,
+        .type = type,
+        .column = column,
+        .partition = part_o,
+        .disk = part->disk,
+        .disk_offset = (part->disk->priv->data_start + part->start) *
+                       SECTOR_SIZE + part_offset
+    };
+
+    if (sink->array) {
+        g_array_append_val(sink->array, e);
+    } else if (sink->count < sink->n_extents) {
+        sink->extents[sink->count] = e;
+    }
+    sink->count++;
+}
+
+static gboolean
+_map_range(const struct _vol_layout * const l,
+           guint64 offset, guint64 length,
+           struct _extent_sink * const sink, GError ** const err)
+{
+    if (offset > l->size || length > l->size - offset) {
+        g_set_error(err, LDM_ERROR, LDM_ERROR_INVALID,
+                    "Range %" PRIu64 "+%" PRIu64 " is outside volume %s "
+                    "of size %" PRIu64,
+                    offset, length, l->vol->name, l->size);
+        return FALSE;
+    }
+
+    while (length > 0) {
+        guint64 len = length;
+
+        switch (l->vol->type) {
+        case LDM_VOLUME_TYPE_SIMPLE:
+        case LDM_VOLUME_TYPE_SPANNED:
+        {
+            /* Find the first partition which ends after offset */
+            guint lo = 0, hi = l->n_parts - 1;
+            while (lo < hi) {
+                const guint mid = lo + (hi - lo) / 2;
+                if (l->part_ends[mid] <= offset) lo = mid + 1;
+                else hi = mid;
+            }
+
+            const guint64 start = lo == 0 ? 0 : l->part_ends[lo - 1];
+            len = MIN(length, l->part_ends[lo] - offset);
+            _extent_emit(sink, l, lo, LDM_EXTENT_TYPE_DATA,
+                         offset, len, offset - start);
+            break;
+        }
+
+        case LDM_VOLUME_TYPE_STRIPED:
+        {
+            const guint64 chunk_no = offset / l->chunk;
+            const guint64 within = offset % l->chunk;
+            const guint64 row = chunk_no / l->n_parts;
+
+            len = MIN(length, l->chunk - within);
+            _extent_emit(sink, l, chunk_no % l->n_parts, LDM_EXTENT_TYPE_DATA,
+                         offset, len, row * l->chunk + within);
+            break;
+        }
+
+        case LDM_VOLUME_TYPE_MIRRORED:
+            for (guint i = 0; i < l->n_parts; i++) {
+                _extent_emit(sink, l, i,
+                             i == 0 ? LDM_EXTENT_TYPE_DATA :
+                                      LDM_EXTENT_TYPE_MIRROR,
+                             offset, len, offset);
+            }
+            break;
+
+        case LDM_VOLUME_TYPE_RAID5:
+        {
+            /* Left symmetric: parity rotates backwards from the last column,
+             * and data starts in the column following parity */
+            const guint n_data = l->n_parts - 1;
+            const guint64 chunk_no = offset / l->chunk;
+            const guint64 within = offset % l->chunk;
+            const guint64 row = chunk_no / n_data;
+            const guint parity = n_data - row % l->n_parts;
+            const guint column =
+                (parity + 1 + chunk_no % n_data) % l->n_parts;
+
+            len = MIN(length, l->chunk - within);
+            _extent_emit(sink, l, column, LDM_EXTENT_TYPE_DATA,
+                         offset, len, row * l->chunk + within);
+            _extent_emit(sink, l, parity, LDM_EXTENT_TYPE_PARITY,
+                         offset, len, row * l->chunk + within);
+            break;
+        }
+        }
+
+        offset += len;
+        length -= len;
+    }
+
+    return TRUE;
+}
+
+gssize
+ldm_volume_map(const LDMVolume * const o,
+               const guint64 offset, const guint64 length,
+               LDMExtent * const extents, const gsize n_extents,
+               GError ** const err)
+{
+    struct _vol_layout layout;
+    if (!_vol_layout_init(&layout, o->priv, err)) return -1;
+
+    struct _extent_sink sink = {
+        .extents = extents,
+        .n_extents = n_extents
+    };
+    const gboolean r = _map_range(&layout, offset, length, &sink, err);
+
+    _vol_layout_clear(&layout);
+
+    return r ? (gssize) sink.count : -1;
+}
+
+GArray *
+ldm_volume_map_batch(const LDMVolume * const o,
+                     const LDMRange * const ranges, const gsize n_ranges,
+                     gsize * const first, GError ** const err)
+{
+    struct _vol_layout layout;
+    if (!_vol_layout_init(&layout, o->priv, err)) return NULL;
+
+    struct _extent_sink sink = {
+        .array = g_array_sized_new(FALSE, FALSE, sizeof(LDMExtent), n_ranges)
+    };
+
+    for (gsize i = 0; i < n_ranges; i++) {
+        if (first) first[i] = sink.count;
+
+        if (!_map_range(&layout, ranges[i].offset, ranges[i].length,
+                        &sink, err))
+        {
+            g_array_unref(sink.array); sink.array = NULL;
+            break;
+        }
+    }
+    if (sink.array && first) first[n_ranges] = sink.count;
+
+    _vol_layout_clear(&layout);
+
+    return sink.array;
+}
+
+/* Userspace volume reader */
+
+/* Reads at least this large are split between columns, or mirror legs, and
+ * issued in parallel */
+#define PARALLEL_READ_MIN (1024 * 1024)
+
+/* Sequential writes are coalesced into buffers of at least this size, rounded
+ * up to whole stripe rows, so each column is written a full chunk at a time */
+#define WRITE_BUFFER_MIN (1024 * 1024)
+
+struct _LDMVolumeHandle
+{
+    LDMVolume *vol;
+    struct _vol_layout layout;
+
+    /* Per column. fds[i] is -1 if the disk is missing. Columns on the same
+     * disk share its fd, which is owned by the first of them. */
+    int *fds;
+    guint64 *bases;     /* Byte offset of each partition on its device */
+
+    guint n_healthy;    /* Number of columns whose disk is present */
+    gint next_leg;      /* Round robin counter for mirrored reads */
+
+    GThreadPool *pool;
+
+    GMutex stats_lock;
+    LDMVolumeStats stats;
+
+    /* Writes, if the handle was opened by ldm_volume_open_rw() */
+    gboolean writable;
+    GMutex write_lock;
+    guint8 *wbuf;       /* Coalescing buffer of wbuf_size bytes */
+    gsize wbuf_size;
+    guint64 wbuf_offset; /* Volume offset of the start of wbuf */
+    gsize wbuf_len;     /* Number of bytes in wbuf */
+
+    /* Asynchronous reads. aio is created by the first one. */
+    GMutex aio_lock;
+    GCond aio_idle;
+    guint aio_depth;
+    struct _aio *aio;
+};
+
+/* Whether column i has a disk which isn't shared with an earlier column */
+static gboolean
+_handle_owns_fd(const LDMVolumeHandle * const h, const guint i)
+{
+    if (h->fds[i] == -1) return FALSE;
+
+    for (guint j = 0; j < i; j++) {
+        if (h->fds[j] == h->fds[i]) return FALSE;
+    }
+    return TRUE;
+}
+
+struct _read_op
+{
+    guint column;
+    guint64 part_offset;
+    guint8 *buf;
+    gsize length;
+    gboolean write;     /* Write buf to the column instead of reading it */
+};
+
+static gboolean
+_read_column(const LDMVolumeHandle * const h, const guint column,
+             guint8 * const buf, const gsize length,
+             const guint64 part_offset, GError ** const err)
+{
+    const gchar * const device =
+        h->layout.parts[column]->priv->disk->priv->device;
+    const guint64 offset = h->bases[column] + part_offset;
+
+    gsize read = 0;
+    while (read < length) {
+        const ssize_t in = pread(h->fds[column], buf + read, length - read,
+                                 offset + read);
+        if (in == 0) {
+            g_set_error(err, LDM_ERROR, LDM_ERROR_IO,
+                        "Unexpected end of %s at offset %" PRIu64,
+                        device, offset + read);
+            return FALSE;
+        }
+
+        if (in == -1) {
+            if (errno == EINTR) continue;
+            g_set_error(err, LDM_ERROR, LDM_ERROR_IO,
+                        "Error reading from %s: %m", device);
+            return FALSE;
+        }
+
+        read += in;
+    }
+
+    return TRUE;
+}
+
+static gboolean
+_write_column(const LDMVolumeHandle * const h, const guint column,
+              const guint8 * const buf, const gsize length,
+              const guint64 part_offset, GError ** const err)
+{
+    const LDMPartitionPrivate * const part = h->layout.parts[column]->priv;
+    const gchar * const device = part->disk->priv->device;
+
+    /* Anything outside the partition is LDM metadata or another volume */
+    const guint64 part_size = part->size * SECTOR_SIZE;
+    if (part_offset > part_size || length > part_size - part_offset) {
+        g_set_error(err, LDM_ERROR, LDM_ERROR_INTERNAL,
+                    "Refusing to write %" PRIu64 "+%zu outside partition %s",
+                    part_offset, length, part->name);
+        return FALSE;
+    }
+
+    const guint64 offset = h->bases[column] + part_offset;
+
+    gsize written = 0;
+    while (written < length) {
+        const ssize_t out = pwrite(h->fds[column], buf + written,
+                                   length - written, offset + written);
+        if (out == 0) {
+            g_set_error(err, LDM_ERROR, LDM_ERROR_IO,
+                        "Unexpected end of %s at offset %" PRIu64,
+                        device, offset + written);
+            return FALSE;
+        }
+
+        if (out == -1) {
+            if (errno == EINTR) continue;
+            g_set_error(err, LDM_ERROR, LDM_ERROR_IO,
+                        "Error writing to %s: %m", device);
+            return FALSE;
+        }
+
+        written += out;
+    }
+
+    return TRUE;
+}
+
+static gboolean
+_read_op(const LDMVolumeHandle * const h, const struct _read_op * const op,
+         GError ** const err)
+{
+    /* Writes to a mirror were already fanned out to every leg */
+    if (op->write) {
+        return _write_column(h, op->column, op->buf, op->length,
+                             op->part_offset, err);
+    }
+
+    if (h->layout.vol->type != LDM_VOLUME_TYPE_MIRRORED) {
+        return _read_column(h, op->column, op->buf, op->length,
+                            op->part_offset, err);
+    }
+
+    /* Fail over to the remaining healthy legs of a mirror in turn */
+    GError *leg_err = NULL;
+    for (guint i = 0; i < h->layout.n_parts; i++) {
+        const guint leg = (op->column + i) % h->layout.n_parts;
+        if (h->fds[leg] == -1) continue;
+
+        if (leg_err) {
+            g_warning("%s", leg_err->message);
+            g_error_free(leg_err); leg_err = NULL;
+        }
+
+        if (_read_column(h, leg, op->buf, op->length, op->part_offset,
+                         &leg_err)) return TRUE;
+    }
+
+    g_propagate_error(err, leg_err);
+    return FALSE;
+}
+
+/* The ops of one column of a parallel read */
+struct _read_job
+{
+    const LDMVolumeHandle *h;
+    GArray *ops;
+    struct _read_batch *batch;
+};
+
+struct _read_batch
+{
+    GMutex lock;
+    GCond cond;
+    guint pending;
+    GError *err;
+};
+
+static void
+_read_job_run(gpointer const data, gpointer const user_data)
+{
+    struct _read_job * const job = data;
+    struct _read_batch * const batch = job->batch;
+
+    GError *err = NULL;
+    for (guint i = 0; i < job->ops->len; i++) {
+        if (!_read_op(job->h, &g_array_index(job->ops, struct _read_op, i),
+                      &err)) break;
+    }
+
+    g_mutex_lock(&batch->lock);
+    if (err && batch->err == NULL) batch->err = err;
+    else if (err) g_error_free(err);
+    if (--batch->pending == 0) g_cond_signal(&batch->cond);
+    g_mutex_unlock(&batch->lock);
+
+    g_array_unref(job->ops);
+    g_free(job);
+}
+
+static gboolean
+_read_ops_parallel(LDMVolumeHandle * const h, const GArray * const ops,
+                   GError ** const err)
+{
+    GArray ** const columns = g_new0(GArray *, h->layout.n_parts);
+    for (guint i = 0; i < ops->len; i++) {
+        const struct _read_op * const op =
+            &g_array_index(ops, struct _read_op, i);
+
+        if (columns[op->column] == NULL) {
+            columns[op->column] = g_array_new(FALSE, FALSE,
+                                              sizeof(struct _read_op));
+        }
+        g_array_append_vals(columns[op->column], op, 1);
+    }
+
+    struct _read_batch batch;
+    g_mutex_init(&batch.lock);
+    g_cond_init(&batch.cond);
+    batch.pending = 0;
+    batch.err = NULL;
+
+    g_mutex_lock(&batch.lock);
+    for (guint i = 0; i < h->layout.n_parts; i++) {
+        if (columns[i] == NULL) continue;
+
+        struct _read_job * const job = g_new(struct _read_job, 1);
+        job->h = h;
+        job->ops = columns[i];
+        job->batch = &batch;
+
+        batch.pending++;
+        g_thread_pool_push(h->pool, job, NULL);
+    }
+    while (batch.pending > 0) g_cond_wait(&batch.cond, &batch.lock);
+    g_mutex_unlock(&batch.lock);
+
+    g_mutex_clear(&batch.lock);
+    g_cond_clear(&batch.cond);
+    g_free(columns);
+
+    if (batch.err) {
+        g_propagate_error(err, batch.err);
+        return FALSE;
+    }
+    return TRUE;
+}
+
+/* A chunk of a degraded RAID5 volume is rebuilt by reading the same range of
+ * every other column of its stripe. The first is read directly into the
+ * destination, and the others are XORed into it once all reads are done. */
+struct _xor_fixup
+{
+    guint8 *dst;
+    guint8 *src;        /* The remaining columns, each of length bytes */
+    gsize n_src;
+    gsize length;
+};
+
+static void
+_plan_reconstruct(const LDMVolumeHandle * const h, const guint missing,
+                  guint8 * const dst, const gsize length,
+                  const guint64 part_offset,
+                  GArray * const ops, GArray * const fixups)
+{
+    struct _xor_fixup fixup = {
+        .dst = dst,
+        .src = g_malloc(length * (h->layout.n_parts - 2)),
+        .n_src = 0,
+        .length = length
+    };
+
+    gboolean first = TRUE;
+    for (guint i = 0; i < h->layout.n_parts; i++) {
+        if (i == missing) continue;
+
+        struct _read_op op = {
+            .column = i,
+            .part_offset = part_offset,
+            .length = length
+        };
+        if (first) {
+            op.buf = dst;
+            first = FALSE;
+        } else {
+            op.buf = fixup.src + length * fixup.n_src++;
+        }
+        g_array_append_val(ops, op);
+    }
+
+    g_array_append_val(fixups, fixup);
+}
+
+static void
+_apply_fixups(const GArray * const fixups)
+{
+    for (guint i = 0; i < fixups->len; i++) {
+        const struct _xor_fixup * const f =
+            &g_array_index(fixups, struct _xor_fixup, i);
+
+        for (gsize j = 0; j < f->n_src; j++) {
+            _ldm_simd_xor(f->dst, f->src + f->length * j, f->length);
+        }
+    }
+}
+
+/* A cursor over the buffers a read is scattered into. Positions are counted
+ * from the start of the first buffer, and must be looked up in order. */
+struct _scatter
+{
+    const struct iovec *iov;
+    int i;
+    gsize start;        /* The position of iov[i] */
+};
+
+/* Return the address of position pos, and in avail the number of bytes of its
+ * buffer from there */
+static guint8 *
+_scatter_seek(struct _scatter * const s, const gsize pos, gsize * const avail)
+{
+    while (pos >= s->start + s->iov[s->i].iov_len) {
+        s->start += s->iov[s->i].iov_len;
+        s->i++;
+    }
+
+    *avail = s->start + s->iov[s->i].iov_len - pos;
+    return (guint8 *) s->iov[s->i].iov_base + (pos - s->start);
+}
+
+/* Add ops reading length bytes of a column at part_offset into position pos
+ * of the buffers, split where the buffers are */
+static void
+_plan_scatter(struct _scatter * const s, const guint column,
+              const guint64 part_offset, const gsize pos, const gsize length,
+              GArray * const ops)
+{
+    for (gsize done = 0; done < length;) {
+        gsize avail;
+        guint8 * const dst = _scatter_seek(s, pos + done, &avail);
+
+        const struct _read_op op = {
+            .column = column,
+            .part_offset = part_offset + done,
+            .buf = dst,
+            .length = MIN(avail, length - done)
+        };
+        g_array_append_val(ops, op);
+        done += op.length;
+    }
+}
+
+/* Split a read of a mirrored volume into ops */
+static void
+_plan_mirrored(LDMVolumeHandle * const h, struct _scatter * const s,
+               const gsize count, const guint64 offset, GArray * const ops)
+{
+    const guint n_parts = h->layout.n_parts;
+    guint leg = (guint) g_atomic_int_add(&h->next_leg, 1) % n_parts;
+
+    /* Large reads are spread over all healthy legs in page aligned pieces */
+    guint n_pieces = 1;
+    if (count >= PARALLEL_READ_MIN) n_pieces = h->n_healthy;
+    const gsize piece = ((count / n_pieces) + 4095) & ~(gsize) 4095;
+
+    for (gsize done = 0; done < count; done += piece) {
+        while (h->fds[leg] == -1) leg = (leg + 1) % n_parts;
+
+        _plan_scatter(s, leg, offset + done, done, MIN(piece, count - done),
+                      ops);
+
+        leg = (leg + 1) % n_parts;
+    }
+}
+
+static LDMVolumeHandle *
+_volume_open(LDMVolume * const o, const gboolean writable, GError ** const err)
+{
+    LDMVolumeHandle * const h = g_new0(LDMVolumeHandle, 1);
+    h->vol = g_object_ref(o);
+    h->writable = writable;
+    g_mutex_init(&h->write_lock);
+    g_mutex_init(&h->stats_lock);
+    h->stats.xor_impl = _ldm_simd_name();
+    g_mutex_init(&h->aio_lock);
+    g_cond_init(&h->aio_idle);
+    h->aio_depth = LDM_VOLUME_QUEUE_DEPTH_DEFAULT;
+
+    if (!_vol_layout_init(&h->layout, o->priv, err)) goto error;
+
+    /* Writing RAID5 would mean maintaining parity */
+    if (writable && o->priv->type == LDM_VOLUME_TYPE_RAID5) {
+        g_set_error(err, LDM_ERROR, LDM_ERROR_NOTSUPPORTED,
+                    "Writing RAID5 volume %s is not supported",
+                    o->priv->name);
+        goto error;
+    }
+
+    const guint n_parts = h->layout.n_parts;
+    h->fds = g_new(int, n_parts);
+    h->bases = g_new(guint64, n_parts);
+    for (guint i = 0; i < n_parts; i++) h->fds[i] = -1;
+
+    for (guint i = 0; i < n_parts; i++) {
+        const LDMPartitionPrivate * const part = h->layout.parts[i]->priv;
+        const LDMDiskPrivate * const disk = part->disk->priv;
+
+        h->bases[i] = (disk->data_start + part->start) * SECTOR_SIZE;
+
+        /* A write must reach every leg of a mirror, or they diverge */
+        if (disk->device == NULL) {
+            if (!writable && (o->priv->type == LDM_VOLUME_TYPE_MIRRORED ||
+                              o->priv->type == LDM_VOLUME_TYPE_RAID5)) continue;
+
+            g_set_error(err, LDM_ERROR, LDM_ERROR_MISSING_DISK,
+                        "Disk %s required by volume %s is missing",
+                        disk->name, o->priv->name);
+            goto error;
+        }
+
+        /* A disk may hold several partitions of a volume. It is only opened
+         * once, not least because a second exclusive open would fail. */
+        for (guint j = 0; j < i; j++) {
+            if (h->layout.parts[j]->priv->disk == part->disk) {
+                h->fds[i] = h->fds[j];
+                break;
+            }
+        }
+        if (h->fds[i] != -1) {
+            h->n_healthy++;
+            continue;
+        }
+
+        /* O_EXCL fails if anything else has claimed the device: a mounted
+         * filesystem, any device mapper device on it, or another exclusive
+         * open */
+        if (writable) {
+            h->fds[i] = open(disk->device, O_RDWR | O_EXCL | O_CLOEXEC);
+        } else {
+            h->fds[i] = open(disk->device, O_RDONLY | O_CLOEXEC);
+        }
+        if (h->fds[i] == -1) {
+            g_set_error(err, LDM_ERROR, LDM_ERROR_IO,
+                        "Error opening %s for %s: %m", disk->device,
+                        writable ? "writing" : "reading");
+            goto error;
+        }
+        h->n_healthy++;
+    }
+
+    if (h->n_healthy == 0) {
+        g_set_error(err, LDM_ERROR, LDM_ERROR_MISSING_DISK,
+                    "%s volume %s is missing all partitions",
+                    o->priv->type == LDM_VOLUME_TYPE_RAID5 ?
+                        "RAID5" : "Mirrored",
+                    o->priv->name);
+        goto error;
+    }
+
+    if (o->priv->type == LDM_VOLUME_TYPE_RAID5 && h->n_healthy + 1 < n_parts) {
+        g_set_error(err, LDM_ERROR, LDM_ERROR_MISSING_DISK,
+                    "RAID5 volume %s is missing more than 1 component",
+                    o->priv->name);
+        goto error;
+    }
+
+    if (h->n_healthy > 1) {
+        h->pool = g_thread_pool_new(_read_job_run, NULL, h->n_healthy,
+                                    FALSE, err);
+        if (h->pool == NULL) goto error;
+    }
+
+    if (writable) {
+        h->wbuf_size = WRITE_BUFFER_MIN;
+        if (o->priv->type == LDM_VOLUME_TYPE_STRIPED) {
+            const gsize row = h->layout.chunk * n_parts;
+            h->wbuf_size = (WRITE_BUFFER_MIN + row - 1) / row * row;
+        }
+        h->wbuf = g_malloc(h->wbuf_size);
+    }
+
+    return h;
+
+error:
+    ldm_volume_close(h);
+    return NULL;
+}
+
+LDMVolumeHandle *
+ldm_volume_open(LDMVolume * const o, GError ** const err)
+{
+    return _volume_open(o, FALSE, err);
+}
+
+LDMVolumeHandle *
+ldm_volume_open_rw(LDMVolume * const o, GError ** const err)
+{
+    return _volume_open(o, TRUE, err);
+}
+
+/* Write count bytes at offset to every column which holds them, which is
+ * every leg of a mirror */
+static gboolean
+_write_direct(LDMVolumeHandle * const h, const guint8 * const buf,
+              const gsize count, const guint64 offset, GError ** const err)
+{
+    struct _extent_sink sink = {
+        .array = g_array_new(FALSE, FALSE, sizeof(LDMExtent))
+    };
+    if (!_map_range(&h->layout, offset, count, &sink, err)) {
+        g_array_unref(sink.array);
+        return FALSE;
+    }
+
+    GArray * const ops = g_array_sized_new(FALSE, FALSE,
+                                           sizeof(struct _read_op),
+                                           sink.array->len);
+    for (guint i = 0; i < sink.array->len; i++) {
+        const LDMExtent * const e = &g_array_index(sink.array, LDMExtent, i);
+
+        const struct _read_op op = {
+            .column = e->column,
+            .part_offset = e->disk_offset - h->bases[e->column],
+            .buf = (guint8 *) buf + (e->offset - offset),
+            .length = e->length,
+            .write = TRUE
+        };
+        g_array_append_val(ops, op);
+    }
+    g_array_unref(sink.array);
+
+    gboolean r = TRUE;
+    if (h->pool && ops->len > 1 && count >= PARALLEL_READ_MIN) {
+        r = _read_ops_parallel(h, ops, err);
+    } else {
+        for (guint i = 0; r && i < ops->len; i++) {
+            r = _read_op(h, &g_array_index(ops, struct _read_op, i), err);
+        }
+    }
+
+    g_mutex_lock(&h->stats_lock);
+    h->stats.disk_writes += ops->len;
+    g_mutex_unlock(&h->stats_lock);
+
+    g_array_unref(ops);
+    return r;
+}
+
+/* Write out the coalescing buffer. Called with write_lock held. */
+static gboolean
+_wbuf_flush(LDMVolumeHandle * const h, GError ** const err)
+{
+    if (h->wbuf_len == 0) return TRUE;
+
+    /* The buffer is discarded even if the write fails, so the error is
+     * only reported once */
+    const gsize len = h->wbuf_len;
+    h->wbuf_len = 0;
+    return _write_direct(h, h->wbuf, len, h->wbuf_offset, err);
+}
+
+/* Write out buffered writes before a read, which might overlap them */
+static gboolean
+_flush_writes(LDMVolumeHandle * const h, GError ** const err)
+{
+    if (!h->writable) return TRUE;
+
+    g_mutex_lock(&h->write_lock);
+    const gboolean r = _wbuf_flush(h, err);
+    g_mutex_unlock(&h->write_lock);
+
+    return r;
+}
+
+gssize
+ldm_volume_pwrite(LDMVolumeHandle * const h, const void * const buf,
+                  gsize count, guint64 offset, GError ** const err)
+{
+    if (!h->writable) {
+        g_set_error(err, LDM_ERROR, LDM_ERROR_INVALID,
+                    "Volume %s is not open for writing", h->layout.vol->name);
+        return -1;
+    }
+
+    /* Like pwrite() to a block device, writes stop at the end of the
+     * volume */
+    if (offset >= h->layout.size) return 0;
+    count = MIN(count, h->layout.size - offset);
+
+    g_mutex_lock(&h->write_lock);
+
+    /* A write which doesn't continue the buffered run starts a new one */
+    gboolean r = TRUE;
+    if (h->wbuf_len > 0 && offset != h->wbuf_offset + h->wbuf_len) {
+        r = _wbuf_flush(h, err);
+    }
+
+    const guint8 *src = buf;
+    gsize left = count;
+    while (r && left > 0) {
+        if (h->wbuf_len == 0) {
+            /* Whole aligned buffers don't need to be copied */
+            if (offset % h->wbuf_size == 0 && left >= h->wbuf_size) {
+                const gsize n = left - left % h->wbuf_size;
+                r = _write_direct(h, src, n, offset, err);
+                src += n; offset += n; left -= n;
+                continue;
+            }
+            h->wbuf_offset = offset;
+        }
+
+        /* Fill the buffer up to the next buffer boundary, which may be less
+         * than a whole buffer for the first one of a run */
+        const guint64 end = MIN((h->wbuf_offset / h->wbuf_size + 1) *
+                                h->wbuf_size, h->layout.size);
+        const gsize n = MIN(left, end - (h->wbuf_offset + h->wbuf_len));
+        memcpy(h->wbuf + h->wbuf_len, src, n);
+        h->wbuf_len += n;
+        src += n; offset += n; left -= n;
+
+        if (h->wbuf_offset + h->wbuf_len == end) r = _wbuf_flush(h, err);
+    }
+
+    g_mutex_unlock(&h->write_lock);
+
+    if (!r) return -1;
+
+    g_mutex_lock(&h->stats_lock);
+    h->stats.bytes_written += count;
+    g_mutex_unlock(&h->stats_lock);
+
+    return count;
+}
+
+gboolean
+ldm_volume_flush(LDMVolumeHandle * const h, GError ** const err)
+{
+    if (!h->writable) return TRUE;
+
+    g_mutex_lock(&h->write_lock);
+
+    gboolean r = _wbuf_flush(h, err);
+    for (guint i = 0; r && i < h->layout.n_parts; i++) {
+        if (!_handle_owns_fd(h, i)) continue;
+
+        if (fdatasync(h->fds[i]) == -1) {
+            g_set_error(err, LDM_ERROR, LDM_ERROR_IO,
+                        "Error flushing %s: %m",
+                        h->layout.parts[i]->priv->disk->priv->device);
+            r = FALSE;
+        }
+    }
+
+    g_mutex_unlock(&h->write_lock);
+    return r;
+}
+
+/* Split a read of count bytes at offset into ops on the columns of a volume,
+ * scattered into the buffers of iov, which must hold at least count bytes.
+ * The read is planned as one range, so an extent which spans buffers is only
+ * split where they meet. Chunks on the missing disk of a degraded RAID5 volume
+ * add fixups, and their total length is returned in reconstructed. */
+static gboolean
+_plan_read(LDMVolumeHandle * const h, const struct iovec * const iov,
+           const gsize count, const guint64 offset,
+           GArray * const ops, GArray * const fixups,
+           gsize * const reconstructed, GError ** const err)
+{
+    struct _scatter s = { .iov = iov };
+    *reconstructed = 0;
+
+    if (h->layout.vol->type == LDM_VOLUME_TYPE_MIRRORED) {
+        _plan_mirrored(h, &s, count, offset, ops);
+        return TRUE;
+    }
+
+    struct _extent_sink sink = {
+        .array = g_array_new(FALSE, FALSE, sizeof(LDMExtent))
+    };
+    if (!_map_range(&h->layout, offset, count, &sink, err)) {
+        g_array_unref(sink.array);
+        return FALSE;
+    }
+
+    for (guint i = 0; i < sink.array->len; i++) {
+        const LDMExtent * const e = &g_array_index(sink.array, LDMExtent, i);
+        if (e->type != LDM_EXTENT_TYPE_DATA) continue;
+
+        const gsize pos = e->offset - offset;
+        const guint64 part_offset = e->disk_offset - h->bases[e->column];
+
+        if (h->fds[e->column] != -1) {
+            _plan_scatter(&s, e->column, part_offset, pos, e->length, ops);
+            continue;
+        }
+
+        for (gsize done = 0; done < e->length;) {
+            gsize avail;
+            guint8 * const dst = _scatter_seek(&s, pos + done, &avail);
+            const gsize length = MIN(avail, e->length - done);
+
+            _plan_reconstruct(h, e->column, dst, length, part_offset + done,
+                              ops, fixups);
+            done += length;
+        }
+        *reconstructed += e->length;
+    }
+    g_array_unref(sink.array);
+
+    return TRUE;
+}
+
+static void
+_free_fixups(GArray * const fixups)
+{
+    for (guint i = 0; i < fixups->len; i++) {
+        g_free(g_array_index(fixups, struct _xor_fixup, i).src);
+    }
+    g_array_unref(fixups);
+}
+
+static void
+_account_read(LDMVolumeHandle * const h, const gsize count,
+              const gsize reconstructed, const gint64 start)
+{
+    g_mutex_lock(&h->stats_lock);
+    h->stats.bytes_read += count;
+    if (reconstructed > 0) {
+        h->stats.bytes_reconstructed += reconstructed;
+        h->stats.reconstruct_usec += g_get_monotonic_time() - start;
+    }
+    g_mutex_unlock(&h->stats_lock);
+}
+
+/* Read count bytes at offset into the buffers of iov. count must be within
+ * the volume. */
+static gboolean
+_readv(LDMVolumeHandle * const h, const struct iovec * const iov,
+       const gsize count, const guint64 offset, GError ** const err)
+{
+    if (!_flush_writes(h, err)) return FALSE;
+
+    GArray * const ops = g_array_new(FALSE, FALSE, sizeof(struct _read_op));
+    GArray * const fixups = g_array_new(FALSE, FALSE,
+                                        sizeof(struct _xor_fixup));
+    const gint64 start = g_get_monotonic_time();
+    gsize reconstructed;
+
+    gboolean r = _plan_read(h, iov, count, offset, ops, fixups,
+                            &reconstructed, err);
+    if (!r) goto out;
+
+    /* A degraded read touches every column of each affected stripe, so it is
+     * issued in parallel at a smaller size */
+    if (h->pool && ops->len > 1 &&
+        count + reconstructed * (h->layout.n_parts - 1) >= PARALLEL_READ_MIN)
+    {
+        r = _read_ops_parallel(h, ops, err);
+    } else {
+        for (guint i = 0; r && i < ops->len; i++) {
+            r = _read_op(h, &g_array_index(ops, struct _read_op, i), err);
+        }
+    }
+
+    if (r) {
+        _apply_fixups(fixups);
+        _account_read(h, count, reconstructed, start);
+    }
+
+out:
+    _free_fixups(fixups);
+    g_array_unref(ops);
+    return r;
+}
+
+gssize
+ldm_volume_pread(LDMVolumeHandle * const h, void * const buf, gsize count,
+                 const guint64 offset, GError ** const err)
+{
+    /* Like pread(), reads stop at the end of the volume */
+    if (offset >= h->layout.size) return 0;
+    count = MIN(count, h->layout.size - offset);
+    if (count == 0) return 0;
+
+    const struct iovec iov = { .iov_base = buf, .iov_len = count };
+    return _readv(h, &iov, count, offset, err) ? (gssize) count : -1;
+}
+
+gssize
+ldm_volume_preadv(LDMVolumeHandle * const h,
+                  const struct iovec * const iov, const int iovcnt,
+                  const guint64 offset, GError ** const err)
+{
+    if (offset >= h->layout.size) return 0;
+
+    gsize count = 0;
+    for (int i = 0; i < iovcnt; i++) count += iov[i].iov_len;
+    count = MIN(count, h->layout.size - offset);
+    if (count == 0) return 0;
+
+    return _readv(h, iov, count, offset, err) ? (gssize) count : -1;
+}
+
+/* Asynchronous reads
+ *
+ * A read is planned into ops like a synchronous one. Each op is queued on the
+ * disk it reads from, which is either a thread pool per disk, with one thread
+ * per unit of queue depth, or a shared io_uring with a queue per disk which
+ * limits the number of reads submitted. A thread reaps the ring. The last op
+ * of a read to complete pushes the read onto the done queue and signals the
+ * eventfd, and the callback is called when the done queue is dispatched. */
+
+/* The largest read submitted in one go to io_uring, whose lengths are 32 bit */
+#define URING_READ_MAX (1024 * 1024 * 1024)
+#define URING_ENTRIES_MAX 4096
+
+struct _aio_request
+{
+    LDMVolumeHandle *h;
+    gsize count;
+    GArray *fixups;
+    gsize reconstructed;
+    gint64 start;
+
+    gint refs;          /* One per incomplete op, and one for submission */
+    GError *err;        /* Protected by aio_lock */
+
+    LDMVolumeReadCallback callback;
+    gpointer user_data;
+};
+
+struct _aio_op
+{
+    struct _aio_request *req;
+    struct _read_op op;
+    gsize done;         /* Bytes already read by io_uring */
+    guint failed_legs;  /* Mirror legs which io_uring failed to read */
+    GList link;         /* In the submitted queue of io_uring */
+};
+
+struct _aio
+{
+    LDMVolumeHandle *h;
+
+    guint running;      /* Requests with incomplete ops */
+    guint undispatched; /* Requests whose callback hasn't been called */
+    GAsyncQueue *done;
+    int eventfd;
+
+    GThreadPool **pools; /* Per column, if io_uring isn't used */
+
+#ifdef HAVE_LIBURING
+    gboolean uring;
+    struct io_uring ring;
+    GThread *reaper;
+    GQueue *waiting;    /* Per column, ops not yet submitted */
+    guint *inflight;    /* Per column */
+    GQueue submitted;   /* Ops submitted and not yet reaped */
+    GError *uring_err;  /* Set once the ring can't be reaped */
+#endif
+};
+
+#ifdef HAVE_LIBURING
+/* Whether asynchronous reads may use io_uring. Tests clear this to use the
+ * thread pools where io_uring is available. */
+static gboolean _aio_use_uring = TRUE;
+#endif
+
+static void
+_aio_request_unref(struct _aio_request * const req)
+{
+    if (!g_atomic_int_dec_and_test(&req->refs)) return;
+
+    LDMVolumeHandle * const h = req->h;
+    struct _aio * const aio = h->aio;
+
+    if (req->err == NULL) {
+        _apply_fixups(req->fixups);
+        _account_read(h, req->count, req->reconstructed, req->start);
+    }
+
+    /* req belongs to the dispatcher once it has been pushed */
+    g_async_queue_push(aio->done, req);
+    const guint64 one = 1;
+    if (write(aio->eventfd, &one, sizeof(one)) == -1 && errno != EAGAIN) {
+        g_warning("Error signalling read completion: %m");
+    }
+
+    g_mutex_lock(&h->aio_lock);
+    if (--aio->running == 0) g_cond_broadcast(&h->aio_idle);
+    g_mutex_unlock(&h->aio_lock);
+}
+
+static void
+_aio_op_complete(struct _aio_op * const aop, GError * const err)
+{
+    struct _aio_request * const req = aop->req;
+    g_free(aop);
+
+    if (err) {
+        g_mutex_lock(&req->h->aio_lock);
+        if (req->err == NULL) req->err = err;
+        else g_error_free(err);
+        g_mutex_unlock(&req->h->aio_lock);
+    }
+
+    _aio_request_unref(req);
+}
+
+static void
+_aio_pool_run(gpointer const data, gpointer const user_data)
+{
+    struct _aio_op * const aop = data;
+    LDMVolumeHandle * const h = user_data;
+
+    GError *err = NULL;
+    _read_op(h, &aop->op, &err);
+    _aio_op_complete(aop, err);
+}
+
+#ifdef HAVE_LIBURING
+
+/* Submit waiting ops of each column up to its queue depth. Called with
+ * aio_lock held. */
+static void
+_uring_pump(LDMVolumeHandle * const h)
+{
+    struct _aio * const aio = h->aio;
+
+    guint submitted = 0;
+    for (guint i = 0; i < h->layout.n_parts; i++) {
+        while (aio->inflight[i] < h->aio_depth &&
+               !g_queue_is_empty(&aio->waiting[i]))
+        {
+            struct io_uring_sqe * const sqe = io_uring_get_sqe(&aio->ring);
+            if (sqe == NULL) goto submit;
+
+            struct _aio_op * const aop = g_queue_pop_head(&aio->waiting[i]);
+            const gsize length = MIN(aop->op.length - aop->done,
+                                     URING_READ_MAX);
+            io_uring_prep_read(sqe, h->fds[i], aop->op.buf + aop->done, length,
+                               h->bases[i] + aop->op.part_offset + aop->done);
+            io_uring_sqe_set_data(sqe, aop);
+            aop->link.data = aop;
+            g_queue_push_tail_link(&aio->submitted, &aop->link);
+
+            aio->inflight[i]++;
+            submitted++;
+        }
+    }
+
+submit:
+    if (submitted > 0) {
+        const int r = io_uring_submit(&aio->ring);
+        if (r < 0) g_warning("Error submitting reads: %s", g_strerror(-r));
+    }
+}
+
+/* Handle the completion of one io_uring read. Returns TRUE if the op is
+ * complete, setting err if it failed. Called with aio_lock held. */
+static gboolean
+_uring_complete(LDMVolumeHandle * const h, struct _aio_op * const aop,
+                const int res, GError ** const err)
+{
+    struct _aio * const aio = h->aio;
+    const guint column = aop->op.column;
+
+    g_queue_unlink(&aio->submitted, &aop->link);
+    aio->inflight[column]--;
+
+    if (res == -EINTR || res == -EAGAIN) {
+        g_queue_push_head(&aio->waiting[column], aop);
+        return FALSE;
+    }
+
+    if (res > 0) {
+        aop->done += res;
+        if (aop->done == aop->op.length) return TRUE;
+
+        g_queue_push_head(&aio->waiting[column], aop);
+        return FALSE;
+    }
+
+    const gchar * const device =
+        h->layout.parts[column]->priv->disk->priv->device;
+    GError *leg_err = NULL;
+    if (res == 0) {
+        g_set_error(&leg_err, LDM_ERROR, LDM_ERROR_IO,
+                    "Unexpected end of %s at offset %" PRIu64, device,
+                    h->bases[column] + aop->op.part_offset + aop->done);
+    } else {
+        g_set_error(&leg_err, LDM_ERROR, LDM_ERROR_IO,
+                    "Error reading from %s: %s", device, g_strerror(-res));
+    }
+
+    /* Fail over to the remaining healthy legs of a mirror in turn */
+    if (h->layout.vol->type == LDM_VOLUME_TYPE_MIRRORED &&
+        ++aop->failed_legs < h->n_healthy)
+    {
+        g_warning("%s", leg_err->message);
+        g_error_free(leg_err);
+
+        guint leg = column;
+        do {
+            leg = (leg + 1) % h->layout.n_parts;
+        } while (h->fds[leg] == -1);
+
+        aop->op.column = leg;
+        g_queue_push_tail(&aio->waiting[leg], aop);
+        return FALSE;
+    }
+
+    g_propagate_error(err, leg_err);
+    return TRUE;
+}
+
+/* Complete each op in ops with a copy of the error which stopped the ring */
+static void
+_uring_fail_ops(struct _aio * const aio, GQueue * const ops)
+{
+    struct _aio_op *aop;
+    while ((aop = g_queue_pop_head(ops)) != NULL) {
+        _aio_op_complete(aop, g_error_copy(aio->uring_err));
+    }
+}
+
+/* Stop using a ring which can't be reaped. Ops which were submitted will
+ * never be reaped, so they fail along with those waiting to be submitted, and
+ * ops queued later fail without being submitted. */
+static void
+_uring_fail(LDMVolumeHandle * const h, const int r)
+{
+    struct _aio * const aio = h->aio;
+    GQueue failed = G_QUEUE_INIT;
+
+    g_mutex_lock(&h->aio_lock);
+    g_set_error(&aio->uring_err, LDM_ERROR, LDM_ERROR_IO,
+                "Error waiting for read completion: %s", g_strerror(-r));
+    g_warning("%s", aio->uring_err->message);
+
+    struct _aio_op *aop;
+    while ((aop = g_queue_pop_head(&aio->submitted)) != NULL) {
+        g_queue_push_tail(&failed, aop);
+    }
+    for (guint i = 0; i < h->layout.n_parts; i++) {
+        while ((aop = g_queue_pop_head(&aio->waiting[i])) != NULL) {
+            g_queue_push_tail(&failed, aop);
+        }
+        aio->inflight[i] = 0;
+    }
+    g_mutex_unlock(&h->aio_lock);
+
+    _uring_fail_ops(aio, &failed);
+}
+
+static gpointer
+_uring_reap(gpointer const data)
+{
+    struct _aio * const aio = data;
+    LDMVolumeHandle * const h = aio->h;
+
+    for (;;) {
+        struct io_uring_cqe *cqe;
+        const int r = io_uring_wait_cqe(&aio->ring, &cqe);
+        if (r == -EINTR) continue;
+        if (r < 0) {
+            _uring_fail(h, r);
+            break;
+        }
+
+        struct _aio_op * const aop = io_uring_cqe_get_data(cqe);
+        const int res = cqe->res;
+        io_uring_cqe_seen(&aio->ring, cqe);
+
+        /* A NOP without an op is the request to stop */
+        if (aop == NULL) break;
+
+        GError *err = NULL;
+        g_mutex_lock(&h->aio_lock);
+        const gboolean complete = _uring_complete(h, aop, res, &err);
+        _uring_pump(h);
+        g_mutex_unlock(&h->aio_lock);
+
+        if (complete) _aio_op_complete(aop, err);
+    }
+
+    return NULL;
+}
+
+static gboolean
+_uring_start(LDMVolumeHandle * const h, GError ** const err)
+{
+    struct _aio * const aio = h->aio;
+    const guint n_parts = h->layout.n_parts;
+
+    const int r = io_uring_queue_init(MIN(h->aio_depth * h->n_healthy,
+                                          URING_ENTRIES_MAX),
+                                      &aio->ring, 0);
+    if (r < 0) {
+        g_debug("Not using io_uring for volume %s: %s",
+                h->layout.vol->name, g_strerror(-r));
+        return FALSE;
+    }
+
+    aio->waiting = g_new(GQueue, n_parts);
+    for (guint i = 0; i < n_parts; i++) g_queue_init(&aio->waiting[i]);
+    aio->inflight = g_new0(guint, n_parts);
+    g_queue_init(&aio->submitted);
+
+    aio->reaper = g_thread_try_new("ldm-aio", _uring_reap, aio, err);
+    if (aio->reaper == NULL) {
+        io_uring_queue_exit(&aio->ring);
+        g_free(aio->waiting); aio->waiting = NULL;
+        g_free(aio->inflight); aio->inflight = NULL;
+        return FALSE;
+    }
+
+    aio->uring = TRUE;
+    return TRUE;
+}
+
+static void
+_uring_stop(LDMVolumeHandle * const h)
+{
+    struct _aio * const aio = h->aio;
+
+    g_mutex_lock(&h->aio_lock);
+    struct io_uring_sqe * const sqe = io_uring_get_sqe(&aio->ring);
+    io_uring_prep_nop(sqe);
+    io_uring_sqe_set_data(sqe, NULL);
+    io_uring_submit(&aio->ring);
+    g_mutex_unlock(&h->aio_lock);
+
+    g_thread_join(aio->reaper);
+    io_uring_queue_exit(&aio->ring);
+    g_free(aio->waiting);
+    g_free(aio->inflight);
+    if (aio->uring_err) g_error_free(aio->uring_err);
+}
+
+#endif /* HAVE_LIBURING */
+
+static void
+_aio_free(LDMVolumeHandle * const h)
+{
+    struct _aio * const aio = h->aio;
+    if (aio == NULL) return;
+
+#ifdef HAVE_LIBURING
+    if (aio->uring) _uring_stop(h);
+#endif
+
+    for (guint i = 0; aio->pools && i < h->layout.n_parts; i++) {
+        if (aio->pools[i]) g_thread_pool_free(aio->pools[i], FALSE, TRUE);
+    }
+    g_free(aio->pools);
+
+    if (aio->eventfd != -1) close(aio->eventfd);
+    g_async_queue_unref(aio->done);
+    g_free(aio);
+    h->aio = NULL;
+}
+
+static gboolean
+_aio_start(LDMVolumeHandle * const h, GError ** const err)
+{
+    g_mutex_lock(&h->aio_lock);
+    if (h->aio) {
+        g_mutex_unlock(&h->aio_lock);
+        return TRUE;
+    }
+
+    struct _aio * const aio = g_new0(struct _aio, 1);
+    aio->h = h;
+    aio->done = g_async_queue_new();
+    h->aio = aio;
+
+    const gchar *engine = "threads";
+
+    aio->eventfd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (aio->eventfd == -1) {
+        g_set_error(err, LDM_ERROR, LDM_ERROR_INTERNAL,
+                    "Error creating eventfd: %m");
+        goto error;
+    }
+
+#ifdef HAVE_LIBURING
+    GError *uring_err = NULL;
+    if (_aio_use_uring && _uring_start(h, &uring_err)) {
+        engine = "io_uring";
+        goto out;
+    }
+    if (uring_err) {
+        g_propagate_error(err, uring_err);
+        goto error;
+    }
+#endif
+
+    aio->pools = g_new0(GThreadPool *, h->layout.n_parts);
+    for (guint i = 0; i < h->layout.n_parts; i++) {
+        if (h->fds[i] == -1) continue;
+
+        aio->pools[i] = g_thread_pool_new(_aio_pool_run, h, h->aio_depth,
+                                          FALSE, err);
+        if (aio->pools[i] == NULL) goto error;
+    }
+
+#ifdef HAVE_LIBURING
+out:
+#endif
+    g_mutex_unlock(&h->aio_lock);
+
+    g_mutex_lock(&h->stats_lock);
+    h->stats.aio_engine = engine;
+    g_mutex_unlock(&h->stats_lock);
+
+    return TRUE;
+
+error:
+    _aio_free(h);
+    g_mutex_unlock(&h->aio_lock);
+    return FALSE;
+}
+
+void
+ldm_volume_handle_set_queue_depth(LDMVolumeHandle * const h,
+                                  const guint depth)
+{
+    g_return_if_fail(depth > 0);
+
+    g_mutex_lock(&h->aio_lock);
+    if (h->aio == NULL) h->aio_depth = depth;
+    g_mutex_unlock(&h->aio_lock);
+}
+
+gboolean
+ldm_volume_read_async(LDMVolumeHandle * const h, void * const buf,
+                      gsize count, const guint64 offset,
+                      const LDMVolumeReadCallback callback,
+                      const gpointer user_data, GError ** const err)
+{
+    if (!_flush_writes(h, err) || !_aio_start(h, err)) return FALSE;
+    struct _aio * const aio = h->aio;
+
+    /* Like pread(), reads stop at the end of the volume */
+    count = offset < h->layout.size ? MIN(count, h->layout.size - offset) : 0;
+
+    struct _aio_request * const req = g_new0(struct _aio_request, 1);
+    req->h = h;
+    req->count = count;
+    req->fixups = g_array_new(FALSE, FALSE, sizeof(struct _xor_fixup));
+    req->start = g_get_monotonic_time();
+    req->callback = callback;
+    req->user_data = user_data;
+
+    GArray * const ops = g_array_new(FALSE, FALSE, sizeof(struct _read_op));
+    const struct iovec iov = { .iov_base = buf, .iov_len = count };
+    if (!_plan_read(h, &iov, count, offset, ops, req->fixups,
+                    &req->reconstructed, err))
+    {
+        g_array_unref(ops);
+        _free_fixups(req->fixups);
+        g_free(req);
+        return FALSE;
+    }
+
+    /* Hold a reference while submitting so the request can't complete before
+     * all of its ops have been queued */
+    req->refs = ops->len + 1;
+
+    g_mutex_lock(&h->aio_lock);
+    aio->running++;
+    aio->undispatched++;
+    g_mutex_unlock(&h->aio_lock);
+
+#ifdef HAVE_LIBURING
+    /* Ops fail without being queued if the ring has stopped */
+    GQueue failed = G_QUEUE_INIT;
+    if (aio->uring) g_mutex_lock(&h->aio_lock);
+#endif
+    for (guint i = 0; i < ops->len; i++) {
+        struct _aio_op * const aop = g_new0(struct _aio_op, 1);
+        aop->req = req;
+        aop->op = g_array_index(ops, struct _read_op, i);
+
+#ifdef HAVE_LIBURING
+        if (aio->uring) {
+            g_queue_push_tail(aio->uring_err ? &failed
+                                             : &aio->waiting[aop->op.column],
+                              aop);
+            continue;
+        }
+#endif
+        g_thread_pool_push(aio->pools[aop->op.column], aop, NULL);
+    }
+#ifdef HAVE_LIBURING
+    if (aio->uring) {
+        _uring_pump(h);
+        g_mutex_unlock(&h->aio_lock);
+        _uring_fail_ops(aio, &failed);
+    }
+#endif
+    g_array_unref(ops);
+
+    _aio_request_unref(req);
+    return TRUE;
+}
+
+static void
+_aio_dispatch_one(LDMVolumeHandle * const h, struct _aio_request * const req)
+{
+    req->callback(h, req->err ? -1 : (gssize) req->count, req->err,
+                  req->user_data);
+
+    if (req->err) g_error_free(req->err);
+    _free_fixups(req->fixups);
+    g_free(req);
+
+    g_mutex_lock(&h->aio_lock);
+    h->aio->undispatched--;
+    g_mutex_unlock(&h->aio_lock);
+}
+
+guint
+ldm_volume_handle_dispatch(LDMVolumeHandle * const h, const gboolean wait)
+{
+    struct _aio * const aio = h->aio;
+    if (aio == NULL) return 0;
+
+    /* Clear the eventfd before draining the queue, so that a completion
+     * which races with the drain leaves it readable */
+    guint64 signalled;
+    if (read(aio->eventfd, &signalled, sizeof(signalled)) == -1 &&
+        errno != EAGAIN)
+    {
+        g_warning("Error reading completion eventfd: %m");
+    }
+
+    guint n = 0;
+    for (;;) {
+        struct _aio_request *req = g_async_queue_try_pop(aio->done);
+        if (req == NULL) {
+            if (!wait || n > 0) break;
+
+            g_mutex_lock(&h->aio_lock);
+            const gboolean outstanding = aio->undispatched > 0;
+            g_mutex_unlock(&h->aio_lock);
+            if (!outstanding) break;
+
+            req = g_async_queue_pop(aio->done);
+        }
+
+        _aio_dispatch_one(h, req);
+        n++;
+    }
+
+    return n;
+}
+
+struct _aio_source
+{
+    GSource source;
+    LDMVolumeHandle *h;
+    GPollFD pfd;
+};
+
+static gboolean
+_aio_source_prepare(GSource * const source, gint * const timeout)
+{
+    *timeout = -1;
+    return FALSE;
+}
+
+static gboolean
+_aio_source_check(GSource * const source)
+{
+    return ((struct _aio_source *) source)->pfd.revents & G_IO_IN;
+}
+
+static gboolean
+_aio_source_dispatch(GSource * const source, const GSourceFunc callback,
+                     const gpointer user_data)
+{
+    ldm_volume_handle_dispatch(((struct _aio_source *) source)->h, FALSE);
+    return G_SOURCE_CONTINUE;
+}
+
+static GSourceFuncs _aio_source_funcs = {
+    .prepare = _aio_source_prepare,
+    .check = _aio_source_check,
+    .dispatch = _aio_source_dispatch
+};
+
+GSource *
+ldm_volume_handle_create_source(LDMVolumeHandle * const h,
+                                GError ** const err)
+{
+    if (!_aio_start(h, err)) return NULL;
+
+    GSource * const source = g_source_new(&_aio_source_funcs,
+                                          sizeof(struct _aio_source));
+    struct _aio_source * const aio_source = (struct _aio_source *) source;
+    aio_source->h = h;
+    aio_source->pfd.fd = h->aio->eventfd;
+    aio_source->pfd.events = G_IO_IN;
+    g_source_add_poll(source, &aio_source->pfd);
+    g_source_set_name(source, "LDMVolumeHandle");
+
+    return source;
+}
+
+void
+ldm_volume_close(LDMVolumeHandle * const h)
+{
+    if (h == NULL) return;
+
+    if (h->aio) {
+        g_mutex_lock(&h->aio_lock);
+        while (h->aio->running > 0) g_cond_wait(&h->aio_idle, &h->aio_lock);
+        g_mutex_unlock(&h->aio_lock);
+
+        ldm_volume_handle_dispatch(h, FALSE);
+        _aio_free(h);
+    }
+
+    GError *err = NULL;
+    if (h->wbuf && !ldm_volume_flush(h, &err)) {
+        g_warning("%s", err->message);
+        g_error_free(err);
+    }
+    g_free(h->wbuf);
+
+    if (h->pool) g_thread_pool_free(h->pool, FALSE, TRUE);
+
+    for (guint i = 0; h->fds && i < h->layout.n_parts; i++) {
+        if (_handle_owns_fd(h, i)) close(h->fds[i]);
+    }
+    g_free(h->fds);
+    g_free(h->bases);
+
+    _vol_layout_clear(&h->layout);
+    g_mutex_clear(&h->stats_lock);
+    g_mutex_clear(&h->write_lock);
+    g_mutex_clear(&h->aio_lock);
+    g_cond_clear(&h->aio_idle);
+    g_object_unref(h->vol);
+    g_free(h);
+}
+
+void
+ldm_volume_handle_get_stats(LDMVolumeHandle * const h,
+                            LDMVolumeStats * const stats)
+{
+    g_mutex_lock(&h->stats_lock);
+    *stats = h->stats;
+    g_mutex_unlock(&h->stats_lock);
+}
+
+struct _probe_ctx {
+    LDMVolumeHandle *h;
+    GError **err;
+};
+
+static int
+_probe_read(void * const data, void * const buf, const size_t len,
+            const uint64_t offset)
+{
+    struct _probe_ctx * const ctx = data;
+
+    const gssize r = ldm_volume_pread(ctx->h, buf, len, offset, ctx->err);
+    if (r == -1) return -1;
+    if ((size_t) r < len) {
+        g_set_error(ctx->err, LDM_ERROR, LDM_ERROR_IO,
+                    "Short read probing volume %s",
+                    ctx->h->vol->priv->name);
+        return -1;
+    }
+    return 0;
+}
+
+gboolean
+ldm_volume_probe(LDMVolume * const o, LDMFsInfo * const info,
+                 GError ** const err)
+{
+    LDMVolumeHandle * const h = ldm_volume_open(o, err);
+    if (h == NULL) return FALSE;
+
+    struct _probe_ctx ctx = { h, err };
+    fsprobe_t fs;
+    const int r = fsprobe(_probe_read, &ctx, o->priv->size * SECTOR_SIZE, &fs);
+    ldm_volume_close(h);
+    if (r < 0) return FALSE;
+
+    /* fsprobe_type_t and LDMFsType share their order */
+    info->type = (LDMFsType) fs.type;
+    g_strlcpy(info->label, fs.label, sizeof(info->label));
+    info->serial = fs.serial;
+    info->cluster_size = fs.cluster_size;
+
+    return TRUE;
+}
+
+static GString *
+_dm_part_name(const LDMPartitionPrivate * const part)
+{
+    const LDMDiskPrivate * const disk = part->disk->priv;
+
+    GString * name = g_string_new("");
+    g_string_printf(name, "ldm_part_%s_%s", disk->dgname, part->name);
+
+    return name;
+}
+
+static GString *
+_dm_part_uuid(const LDMPartitionPrivate * const part)
+{
+    const LDMDiskPrivate * const disk = part->disk->priv;
+
+    char ldm_disk_guid[37];
+    uuid_unparse_lower(disk->guid, ldm_disk_guid);
+
+    GString * dm_uuid = g_string_new("");
+    g_string_printf(dm_uuid, "%s%s-%s",
+                    DM_UUID_PREFIX, part->name, ldm_disk_guid);
+
+    return dm_uuid;
+}
+
+static GString *
+_dm_vol_name(const LDMVolumePrivate * const vol)
+{
+    GString * r = g_string_new("");
+    g_string_printf(r, "ldm_vol_%s_%s", vol->dgname, vol->name);
+    return r;
+}
+
+static GString *
+_dm_vol_uuid(const LDMVolumePrivate * const vol)
+{
+    char ldm_vol_uuid[37];
+    uuid_unparse_lower(vol->guid, ldm_vol_uuid);
+
+    GString * dm_uuid = g_string_new("");
+    g_string_printf(dm_uuid, "%s%s-%s",
+                    DM_UUID_PREFIX, vol->name, ldm_vol_uuid);
+
+    return dm_uuid;
+}
+
+/* The libdevmapper backend's snapshot is a dm_tree of every device */
+static gpointer
+_dm_libdm_list(const dm_backend_t * const backend, GError ** const err)
+{
+    struct dm_tree *tree;
+    tree = dm_tree_create();
+    if (!tree) {
+        g_set_error(err, LDM_ERROR, LDM_ERROR_EXTERNAL,
+                    "dm_tree_create: %s", _dm_err()->msg);
+        return NULL;
+    }
+
+    struct dm_task *task;
+    task = dm_task_create(DM_DEVICE_LIST);
+    if (!task) {
+        g_set_error(err, LDM_ERROR, LDM_ERROR_EXTERNAL,
+                    "dm_task_create: %s", _dm_err()->msg);
+        goto error;
+    }
+
+    if (!dm_task_run(task)) {
+        g_set_error_literal(err, LDM_ERROR, LDM_ERROR_EXTERNAL,
+                            _dm_err()->msg);
+        goto error;
+    }
+
+    struct dm_names *names;
+    names = dm_task_get_names(task);
+    if (!task) {
+        g_set_error(err, LDM_ERROR, LDM_ERROR_EXTERNAL,
+                    "dm_task_get_names: %s", _dm_err()->msg);
+        goto error;
+    }
+
+    if (names->dev != 0) {
+        for (;;) {
+            if (!dm_tree_add_dev(tree, major(names->dev), minor(names->dev))) {
+                g_set_error(err, LDM_ERROR, LDM_ERROR_EXTERNAL,
+                            "dm_tree_add_dev: %s", _dm_err()->msg);
+                goto error;
+            }
+
+            if (names->next == 0) break;
+
+            names = (struct dm_names *)((char *)names + names->next);
+        }
+    }
+
+    dm_task_destroy(task);
+    return tree;
+
+error:
+    if (tree) dm_tree_free(tree);
+    if (task) dm_task_destroy(task);
+    return NULL;
+}
+
+/* Lock cache, building its snapshot if it has been dropped. Returns the
+ * snapshot, or NULL with cache unlocked on error. */
+static gpointer
+_dm_cache_lock(struct _dm_cache * const cache, GError ** const err)
+{
+    g_mutex_lock(&cache->lock);
+    g_mutex_lock(&_dm_backend_lock);
+    if (cache->snapshot == NULL) {
+        cache->snapshot = cache->backend->list(cache->backend, err);
+        if (cache->snapshot == NULL) {
+            g_mutex_unlock(&_dm_backend_lock);
+            g_mutex_unlock(&cache->lock);
+            return NULL;
+        }
+    }
+
+    return cache->snapshot;
+}
+
+/* Unlock cache. If the caller changed the set of devices, the snapshot is
+ * dropped to be rebuilt by the next user. */
+static void
+_dm_cache_unlock(struct _dm_cache * const cache, const gboolean changed)
+{
+    if (changed && cache->snapshot) {
+        cache->backend->list_free(cache->backend, cache->snapshot);
+        cache->snapshot = NULL;
+    }
+    g_mutex_unlock(&_dm_backend_lock);
+    g_mutex_unlock(&cache->lock);
+}
+
+/* Returns the device path of the device with the given uuid, or NULL if it
+ * doesn't exist or on error. The name comes from the cached snapshot, which
+ * already ran DM_DEVICE_INFO for every device when it was built. It is
+ * mangled the same way as dm_task_get_name_mangled(): characters udev doesn't
+ * allow in a device node name are written as \xNN. */
+static gchar *
+_dm_get_device(struct _dm_cache * const cache, const gchar * const uuid,
+               GError ** const err)
+{
+    const gpointer snapshot = _dm_cache_lock(cache, err);
+    if (snapshot == NULL) return NULL;
+
+    gchar *r = NULL;
+    const gchar * const name =
+        cache->backend->info(cache->backend, snapshot, uuid);
+    if (name) {
+        GString * const path = g_string_new(dm_dir());
+        g_string_append_c(path, '/');
+        for (const gchar *c = name; *c != '\0'; c++) {
+            if (g_ascii_isalnum(*c) || strchr("#+-.:=@_", *c) != NULL)
+                g_string_append_c(path, *c);
+            else
+                g_string_append_printf(path, "\\x%02x", (guchar) *c);
+        }
+        r = g_string_free(path, FALSE);
+    }
+
+    _dm_cache_unlock(cache, FALSE);
+    return r;
+}
+
+gboolean
+_dm_remove(const gchar * const name, uint32_t udev_cookie, GError ** const err)
+{
+    gboolean r = TRUE;
+
+    struct dm_task * const task = dm_task_create(DM_DEVICE_REMOVE);
+    if (!task) {
+        g_set_error(err, LDM_ERROR, LDM_ERROR_EXTERNAL,
+                    "dm_task_create(DM_DEVICE_REMOVE) failed: %s",
+                    _dm_err()->msg);
+        r = FALSE; goto out;
+    }
+
+    if (!dm_task_set_name(task, name)) {
+        g_set_error(err, LDM_ERROR, LDM_ERROR_EXTERNAL,
+                    "DM_DEVICE_REMOVE: dm_task_set_name(%s) failed: %s",
+                    name, _dm_err()->msg);
+        r = FALSE; goto out;
+    }
+
+    if (udev_cookie && !dm_task_set_cookie(task, &udev_cookie, 0)) {
+        g_set_error(err, LDM_ERROR, LDM_ERROR_EXTERNAL,
+                    "DM_DEVICE_REMOVE: dm_task_set_cookie(%08X) failed: %s",
+                    udev_cookie, _dm_err()->msg);
+        r = FALSE; goto out;
+    }
+
+    /* If a remove operation fails, try again in case it was only opened
+     * transiently. */
+    dm_task_retry_remove(task);
+
+    if (!dm_task_run(task)) {
+        if (_dm_err()->err == EBUSY) {
+            g_set_error(err, LDM_ERROR, LDM_ERROR_EXTERNAL,
+                        "Device is still mounted");
+        } else {
+            g_set_error_literal(err, LDM_ERROR, LDM_ERROR_EXTERNAL,
+                                _dm_err()->msg);
+        }
+        r = FALSE; goto out;
+    }
+
+out:
+    dm_task_destroy(task);
+    return r;
+}
+
+/* Device mapper operations on several volumes share one snapshot of the
+ * existing devices, and one udev cookie which is only waited on at the end.
+ * Mirrored and RAID5 volumes refer to their partition devices by device
+ * number rather than by path, so they don't need to wait for udev to create
+ * the partitions' device nodes first. The snapshot is the cached one, which is
+ * held locked for the whole batch and dropped at the end if anything was
+ * changed. */
+struct _dm_batch
+{
+    struct _dm_cache *cache;
+    const dm_backend_t *backend;
+    gpointer snapshot;
+    uint32_t cookie;
+    LDMDmFlags flags;
+    const LDMRaidParams *raid_params;
+    gboolean changed;   /* Whether any device may have been changed */
+};
+
+static gboolean
+_dm_batch_begin(struct _dm_batch * const batch, struct _dm_cache * const cache,
+                const LDMDmFlags flags, const LDMRaidParams * const raid_params,
+                GError ** const err)
+{
+    batch->cache = cache;
+    batch->backend = cache->backend;
+    batch->flags = flags;
+    batch->raid_params = raid_params;
+    batch->changed = FALSE;
+    batch->snapshot = _dm_cache_lock(cache, err);
+    if (batch->snapshot == NULL) return FALSE;
+
+    if (!batch->backend->cookie_create(batch->backend, &batch->cookie, err)) {
+        _dm_cache_unlock(cache, FALSE);
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+static void
+_dm_batch_end(struct _dm_batch * const batch)
+{
+    batch->backend->udev_wait(batch->backend, batch->cookie);
+    _dm_cache_unlock(batch->cache, batch->changed);
+}
+
+/* Plans, described in dmbackend.h, are simplified by _dm_plan_optimise(), then
+ * handed to the backend which creates their devices. */
+
+static void
+_dm_plan_seg_clear(gpointer const data)
+{
+    struct _dm_plan_seg * const seg = data;
+    g_array_unref(seg->areas);
+}
+
+static void
+_dm_plan_dev_clear(gpointer const data)
+{
+    struct _dm_plan_dev * const dev = data;
+
+    g_string_free(dev->name, TRUE);
+    g_string_free(dev->uuid, TRUE);
+    g_array_unref(dev->segs);
+}
+
+static GArray *
+_dm_plan_new(void)
+{
+    GArray * const plan = g_array_new(FALSE, FALSE,
+                                      sizeof(struct _dm_plan_dev));
+    g_array_set_clear_func(plan, _dm_plan_dev_clear);
+
+    return plan;
+}
+
+/* Append a device to plan, taking ownership of name and uuid. Returns its
+ * index. */
+static gint
+_dm_plan_add_dev(GArray * const plan, GString * const name,
+                 GString * const uuid, const LDMDmFlags flags)
+{
+    struct _dm_plan_dev dev = {
+        .name = name,
+        .uuid = uuid,
+        .read_only = (flags & LDM_DM_READ_ONLY) != 0,
+        .segs = g_array_new(FALSE, FALSE, sizeof(struct _dm_plan_seg))
+    };
+    g_array_set_clear_func(dev.segs, _dm_plan_seg_clear);
+    g_array_append_val(plan, dev);
+
+    return plan->len - 1;
+}
+
+/* Append a segment to device dev of plan. The returned segment is valid until
+ * the next segment is added to the same device. */
+static struct _dm_plan_seg *
+_dm_plan_add_seg(GArray * const plan, const gint dev,
+                 const _dm_seg_type type, const guint64 size)
+{
+    GArray * const segs = g_array_index(plan, struct _dm_plan_dev, dev).segs;
+
+    struct _dm_plan_seg seg = {
+        .type = type,
+        .size = size,
+        .areas = g_array_new(FALSE, FALSE, sizeof(struct _dm_plan_area))
+    };
+    g_array_append_val(segs, seg);
+
+    return &g_array_index(segs, struct _dm_plan_seg, segs->len - 1);
+}
+
+static void
+_dm_seg_add_area(struct _dm_plan_seg * const seg, const gchar * const disk,
+                 const gint dev, const guint64 offset)
+{
+    const struct _dm_plan_area area = {
+        .disk = disk, .dev = dev, .offset = offset
+    };
+    g_array_append_val(seg->areas, area);
+}
+
+static void
+_dm_seg_add_part(struct _dm_plan_seg * const seg,
+                 const LDMPartitionPrivate * const part)
+{
+    const LDMDiskPrivate * const disk = part->disk->priv;
+    _dm_seg_add_area(seg, disk->device, -1, disk->data_start + part->start);
+}
+
+static gboolean
+_dm_plan_spanned(GArray * const plan, const LDMVolumePrivate * const vol,
+                 const LDMDmFlags flags, GError ** const err)
+{
+    uint64_t pos = 0;
+    for (guint i = 0; i < vol->parts->len; i++) {
+        const LDMPartition * const part_o =
+            g_array_index(vol->parts, const LDMPartition *, i);
+        const LDMPartitionPrivate * const part = part_o->priv;
+
+        const LDMDiskPrivate * const disk = part->disk->priv;
+        if (!disk->device) {
+            g_set_error(err, LDM_ERROR, LDM_ERROR_MISSING_DISK,
+                        "Disk %s required by spanned volume %s is missing",
+                        disk->name, vol->name);
+            return FALSE;
+        }
+
+        /* Sanity check: current position from adding up sizes of partitions
+         * should equal the volume offset of the partition */
+        if (pos != part->vol_offset) {
+            g_set_error(err, LDM_ERROR, LDM_ERROR_INVALID,
+                        "Partition volume offset does not match sizes of "
+                        "preceding partitions");
+            return FALSE;
+        }
+
+        pos += part->size;
+    }
+
+    const gint dev = _dm_plan_add_dev(plan, _dm_vol_name(vol),
+                                      _dm_vol_uuid(vol), flags);
+    for (guint i = 0; i < vol->parts->len; i++) {
+        const LDMPartition * const part_o =
+            g_array_index(vol->parts, const LDMPartition *, i);
+
+        struct _dm_plan_seg * const seg =
+            _dm_plan_add_seg(plan, dev, _DM_SEG_LINEAR, part_o->priv->size);
+        _dm_seg_add_part(seg, part_o->priv);
+    }
+
+    return TRUE;
+}
+
+static gboolean
+_dm_plan_striped(GArray * const plan, const LDMVolumePrivate * const vol,
+                 const LDMDmFlags flags, GError ** const err)
+{
+    for (guint i = 0; i < vol->parts->len; i++) {
+        const LDMPartition * const part_o =
+            g_array_index(vol->parts, const LDMPartition *, i);
+        const LDMDiskPrivate * const disk = part_o->priv->disk->priv;
+
+        if (!disk->device) {
+            g_set_error(err, LDM_ERROR, LDM_ERROR_MISSING_DISK,
+                        "Disk %s required by striped volume %s is missing",
+                        disk->name, vol->name);
+            return FALSE;
+        }
+    }
+
+    const gint dev = _dm_plan_add_dev(plan, _dm_vol_name(vol),
+                                      _dm_vol_uuid(vol), flags);
+    struct _dm_plan_seg * const seg =
+        _dm_plan_add_seg(plan, dev, _DM_SEG_STRIPED, vol->size);
+    seg->stripe_size = vol->chunk_size;
+
+    for (guint i = 0; i < vol->parts->len; i++) {
+        const LDMPartition * const part_o =
+            g_array_index(vol->parts, const LDMPartition *, i);
+        _dm_seg_add_part(seg, part_o->priv);
+    }
+
+    return TRUE;
+}
+
+/* The region size for vol if the caller didn't choose one. Like dm-raid's own
+ * default, it is the smallest power of two which keeps the number of regions
+ * under 2^21, and at least 4MiB. It is also at least the chunk size of a RAID5
+ * volume, which dm-raid requires, and no larger than the volume. */
+static guint32
+_dm_raid_region_size(const LDMVolumePrivate * const vol)
+{
+    guint64 region_size = 1 << 13;
+    while (region_size < vol->size >> 21) region_size <<= 1;
+    while (region_size < vol->chunk_size) region_size <<= 1;
+    while (region_size > vol->size && region_size > 1) region_size >>= 1;
+
+    return region_size;
+}
+
+/* Plan a mirrored or RAID5 volume, stacked on a partition device for each
+ * present member.
+ *
+ * Without metadata devices, md assumes a new array needs a full resync. A
+ * read-only volume must not write to its disks, so it is created with nosync,
+ * which dm-raid accepts for raid1 and raid4/5 but not raid6, and its devices
+ * are loaded read-only. Every present member is kept, so a RAID5 volume with
+ * no missing member is never degraded. A read-only mirror doesn't get this
+ * far: _dm_plan_optimise() maps it onto a single partition. */
+static gboolean
+_dm_plan_raid(GArray * const plan, const LDMVolumePrivate * const vol,
+              const gchar * const raid_type, const guint32 stripe_size,
+              const LDMDmFlags flags, const LDMRaidParams * const params_in,
+              GError ** const err)
+{
+    static const LDMRaidParams defaults = { 0 };
+    const LDMRaidParams * const tuning = params_in ? params_in : &defaults;
+
+    struct dm_tree_node_raid_params params = {
+        .raid_type = raid_type,
+        .stripe_size = stripe_size,
+        .region_size = tuning->region_size,
+        .min_recovery_rate = tuning->min_recovery_rate,
+        .max_recovery_rate = tuning->max_recovery_rate,
+        .sync_daemon_sleep = tuning->daemon_sleep
+    };
+
+    if (params.region_size == 0) {
+        params.region_size = _dm_raid_region_size(vol);
+    } else if ((params.region_size & (params.region_size - 1)) != 0 ||
+               params.region_size > vol->size)
+    {
+        g_set_error(err, LDM_ERROR, LDM_ERROR_INVALID,
+                    "Region size %" PRIu32 " of volume %s is not a power of 2 "
+                    "no larger than the volume", params.region_size,
+                    vol->name);
+        return FALSE;
+    }
+
+    if (vol->type == LDM_VOLUME_TYPE_RAID5) {
+        params.stripe_cache = tuning->stripe_cache;
+    }
+
+    if (flags & LDM_DM_READ_ONLY) params.flags |= DM_NOSYNC;
+
+    gint * const legs = g_new(gint, vol->parts->len);
+    guint present = 0;
+    for (guint i = 0; i < vol->parts->len; i++) {
+        const LDMPartition * const part_o =
+            g_array_index(vol->parts, const LDMPartition *, i);
+        const LDMPartitionPrivate * const part = part_o->priv;
+        const LDMDiskPrivate * const disk = part->disk->priv;
+
+        legs[i] = -1;
+        if (!disk->device) {
+            g_warning("Disk %s required by partition %s is missing",
+                      disk->name, part->name);
+            continue;
+        }
+
+        legs[i] = _dm_plan_add_dev(plan, _dm_part_name(part),
+                                   _dm_part_uuid(part), flags);
+        struct _dm_plan_seg * const seg =
+            _dm_plan_add_seg(plan, legs[i], _DM_SEG_LINEAR, part->size);
+        _dm_seg_add_part(seg, part);
+
+        /* A write-mostly mirror which is missing can't be marked as one */
+        if (vol->type == LDM_VOLUME_TYPE_MIRRORED && i < 64 &&
+            (tuning->write_mostly & (UINT64_C(1) << i)))
+        {
+            params.writemostly |= UINT64_C(1) << i;
+        }
+
+        present++;
+    }
+
+    gboolean r = FALSE;
+    if (vol->type == LDM_VOLUME_TYPE_MIRRORED && present == 0) {
+        g_set_error(err, LDM_ERROR, LDM_ERROR_MISSING_DISK,
+                    "Mirrored volume is missing all partitions");
+        goto out;
+    }
+
+    if (vol->type == LDM_VOLUME_TYPE_RAID5 && present < vol->parts->len - 1) {
+        g_set_error(err, LDM_ERROR, LDM_ERROR_MISSING_DISK,
+                    "RAID5 volume is missing more than 1 component");
+        goto out;
+    }
+
+    const gint dev = _dm_plan_add_dev(plan, _dm_vol_name(vol),
+                                      _dm_vol_uuid(vol), flags);
+    struct _dm_plan_seg * const seg =
+        _dm_plan_add_seg(plan, dev, _DM_SEG_RAID, vol->size);
+    seg->raid = params;
+    for (guint i = 0; i < vol->parts->len; i++) {
+        _dm_seg_add_area(seg, NULL, legs[i], 0);
+    }
+    r = TRUE;
+
+out:
+    g_free(legs);
+    return r;
+}
+
+/* Replace a mirror's raid1 segment with linear segments onto the partition
+ * of its best member, which is the first which isn't write-mostly, or failing
+ * that the first. */
+static void
+_dm_plan_mirror_to_linear(GArray * const plan, struct _dm_plan_dev * const vol)
+{
+    const struct _dm_plan_seg * const raid =
+        &g_array_index(vol->segs, struct _dm_plan_seg, 0);
+
+    gint best = -1;
+    for (guint i = 0; i < raid->areas->len; i++) {
+        const struct _dm_plan_area * const area =
+            &g_array_index(raid->areas, struct _dm_plan_area, i);
+        if (area->dev < 0) continue;
+
+        if (best == -1) best = area->dev;
+        if (i >= 64 || !(raid->raid.writemostly & (UINT64_C(1) << i))) {
+            best = area->dev;
+            break;
+        }
+    }
+
+    const GArray * const leg_segs =
+        g_array_index(plan, struct _dm_plan_dev, best).segs;
+    GArray * const segs = g_array_new(FALSE, FALSE,
+                                      sizeof(struct _dm_plan_seg));
+    g_array_set_clear_func(segs, _dm_plan_seg_clear);
+
+    guint64 remaining = raid->size;
+    for (guint i = 0; i < leg_segs->len && remaining > 0; i++) {
+        const struct _dm_plan_seg * const leg_seg =
+            &g_array_index(leg_segs, struct _dm_plan_seg, i);
+
+        struct _dm_plan_seg seg = *leg_seg;
+        seg.size = MIN(seg.size, remaining);
+        seg.areas = g_array_sized_new(FALSE, FALSE,
+                                      sizeof(struct _dm_plan_area),
+                                      leg_seg->areas->len);
+        g_array_append_vals(seg.areas, leg_seg->areas->data,
+                            leg_seg->areas->len);
+        g_array_append_val(segs, seg);
+
+        remaining -= seg.size;
+    }
+
+    g_array_unref(vol->segs);
+    vol->segs = segs;
+}
+
+/* Merge consecutive linear segments which map contiguous sectors of the same
+ * device */
+static void
+_dm_plan_merge_linear(struct _dm_plan_dev * const dev)
+{
+    for (guint i = 1; i < dev->segs->len;) {
+        struct _dm_plan_seg * const prev =
+            &g_array_index(dev->segs, struct _dm_plan_seg, i - 1);
+        const struct _dm_plan_seg * const seg =
+            &g_array_index(dev->segs, struct _dm_plan_seg, i);
+
+        if (prev->type == _DM_SEG_LINEAR && seg->type == _DM_SEG_LINEAR) {
+            const struct _dm_plan_area * const a =
+                &g_array_index(prev->areas, struct _dm_plan_area, 0);
+            const struct _dm_plan_area * const b =
+                &g_array_index(seg->areas, struct _dm_plan_area, 0);
+
+            if (g_strcmp0(a->disk, b->disk) == 0 && a->dev == b->dev &&
+                a->offset + prev->size == b->offset)
+            {
+                prev->size += seg->size;
+                g_array_remove_index(dev->segs, i);
+                continue;
+            }
+        }
+
+        i++;
     }
+}
 
-    if (!dm_task_set_name(task, name)) {
-        g_set_error(err, LDM_ERROR, LDM_ERROR_EXTERNAL,
-                    "DM_DEVICE_CREATE: dm_task_set_name(%s) failed: %s",
-                    name, _dm_err_last_msg);
-        r = FALSE; goto out;
+/* Remove devices which nothing is stacked on, other than the volume */
+static void
+_dm_plan_prune(GArray * const plan)
+{
+    gboolean * const used = g_new0(gboolean, plan->len);
+    used[plan->len - 1] = TRUE;
+
+    /* Devices are only stacked on earlier ones */
+    for (guint i = plan->len; i > 0; i--) {
+        if (!used[i - 1]) continue;
+
+        const GArray * const segs =
+            g_array_index(plan, struct _dm_plan_dev, i - 1).segs;
+        for (guint j = 0; j < segs->len; j++) {
+            const GArray * const areas =
+                g_array_index(segs, struct _dm_plan_seg, j).areas;
+            for (guint k = 0; k < areas->len; k++) {
+                const gint dev =
+                    g_array_index(areas, struct _dm_plan_area, k).dev;
+                if (dev >= 0) used[dev] = TRUE;
+            }
+        }
     }
 
-    if (!dm_task_set_uuid(task, uuid)) {
-        g_set_error(err, LDM_ERROR, LDM_ERROR_EXTERNAL,
-                    "DM_DEVICE_CREATE: dm_task_set_uuid(%s) failed: %s",
-                    uuid, _dm_err_last_msg);
-        r = FALSE; goto out;
+    /* Renumber the remaining devices */
+    gint * const index = g_new(gint, plan->len);
+    gint next = 0;
+    for (guint i = 0; i < plan->len; i++) index[i] = used[i] ? next++ : -1;
+
+    for (guint i = plan->len; i > 0; i--) {
+        if (!used[i - 1]) g_array_remove_index(plan, i - 1);
+    }
+
+    for (guint i = 0; i < plan->len; i++) {
+        const GArray * const segs =
+            g_array_index(plan, struct _dm_plan_dev, i).segs;
+        for (guint j = 0; j < segs->len; j++) {
+            const GArray * const areas =
+                g_array_index(segs, struct _dm_plan_seg, j).areas;
+            for (guint k = 0; k < areas->len; k++) {
+                struct _dm_plan_area * const area =
+                    &g_array_index(areas, struct _dm_plan_area, k);
+                if (area->dev >= 0) area->dev = index[area->dev];
+            }
+        }
     }
 
-    for (guint i = 0; i < n_targets; i++) {
-        const struct dm_target * const target = &targets[i];
+    g_free(index);
+    g_free(used);
+}
+
+/* Simplify the plan of a volume:
+ *
+ * A mirror which is read-only, or which has a single member present, has no
+ * use for md: it is mapped directly onto the partition of one member, and
+ * the partition devices are dropped.
+ *
+ * Consecutive linear segments which are contiguous on the same disk, such as
+ * the partitions of a spanned volume which follow each other on a disk, are
+ * merged into one. */
+static void
+_dm_plan_optimise(GArray * const plan, const LDMDmFlags flags)
+{
+    struct _dm_plan_dev * const vol =
+        &g_array_index(plan, struct _dm_plan_dev, plan->len - 1);
 
-        if (!dm_task_add_target(task, target->start, target->size,
-                                      target->type, target->params->str))
+    if (vol->segs->len == 1) {
+        const struct _dm_plan_seg * const seg =
+            &g_array_index(vol->segs, struct _dm_plan_seg, 0);
+
+        if (seg->type == _DM_SEG_RAID &&
+            g_strcmp0(seg->raid.raid_type, "raid1") == 0)
         {
-            g_set_error(err, LDM_ERROR, LDM_ERROR_EXTERNAL,
-                        "DM_DEVICE_CREATE: "
-                        "dm_task_add_target(%s, %" PRIu64 ", %" PRIu64 ", "
-                                           "%s, %s) failed: %s",
-                        name, target->start, target->size,
-                        target->type, target->params->str, _dm_err_last_msg);
-            r = FALSE; goto out;
+            guint present = 0;
+            for (guint i = 0; i < seg->areas->len; i++) {
+                if (g_array_index(seg->areas, struct _dm_plan_area, i).dev >= 0)
+                    present++;
+            }
+
+            if (present == 1 || (flags & LDM_DM_READ_ONLY))
+                _dm_plan_mirror_to_linear(plan, vol);
         }
     }
 
-    if (!dm_task_set_cookie(task, &udev_cookie, 0)) {
-        g_set_error(err, LDM_ERROR, LDM_ERROR_EXTERNAL,
-                    "DM_DEVICE_CREATE: dm_task_set_cookie(%08X) failed: %s",
-                    udev_cookie, _dm_err_last_msg);
-        r = FALSE; goto out;
+    for (guint i = 0; i < plan->len; i++) {
+        _dm_plan_merge_linear(&g_array_index(plan, struct _dm_plan_dev, i));
     }
 
-    if (!dm_task_run(task)) {
-        g_set_error_literal(err, LDM_ERROR, LDM_ERROR_EXTERNAL,
-                            _dm_err_last_msg);
-        r = FALSE; goto out;
+    _dm_plan_prune(plan);
+}
+
+/* Returns the optimised plan for vol, or NULL on error */
+static GArray *
+_dm_plan_volume(const LDMVolumePrivate * const vol, const LDMDmFlags flags,
+                const LDMRaidParams * const params, GError ** const err)
+{
+    GArray * const plan = _dm_plan_new();
+
+    gboolean r = FALSE;
+    switch (vol->type) {
+    case LDM_VOLUME_TYPE_SIMPLE:
+    case LDM_VOLUME_TYPE_SPANNED:
+        r = _dm_plan_spanned(plan, vol, flags, err);
+        break;
+
+    case LDM_VOLUME_TYPE_STRIPED:
+        r = _dm_plan_striped(plan, vol, flags, err);
+        break;
+
+    case LDM_VOLUME_TYPE_MIRRORED:
+        /* The kernel requires a chunk size for raid1, but doesn't use it */
+        r = _dm_plan_raid(plan, vol, "raid1", 128, flags, params, err);
+        break;
+
+    case LDM_VOLUME_TYPE_RAID5:
+        r = _dm_plan_raid(plan, vol, "raid5_ls", vol->chunk_size, flags,
+                          params, err);
+        break;
+
+    default:
+        /* Should be impossible */
+        g_error("Unexpected volume type: %u", vol->type);
     }
 
-    if (mangled_name) {
-        char *tmp = dm_task_get_name_mangled(task);
-        *mangled_name = g_string_new(tmp);
-        dm_free(tmp);
+    if (!r) {
+        g_array_unref(plan);
+        return NULL;
     }
 
-out:
-    dm_task_destroy(task);
-    return r;
+    _dm_plan_optimise(plan, flags);
+    return plan;
 }
 
-gboolean
-_dm_remove(const gchar * const name, uint32_t udev_cookie, GError ** const err)
+static gboolean
+_dm_node_add_area(struct dm_tree_node * const node, const GArray * const plan,
+                  const struct _dm_plan_area * const area)
 {
-    gboolean r = TRUE;
+    if (area->disk) {
+        return dm_tree_node_add_target_area(node, area->disk, NULL,
+                                            area->offset);
+    }
 
-    struct dm_task * const task = dm_task_create(DM_DEVICE_REMOVE);
-    if (!task) {
-        g_set_error(err, LDM_ERROR, LDM_ERROR_EXTERNAL,
-                    "dm_task_create(DM_DEVICE_REMOVE) failed: %s",
-                    _dm_err_last_msg);
-        r = FALSE; goto out;
+    if (area->dev >= 0) {
+        const struct _dm_plan_dev * const dev =
+            &g_array_index(plan, struct _dm_plan_dev, area->dev);
+        return dm_tree_node_add_target_area(node, NULL, dev->uuid->str,
+                                            area->offset);
     }
 
-    if (!dm_task_set_name(task, name)) {
-        g_set_error(err, LDM_ERROR, LDM_ERROR_EXTERNAL,
-                    "DM_DEVICE_REMOVE: dm_task_set_name(%s) failed: %s",
-                    name, _dm_err_last_msg);
-        r = FALSE; goto out;
+    return dm_tree_node_add_null_area(node, 0);
+}
+
+static gboolean
+_dm_node_add_seg(struct dm_tree_node * const node, const GArray * const plan,
+                 const struct _dm_plan_seg * const seg)
+{
+    switch (seg->type) {
+    case _DM_SEG_LINEAR:
+        if (!dm_tree_node_add_linear_target(node, seg->size)) return FALSE;
+        break;
+
+    case _DM_SEG_STRIPED:
+        if (!dm_tree_node_add_striped_target(node, seg->size,
+                                             seg->stripe_size))
+            return FALSE;
+        break;
+
+    case _DM_SEG_RAID:
+        if (!dm_tree_node_add_raid_target_with_params(node, seg->size,
+                                                      &seg->raid))
+            return FALSE;
+        break;
     }
 
-    if (udev_cookie && !dm_task_set_cookie(task, &udev_cookie, 0)) {
-        g_set_error(err, LDM_ERROR, LDM_ERROR_EXTERNAL,
-                    "DM_DEVICE_REMOVE: dm_task_set_cookie(%08X) failed: %s",
-                    udev_cookie, _dm_err_last_msg);
-        r = FALSE; goto out;
+    for (guint i = 0; i < seg->areas->len; i++) {
+        /* Each raid member has an empty metadata area before its data */
+        if (seg->type == _DM_SEG_RAID && !dm_tree_node_add_null_area(node, 0))
+            return FALSE;
+
+        if (!_dm_node_add_area(node, plan,
+                &g_array_index(seg->areas, struct _dm_plan_area, i)))
+            return FALSE;
     }
 
-    /* If a remove operation fails, try again in case it was only opened
-     * transiently. */
-    dm_task_retry_remove(task);
+    return TRUE;
+}
 
-    if (!dm_task_run(task)) {
-        if (_dm_err_last_errno == EBUSY) {
+/* Add every device of plan to tree */
+static gboolean
+_dm_plan_realise(const GArray * const plan, struct dm_tree * const tree,
+                 GError ** const err)
+{
+    for (guint i = 0; i < plan->len; i++) {
+        const struct _dm_plan_dev * const dev =
+            &g_array_index(plan, struct _dm_plan_dev, i);
+
+        struct dm_tree_node * const node =
+            dm_tree_add_new_dev(tree, dev->name->str, dev->uuid->str, 0, 0,
+                                dev->read_only, 0, NULL);
+        if (node == NULL) {
             g_set_error(err, LDM_ERROR, LDM_ERROR_EXTERNAL,
-                        "Device is still mounted");
-        } else {
-            g_set_error_literal(err, LDM_ERROR, LDM_ERROR_EXTERNAL,
-                                _dm_err_last_msg);
+                        "dm_tree_add_new_dev(%s): %s",
+                        dev->name->str, _dm_err()->msg);
+            return FALSE;
+        }
+
+        for (guint j = 0; j < dev->segs->len; j++) {
+            if (!_dm_node_add_seg(node, plan,
+                    &g_array_index(dev->segs, struct _dm_plan_seg, j)))
+            {
+                g_set_error(err, LDM_ERROR, LDM_ERROR_EXTERNAL,
+                            "Building table of %s: %s",
+                            dev->name->str, _dm_err()->msg);
+                return FALSE;
+            }
         }
-        r = FALSE; goto out;
     }
 
-out:
-    dm_task_destroy(task);
-    return r;
+    return TRUE;
 }
 
-static GString *
-_dm_create_part(const LDMPartitionPrivate * const part, uint32_t cookie,
-                GError ** const err)
+static void
+_dm_plan_append_area(GString * const params, const GArray * const plan,
+                     const struct _dm_plan_area * const area)
 {
-    const LDMDiskPrivate * const disk = part->disk->priv;
-
-    if (!disk->device) {
-        g_set_error(err, LDM_ERROR, LDM_ERROR_MISSING_DISK,
-                    "Disk %s required by partition %s is missing",
-                    disk->name, part->name);
-        return NULL;
+    if (area->disk) {
+        g_string_append(params, area->disk);
+    } else if (area->dev >= 0) {
+        const struct _dm_plan_dev * const dev =
+            &g_array_index(plan, struct _dm_plan_dev, area->dev);
+        g_string_append_printf(params, "%s/%s", dm_dir(), dev->name->str);
+    } else {
+        g_string_append_c(params, '-');
     }
+}
 
-    struct dm_target target;
-    target.start = 0;
-    target.size = part->size;
-    target.type = "linear";
-    target.params = g_string_new("");
-    g_string_printf(target.params, "%s %" PRIu64,
-                    disk->device, disk->data_start + part->start);
+/* Format the parameters of a raid segment in the order libdevmapper does */
+static void
+_dm_plan_raid_params(GString * const params, const GArray * const plan,
+                     const struct _dm_plan_seg * const seg)
+{
+    const struct dm_tree_node_raid_params * const raid = &seg->raid;
+    GString * const opts = g_string_new("");
+    guint n_opts = 1;
+
+    if (raid->flags & DM_NOSYNC) {
+        g_string_append(opts, " nosync"); n_opts++;
+    }
+    if (raid->region_size) {
+        g_string_append_printf(opts, " region_size %" PRIu32,
+                               raid->region_size);
+        n_opts += 2;
+    }
+    for (guint i = 0; i < seg->areas->len && i < 64; i++) {
+        if (raid->writemostly & (UINT64_C(1) << i)) {
+            g_string_append_printf(opts, " write_mostly %u", i);
+            n_opts += 2;
+        }
+    }
+    /* The kernel checks each rate against the other as it is parsed, so
+     * max_recovery_rate comes first */
+    if (raid->max_recovery_rate) {
+        g_string_append_printf(opts, " max_recovery_rate %" PRIu32,
+                               raid->max_recovery_rate);
+        n_opts += 2;
+    }
+    if (raid->min_recovery_rate) {
+        g_string_append_printf(opts, " min_recovery_rate %" PRIu32,
+                               raid->min_recovery_rate);
+        n_opts += 2;
+    }
+    if (raid->stripe_cache) {
+        g_string_append_printf(opts, " stripe_cache %" PRIu32,
+                               raid->stripe_cache);
+        n_opts += 2;
+    }
+    if (raid->sync_daemon_sleep) {
+        g_string_append_printf(opts, " daemon_sleep %" PRIu32,
+                               raid->sync_daemon_sleep);
+        n_opts += 2;
+    }
 
-    GString *name = _dm_part_name(part);
-    GString *uuid = _dm_part_uuid(part);
-    GString *mangled_name = NULL;
+    g_string_append_printf(params, "%s %u %" PRIu32 "%s %u",
+                           raid->raid_type, n_opts, raid->stripe_size,
+                           opts->str, seg->areas->len);
+    g_string_free(opts, TRUE);
 
-    if (!_dm_create(name->str, uuid->str, cookie, 1, &target,
-                    &mangled_name, err)) {
-        mangled_name = NULL;
+    for (guint i = 0; i < seg->areas->len; i++) {
+        g_string_append(params, " - ");
+        _dm_plan_append_area(params, plan,
+                             &g_array_index(seg->areas,
+                                            struct _dm_plan_area, i));
     }
+}
 
-    g_string_free(name, TRUE);
-    g_string_free(uuid, TRUE);
-    g_string_free(target.params, TRUE);
+static void
+_dm_target_clear(gpointer const data)
+{
+    LDMDmTarget * const target = data;
 
-    return mangled_name;
+    g_free(target->type);
+    g_free(target->params);
 }
 
-static GString *
-_dm_create_spanned(const LDMVolumePrivate * const vol, GError ** const err)
+static void
+_dm_device_clear(gpointer const data)
 {
-    GString *name = NULL;
-    guint i = 0;
-    struct dm_target *targets = g_malloc(sizeof(*targets) * vol->parts->len);
+    LDMDmDevice * const device = data;
 
-    uint64_t pos = 0;
-    for (; i < vol->parts->len; i++) {
-        const LDMPartition * const part_o =
-            g_array_index(vol->parts, const LDMPartition *, i);
-        const LDMPartitionPrivate * const part = part_o->priv;
+    g_free(device->name);
+    g_free(device->uuid);
+    g_array_unref(device->targets);
+}
 
-        const LDMDiskPrivate * const disk = part->disk->priv;
-        if (!disk->device) {
-            g_set_error(err, LDM_ERROR, LDM_ERROR_MISSING_DISK,
-                        "Disk %s required by spanned volume %s is missing",
-                        disk->name, vol->name);
-            goto out;
-        }
+/* Convert plan into the public form returned by ldm_volume_dm_plan() */
+static GArray *
+_dm_plan_export(const GArray * const plan)
+{
+    GArray * const devices = g_array_sized_new(FALSE, FALSE,
+                                               sizeof(LDMDmDevice), plan->len);
+    g_array_set_clear_func(devices, _dm_device_clear);
+
+    for (guint i = 0; i < plan->len; i++) {
+        const struct _dm_plan_dev * const dev =
+            &g_array_index(plan, struct _dm_plan_dev, i);
+
+        LDMDmDevice device = {
+            .name = g_strdup(dev->name->str),
+            .uuid = g_strdup(dev->uuid->str),
+            .read_only = dev->read_only,
+            .targets = g_array_sized_new(FALSE, FALSE, sizeof(LDMDmTarget),
+                                         dev->segs->len)
+        };
+        g_array_set_clear_func(device.targets, _dm_target_clear);
+
+        guint64 start = 0;
+        for (guint j = 0; j < dev->segs->len; j++) {
+            const struct _dm_plan_seg * const seg =
+                &g_array_index(dev->segs, struct _dm_plan_seg, j);
+            GString * const params = g_string_new("");
+
+            const gchar *type = NULL;
+            switch (seg->type) {
+            case _DM_SEG_LINEAR:
+                type = "linear";
+                break;
 
-        /* Sanity check: current position from adding up sizes of partitions
-         * should equal the volume offset of the partition */
-        if (pos != part->vol_offset) {
-            g_set_error(err, LDM_ERROR, LDM_ERROR_INVALID,
-                        "Partition volume offset does not match sizes of "
-                        "preceding partitions");
-            goto out;
+            case _DM_SEG_STRIPED:
+                type = "striped";
+                g_string_append_printf(params, "%u %" PRIu32 " ",
+                                       seg->areas->len, seg->stripe_size);
+                break;
+
+            case _DM_SEG_RAID:
+                type = "raid";
+                _dm_plan_raid_params(params, plan, seg);
+                break;
+            }
+
+            if (seg->type != _DM_SEG_RAID) {
+                for (guint k = 0; k < seg->areas->len; k++) {
+                    const struct _dm_plan_area * const area =
+                        &g_array_index(seg->areas, struct _dm_plan_area, k);
+
+                    if (k > 0) g_string_append_c(params, ' ');
+                    _dm_plan_append_area(params, plan, area);
+                    g_string_append_printf(params, " %" PRIu64, area->offset);
+                }
+            }
+
+            LDMDmTarget target = {
+                .start = start,
+                .size = seg->size,
+                .type = g_strdup(type),
+                .params = g_string_free(params, FALSE)
+            };
+            g_array_append_val(device.targets, target);
+
+            start += seg->size;
         }
 
-        struct dm_target *target = &targets[i];
-        target->start = pos;
-        target->size = part->size;
-        target->type = "linear";
-        target->params = g_string_new("");
-        g_string_append_printf(target->params, "%s %" PRIu64,
-                                               disk->device,
-                                               disk->data_start + part->start);
-        pos += part->size;
+        g_array_append_val(devices, device);
     }
 
-    uint32_t cookie;
-    if (!dm_udev_create_cookie(&cookie)) {
+    return devices;
+}
+
+/* Create every device in tree, which holds the devices of a single volume.
+ * libdevmapper creates and loads the tables of the partition devices before
+ * the volume which is stacked on them, then resumes them in the same order.
+ * If any step fails, every device which was created is removed again. */
+static gboolean
+_dm_tree_activate(struct dm_tree * const tree, const uint32_t cookie,
+                  GError ** const err)
+{
+    struct dm_tree_node * const root = dm_tree_find_node(tree, 0, 0);
+    const size_t prefix_len = strlen(DM_UUID_PREFIX);
+
+    dm_tree_set_cookie(root, cookie);
+    if (dm_tree_preload_children(root, DM_UUID_PREFIX, prefix_len) &&
+        dm_tree_activate_children(root, DM_UUID_PREFIX, prefix_len))
+    {
+        return TRUE;
+    }
+
+    g_set_error_literal(err, LDM_ERROR, LDM_ERROR_EXTERNAL, _dm_err()->msg);
+
+    if (!dm_tree_deactivate_children(root, DM_UUID_PREFIX, prefix_len)) {
+        g_warning("Removing partially created devices: %s", _dm_err()->msg);
+    }
+
+    return FALSE;
+}
+
+static void
+_dm_libdm_list_free(const dm_backend_t * const backend,
+                    const gpointer snapshot)
+{
+    dm_tree_free(snapshot);
+}
+
+static const gchar *
+_dm_libdm_info(const dm_backend_t * const backend, const gpointer snapshot,
+               const gchar * const uuid)
+{
+    struct dm_tree_node * const node =
+        dm_tree_find_node_by_uuid(snapshot, uuid);
+
+    return node ? dm_tree_node_get_name(node) : NULL;
+}
+
+static gboolean
+_dm_libdm_create(const dm_backend_t * const backend, const GArray * const plan,
+                 const uint32_t cookie, GError ** const err)
+{
+    struct dm_tree * const tree = dm_tree_create();
+    if (!tree) {
+        g_set_error(err, LDM_ERROR, LDM_ERROR_EXTERNAL,
+                    "dm_tree_create: %s", _dm_err()->msg);
+        return FALSE;
+    }
+
+    const gboolean r = _dm_plan_realise(plan, tree, err) &&
+                       _dm_tree_activate(tree, cookie, err);
+    dm_tree_free(tree);
+
+    return r;
+}
+
+static gboolean
+_dm_libdm_remove(const dm_backend_t * const backend, const gpointer snapshot,
+                 const gchar * const uuid, const uint32_t cookie,
+                 GError ** const err)
+{
+    struct dm_tree_node * const node =
+        dm_tree_find_node_by_uuid(snapshot, uuid);
+    if (node == NULL) return TRUE;
+
+    if (!_dm_remove(dm_tree_node_get_name(node), cookie, err)) return FALSE;
+
+    dm_tree_set_cookie(node, cookie);
+    if (!dm_tree_deactivate_children(node, NULL, 0)) {
+        g_set_error(err, LDM_ERROR, LDM_ERROR_EXTERNAL,
+                    "removing children: %s", _dm_err()->msg);
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+static gboolean
+_dm_plan_has_uuid(const GArray * const plan, const gchar * const uuid)
+{
+    for (guint i = 0; i < plan->len; i++) {
+        if (strcmp(g_array_index(plan, struct _dm_plan_dev, i).uuid->str,
+                   uuid) == 0)
+            return TRUE;
+    }
+
+    return FALSE;
+}
+
+/* The tree for a refresh starts with the volume's existing devices, so that
+ * dm_tree_add_new_dev() gives them new tables rather than creating them again.
+ * libdevmapper loads each table with identical reload suppression: it reads
+ * the live table with DM_DEVICE_TABLE first, and only does DM_DEVICE_RELOAD if
+ * they differ. They always differ for a raid device, whose table the kernel
+ * reports in a form of its own, so _dm_vol_refresh() checks the tables in that
+ * form before calling this at all. Activation then resumes only the devices which were reloaded,
+ * the kernel swapping in the new table while the device is suspended, so
+ * anything holding the volume open keeps it. If a step fails, the volume keeps
+ * its live table. */
+static gboolean
+_dm_libdm_reload(const dm_backend_t * const backend, const gpointer snapshot,
+                 const GArray * const plan, gboolean * const changed,
+                 const uint32_t cookie, GError ** const err)
+{
+    const struct _dm_plan_dev * const vol =
+        &g_array_index(plan, struct _dm_plan_dev, plan->len - 1);
+    const size_t prefix_len = strlen(DM_UUID_PREFIX);
+
+    *changed = FALSE;
+
+    struct dm_tree_node * const live =
+        dm_tree_find_node_by_uuid(snapshot, vol->uuid->str);
+    if (live == NULL) return TRUE;
+
+    struct dm_tree * const tree = dm_tree_create();
+    if (!tree) {
+        g_set_error(err, LDM_ERROR, LDM_ERROR_EXTERNAL,
+                    "dm_tree_create: %s", _dm_err()->msg);
+        return FALSE;
+    }
+
+    /* The devices under the volume which it won't use any more */
+    GPtrArray * const unused = g_ptr_array_new_with_free_func(g_free);
+    void *handle = NULL;
+    struct dm_tree_node *child;
+    while ((child = dm_tree_next_child(&handle, live, 0)) != NULL) {
+        const gchar * const uuid = dm_tree_node_get_uuid(child);
+        if (uuid && g_str_has_prefix(uuid, DM_UUID_PREFIX) &&
+            !_dm_plan_has_uuid(plan, uuid))
+        {
+            g_ptr_array_add(unused, g_strdup(dm_tree_node_get_name(child)));
+        }
+    }
+
+    gboolean r = FALSE;
+    const struct dm_info * const info = dm_tree_node_get_info(live);
+    if (!dm_tree_add_dev(tree, info->major, info->minor)) {
         g_set_error(err, LDM_ERROR, LDM_ERROR_EXTERNAL,
-                    "dm_udev_create_cookie: %s", _dm_err_last_msg);
+                    "dm_tree_add_dev: %s", _dm_err()->msg);
         goto out;
     }
 
-    name = _dm_vol_name(vol);
-    GString *uuid = _dm_vol_uuid(vol);
+    if (!_dm_plan_realise(plan, tree, err)) goto out;
+
+    struct dm_tree_node * const root = dm_tree_find_node(tree, 0, 0);
+    dm_tree_set_cookie(root, cookie);
+    if (!dm_tree_preload_children(root, DM_UUID_PREFIX, prefix_len)) {
+        g_set_error_literal(err, LDM_ERROR, LDM_ERROR_EXTERNAL,
+                            _dm_err()->msg);
+        goto out;
+    }
+
+    /* Created and reloaded devices now have an inactive table */
+    for (guint i = 0; i < plan->len; i++) {
+        const struct _dm_plan_dev * const dev =
+            &g_array_index(plan, struct _dm_plan_dev, i);
+        const struct dm_tree_node * const node =
+            dm_tree_find_node_by_uuid(tree, dev->uuid->str);
+        if (node && dm_tree_node_get_info(node)->inactive_table)
+            *changed = TRUE;
+    }
+
+    if (!dm_tree_activate_children(root, DM_UUID_PREFIX, prefix_len)) {
+        g_set_error_literal(err, LDM_ERROR, LDM_ERROR_EXTERNAL,
+                            _dm_err()->msg);
+        goto out;
+    }
 
-    if (!_dm_create(name->str, uuid->str, cookie, vol->parts->len, targets,
-                    NULL, err)) {
-        g_string_free(name, TRUE);
-        name = NULL;
+    for (guint i = 0; i < unused->len; i++) {
+        if (!_dm_remove(g_ptr_array_index(unused, i), cookie, err)) goto out;
+        *changed = TRUE;
     }
 
-    g_string_free(uuid, TRUE);
-    dm_udev_wait(cookie);
+    r = TRUE;
 
 out:
-    for (; i > 0; i--) {
-        struct dm_target *target = &targets[i-1];
-        g_string_free(target->params, TRUE);
-    }
-    g_free(targets);
-
-    return name;
+    g_ptr_array_unref(unused);
+    dm_tree_free(tree);
+    return r;
 }
 
-static GString *
-_dm_create_striped(const LDMVolumePrivate * const vol, GError ** const err)
+static gchar *
+_dm_libdm_table(const dm_backend_t * const backend, const gpointer snapshot,
+                const gchar * const uuid, gboolean * const read_only)
 {
-    GString *name = NULL;
-    struct dm_target target;
+    gchar *r = NULL;
 
-    target.start = 0;
-    target.size = vol->size;
-    target.type = "striped";
-    target.params = g_string_new("");
-    g_string_printf(target.params, "%" PRIu32 " %" PRIu64,
-                    vol->parts->len, vol->chunk_size);
+    struct dm_task * const task = dm_task_create(DM_DEVICE_TABLE);
+    if (!task) return NULL;
 
-    for (guint i = 0; i < vol->parts->len; i++) {
-        const LDMPartition * const part_o =
-            g_array_index(vol->parts, const LDMPartition *, i);
-        const LDMPartitionPrivate * const part = part_o->priv;
+    struct dm_info info;
+    if (!dm_task_set_uuid(task, uuid) || !dm_task_run(task) ||
+        !dm_task_get_info(task, &info) || !info.exists)
+    {
+        goto out;
+    }
 
-        const LDMDiskPrivate * const disk = part->disk->priv;
-        if (!disk->device) {
-            g_set_error(err, LDM_ERROR, LDM_ERROR_MISSING_DISK,
-                        "Disk %s required by striped volume %s is missing",
-                        disk->name, vol->name);
-            goto out;
+    GString * const table = g_string_new("");
+    void *next = NULL;
+    do {
+        uint64_t start, length;
+        char *type, *params;
+
+        next = dm_get_next_target(task, next, &start, &length, &type, &params);
+        if (type) {
+            g_string_append_printf(table, "%" PRIu64 " %" PRIu64 " %s %s\n",
+                                   start, length, type, params ? params : "");
         }
+    } while (next);
 
-        g_string_append_printf(target.params, " %s %" PRIu64,
-                                               disk->device,
-                                               disk->data_start + part->start);
-    }
+    *read_only = info.read_only;
+    r = g_string_free(table, FALSE);
 
-    uint32_t cookie;
-    if (!dm_udev_create_cookie(&cookie)) {
-        g_set_error(err, LDM_ERROR, LDM_ERROR_EXTERNAL,
-                    "dm_udev_create_cookie: %s", _dm_err_last_msg);
-        goto out;
-    }
+out:
+    dm_task_destroy(task);
+    return r;
+}
 
-    name = _dm_vol_name(vol);
-    GString *uuid = _dm_vol_uuid(vol);
+static gboolean
+_dm_libdm_dev_number(const dm_backend_t * const backend,
+                     const gpointer snapshot, const gchar * const disk,
+                     const gchar * const uuid,
+                     guint * const major_r, guint * const minor_r)
+{
+    if (disk) {
+        struct stat st;
+        if (stat(disk, &st) == -1 || !S_ISBLK(st.st_mode)) return FALSE;
 
-    if (!_dm_create(name->str, uuid->str, cookie, 1, &target, NULL, err)) {
-        g_string_free(name, TRUE);
-        name = NULL;
+        *major_r = major(st.st_rdev);
+        *minor_r = minor(st.st_rdev);
+        return TRUE;
     }
 
-    g_string_free(uuid, TRUE);
-    dm_udev_wait(cookie);
+    const struct dm_tree_node * const node =
+        dm_tree_find_node_by_uuid(snapshot, uuid);
+    if (node == NULL) return FALSE;
 
-out:
-    g_string_free(target.params, TRUE);
+    const struct dm_info * const info = dm_tree_node_get_info(node);
+    *major_r = info->major;
+    *minor_r = info->minor;
+    return TRUE;
+}
 
-    return name;
+static gboolean
+_dm_libdm_cookie_create(const dm_backend_t * const backend,
+                        uint32_t * const cookie, GError ** const err)
+{
+    if (dm_udev_create_cookie(cookie)) return TRUE;
+
+    g_set_error(err, LDM_ERROR, LDM_ERROR_EXTERNAL,
+                "dm_udev_create_cookie: %s", _dm_err()->msg);
+    return FALSE;
 }
 
-static GString *
-_dm_create_mirrored(const LDMVolumePrivate * const vol, GError ** const err)
+static void
+_dm_libdm_udev_wait(const dm_backend_t * const backend, const uint32_t cookie)
 {
-    GString *name = NULL;
-    struct dm_target target;
+    dm_udev_wait(cookie);
+}
 
-    target.start = 0;
-    target.size = vol->size;
-    target.type = "raid";
-    target.params = g_string_new("");
-    g_string_printf(target.params, "raid1 1 128 %u", vol->parts->len);
+static const dm_backend_t _dm_libdm_backend = {
+    .list = _dm_libdm_list,
+    .list_free = _dm_libdm_list_free,
+    .info = _dm_libdm_info,
+    .create = _dm_libdm_create,
+    .remove = _dm_libdm_remove,
+    .table = _dm_libdm_table,
+    .dev_number = _dm_libdm_dev_number,
+    .reload = _dm_libdm_reload,
+    .cookie_create = _dm_libdm_cookie_create,
+    .udev_wait = _dm_libdm_udev_wait
+};
 
-    GArray * devices = g_array_new(FALSE, FALSE, sizeof(GString *));
-    g_array_set_clear_func(devices, _free_gstring);
+static gboolean
+_dm_vol_create(const LDMVolumePrivate * const vol,
+               struct _dm_batch * const batch,
+               GString ** const created, GError ** const err)
+{
+    if (created) *created = NULL;
 
-    uint32_t cookie;
-    if (!dm_udev_create_cookie(&cookie)) {
-        g_set_error(err, LDM_ERROR, LDM_ERROR_EXTERNAL,
-                    "dm_udev_create_cookie: %s", _dm_err_last_msg);
-        goto out;
-    }
+    /* Check if the device already exists */
+    GString *uuid = _dm_vol_uuid(vol);
+    const gchar * const exists =
+        batch->backend->info(batch->backend, batch->snapshot, uuid->str);
+    g_string_free(uuid, TRUE);
+    if (exists) return TRUE;
 
-    const char *dir = dm_dir();
+    /* A failed create is rolled back, but the rollback can itself fail */
+    batch->changed = TRUE;
 
-    int found = 0;
-    for (guint i = 0; i < vol->parts->len; i++) {
-        const LDMPartition * const part_o =
-            g_array_index(vol->parts, const LDMPartition *, i);
-        const LDMPartitionPrivate * const part = part_o->priv;
+    GArray * const plan =
+        _dm_plan_volume(vol, batch->flags, batch->raid_params, err);
+    if (plan == NULL) return FALSE;
 
-        GString * chunk = _dm_create_part(part, cookie, err);
-        if (chunk == NULL) {
-            if (err && (*err)->code == LDM_ERROR_MISSING_DISK) {
-                g_warning("%s", (*err)->message);
-                g_error_free(*err); *err = NULL;
-                g_string_append(target.params, " - -");
-                continue;
-            } else {
-                goto out;
-            }
-        }
+    const gboolean r =
+        batch->backend->create(batch->backend, plan, batch->cookie, err);
+    g_array_unref(plan);
 
-        found++;
-        g_array_append_val(devices, chunk);
-        g_string_append_printf(target.params, " - %s/%s", dir, chunk->str);
-    }
+    if (r && created) *created = _dm_vol_name(vol);
 
-    if (found == 0) {
-        g_set_error(err, LDM_ERROR, LDM_ERROR_MISSING_DISK,
-                    "Mirrored volume is missing all partitions");
-        return FALSE;
-    }
+    return r;
+}
 
-    /* Wait until all partitions have been created */
-    dm_udev_wait(cookie);
-    if (!dm_udev_create_cookie(&cookie)) {
-        g_set_error(err, LDM_ERROR, LDM_ERROR_EXTERNAL,
-                    "dm_udev_create_cookie: %s", _dm_err_last_msg);
-        goto out;
-    }
+static gboolean
+_dm_vol_remove(const LDMVolumePrivate * const vol,
+               struct _dm_batch * const batch,
+               GString ** const removed, GError ** const err)
+{
+    if (removed) *removed = NULL;
 
-    name = _dm_vol_name(vol);
     GString *uuid = _dm_vol_uuid(vol);
+    if (!batch->backend->info(batch->backend, batch->snapshot, uuid->str)) {
+        g_string_free(uuid, TRUE);
+        return TRUE;
+    }
+
+    batch->changed = TRUE;
+
+    const gboolean r = batch->backend->remove(batch->backend, batch->snapshot,
+                                              uuid->str, batch->cookie, err);
+    g_string_free(uuid, TRUE);
+    if (!r) return FALSE;
 
-    if (!_dm_create(name->str, uuid->str, cookie, 1, &target, NULL, err)) {
+    GString * const name = _dm_vol_name(vol);
+    if (removed)
+        *removed = name;
+    else
         g_string_free(name, TRUE);
-        name = NULL;
+
+    return TRUE;
+}
+
+/* Append the device under area as the kernel gives it in a table. Returns
+ * FALSE if its device number isn't known. */
+static gboolean
+_dm_kernel_append_area(GString * const params,
+                       const dm_backend_t * const backend,
+                       const gpointer snapshot, const GArray * const plan,
+                       const struct _dm_plan_area * const area)
+{
+    guint maj, min;
+
+    if (area->disk) {
+        if (!backend->dev_number(backend, snapshot, area->disk, NULL,
+                                 &maj, &min))
+            return FALSE;
+    } else if (area->dev >= 0) {
+        const struct _dm_plan_dev * const dev =
+            &g_array_index(plan, struct _dm_plan_dev, area->dev);
+        if (!backend->dev_number(backend, snapshot, NULL, dev->uuid->str,
+                                 &maj, &min))
+            return FALSE;
+    } else {
+        g_string_append_c(params, '-');
+        return TRUE;
     }
 
-    g_string_free(uuid, TRUE);
-    dm_udev_wait(cookie);
+    g_string_append_printf(params, "%u:%u", maj, min);
+    return TRUE;
+}
 
-    g_array_unref(devices); devices = NULL;
+/* Format the parameters of a raid segment the way the kernel reports them,
+ * which isn't the way libdevmapper loaded them: raid1 has no chunk size, and
+ * the options come in the order dm-raid emits them */
+static gboolean
+_dm_kernel_raid_params(GString * const params,
+                       const dm_backend_t * const backend,
+                       const gpointer snapshot, const GArray * const plan,
+                       const struct _dm_plan_seg * const seg)
+{
+    const struct dm_tree_node_raid_params * const raid = &seg->raid;
+    GString * const opts = g_string_new("");
+    guint n_opts = 1;
 
-out:
-    if (devices) {
-        GError *cleanup_err = NULL;
-        for (int i = devices->len; i > 0; i--) {
-            GString *device = g_array_index(devices, GString *, i - 1);
-            if (!_dm_remove(device->str, 0, &cleanup_err)) {
-                g_warning("%s", cleanup_err->message);
-                g_error_free(cleanup_err); cleanup_err = NULL;
-            }
+    if (raid->flags & DM_NOSYNC) {
+        g_string_append(opts, " nosync"); n_opts++;
+    }
+    if (raid->sync_daemon_sleep) {
+        g_string_append_printf(opts, " daemon_sleep %" PRIu32,
+                               raid->sync_daemon_sleep);
+        n_opts += 2;
+    }
+    if (raid->min_recovery_rate) {
+        g_string_append_printf(opts, " min_recovery_rate %" PRIu32,
+                               raid->min_recovery_rate);
+        n_opts += 2;
+    }
+    if (raid->max_recovery_rate) {
+        g_string_append_printf(opts, " max_recovery_rate %" PRIu32,
+                               raid->max_recovery_rate);
+        n_opts += 2;
+    }
+    for (guint i = 0; i < seg->areas->len && i < 64; i++) {
+        if (raid->writemostly & (UINT64_C(1) << i)) {
+            g_string_append_printf(opts, " write_mostly %u", i);
+            n_opts += 2;
         }
-        g_array_unref(devices); devices = NULL;
+    }
+    if (raid->stripe_cache) {
+        g_string_append_printf(opts, " stripe_cache %" PRIu32,
+                               raid->stripe_cache);
+        n_opts += 2;
+    }
+    if (raid->region_size) {
+        g_string_append_printf(opts, " region_size %" PRIu32,
+                               raid->region_size);
+        n_opts += 2;
     }
 
-    g_string_free(target.params, TRUE);
+    const guint32 chunk =
+        strcmp(raid->raid_type, "raid1") == 0 ? 0 : raid->stripe_size;
+    g_string_append_printf(params, "%s %u %" PRIu32 "%s %u",
+                           raid->raid_type, n_opts, chunk, opts->str,
+                           seg->areas->len);
+    g_string_free(opts, TRUE);
+
+    for (guint i = 0; i < seg->areas->len; i++) {
+        g_string_append(params, " - ");
+        if (!_dm_kernel_append_area(params, backend, snapshot, plan,
+                                    &g_array_index(seg->areas,
+                                                   struct _dm_plan_area, i)))
+            return FALSE;
+    }
 
-    return name;
+    return TRUE;
 }
 
-static GString *
-_dm_create_raid5(const LDMVolumePrivate * const vol, GError ** const err)
+/* Returns the table of dev as the kernel would report it once loaded, in the
+ * form of the backend's table operation, or NULL if a device it is stacked on
+ * doesn't exist */
+static gchar *
+_dm_kernel_table(const dm_backend_t * const backend, const gpointer snapshot,
+                 const GArray * const plan,
+                 const struct _dm_plan_dev * const dev)
 {
-    GString *name = NULL;
-    GString *uuid = NULL;
-    struct dm_target target;
+    GString * const table = g_string_new("");
+    gboolean r = TRUE;
+    guint64 start = 0;
 
-    target.start = 0;
-    target.size = vol->size;
-    target.type = "raid";
-    target.params = g_string_new("");
-    g_string_append_printf(target.params, "raid5_ls 1 %" PRIu64 " %" PRIu32,
-                           vol->chunk_size, vol->parts->len);
+    for (guint i = 0; r && i < dev->segs->len; i++) {
+        const struct _dm_plan_seg * const seg =
+            &g_array_index(dev->segs, struct _dm_plan_seg, i);
 
-    GArray * devices = g_array_new(FALSE, FALSE, sizeof(GString *));
-    g_array_set_clear_func(devices, _free_gstring);
+        g_string_append_printf(table, "%" PRIu64 " %" PRIu64 " ",
+                               start, seg->size);
+        switch (seg->type) {
+        case _DM_SEG_LINEAR:
+            g_string_append(table, "linear ");
+            break;
 
-    uint32_t cookie;
-    if (!dm_udev_create_cookie(&cookie)) {
-        g_set_error(err, LDM_ERROR, LDM_ERROR_EXTERNAL,
-                    "dm_udev_create_cookie: %s", _dm_err_last_msg);
-        goto out;
-    }
+        case _DM_SEG_STRIPED:
+            g_string_append_printf(table, "striped %u %" PRIu32 " ",
+                                   seg->areas->len, seg->stripe_size);
+            break;
 
-    const char *dir = dm_dir();
+        case _DM_SEG_RAID:
+            g_string_append(table, "raid ");
+            r = _dm_kernel_raid_params(table, backend, snapshot, plan, seg);
+            break;
+        }
 
-    guint n_found = 0;
-    for (guint i = 0; i < vol->parts->len; i++) {
-        const LDMPartition * const part_o =
-            g_array_index(vol->parts, const LDMPartition *, i);
-        const LDMPartitionPrivate * const part = part_o->priv;
+        for (guint j = 0; r && seg->type != _DM_SEG_RAID &&
+                          j < seg->areas->len; j++)
+        {
+            const struct _dm_plan_area * const area =
+                &g_array_index(seg->areas, struct _dm_plan_area, j);
 
-        GString * chunk = _dm_create_part(part, cookie, err);
-        if (chunk == NULL) {
-            if (err && (*err)->code == LDM_ERROR_MISSING_DISK) {
-                g_warning("%s", (*err)->message);
-                g_error_free(*err); *err = NULL;
-                g_string_append(target.params, " - -");
-                continue;
-            } else {
-                goto out;
-            }
+            if (j > 0) g_string_append_c(table, ' ');
+            r = _dm_kernel_append_area(table, backend, snapshot, plan, area);
+            g_string_append_printf(table, " %" PRIu64, area->offset);
         }
 
-        n_found++;
-        g_array_append_val(devices, chunk);
-        g_string_append_printf(target.params, " - %s/%s", dir, chunk->str);
+        g_string_append_c(table, '\n');
+        start += seg->size;
     }
 
-    if (n_found < vol->parts->len - 1) {
-        g_set_error(err, LDM_ERROR, LDM_ERROR_MISSING_DISK,
-                    "RAID5 volume is missing more than 1 component");
-        goto out;
-    }
+    return g_string_free(table, !r);
+}
 
-    /* Wait until all partitions have been created */
-    dm_udev_wait(cookie);
-    if (!dm_udev_create_cookie(&cookie)) {
-        g_set_error(err, LDM_ERROR, LDM_ERROR_EXTERNAL,
-                    "dm_udev_create_cookie: %s", _dm_err_last_msg);
-        goto out;
+/* Whether every device of plan exists with the planned table and mode.
+ * libdevmapper compares each table it loads with the live one as text, but
+ * the kernel doesn't report a raid table the way it was loaded, so it would
+ * reload a raid device on every refresh. The tables are compared in the
+ * kernel's form here instead. */
+static gboolean
+_dm_plan_is_live(const dm_backend_t * const backend, const gpointer snapshot,
+                 const GArray * const plan)
+{
+    for (guint i = 0; i < plan->len; i++) {
+        const struct _dm_plan_dev * const dev =
+            &g_array_index(plan, struct _dm_plan_dev, i);
+
+        gboolean read_only;
+        gchar * const live =
+            backend->table(backend, snapshot, dev->uuid->str, &read_only);
+        if (live == NULL) return FALSE;
+
+        gchar * const planned = _dm_kernel_table(backend, snapshot, plan, dev);
+        const gboolean same = planned && strcmp(live, planned) == 0 &&
+                              !read_only == !dev->read_only;
+        g_free(planned);
+        g_free(live);
+
+        if (!same) return FALSE;
     }
 
-    name = _dm_vol_name(vol);
-    uuid = _dm_vol_uuid(vol);
+    return TRUE;
+}
 
-    if (!_dm_create(name->str, uuid->str, cookie, 1, &target, NULL, err)) {
-        g_string_free(name, TRUE); name = NULL;
-        g_string_free(uuid, TRUE);
-        goto out;
-    }
+static gboolean
+_dm_vol_refresh(const LDMVolumePrivate * const vol,
+                struct _dm_batch * const batch,
+                GString ** const refreshed, GError ** const err)
+{
+    if (refreshed) *refreshed = NULL;
 
+    /* A volume without a device has nothing to refresh */
+    GString *uuid = _dm_vol_uuid(vol);
+    const gchar * const exists =
+        batch->backend->info(batch->backend, batch->snapshot, uuid->str);
     g_string_free(uuid, TRUE);
-    dm_udev_wait(cookie);
+    if (!exists) return TRUE;
 
-    g_array_unref(devices); devices = NULL;
+    GArray * const plan =
+        _dm_plan_volume(vol, batch->flags, batch->raid_params, err);
+    if (plan == NULL) return FALSE;
 
-out:
-    if (devices) {
-        GError *cleanup_err = NULL;
-        for (int i = devices->len; i > 0; i--) {
-            GString *device = g_array_index(devices, GString *, i - 1);
-            if (!_dm_remove(device->str, 0, &cleanup_err)) {
-                g_warning("%s", cleanup_err->message);
-                g_error_free(cleanup_err); cleanup_err = NULL;
-            }
-        }
-        g_array_unref(devices); devices = NULL;
+    if (_dm_plan_is_live(batch->backend, batch->snapshot, plan)) {
+        g_array_unref(plan);
+        return TRUE;
     }
 
-    g_string_free(target.params, TRUE);
+    gboolean changed = FALSE;
+    const gboolean r = batch->backend->reload(batch->backend, batch->snapshot,
+                                              plan, &changed, batch->cookie,
+                                              err);
+    g_array_unref(plan);
 
-    return name;
+    /* A failed refresh may still have changed some of the devices */
+    if (changed || !r) batch->changed = TRUE;
+
+    if (r && changed && refreshed) *refreshed = _dm_vol_name(vol);
+
+    return r;
 }
 
 GString *
@@ -3092,12 +7113,22 @@ ldm_volume_dm_get_name(const LDMVolume * const o)
     return _dm_vol_name(o->priv);
 }
 
+/* Volumes and partitions not held by an LDM object have no cache to share, and
+ * use a private one for the duration of the call. */
+static struct _dm_cache *
+_dm_cache_get(struct _dm_cache * const cache)
+{
+    return cache ? _dm_cache_ref(cache) : _dm_cache_new();
+}
+
 gchar *
 ldm_partition_dm_get_device(const LDMPartition * const o, GError ** const err)
 {
+    struct _dm_cache * const cache = _dm_cache_get(o->priv->dm_cache);
     GString *uuid = _dm_part_uuid(o->priv);
-    gchar* r = _dm_get_device(uuid->str, err);
+    gchar* r = _dm_get_device(cache, uuid->str, err);
     g_string_free(uuid, TRUE);
+    _dm_cache_unref(cache);
 
     return r;
 }
@@ -3105,61 +7136,52 @@ ldm_partition_dm_get_device(const LDMPartition * const o, GError ** const err)
 gchar *
 ldm_volume_dm_get_device(const LDMVolume * const o, GError ** const err)
 {
+    struct _dm_cache * const cache = _dm_cache_get(o->priv->dm_cache);
     GString *uuid = _dm_vol_uuid(o->priv);
-    gchar* r = _dm_get_device(uuid->str, err);
+    gchar* r = _dm_get_device(cache, uuid->str, err);
     g_string_free(uuid, TRUE);
+    _dm_cache_unref(cache);
 
     return r;
 }
 
 gboolean
-ldm_volume_dm_create(const LDMVolume * const o, GString **created,
-                     GError ** const err)
+ldm_volume_dm_create_full(const LDMVolume * const o, const LDMDmFlags flags,
+                          const LDMRaidParams * const params,
+                          GString **created, GError ** const err)
 {
     if (created) *created = NULL;
 
-    const LDMVolumePrivate * const vol = o->priv;
-
-    /* Check if the device already exists */
-    GString *uuid = _dm_vol_uuid(vol);
-    if (_dm_find_tree_node_by_uuid(uuid->str, NULL, NULL, err)) {
-        g_string_free(uuid, TRUE);
-        return TRUE;
+    struct _dm_cache * const cache = _dm_cache_get(o->priv->dm_cache);
+    struct _dm_batch batch;
+    gboolean r = FALSE;
+    if (_dm_batch_begin(&batch, cache, flags, params, err)) {
+        r = _dm_vol_create(o->priv, &batch, created, err);
+        _dm_batch_end(&batch);
     }
-    g_string_free(uuid, TRUE);
-
-    GString *name = NULL;
-    switch (vol->type) {
-    case LDM_VOLUME_TYPE_SIMPLE:
-    case LDM_VOLUME_TYPE_SPANNED:
-        name = _dm_create_spanned(vol, err);
-        break;
-
-    case LDM_VOLUME_TYPE_STRIPED:
-        name = _dm_create_striped(vol, err);
-        break;
 
-    case LDM_VOLUME_TYPE_MIRRORED:
-        name = _dm_create_mirrored(vol, err);
-        break;
+    _dm_cache_unref(cache);
+    return r;
+}
 
-    case LDM_VOLUME_TYPE_RAID5:
-        name = _dm_create_raid5(vol, err);
-        break;
+GArray *
+ldm_volume_dm_plan(const LDMVolume * const o, const LDMDmFlags flags,
+                   const LDMRaidParams * const params, GError ** const err)
+{
+    GArray * const plan = _dm_plan_volume(o->priv, flags, params, err);
+    if (plan == NULL) return NULL;
 
-    default:
-        /* Should be impossible */
-        g_error("Unexpected volume type: %u", vol->type);
-    }
+    GArray * const devices = _dm_plan_export(plan);
+    g_array_unref(plan);
 
-    gboolean r = name != NULL;
-    
-    if (created)
-        *created = name;
-    else if (name)
-        g_string_free(name, TRUE);
+    return devices;
+}
 
-    return r;
+gboolean
+ldm_volume_dm_create(const LDMVolume * const o, GString **created,
+                     GError ** const err)
+{
+    return ldm_volume_dm_create_full(o, 0, NULL, created, err);
 }
 
 gboolean
@@ -3168,52 +7190,125 @@ ldm_volume_dm_remove(const LDMVolume * const o, GString **removed,
 {
     if (removed) *removed = NULL;
 
-    const LDMVolumePrivate * const vol = o->priv;
+    struct _dm_cache * const cache = _dm_cache_get(o->priv->dm_cache);
+    struct _dm_batch batch;
+    gboolean r = FALSE;
+    if (_dm_batch_begin(&batch, cache, 0, NULL, err)) {
+        r = _dm_vol_remove(o->priv, &batch, removed, err);
+        _dm_batch_end(&batch);
+    }
+
+    _dm_cache_unref(cache);
+    return r;
+}
+
+gboolean
+ldm_volume_dm_refresh(const LDMVolume * const o, const LDMDmFlags flags,
+                      const LDMRaidParams * const params,
+                      GString **refreshed, GError ** const err)
+{
+    if (refreshed) *refreshed = NULL;
 
+    struct _dm_cache * const cache = _dm_cache_get(o->priv->dm_cache);
+    struct _dm_batch batch;
     gboolean r = FALSE;
+    if (_dm_batch_begin(&batch, cache, flags, params, err)) {
+        r = _dm_vol_refresh(o->priv, &batch, refreshed, err);
+        _dm_batch_end(&batch);
+    }
 
-    struct dm_tree *tree = NULL;
-    struct dm_tree_node *node = NULL;
+    _dm_cache_unref(cache);
+    return r;
+}
 
-    GString *uuid = _dm_vol_uuid(vol);
-    gboolean found = _dm_find_tree_node_by_uuid(uuid->str, &node, &tree, err);
-    g_string_free(uuid, TRUE);
+static void
+_dm_result_clear(gpointer const data)
+{
+    LDMDmResult * const result = data;
 
-    GString *name = NULL;
-    if (found) {
-        uint32_t cookie;
-        if (!dm_udev_create_cookie(&cookie)) {
-            g_set_error(err, LDM_ERROR, LDM_ERROR_EXTERNAL,
-                        "dm_udev_create_cookie: %s", _dm_err_last_msg);
-            goto out;
-        }
+    g_object_unref(result->disk_group);
+    g_object_unref(result->volume);
+    if (result->device) g_string_free(result->device, TRUE);
+    if (result->error) g_error_free(result->error);
+}
 
-        name = _dm_vol_name(vol);
-        if (!_dm_remove(name->str, cookie, err)) {
-            g_string_free(name, TRUE); name = NULL;
-            goto out;
-        }
+typedef gboolean (*_dm_vol_op_t)(const LDMVolumePrivate *,
+                                 struct _dm_batch *,
+                                 GString **, GError **);
 
-        dm_tree_set_cookie(node, cookie);
-        if (!dm_tree_deactivate_children(node, NULL, 0)) {
-            g_set_error(err, LDM_ERROR, LDM_ERROR_EXTERNAL,
-                        "removing children: %s", _dm_err_last_msg);
-            g_string_free(name, TRUE); name = NULL;
-            goto out;
-        }
+/* Apply op to every volume of every disk group. A volume which fails is
+ * recorded in its result, and doesn't stop the others. Results are in disk
+ * group and volume order.
+ *
+ * The volumes are done in turn, as libdevmapper isn't thread-safe. Their
+ * device mapper ioctls are quick: what takes the time is udev processing the
+ * events of the new devices, and with the batch's single cookie it does that
+ * for every volume while the next is being created. */
+static GArray *
+_dm_all(LDM * const o, const _dm_vol_op_t op, const LDMDmFlags flags,
+        const LDMRaidParams * const params, GError ** const err)
+{
+    struct _dm_batch batch;
+    if (!_dm_batch_begin(&batch, o->priv->dm_cache, flags, params, err))
+        return NULL;
 
-        dm_udev_wait(cookie);
+    GArray * const results = g_array_new(FALSE, FALSE, sizeof(LDMDmResult));
+    g_array_set_clear_func(results, _dm_result_clear);
+
+    GArray * const dgs = ldm_get_disk_groups(o);
+    for (guint i = 0; dgs && i < dgs->len; i++) {
+        LDMDiskGroup * const dg = g_array_index(dgs, LDMDiskGroup *, i);
+        const GArray * const vols = dg->priv->vols;
+
+        for (guint j = 0; j < vols->len; j++) {
+            LDMVolume * const vol = g_array_index(vols, LDMVolume *, j);
+
+            LDMDmResult result = {
+                .disk_group = g_object_ref(dg),
+                .volume = g_object_ref(vol)
+            };
+            (*op)(vol->priv, &batch, &result.device, &result.error);
+            g_array_append_val(results, result);
+        }
     }
+    if (dgs) g_array_unref(dgs);
 
-    r = TRUE;
+    _dm_batch_end(&batch);
+    return results;
+}
 
-out:
-    if (tree) dm_tree_free(tree);
+GArray *
+ldm_dm_create_all_full(LDM * const o, const LDMDmFlags flags,
+                       const LDMRaidParams * const params, GError ** const err)
+{
+    return _dm_all(o, _dm_vol_create, flags, params, err);
+}
 
-    if (removed)
-        *removed = name;
-    else if (name)
-        g_string_free(name, TRUE);
+GArray *
+ldm_dm_create_all(LDM * const o, GError ** const err)
+{
+    return ldm_dm_create_all_full(o, 0, NULL, err);
+}
 
-    return r;
+GArray *
+ldm_dm_remove_all(LDM * const o, GError ** const err)
+{
+    return _dm_all(o, _dm_vol_remove, 0, NULL, err);
+}
+
+GArray *
+ldm_dm_refresh_all(LDM * const o, const LDMDmFlags flags,
+                   const LDMRaidParams * const params, GError ** const err)
+{
+    return _dm_all(o, _dm_vol_refresh, flags, params, err);
+}
+
+void
+ldm_dm_refresh_cache(LDM * const o)
+{
+    struct _dm_cache * const cache = o->priv->dm_cache;
+
+    g_mutex_lock(&cache->lock);
+    g_mutex_lock(&_dm_backend_lock);
+    _dm_cache_unlock(cache, TRUE);
 }
@@ -19,6 +19,7 @@
 #define LIBLDM_LDM_H__
 
 #include <glib-object.h>
+#include <sys/uio.h>
 
 G_BEGIN_DECLS
 
@@ -70,7 +71,13 @@ typedef struct _LDMPrivate LDMPrivate;
 /**
  * LDM:
  *
- * An LDM metadata scanner
+ * An LDM metadata scanner.
+ *
+ * An LDM object may be used from several threads at once. Devices added with
+ * ldm_add() and ldm_add_fd() are published as a new set of disk groups, leaving
+ * objects obtained earlier unchanged. A reader therefore always sees a
+ * consistent model, but must call ldm_get_disk_groups() or
+ * ldm_find_disk_group() again to see the effect of a later scan.
  */
 typedef struct _LDM LDM;
 struct _LDM
@@ -244,6 +251,358 @@ typedef struct
     GObjectClass parent_class;
 } LDMDiskClass;
 
+/* Info structs */
+
+/**
+ * LDMDiskGroupInfo:
+ * @name: The Windows-assigned name
+ * @guid: (array fixed-size=16): The Windows-assigned GUID in binary form
+ *
+ * A snapshot of the properties of an #LDMDiskGroup, filled by
+ * ldm_disk_group_get_info(). Pointers are owned by the disk group and are
+ * valid for its lifetime.
+ */
+typedef struct
+{
+    const gchar *name;
+    const guint8 *guid;
+} LDMDiskGroupInfo;
+
+/**
+ * LDMVolumeInfo:
+ * @name: The Windows-assigned name
+ * @guid: (array fixed-size=16): The Windows-assigned GUID in binary form
+ * @type: The volume type
+ * @size: The volume size in sectors
+ * @part_type: The MBR-style partition type
+ * @hint: The mounting hint, or NULL
+ * @chunk_size: The chunk size in sectors of a striped or raid5 volume, or 0
+ * @n_partitions: The number of partitions in the volume
+ *
+ * A snapshot of the properties of an #LDMVolume, filled by
+ * ldm_volume_get_info(). Pointers are owned by the volume and are valid for
+ * its lifetime.
+ */
+typedef struct
+{
+    const gchar *name;
+    const guint8 *guid;
+    LDMVolumeType type;
+    guint64 size;
+    guint8 part_type;
+    const gchar *hint;
+    guint64 chunk_size;
+    guint n_partitions;
+} LDMVolumeInfo;
+
+/**
+ * LDMPartitionInfo:
+ * @name: The Windows-assigned name
+ * @start: The start sector, measured from the start of the underlying disk
+ * @size: The size in sectors
+ * @disk: (transfer none): The underlying disk
+ *
+ * A snapshot of the properties of an #LDMPartition, filled by
+ * ldm_partition_get_info(). Pointers are owned by the partition and are valid
+ * for its lifetime.
+ */
+typedef struct
+{
+    const gchar *name;
+    guint64 start;
+    guint64 size;
+    const LDMDisk *disk;
+} LDMPartitionInfo;
+
+/**
+ * LDMDiskInfo:
+ * @name: The Windows-assigned name
+ * @guid: (array fixed-size=16): The Windows-assigned GUID in binary form
+ * @device: The host device, or NULL if the disk is missing
+ * @data_start: The start sector of the data portion
+ * @data_size: The size in sectors of the data portion
+ * @metadata_start: The start sector of the metadata portion
+ * @metadata_size: The size in sectors of the metadata portion
+ *
+ * A snapshot of the properties of an #LDMDisk, filled by ldm_disk_get_info().
+ * Pointers are owned by the disk and are valid for its lifetime.
+ */
+typedef struct
+{
+    const gchar *name;
+    const guint8 *guid;
+    const gchar *device;
+    guint64 data_start;
+    guint64 data_size;
+    guint64 metadata_start;
+    guint64 metadata_size;
+} LDMDiskInfo;
+
+/* Address translation */
+
+/**
+ * LDMExtentType:
+ * @LDM_EXTENT_TYPE_DATA: The extent holds volume data
+ * @LDM_EXTENT_TYPE_MIRROR: The extent holds another copy of volume data, on a
+ *                          further leg of a mirrored volume
+ * @LDM_EXTENT_TYPE_PARITY: The extent holds the RAID5 parity protecting the
+ *                          data extent which precedes it
+ */
+typedef enum {
+    LDM_EXTENT_TYPE_DATA,
+    LDM_EXTENT_TYPE_MIRROR,
+    LDM_EXTENT_TYPE_PARITY
+} LDMExtentType;
+
+#define LDM_TYPE_EXTENT_TYPE (ldm_extent_type_get_type())
+
+GType ldm_extent_type_get_type(void);
+
+/**
+ * LDMExtent:
+ * @offset: The offset in bytes of the mapped range in the volume
+ * @length: The length in bytes of the mapped range
+ * @type: What the extent holds
+ * @column: The index of @partition in the volume's partitions
+ * @partition: (transfer none): The partition holding the extent
+ * @disk: (transfer none): The disk holding the extent
+ * @disk_offset: The offset in bytes of the extent on the host device of @disk
+ *
+ * A contiguous range of a volume and where it is stored. Offsets are based on
+ * 512 byte sectors, as used by device mapper.
+ */
+typedef struct
+{
+    guint64 offset;
+    guint64 length;
+    LDMExtentType type;
+    guint column;
+    const LDMPartition *partition;
+    const LDMDisk *disk;
+    guint64 disk_offset;
+} LDMExtent;
+
+/**
+ * LDMRange:
+ * @offset: The offset in bytes of the range in the volume
+ * @length: The length in bytes of the range
+ *
+ * A range of a volume, passed to ldm_volume_map_batch().
+ */
+typedef struct
+{
+    guint64 offset;
+    guint64 length;
+} LDMRange;
+
+/* Volume reader */
+
+/**
+ * LDMVolumeHandle:
+ *
+ * An open volume, created by ldm_volume_open(), which reads directly from the
+ * member disks without device mapper.
+ */
+typedef struct _LDMVolumeHandle LDMVolumeHandle;
+
+/**
+ * LDMVolumeStats:
+ * @bytes_read: The number of bytes returned by reads of the handle
+ * @bytes_reconstructed: The number of bytes rebuilt from the parity of a
+ *                       degraded RAID5 volume
+ * @reconstruct_usec: The time in microseconds spent in reads which rebuilt
+ *                    data, including reading the surviving columns
+ * @xor_impl: The name of the XOR implementation used for reconstruction
+ * @aio_engine: The engine used for asynchronous reads: "io_uring", "threads",
+ *              or NULL if none has been made
+ * @bytes_written: The number of bytes written to the handle
+ * @disk_writes: The number of writes issued to member disks. Coalescing keeps
+ *               this low for small sequential writes.
+ *
+ * I/O statistics of an #LDMVolumeHandle, returned by
+ * ldm_volume_handle_get_stats().
+ */
+typedef struct
+{
+    guint64 bytes_read;
+    guint64 bytes_reconstructed;
+    guint64 reconstruct_usec;
+    const gchar *xor_impl;
+    const gchar *aio_engine;
+    guint64 bytes_written;
+    guint64 disk_writes;
+} LDMVolumeStats;
+
+/**
+ * LDMVolumeReadCallback:
+ * @h: The #LDMVolumeHandle which was read
+ * @result: The number of bytes read, or -1 on error
+ * @err: (allow-none): The error if @result is -1. It is freed when the
+ *       callback returns.
+ * @user_data: The data passed to ldm_volume_read_async()
+ *
+ * Called when an asynchronous read completes.
+ */
+typedef void (*LDMVolumeReadCallback)(LDMVolumeHandle *h, gssize result,
+                                      const GError *err, gpointer user_data);
+
+#define LDM_VOLUME_QUEUE_DEPTH_DEFAULT 32
+
+/* Filesystem probe */
+
+/**
+ * LDMFsType:
+ * @LDM_FS_TYPE_UNKNOWN: The contents of the volume were not recognised
+ * @LDM_FS_TYPE_NTFS: NTFS
+ * @LDM_FS_TYPE_REFS: ReFS
+ * @LDM_FS_TYPE_FAT12: FAT12
+ * @LDM_FS_TYPE_FAT16: FAT16
+ * @LDM_FS_TYPE_FAT32: FAT32
+ * @LDM_FS_TYPE_EXFAT: exFAT
+ * @LDM_FS_TYPE_BITLOCKER: A BitLocker encrypted volume
+ */
+typedef enum {
+    LDM_FS_TYPE_UNKNOWN,
+    LDM_FS_TYPE_NTFS,
+    LDM_FS_TYPE_REFS,
+    LDM_FS_TYPE_FAT12,
+    LDM_FS_TYPE_FAT16,
+    LDM_FS_TYPE_FAT32,
+    LDM_FS_TYPE_EXFAT,
+    LDM_FS_TYPE_BITLOCKER
+} LDMFsType;
+
+#define LDM_TYPE_FS_TYPE (ldm_fs_type_get_type())
+
+GType ldm_fs_type_get_type(void);
+
+#define LDM_FS_LABEL_MAX 128
+
+/**
+ * LDMFsInfo:
+ * @type: The type of the filesystem
+ * @label: The UTF-8 label of the filesystem, empty if it has none
+ * @serial: The serial number of the filesystem. FAT and exFAT serial numbers
+ *          are 32 bits.
+ * @cluster_size: The cluster size in bytes, or 0 if it is not known
+ *
+ * The filesystem of a volume, returned by ldm_volume_probe().
+ */
+typedef struct
+{
+    LDMFsType type;
+    gchar label[LDM_FS_LABEL_MAX];
+    guint64 serial;
+    guint32 cluster_size;
+} LDMFsInfo;
+
+/* Device mapper */
+
+/**
+ * LDMDmFlags:
+ * @LDM_DM_READ_ONLY: Create read-only devices. Nothing is written to the disks
+ *                    of a mirrored or RAID5 volume: it is not resynced when it
+ *                    is created. A mirrored volume is mapped directly onto the
+ *                    partition of one of its members. A RAID5 volume keeps
+ *                    all of its present members, and is created with the
+ *                    raid target's nosync option.
+ *
+ * Flags controlling the creation of device mapper devices.
+ */
+typedef enum {
+    LDM_DM_READ_ONLY = 1 << 0
+} LDMDmFlags;
+
+#define LDM_TYPE_DM_FLAGS (ldm_dm_flags_get_type())
+
+GType ldm_dm_flags_get_type(void);
+
+/**
+ * LDMRaidParams:
+ * @region_size: The size in sectors of the regions in which md tracks which
+ *               parts of the volume are in sync. It must be a power of 2. 0
+ *               chooses one from the size of the volume.
+ * @min_recovery_rate: The minimum resync rate in KiB/s per disk, or 0 for the
+ *                     kernel's default
+ * @max_recovery_rate: The maximum resync rate in KiB/s per disk, or 0 for the
+ *                     kernel's default
+ * @daemon_sleep: The interval in milliseconds between runs of md's bitmap
+ *                daemon, or 0 for the kernel's default
+ * @write_mostly: Mirrored volumes only. A bit mask of the partitions, by their
+ *                index in ldm_volume_get_partitions(), which are only read
+ *                from if no other partition is available. Useful for the HDD
+ *                side of a mirror with an SSD.
+ * @stripe_cache: RAID5 volumes only. The number of entries in md's stripe
+ *                cache, or 0 for the kernel's default.
+ *
+ * Tuning of the device mapper raid target of a mirrored or RAID5 volume,
+ * passed to the functions which plan, create or refresh its devices. A field
+ * which doesn't apply to the type of a volume is ignored.
+ */
+typedef struct
+{
+    guint32 region_size;
+    guint32 min_recovery_rate;
+    guint32 max_recovery_rate;
+    guint32 daemon_sleep;
+    guint64 write_mostly;
+    guint32 stripe_cache;
+} LDMRaidParams;
+
+/**
+ * LDMDmResult:
+ * @disk_group: (transfer none): The disk group containing @volume
+ * @volume: (transfer none): The volume
+ * @device: (allow-none): The name of the device mapper device which was
+ *          created or removed, or NULL if there was nothing to do or it failed
+ * @error: (allow-none): The reason @volume could not be created or removed, or
+ *         NULL if it succeeded
+ *
+ * The outcome for one volume of ldm_dm_create_all() or ldm_dm_remove_all().
+ */
+typedef struct
+{
+    LDMDiskGroup *disk_group;
+    LDMVolume *volume;
+    GString *device;
+    GError *error;
+} LDMDmResult;
+
+/**
+ * LDMDmTarget:
+ * @start: The first sector of the device mapped by this target
+ * @size: The number of sectors mapped by this target
+ * @type: The target type, e.g. "linear"
+ * @params: The target's parameters, as they would appear in dmsetup table
+ *          output
+ *
+ * One line of the table of a planned device mapper device.
+ */
+typedef struct
+{
+    guint64 start;
+    guint64 size;
+    gchar *type;
+    gchar *params;
+} LDMDmTarget;
+
+/**
+ * LDMDmDevice:
+ * @name: The name of the device
+ * @uuid: The device mapper UUID of the device
+ * @read_only: Whether the device is created read-only
+ * @targets: (element-type LDMDmTarget): The device's table
+ *
+ * A device mapper device planned by ldm_volume_dm_plan().
+ */
+typedef struct
+{
+    gchar *name;
+    gchar *uuid;
+    gboolean read_only;
+    GArray *targets;
+} LDMDmDevice;
+
 GType ldm_get_type(void);
 GType ldm_disk_group_get_type(void);
 
@@ -284,17 +643,62 @@ gboolean ldm_add(LDM *o, const gchar *path, GError **err);
 gboolean ldm_add_fd(LDM *o, int fd, guint secsize, const gchar *path,
                     GError **err);
 
+/**
+ * ldm_save_snapshot:
+ * @o: An #LDM object
+ * @path: The path of the snapshot file
+ * @err: A #GError to receive any generated errors
+ *
+ * Save all metadata in LDM object @o to a snapshot file, which can later be
+ * loaded with ldm_load_snapshot() instead of scanning devices again. The file
+ * is replaced atomically, so it is safe to save a snapshot while other
+ * processes are loading it.
+ *
+ * Returns: true on success, false on error
+ */
+gboolean ldm_save_snapshot(LDM *o, const gchar *path, GError **err);
+
+/**
+ * ldm_load_snapshot:
+ * @path: The path of a snapshot file written by ldm_save_snapshot()
+ * @err: A #GError to receive any generated errors
+ *
+ * Instantiate a new LDM object from a snapshot file. The snapshot is mapped
+ * read-only and no LDM metadata is parsed. Its records are copied into the
+ * returned objects rather than used in place, so the file is unmapped before
+ * this returns and may be replaced at any time. Only the PRIVHEAD and VMDB
+ * headers of the devices recorded in the snapshot are read, to check that
+ * their committed sequence numbers still match. If they don't, the snapshot is
+ * out of date and %LDM_ERROR_INCONSISTENT is returned: the caller should scan
+ * the devices again.
+ *
+ * Returns: (transfer full): a new #LDM object, or NULL on error
+ */
+LDM *ldm_load_snapshot(const gchar *path, GError **err);
+
 /**
  * ldm_get_disk_groups:
  * @o: An #LDM object
  *
- * Get an array of discovered disk groups.
+ * Get an array of discovered disk groups. The array and the disk groups in it
+ * are never modified: subsequent scans do not affect them.
  *
  * Returns: (element-type LDMDiskGroup)(transfer container):
  *      An array of disk groups
  */
 GArray *ldm_get_disk_groups(LDM *o);
 
+/**
+ * ldm_find_disk_group:
+ * @o: An #LDM object
+ * @guid: The string representation of a disk group's GUID
+ *
+ * Find a discovered disk group by its GUID.
+ *
+ * Returns: (transfer full): The disk group, or NULL if it was not found
+ */
+LDMDiskGroup *ldm_find_disk_group(LDM *o, const gchar *guid);
+
 /**
  * ldm_disk_group_get_volumes:
  * @o: An #LDMDiskGroup
@@ -328,6 +732,44 @@ GArray *ldm_disk_group_get_partitions(LDMDiskGroup *o);
  */
 GArray *ldm_disk_group_get_disks(LDMDiskGroup *o);
 
+/**
+ * ldm_disk_group_find_volume:
+ * @o: An #LDMDiskGroup
+ * @id: The name of a volume, or the string representation of its GUID
+ *
+ * Find a volume in a disk group by name or GUID. @id is first looked up as a
+ * name. If no volume has that name, and @id is a valid GUID, it is looked up as
+ * a GUID.
+ *
+ * Returns: (transfer full): The volume, or NULL if it was not found
+ */
+LDMVolume *ldm_disk_group_find_volume(LDMDiskGroup *o, const gchar *id);
+
+/**
+ * ldm_disk_group_find_partition:
+ * @o: An #LDMDiskGroup
+ * @name: The name of a partition
+ *
+ * Find a partition in a disk group by name.
+ *
+ * Returns: (transfer full): The partition, or NULL if it was not found
+ */
+LDMPartition *ldm_disk_group_find_partition(LDMDiskGroup *o,
+                                            const gchar *name);
+
+/**
+ * ldm_disk_group_find_disk:
+ * @o: An #LDMDiskGroup
+ * @id: The name of a disk, or the string representation of its GUID
+ *
+ * Find a disk in a disk group by name or GUID. @id is first looked up as a
+ * name. If no disk has that name, and @id is a valid GUID, it is looked up as a
+ * GUID.
+ *
+ * Returns: (transfer full): The disk, or NULL if it was not found
+ */
+LDMDisk *ldm_disk_group_find_disk(LDMDiskGroup *o, const gchar *id);
+
 /**
  * ldm_disk_group_get_name:
  * @o: An #LDMDiskGroup
@@ -338,6 +780,16 @@ GArray *ldm_disk_group_get_disks(LDMDiskGroup *o);
  */
 gchar *ldm_disk_group_get_name(const LDMDiskGroup *o);
 
+/**
+ * ldm_disk_group_peek_name:
+ * @o: An #LDMDiskGroup
+ *
+ * Get the Windows-assigned name of a disk group without copying it.
+ *
+ * Returns: (transfer none): The name, valid for the lifetime of @o
+ */
+const gchar *ldm_disk_group_peek_name(const LDMDiskGroup *o);
+
 /**
  * ldm_disk_group_get_guid:
  * @o: An #LDMDiskGroup
@@ -348,6 +800,26 @@ gchar *ldm_disk_group_get_name(const LDMDiskGroup *o);
  */
 gchar *ldm_disk_group_get_guid(const LDMDiskGroup *o);
 
+/**
+ * ldm_disk_group_get_guid_bytes:
+ * @o: An #LDMDiskGroup
+ *
+ * Get the Windows-assigned GUID of a disk group in its binary form.
+ *
+ * Returns: (transfer none)(array fixed-size=16): The 16 byte GUID, valid for
+ *          the lifetime of @o
+ */
+const guint8 *ldm_disk_group_get_guid_bytes(const LDMDiskGroup *o);
+
+/**
+ * ldm_disk_group_get_info:
+ * @o: An #LDMDiskGroup
+ * @info: (out caller-allocates): The #LDMDiskGroupInfo to fill
+ *
+ * Get all properties of a disk group in a single call, without copying.
+ */
+void ldm_disk_group_get_info(const LDMDiskGroup *o, LDMDiskGroupInfo *info);
+
 /**
  * ldm_volume_get_partitions:
  * @o: An #LDMVolume
@@ -369,6 +841,16 @@ GArray *ldm_volume_get_partitions(LDMVolume *o);
  */
 gchar *ldm_volume_get_name(const LDMVolume *o);
 
+/**
+ * ldm_volume_peek_name:
+ * @o: An #LDMVolume
+ *
+ * Get the Windows-assigned name of a volume without copying it.
+ *
+ * Returns: (transfer none): The name, valid for the lifetime of @o
+ */
+const gchar *ldm_volume_peek_name(const LDMVolume *o);
+
 /**
  * ldm_volume_get_guid:
  * @o: An #LDMVolume
@@ -379,6 +861,17 @@ gchar *ldm_volume_get_name(const LDMVolume *o);
  */
 gchar *ldm_volume_get_guid(const LDMVolume *o);
 
+/**
+ * ldm_volume_get_guid_bytes:
+ * @o: An #LDMVolume
+ *
+ * Get the Windows-assigned GUID of a volume in its binary form.
+ *
+ * Returns: (transfer none)(array fixed-size=16): The 16 byte GUID, valid for
+ *          the lifetime of @o
+ */
+const guint8 *ldm_volume_get_guid_bytes(const LDMVolume *o);
+
 /**
  * ldm_volume_get_voltype:
  * @o: An #LDMVolume
@@ -427,6 +920,16 @@ guint8 ldm_volume_get_part_type(const LDMVolume *o);
  */
 gchar *ldm_volume_get_hint(const LDMVolume *o);
 
+/**
+ * ldm_volume_peek_hint:
+ * @o: An #LDMVolume
+ *
+ * Get the volume mounting hint without copying it.
+ *
+ * Returns: (transfer none): The mounting hint, valid for the lifetime of @o
+ */
+const gchar *ldm_volume_peek_hint(const LDMVolume *o);
+
 /**
  * ldm_volume_get_chunk_size:
  * @o: An #LDMVolume
@@ -438,6 +941,287 @@ gchar *ldm_volume_get_hint(const LDMVolume *o);
  */
 guint64 ldm_volume_get_chunk_size(const LDMVolume *o);
 
+/**
+ * ldm_volume_get_info:
+ * @o: An #LDMVolume
+ * @info: (out caller-allocates): The #LDMVolumeInfo to fill
+ *
+ * Get all properties of a volume in a single call, without copying.
+ */
+void ldm_volume_get_info(const LDMVolume *o, LDMVolumeInfo *info);
+
+/**
+ * ldm_volume_map:
+ * @o: An #LDMVolume
+ * @offset: The offset in bytes of the range to map
+ * @length: The length in bytes of the range to map
+ * @extents: (out caller-allocates)(array length=n_extents): An array to
+ *           receive the extents
+ * @n_extents: The number of elements in @extents
+ * @err: A #GError to receive any generated errors
+ *
+ * Translate a range of a volume into the extents of the disks which store it,
+ * in volume order. A range of a mirrored volume maps to a data extent followed
+ * by a mirror extent for every further leg. A range of a RAID5 volume maps to
+ * a data extent for every chunk it touches, each followed by the parity
+ * extent for the same part of its stripe. Missing disks are mapped like any
+ * other.
+ *
+ * If more than @n_extents extents are required, only the first @n_extents are
+ * stored. @extents may be NULL if @n_extents is 0.
+ *
+ * Returns: The number of extents required to map the whole range, or -1 on
+ *          error
+ */
+gssize ldm_volume_map(const LDMVolume *o, guint64 offset, guint64 length,
+                      LDMExtent *extents, gsize n_extents, GError **err);
+
+/**
+ * ldm_volume_map_batch:
+ * @o: An #LDMVolume
+ * @ranges: (array length=n_ranges): The ranges to map
+ * @n_ranges: The number of elements in @ranges
+ * @first: (out caller-allocates)(array)(allow-none): An array of @n_ranges + 1
+ *         elements to receive the index of the first extent of each range.
+ *         The last element receives the total number of extents.
+ * @err: A #GError to receive any generated errors
+ *
+ * Map many ranges of a volume in one call. This is equivalent to calling
+ * ldm_volume_map() for each range, but the volume layout is only looked up
+ * once.
+ *
+ * Returns: (element-type LDMExtent)(transfer full): The extents of all
+ *          ranges, in order, or NULL on error
+ */
+GArray *ldm_volume_map_batch(const LDMVolume *o, const LDMRange *ranges,
+                             gsize n_ranges, gsize *first, GError **err);
+
+/**
+ * ldm_volume_open:
+ * @o: An #LDMVolume
+ * @err: A #GError to receive any generated errors
+ *
+ * Open a volume for reading directly from the devices of its member disks.
+ * This requires neither device mapper nor any privilege beyond read access to
+ * the devices. A mirrored volume can be opened as long as one leg is present.
+ * A RAID5 volume can be opened with one disk missing, in which case data on
+ * the missing disk is rebuilt from the parity of the others as it is read.
+ * Every disk of any other volume type must be present.
+ *
+ * Large reads are split between columns, or between the legs of a mirror, and
+ * issued in parallel. Reads of a degraded RAID5 volume which touch the missing
+ * disk read the rest of each affected stripe in parallel. Smaller reads of a
+ * mirror are spread over its legs in turn, and a read which fails on one leg
+ * is retried on the others.
+ *
+ * A handle may be used from several threads at once.
+ *
+ * Returns: (transfer full): A handle to be closed with ldm_volume_close(), or
+ *          NULL on error
+ */
+LDMVolumeHandle *ldm_volume_open(LDMVolume *o, GError **err);
+
+/**
+ * ldm_volume_open_rw:
+ * @o: An #LDMVolume
+ * @err: A #GError to receive any generated errors
+ *
+ * Open a simple, spanned, striped or mirrored volume for reading and writing
+ * directly to the devices of its member disks, as ldm_volume_open() does for
+ * reading. Every member disk must be present. RAID5 volumes can't be opened
+ * for writing.
+ *
+ * Each member disk is opened once with O_EXCL, so this fails with
+ * %LDM_ERROR_IO if anything else has claimed any of them: a mounted
+ * filesystem, any device mapper device on the disk, whichever volume it
+ * belongs to, or another exclusive open. In particular, only one volume on a
+ * disk can be open for writing at a time. Opening a disk for reading doesn't
+ * claim it.
+ *
+ * Only the data areas of the volume's partitions are ever written: LDM
+ * metadata is not touched.
+ *
+ * Returns: (transfer full): A handle to be closed with ldm_volume_close(), or
+ *          NULL on error
+ */
+LDMVolumeHandle *ldm_volume_open_rw(LDMVolume *o, GError **err);
+
+/**
+ * ldm_volume_pread:
+ * @h: An #LDMVolumeHandle
+ * @buf: (out caller-allocates)(array length=count): The buffer to read into
+ * @count: The number of bytes to read
+ * @offset: The offset in bytes in the volume to read from
+ * @err: A #GError to receive any generated errors
+ *
+ * Read from an open volume. Like pread(), reads are truncated at the end of
+ * the volume.
+ *
+ * Returns: The number of bytes read, which is only less than @count at the end
+ *          of the volume, or -1 on error
+ */
+gssize ldm_volume_pread(LDMVolumeHandle *h, void *buf, gsize count,
+                        guint64 offset, GError **err);
+
+/**
+ * ldm_volume_preadv:
+ * @h: An #LDMVolumeHandle
+ * @iov: (array length=iovcnt): The buffers to read into
+ * @iovcnt: The number of elements in @iov
+ * @offset: The offset in bytes in the volume to read from
+ * @err: A #GError to receive any generated errors
+ *
+ * Read from an open volume into several buffers, like preadv(). The buffers
+ * are read as one range, which is split between member disks like
+ * ldm_volume_pread() and scattered into the buffers, so the disks are read in
+ * parallel for the whole vector rather than for each buffer in turn.
+ *
+ * Returns: The number of bytes read, which is only less than the total length
+ *          of the buffers at the end of the volume, or -1 on error
+ */
+gssize ldm_volume_preadv(LDMVolumeHandle *h, const struct iovec *iov,
+                         int iovcnt, guint64 offset, GError **err);
+
+/**
+ * ldm_volume_pwrite:
+ * @h: An #LDMVolumeHandle opened by ldm_volume_open_rw()
+ * @buf: (array length=count): The data to write
+ * @count: The number of bytes to write
+ * @offset: The offset in bytes in the volume to write to
+ * @err: A #GError to receive any generated errors
+ *
+ * Write to an open volume. Writes to a mirror go to every leg. Like pwrite()
+ * to a block device, writes are truncated at the end of the volume.
+ *
+ * Sequential writes are coalesced into buffers of whole stripe rows, of at
+ * least 1MiB, so each column is written a full chunk at a time however small
+ * the writes are. The buffer is written out when it is full, by a write which
+ * doesn't follow on from it, by a read, and by ldm_volume_flush() and
+ * ldm_volume_close(). An error writing a buffer is returned by whichever of
+ * these wrote it.
+ *
+ * Returns: The number of bytes written, which is only less than @count at the
+ *          end of the volume, or -1 on error
+ */
+gssize ldm_volume_pwrite(LDMVolumeHandle *h, const void *buf, gsize count,
+                         guint64 offset, GError **err);
+
+/**
+ * ldm_volume_flush:
+ * @h: An #LDMVolumeHandle
+ * @err: A #GError to receive any generated errors
+ *
+ * Write out any buffered writes to an open volume, and flush the member disks.
+ * This does nothing for a handle opened by ldm_volume_open().
+ *
+ * Returns: true on success, false on error
+ */
+gboolean ldm_volume_flush(LDMVolumeHandle *h, GError **err);
+
+/**
+ * ldm_volume_close:
+ * @h: (transfer full)(allow-none): An #LDMVolumeHandle
+ *
+ * Close an open volume. This waits for asynchronous reads in flight, and
+ * calls the callbacks of any which have not been dispatched. Buffered writes
+ * are flushed, and a warning is logged if this fails: call ldm_volume_flush()
+ * first to handle the error.
+ */
+void ldm_volume_close(LDMVolumeHandle *h);
+
+/**
+ * ldm_volume_handle_get_stats:
+ * @h: An #LDMVolumeHandle
+ * @stats: (out caller-allocates): The statistics of @h
+ *
+ * Get the I/O statistics of an open volume since it was opened. The rate at
+ * which a degraded RAID5 volume can be read is @bytes_reconstructed divided
+ * by @reconstruct_usec.
+ */
+void ldm_volume_handle_get_stats(LDMVolumeHandle *h, LDMVolumeStats *stats);
+
+/**
+ * ldm_volume_handle_set_queue_depth:
+ * @h: An #LDMVolumeHandle
+ * @depth: The maximum number of reads in flight on each disk
+ *
+ * Set the number of asynchronous reads which may be in flight on each member
+ * disk of a volume at once. The default is
+ * %LDM_VOLUME_QUEUE_DEPTH_DEFAULT. It only takes effect if it is set before
+ * the first asynchronous read.
+ */
+void ldm_volume_handle_set_queue_depth(LDMVolumeHandle *h, guint depth);
+
+/**
+ * ldm_volume_read_async:
+ * @h: An #LDMVolumeHandle
+ * @buf: (out caller-allocates)(array length=count): The buffer to read into,
+ *       which must remain valid until @callback is called
+ * @count: The number of bytes to read
+ * @offset: The offset in bytes in the volume to read from
+ * @callback: (scope async): Called when the read completes
+ * @user_data: Data passed to @callback
+ * @err: A #GError to receive any generated errors
+ *
+ * Start reading from an open volume without waiting for the read to complete.
+ * The read is split between member disks like ldm_volume_pread(), and each
+ * piece is queued on its disk, which has at most the number of reads set by
+ * ldm_volume_handle_set_queue_depth() in flight at once. Reads are issued with
+ * io_uring where it is available, and otherwise by a pool of threads for
+ * each disk.
+ *
+ * @callback is not called from the thread which completed the read, but by
+ * ldm_volume_handle_dispatch() or by a source from
+ * ldm_volume_handle_create_source(). Reads may complete in any order.
+ *
+ * Returns: true if the read was started, false on error, in which case
+ *          @callback will not be called
+ */
+gboolean ldm_volume_read_async(LDMVolumeHandle *h, void *buf, gsize count,
+                               guint64 offset, LDMVolumeReadCallback callback,
+                               gpointer user_data, GError **err);
+
+/**
+ * ldm_volume_handle_dispatch:
+ * @h: An #LDMVolumeHandle
+ * @wait: Whether to wait for a read to complete if none has
+ *
+ * Call the callbacks of completed asynchronous reads. If @wait is true and
+ * reads are in flight but none has completed, wait until one does.
+ * Completions should be dispatched by one thread at a time.
+ *
+ * Returns: The number of callbacks called
+ */
+guint ldm_volume_handle_dispatch(LDMVolumeHandle *h, gboolean wait);
+
+/**
+ * ldm_volume_handle_create_source:
+ * @h: An #LDMVolumeHandle
+ * @err: A #GError to receive any generated errors
+ *
+ * Create a #GSource which calls the callbacks of completed asynchronous reads
+ * from the #GMainContext it is attached to. The source must be destroyed
+ * before @h is closed.
+ *
+ * Returns: (transfer full): A new #GSource, or NULL on error
+ */
+GSource *ldm_volume_handle_create_source(LDMVolumeHandle *h, GError **err);
+
+/**
+ * ldm_volume_probe:
+ * @o: An #LDMVolume
+ * @info: (out caller-allocates): The filesystem of @o
+ * @err: A #GError to receive any generated errors
+ *
+ * Identify the filesystem of a volume from its first sectors, read directly
+ * from the member disks as with ldm_volume_open(). The volume does not need to
+ * be activated. A volume whose contents are not recognised is not an error:
+ * its type is %LDM_FS_TYPE_UNKNOWN.
+ *
+ * Returns: true on success, false on error
+ */
+gboolean ldm_volume_probe(LDMVolume *o, LDMFsInfo *info, GError **err);
+
 /**
  * ldm_volume_dm_get_name:
  * @o: An #LDMVolume
@@ -459,6 +1243,9 @@ GString *ldm_volume_dm_get_name(const LDMVolume *o);
  * (e.g. /dev/mapper/ldm_vol_Red-nzv8x6obywgDg0_Volume3). It is dynamic
  * runtime property and it will be NULL if device mapper device is absent.
  *
+ * The device is looked up in a list of the host's device mapper devices which
+ * is cached by the #LDM object holding the volume. See ldm_dm_refresh_cache().
+ *
  * Returns: (transfer full): The host device mapper device if present,
  *          or NULL otherwise
  */
@@ -474,12 +1261,60 @@ gchar *ldm_volume_dm_get_device(const LDMVolume * const o, GError **err);
  * volume whose device already exists it will still return success. However,
  * @created will not be set.
  *
+ * The devices of a mirrored or RAID5 volume and of its partitions are created
+ * together. If any of them can't be created, those which were are removed
+ * again.
+ *
  * Returns: True if, following the call, the device exists. False if it doesn't.
  *          @created will only be set if the call actually created the device.
  */
 gboolean ldm_volume_dm_create(const LDMVolume *o, GString **created,
                               GError **err);
 
+/**
+ * ldm_volume_dm_create_full:
+ * @o: An #LDMVolume
+ * @flags: #LDMDmFlags controlling how the device is created
+ * @params: (allow-none): The tuning of a mirrored or RAID5 volume's device, or
+ *          NULL for the kernel's defaults
+ * @created: (out): The name of the created device, if any
+ * @err: A #GError to receive any generated errors
+ *
+ * Create a device mapper device for a volume as ldm_volume_dm_create() does,
+ * with @flags and @params. Neither has any effect if the device already
+ * exists.
+ *
+ * Returns: True if, following the call, the device exists. False if it doesn't.
+ *          @created will only be set if the call actually created the device.
+ */
+gboolean ldm_volume_dm_create_full(const LDMVolume *o, LDMDmFlags flags,
+                                   const LDMRaidParams *params,
+                                   GString **created, GError **err);
+
+/**
+ * ldm_volume_dm_plan:
+ * @o: An #LDMVolume
+ * @flags: #LDMDmFlags as would be passed to ldm_volume_dm_create_full()
+ * @params: (allow-none): #LDMRaidParams as would be passed to
+ *          ldm_volume_dm_create_full()
+ * @err: A #GError to receive any generated errors
+ *
+ * Get the device mapper devices which ldm_volume_dm_create_full() would create
+ * for a volume, without creating them. This doesn't require any privileges,
+ * and doesn't look at which devices already exist.
+ *
+ * The devices are in the order they must be created: each is stacked only on
+ * disks and on devices before it, and the volume's own device is last. In
+ * their tables, devices are referred to by path, and planned devices by their
+ * path under the device mapper directory. ldm_volume_dm_create_full() refers
+ * to the same devices by device number.
+ *
+ * Returns: (element-type LDMDmDevice)(transfer full): The planned devices, or
+ *          NULL on error
+ */
+GArray *ldm_volume_dm_plan(const LDMVolume *o, LDMDmFlags flags,
+                           const LDMRaidParams *params, GError **err);
+
 /**
  * ldm_volume_dm_remove:
  * @o: An #LDMVolume
@@ -497,6 +1332,116 @@ gboolean ldm_volume_dm_create(const LDMVolume *o, GString **created,
 gboolean ldm_volume_dm_remove(const LDMVolume *o, GString **removed,
                               GError **err);
 
+/**
+ * ldm_volume_dm_refresh:
+ * @o: An #LDMVolume
+ * @flags: #LDMDmFlags as would be passed to ldm_volume_dm_create_full()
+ * @params: (allow-none): #LDMRaidParams as would be passed to
+ *          ldm_volume_dm_create_full()
+ * @refreshed: (out): The name of the refreshed device, if any
+ * @err: A #GError to receive any generated errors
+ *
+ * Bring the existing device mapper devices of a volume up to date with its
+ * metadata, for example after the volume was extended and its disks were
+ * added again. The table of each device is compared with its live table, and
+ * only a device whose table differs is reloaded and resumed in place, so
+ * anything holding the volume open can carry on using it. The devices of new
+ * partitions are created, and those of partitions the volume no longer uses
+ * are removed. If nothing differs, nothing is done.
+ *
+ * If this function is called for a volume whose device does not exist, it
+ * does nothing and returns success. If it fails, the volume's device keeps
+ * the table it had.
+ *
+ * Returns: True if, following the call, the volume's devices are up to date
+ *          or it has none. False if they aren't. @refreshed will only be set
+ *          if any device was changed.
+ */
+gboolean ldm_volume_dm_refresh(const LDMVolume *o, LDMDmFlags flags,
+                               const LDMRaidParams *params,
+                               GString **refreshed, GError **err);
+
+/**
+ * ldm_dm_create_all:
+ * @o: An #LDM object
+ * @err: A #GError to receive any generated errors
+ *
+ * Create device mapper devices for every volume in every disk group, as
+ * ldm_volume_dm_create() would for each. The existing devices are listed once
+ * for all volumes, and udev is only waited for once, after every device has
+ * been created. A volume which can't be created doesn't prevent the creation
+ * of the others: its error is returned in its result.
+ *
+ * The results are in the order of ldm_get_disk_groups() and
+ * ldm_disk_group_get_volumes().
+ *
+ * Returns: (element-type LDMDmResult)(transfer full): An array with a result
+ *          for each volume, or NULL if device mapper couldn't be used at all
+ */
+GArray *ldm_dm_create_all(LDM *o, GError **err);
+
+/**
+ * ldm_dm_create_all_full:
+ * @o: An #LDM object
+ * @flags: #LDMDmFlags controlling how the devices are created
+ * @params: (allow-none): The tuning of the devices of mirrored and RAID5
+ *          volumes, or NULL for the kernel's defaults
+ * @err: A #GError to receive any generated errors
+ *
+ * Create device mapper devices for every volume in every disk group as
+ * ldm_dm_create_all() does, with @flags and @params.
+ *
+ * Returns: (element-type LDMDmResult)(transfer full): An array with a result
+ *          for each volume, or NULL if device mapper couldn't be used at all
+ */
+GArray *ldm_dm_create_all_full(LDM *o, LDMDmFlags flags,
+                               const LDMRaidParams *params, GError **err);
+
+/**
+ * ldm_dm_remove_all:
+ * @o: An #LDM object
+ * @err: A #GError to receive any generated errors
+ *
+ * Remove the device mapper devices of every volume in every disk group, as
+ * ldm_volume_dm_remove() would for each, listing the existing devices and
+ * waiting for udev once for all of them.
+ *
+ * Returns: (element-type LDMDmResult)(transfer full): An array with a result
+ *          for each volume, or NULL if device mapper couldn't be used at all
+ */
+GArray *ldm_dm_remove_all(LDM *o, GError **err);
+
+/**
+ * ldm_dm_refresh_all:
+ * @o: An #LDM object
+ * @flags: #LDMDmFlags as would be passed to ldm_dm_create_all_full()
+ * @params: (allow-none): #LDMRaidParams as would be passed to
+ *          ldm_dm_create_all_full()
+ * @err: A #GError to receive any generated errors
+ *
+ * Refresh the device mapper devices of every volume in every disk group, as
+ * ldm_volume_dm_refresh() would for each, listing the existing devices and
+ * waiting for udev once for all of them. The result of a volume only has a
+ * device if it was changed.
+ *
+ * Returns: (element-type LDMDmResult)(transfer full): An array with a result
+ *          for each volume, or NULL if device mapper couldn't be used at all
+ */
+GArray *ldm_dm_refresh_all(LDM *o, LDMDmFlags flags,
+                           const LDMRaidParams *params, GError **err);
+
+/**
+ * ldm_dm_refresh_cache:
+ * @o: An #LDM object
+ *
+ * Forget the cached list of the host's device mapper devices used by
+ * ldm_volume_dm_get_device() and ldm_partition_dm_get_device(), so that the
+ * next lookup sees devices created or removed by something other than this
+ * object. Devices created or removed through this object refresh the cache
+ * themselves.
+ */
+void ldm_dm_refresh_cache(LDM *o);
+
 /**
  * ldm_partition_get_disk:
  * @o: An #LDMPartition
@@ -517,6 +1462,16 @@ LDMDisk *ldm_partition_get_disk(LDMPartition *o);
  */
 gchar *ldm_partition_get_name(const LDMPartition *o);
 
+/**
+ * ldm_partition_peek_name:
+ * @o: An #LDMPartition
+ *
+ * Get the Windows-assigned name of a partition without copying it.
+ *
+ * Returns: (transfer none): The name, valid for the lifetime of @o
+ */
+const gchar *ldm_partition_peek_name(const LDMPartition *o);
+
 /**
  * ldm_partition_get_start:
  * @o: An #LDMPartition
@@ -538,6 +1493,16 @@ guint64 ldm_partition_get_start(const LDMPartition *o);
  */
 guint64 ldm_partition_get_size(const LDMPartition *o);
 
+/**
+ * ldm_partition_get_info:
+ * @o: An #LDMPartition
+ * @info: (out caller-allocates): The #LDMPartitionInfo to fill
+ *
+ * Get all properties of a partition in a single call, without copying or
+ * taking a reference to the underlying disk.
+ */
+void ldm_partition_get_info(const LDMPartition *o, LDMPartitionInfo *info);
+
 /**
  * ldm_partition_dm_get_device:
  * @o: An #LDMPartition
@@ -562,6 +1527,16 @@ gchar *ldm_partition_dm_get_device(const LDMPartition * const o, GError **err);
  */
 gchar *ldm_disk_get_name(const LDMDisk *o);
 
+/**
+ * ldm_disk_peek_name:
+ * @o: An #LDMDisk
+ *
+ * Get the Windows-assigned name of a disk without copying it.
+ *
+ * Returns: (transfer none): The name, valid for the lifetime of @o
+ */
+const gchar *ldm_disk_peek_name(const LDMDisk *o);
+
 /**
  * ldm_disk_get_guid:
  * @o: An #LDMDisk
@@ -572,6 +1547,17 @@ gchar *ldm_disk_get_name(const LDMDisk *o);
  */
 gchar *ldm_disk_get_guid(const LDMDisk *o);
 
+/**
+ * ldm_disk_get_guid_bytes:
+ * @o: An #LDMDisk
+ *
+ * Get the Windows-assigned GUID of a disk in its binary form.
+ *
+ * Returns: (transfer none)(array fixed-size=16): The 16 byte GUID, valid for
+ *          the lifetime of @o
+ */
+const guint8 *ldm_disk_get_guid_bytes(const LDMDisk *o);
+
 /**
  * ldm_disk_get_device:
  * @o: An #LDMDisk
@@ -584,6 +1570,17 @@ gchar *ldm_disk_get_guid(const LDMDisk *o);
  */
 gchar *ldm_disk_get_device(const LDMDisk *o);
 
+/**
+ * ldm_disk_peek_device:
+ * @o: An #LDMDisk
+ *
+ * Get the name of the host device of a disk without copying it.
+ *
+ * Returns: (transfer none): The name of the host device, or NULL if the disk is
+ *          missing. It is valid for the lifetime of @o.
+ */
+const gchar *ldm_disk_peek_device(const LDMDisk *o);
+
 /**
  * ldm_disk_get_data_start:
  * @o: An #LDMDisk
@@ -624,6 +1621,15 @@ guint64 ldm_disk_get_metadata_start(const LDMDisk *o);
  */
 guint64 ldm_disk_get_metadata_size(const LDMDisk *o);
 
+/**
+ * ldm_disk_get_info:
+ * @o: An #LDMDisk
+ * @info: (out caller-allocates): The #LDMDiskInfo to fill
+ *
+ * Get all properties of a disk in a single call, without copying.
+ */
+void ldm_disk_get_info(const LDMDisk *o, LDMDiskInfo *info);
+
 G_END_DECLS
 
 #endif /* LIBLDM_LDM_H__ */
@@ -20,11 +20,13 @@
 #include <dirent.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <inttypes.h>
 #include <libdevmapper.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <uuid/uuid.h>
 #include <wordexp.h>
 
 #include <glib-object.h>
@@ -34,7 +36,11 @@
 #include <readline/readline.h>
 #include <readline/history.h>
 
+#include "cbor.h"
+#include "export.h"
 #include "ldm.h"
+#include "nbd.h"
+#include "verify.h"
 
 #define USAGE_SCAN \
     "  scan [<device...>]"
@@ -53,7 +59,32 @@
     "  remove all\n" \
     "  remove volume <disk group guid> <name>"
 
-#define USAGE_ALL USAGE_SCAN "\n" USAGE_SHOW "\n" USAGE_CREATE "\n" USAGE_REMOVE
+#define USAGE_REFRESH \
+    "  refresh all\n" \
+    "  refresh volume <disk group guid> <name>"
+
+#define USAGE_VERIFY \
+    "  verify volume <disk group guid> <name>"
+
+#define USAGE_EXPORT \
+    "  export volume <disk group guid> <name> <file>"
+
+#define USAGE_NBD \
+    "  nbd volume <disk group guid> <name> --socket <path>"
+
+#define USAGE_ALL USAGE_SCAN "\n" USAGE_SHOW "\n" USAGE_CREATE "\n" \
+                  USAGE_REMOVE "\n" USAGE_REFRESH "\n" USAGE_VERIFY "\n" \
+                  USAGE_EXPORT "\n" USAGE_NBD
+
+static VerifyOptions verify_options;
+static ExportOptions export_options;
+static NbdOptions nbd_options;
+static LDMDmFlags create_flags;
+static LDMRaidParams raid_params;
+static gboolean raid_params_set;
+static gboolean create_dry_run;
+static gboolean create_concise;
+static gboolean show_probe;
 
 gboolean
 usage_show(void)
@@ -74,6 +105,30 @@ gboolean usage_remove(void)
     return FALSE;
 }
 
+gboolean usage_refresh(void)
+{
+    g_warning(USAGE_REFRESH);
+    return FALSE;
+}
+
+gboolean usage_verify(void)
+{
+    g_warning(USAGE_VERIFY);
+    return FALSE;
+}
+
+gboolean usage_export(void)
+{
+    g_warning(USAGE_EXPORT);
+    return FALSE;
+}
+
+gboolean usage_nbd(void)
+{
+    g_warning(USAGE_NBD);
+    return FALSE;
+}
+
 typedef gboolean (*_action_t) (LDM *ldm, gint argc, gchar **argv,
                                JsonBuilder *jb);
 
@@ -81,23 +136,174 @@ gboolean ldm_scan(LDM *ldm, gint argc, gchar **argv, JsonBuilder *jb);
 gboolean ldm_show(LDM *ldm, gint argc, gchar **argv, JsonBuilder *jb);
 gboolean ldm_create(LDM *ldm, gint argc, gchar **argv, JsonBuilder *jb);
 gboolean ldm_remove(LDM *ldm, gint argc, gchar **argv, JsonBuilder *jb);
+gboolean ldm_refresh(LDM *ldm, gint argc, gchar **argv, JsonBuilder *jb);
+gboolean ldm_verify(LDM *ldm, gint argc, gchar **argv, JsonBuilder *jb);
+gboolean ldm_export(LDM *ldm, gint argc, gchar **argv, JsonBuilder *jb);
+gboolean ldm_nbd(LDM *ldm, gint argc, gchar **argv, JsonBuilder *jb);
 
 typedef struct {
     const char * name;
     const _action_t action;
 } _command_t;
 
+typedef enum {
+    FORMAT_JSON,
+    FORMAT_JSONL,
+    FORMAT_CBOR
+} _format_t;
+
 static const _command_t commands[] = {
     { "scan", ldm_scan },
     { "show", ldm_show },
     { "create", ldm_create },
     { "remove", ldm_remove },
+    { "refresh", ldm_refresh },
+    { "verify", ldm_verify },
+    { "export", ldm_export },
+    { "nbd", ldm_nbd },
     { NULL }
 };
 
+/* Parse the canonical string representation of a GUID */
+static gboolean
+_parse_guid(const gchar * const str, guint8 * const guid)
+{
+    static const int dashes[] = { 8, 13, 18, 23 };
+
+    if (strlen(str) != 36) return FALSE;
+    for (guint i = 0; i < G_N_ELEMENTS(dashes); i++) {
+        if (str[dashes[i]] != '-') return FALSE;
+    }
+
+    const gchar *c = str;
+    for (int i = 0; i < 16; i++) {
+        if (*c == '-') c++;
+
+        const gint hi = g_ascii_xdigit_value(c[0]);
+        const gint lo = g_ascii_xdigit_value(c[1]);
+        if (hi == -1 || lo == -1) return FALSE;
+
+        guid[i] = (hi << 4) | lo;
+        c += 2;
+    }
+
+    return TRUE;
+}
+
+/* Whether the value of an object member named name is a GUID */
+static gboolean
+_is_guid_member(const gchar * const name)
+{
+    return g_strcmp0(name, "guid") == 0 || g_str_has_suffix(name, "-guid");
+}
+
+/* Encode node as CBOR. If guid is set, node is the value of a GUID member, or
+ * an element of one, and is written as a binary UUID. */
+static void
+_cbor_encode(GByteArray * const buf, JsonNode * const node,
+             const gboolean guid)
+{
+    switch (json_node_get_node_type(node)) {
+    case JSON_NODE_OBJECT:
+    {
+        JsonObject * const obj = json_node_get_object(node);
+        GList * const members = json_object_get_members(obj);
+
+        cbor_write_map(buf, json_object_get_size(obj));
+        for (GList *i = members; i != NULL; i = i->next) {
+            const gchar * const name = i->data;
+
+            cbor_write_string(buf, name, strlen(name));
+            _cbor_encode(buf, json_object_get_member(obj, name),
+                         _is_guid_member(name));
+        }
+        g_list_free(members);
+        break;
+    }
+
+    case JSON_NODE_ARRAY:
+    {
+        JsonArray * const array = json_node_get_array(node);
+        const guint len = json_array_get_length(array);
+
+        cbor_write_array(buf, len);
+        for (guint i = 0; i < len; i++) {
+            _cbor_encode(buf, json_array_get_element(array, i), guid);
+        }
+        break;
+    }
+
+    case JSON_NODE_VALUE:
+    {
+        const GType type = json_node_get_value_type(node);
+
+        if (type == G_TYPE_INT64) {
+            cbor_write_int(buf, json_node_get_int(node));
+        } else if (type == G_TYPE_BOOLEAN) {
+            cbor_write_bool(buf, json_node_get_boolean(node));
+        } else if (type == G_TYPE_DOUBLE) {
+            cbor_write_double(buf, json_node_get_double(node));
+        } else {
+            const gchar * const str = json_node_get_string(node);
+
+            /* GUIDs are written as binary UUIDs rather than strings. Other
+             * strings are never converted, whatever they look like. */
+            guint8 bytes[16];
+            if (guid && _parse_guid(str, bytes)) {
+                cbor_write_tag(buf, CBOR_TAG_UUID);
+                cbor_write_bytes(buf, bytes, sizeof(bytes));
+            } else {
+                cbor_write_string(buf, str, strlen(str));
+            }
+        }
+        break;
+    }
+
+    case JSON_NODE_NULL:
+        cbor_write_null(buf);
+        break;
+    }
+}
+
+static gboolean
+_write_result(const _format_t format, GOutputStream * const out,
+              JsonGenerator * const jg, JsonNode * const root,
+              GError ** const err)
+{
+    switch (format) {
+    case FORMAT_JSON:
+        json_generator_set_root(jg, root);
+        if (!json_generator_to_stream(jg, out, NULL, err)) return FALSE;
+        printf("\n");
+        return TRUE;
+
+    case FORMAT_JSONL:
+        /* jg is not pretty-printed in this mode, so each result is written
+         * as a single line */
+        json_generator_set_root(jg, root);
+        if (!json_generator_to_stream(jg, out, NULL, err)) return FALSE;
+        return g_output_stream_write_all(out, "\n", 1, NULL, NULL, err);
+
+    case FORMAT_CBOR:
+    {
+        GByteArray * const buf = g_byte_array_new();
+        _cbor_encode(buf, root, FALSE);
+
+        gboolean r = g_output_stream_write_all(out, buf->data, buf->len,
+                                               NULL, NULL, err);
+        g_byte_array_free(buf, TRUE);
+        return r;
+    }
+
+    default:
+        /* Should be impossible */
+        g_error("Unexpected output format: %u", format);
+    }
+}
+
 gboolean
 do_command(LDM * const ldm, const int argc, char *argv[], gboolean *result,
-           GOutputStream * const out,
+           const _format_t format, GOutputStream * const out,
            JsonGenerator * const jg, JsonBuilder * const jb)
 {
     const _command_t *i = commands;
@@ -105,13 +311,12 @@ do_command(LDM * const ldm, const int argc, char *argv[], gboolean *result,
         if (g_strcmp0(i->name, argv[0]) == 0) {
             if ((i->action)(ldm, argc - 1, argv + 1, jb)) {
                 GError *err = NULL;
-                json_generator_set_root(jg, json_builder_get_root(jb));
-                if (!json_generator_to_stream(jg, out, NULL, &err)) {
-                    g_warning("Error writing JSON output: %s",
+                if (!_write_result(format, out, jg,
+                                   json_builder_get_root(jb), &err)) {
+                    g_warning("Error writing output: %s",
                               err ? err->message : "(no detail)");
                     if (err) { g_error_free(err); err = NULL; }
                 }
-                printf("\n");
 
                 if (result) *result = TRUE;
             } else {
@@ -161,9 +366,9 @@ _scan(LDM *const ldm, gboolean ignore_errors,
         for (guint i = 0; i < dgs->len; i++) {
             LDMDiskGroup * const dg = g_array_index(dgs, LDMDiskGroup *, i);
 
-            gchar *guid = ldm_disk_group_get_guid(dg);
+            char guid[37];
+            uuid_unparse(ldm_disk_group_get_guid_bytes(dg), guid);
             json_builder_add_string_value(jb, guid);
-            g_free(guid);
         }
         g_array_unref(dgs);
 
@@ -180,19 +385,18 @@ ldm_scan(LDM *const ldm, const gint argc, gchar ** const argv,
     return _scan(ldm, FALSE, argc, argv, jb);
 }
 
+typedef const gchar * (*_peek_name_t)(gconstpointer);
+
 void
 show_json_array(JsonBuilder * const jb, const GArray * const array,
-                const gchar * const name)
+                const gchar * const name, _peek_name_t const peek_name)
 {
     json_builder_set_member_name(jb, name);
     json_builder_begin_array(jb);
     for (guint i = 0; i < array->len; i++) {
-        GObject * const o = g_array_index(array, GObject *, i);
+        gconstpointer const o = g_array_index(array, gconstpointer, i);
 
-        gchar *value;
-        g_object_get(o, "name", &value, NULL);
-        json_builder_add_string_value(jb, value);
-        g_free(value);
+        json_builder_add_string_value(jb, (*peek_name)(o));
     }
     json_builder_end_array(jb);
 }
@@ -200,31 +404,8 @@ show_json_array(JsonBuilder * const jb, const GArray * const array,
 LDMDiskGroup *
 find_diskgroup(LDM * const ldm, const gchar * const guid)
 {
-    LDMDiskGroup *dg = NULL;
-
-    GArray * const diskgroups = ldm_get_disk_groups(ldm);
-    for (guint i = 0; i < diskgroups->len; i++) {
-        LDMDiskGroup * const dg_i =
-            g_array_index(diskgroups, LDMDiskGroup *, i);
-
-        gchar *guid_i = ldm_disk_group_get_guid(dg_i);
-
-        if (g_strcmp0(guid_i, guid) == 0) {
-            dg = dg_i;
-            g_free(guid_i);
-            break;
-        }
-
-        g_free(guid_i);
-    }
-
-    if (dg) {
-        g_object_ref(dg);
-    } else {
-        g_warning("No such disk group: %s", guid);
-    }
-
-    g_array_unref(diskgroups);
+    LDMDiskGroup * const dg = ldm_find_disk_group(ldm, guid);
+    if (!dg) g_warning("No such disk group: %s", guid);
 
     return dg;
 }
@@ -238,23 +419,20 @@ show_diskgroup(LDM * const ldm, const gint argc, gchar ** const argv,
     LDMDiskGroup *dg = find_diskgroup(ldm, argv[0]);
     if (!dg) return FALSE;
 
-    gchar *name = ldm_disk_group_get_name(dg);
-
     json_builder_begin_object(jb);
 
     json_builder_set_member_name(jb, "name");
-    json_builder_add_string_value(jb, name);
+    json_builder_add_string_value(jb, ldm_disk_group_peek_name(dg));
     json_builder_set_member_name(jb, "guid");
     json_builder_add_string_value(jb, argv[0]);
 
-    g_free(name);
-
     GArray * const volumes = ldm_disk_group_get_volumes(dg);
-    show_json_array(jb, volumes, "volumes");
+    show_json_array(jb, volumes, "volumes",
+                    (_peek_name_t) ldm_volume_peek_name);
     g_array_unref(volumes);
 
     GArray * const disks = ldm_disk_group_get_disks(dg);
-    show_json_array(jb, disks, "disks");
+    show_json_array(jb, disks, "disks", (_peek_name_t) ldm_disk_peek_name);
     g_array_unref(disks);
 
     json_builder_end_object(jb);
@@ -263,6 +441,57 @@ show_diskgroup(LDM * const ldm, const gint argc, gchar ** const argv,
     return TRUE;
 }
 
+static void
+_show_fs(const LDMFsInfo * const fs, JsonBuilder * const jb)
+{
+    GEnumClass * const fs_class = g_type_class_ref(LDM_TYPE_FS_TYPE);
+    GEnumValue * const fs_v = g_enum_get_value(fs_class, fs->type);
+
+    json_builder_set_member_name(jb, "filesystem");
+    json_builder_begin_object(jb);
+
+    json_builder_set_member_name(jb, "type");
+    json_builder_add_string_value(jb, fs_v->value_nick);
+    if (fs->label[0] != '\0') {
+        json_builder_set_member_name(jb, "label");
+        json_builder_add_string_value(jb, fs->label);
+    }
+
+    /* Print serial numbers the way Windows does */
+    gchar *serial = NULL;
+    switch (fs->type) {
+    case LDM_FS_TYPE_FAT12:
+    case LDM_FS_TYPE_FAT16:
+    case LDM_FS_TYPE_FAT32:
+    case LDM_FS_TYPE_EXFAT:
+        serial = g_strdup_printf("%04X-%04X",
+                                 (guint) (fs->serial >> 16) & 0xFFFF,
+                                 (guint) fs->serial & 0xFFFF);
+        break;
+
+    case LDM_FS_TYPE_NTFS:
+    case LDM_FS_TYPE_REFS:
+        serial = g_strdup_printf("%016" PRIX64, fs->serial);
+        break;
+
+    default:
+        break;
+    }
+    if (serial != NULL) {
+        json_builder_set_member_name(jb, "serial");
+        json_builder_add_string_value(jb, serial);
+        g_free(serial);
+    }
+
+    if (fs->cluster_size > 0) {
+        json_builder_set_member_name(jb, "cluster-size");
+        json_builder_add_int_value(jb, fs->cluster_size);
+    }
+
+    json_builder_end_object(jb);
+    g_type_class_unref(fs_class);
+}
+
 gboolean
 show_volume(LDM *const ldm, const gint argc, gchar ** const argv,
              JsonBuilder * const jb)
@@ -272,82 +501,80 @@ show_volume(LDM *const ldm, const gint argc, gchar ** const argv,
     LDMDiskGroup *dg = find_diskgroup(ldm, argv[0]);
     if (!dg) return FALSE;
 
-    GArray * const volumes = ldm_disk_group_get_volumes(dg);
+    LDMVolume * const vol = ldm_disk_group_find_volume(dg, argv[1]);
     g_object_unref(dg);
-    gboolean found = FALSE;
-    for (guint i = 0; i < volumes->len; i++) {
-        LDMVolume * const vol = g_array_index(volumes, LDMVolume *, i);
-
-        gchar *name = ldm_volume_get_name(vol);
-        if (g_strcmp0(name, argv[1]) == 0) {
-            found = TRUE;
-
-            gchar *guid = ldm_volume_get_guid(vol);
-            LDMVolumeType type = ldm_volume_get_voltype(vol);
-            guint64 size = ldm_volume_get_size(vol);
-            guint64 chunk_size = ldm_volume_get_chunk_size(vol);
-            gchar *hint = ldm_volume_get_hint(vol);
-
-            GError *err = NULL;
-            gchar *device = ldm_volume_dm_get_device(vol, &err);
-            if (err) {
-                g_warning("Unable to get device for volume %s with GUID %s: %s",
-                          name, guid, err->message);
-                g_error_free(err);
-            }
+    if (!vol) return FALSE;
 
-            json_builder_begin_object(jb);
+    LDMVolumeInfo info;
+    ldm_volume_get_info(vol, &info);
 
-            GEnumValue * const type_v =
-                g_enum_get_value(g_type_class_peek(LDM_TYPE_VOLUME_TYPE), type);
+    char guid[37];
+    uuid_unparse(info.guid, guid);
 
-            json_builder_set_member_name(jb, "name");
-            json_builder_add_string_value(jb, name);
-            json_builder_set_member_name(jb, "guid");
-            json_builder_add_string_value(jb, guid);
-            json_builder_set_member_name(jb, "type");
-            json_builder_add_string_value(jb, type_v->value_nick);
-            json_builder_set_member_name(jb, "size");
-            json_builder_add_int_value(jb, size);
-            json_builder_set_member_name(jb, "chunk-size");
-            json_builder_add_int_value(jb, chunk_size);
-            if (hint != NULL) {
-                json_builder_set_member_name(jb, "hint");
-                json_builder_add_string_value(jb, hint);
-            }
-            if (device != NULL) {
-                json_builder_set_member_name(jb, "device");
-                json_builder_add_string_value(jb, device);
-            }
+    GError *err = NULL;
+    gchar *device = ldm_volume_dm_get_device(vol, &err);
+    if (err) {
+        g_warning("Unable to get device for volume %s with GUID %s: %s",
+                  info.name, guid, err->message);
+        g_error_free(err);
+        err = NULL;
+    }
 
-            json_builder_set_member_name(jb, "partitions");
-            json_builder_begin_array(jb);
-            GArray * const partitions = ldm_volume_get_partitions(vol);
-            for (guint j = 0; j < partitions->len; j++) {
-                LDMPartition * const part =
-                    g_array_index(partitions, LDMPartition *, j);
+    /* Probing reads every member disk, so it is only done on request */
+    LDMFsInfo fs;
+    gboolean have_fs = FALSE;
+    if (show_probe) {
+        have_fs = ldm_volume_probe(vol, &fs, &err);
+        if (!have_fs) {
+            g_warning("Unable to probe volume %s with GUID %s: %s",
+                      info.name, guid, err->message);
+            g_error_free(err);
+        }
+    }
 
-                gchar *partname = ldm_partition_get_name(part);
-                json_builder_add_string_value(jb, partname);
-                g_free(partname);
-            }
-            g_array_unref(partitions);
-            json_builder_end_array(jb);
+    json_builder_begin_object(jb);
 
-            json_builder_end_object(jb);
+    GEnumValue * const type_v =
+        g_enum_get_value(g_type_class_peek(LDM_TYPE_VOLUME_TYPE), info.type);
 
-            g_free(guid);
-            g_free(hint);
-            g_free(device);
-        }
+    json_builder_set_member_name(jb, "name");
+    json_builder_add_string_value(jb, info.name);
+    json_builder_set_member_name(jb, "guid");
+    json_builder_add_string_value(jb, guid);
+    json_builder_set_member_name(jb, "type");
+    json_builder_add_string_value(jb, type_v->value_nick);
+    json_builder_set_member_name(jb, "size");
+    json_builder_add_int_value(jb, info.size);
+    json_builder_set_member_name(jb, "chunk-size");
+    json_builder_add_int_value(jb, info.chunk_size);
+    if (info.hint != NULL) {
+        json_builder_set_member_name(jb, "hint");
+        json_builder_add_string_value(jb, info.hint);
+    }
+    if (device != NULL) {
+        json_builder_set_member_name(jb, "device");
+        json_builder_add_string_value(jb, device);
+    }
+    if (have_fs) _show_fs(&fs, jb);
 
-        g_free(name);
+    json_builder_set_member_name(jb, "partitions");
+    json_builder_begin_array(jb);
+    GArray * const partitions = ldm_volume_get_partitions(vol);
+    for (guint j = 0; j < partitions->len; j++) {
+        LDMPartition * const part =
+            g_array_index(partitions, LDMPartition *, j);
 
-        if (found) break;
+        json_builder_add_string_value(jb, ldm_partition_peek_name(part));
     }
-    g_array_unref(volumes);
+    g_array_unref(partitions);
+    json_builder_end_array(jb);
+
+    json_builder_end_object(jb);
 
-    return found;
+    g_free(device);
+    g_object_unref(vol);
+
+    return TRUE;
 }
 
 gboolean
@@ -359,59 +586,44 @@ show_partition(LDM *const ldm, const gint argc, gchar ** const argv,
     LDMDiskGroup *dg = find_diskgroup(ldm, argv[0]);
     if (!dg) return FALSE;
 
-    GArray * const parts = ldm_disk_group_get_partitions(dg);
+    LDMPartition * const part = ldm_disk_group_find_partition(dg, argv[1]);
     g_object_unref(dg);
-    gboolean found = FALSE;
-    for (guint i = 0; i < parts->len; i++) {
-        LDMPartition * const part = g_array_index(parts, LDMPartition *, i);
-
-        gchar *name = ldm_partition_get_name(part);
-        if (g_strcmp0(name, argv[1]) == 0) {
-            found = TRUE;
-
-            guint64 start = ldm_partition_get_start(part);
-            guint64 size = ldm_partition_get_size(part);
-
-            LDMDisk * const disk = ldm_partition_get_disk(part);
-            gchar *diskname = ldm_disk_get_name(disk);
-            g_object_unref(disk);
-
-            GError *err = NULL;
-            gchar *device = ldm_partition_dm_get_device(part, &err);
-            if (err) {
-                g_warning("Unable to get device for partition %s on disk %s: %s",
-                          name, diskname, err->message);
-                g_error_free(err);
-            }
+    if (!part) return FALSE;
 
-            json_builder_begin_object(jb);
-
-            json_builder_set_member_name(jb, "name");
-            json_builder_add_string_value(jb, name);
-            json_builder_set_member_name(jb, "start");
-            json_builder_add_int_value(jb, start);
-            json_builder_set_member_name(jb, "size");
-            json_builder_add_int_value(jb, size);
-            json_builder_set_member_name(jb, "disk");
-            json_builder_add_string_value(jb, diskname);
-            if (device != NULL) {
-                json_builder_set_member_name(jb, "device");
-                json_builder_add_string_value(jb, device);
-            }
+    LDMPartitionInfo info;
+    ldm_partition_get_info(part, &info);
 
-            json_builder_end_object(jb);
+    const gchar * const diskname = ldm_disk_peek_name(info.disk);
 
-            g_free(diskname);
-            g_free(device);
-        }
+    GError *err = NULL;
+    gchar *device = ldm_partition_dm_get_device(part, &err);
+    if (err) {
+        g_warning("Unable to get device for partition %s on disk %s: %s",
+                  info.name, diskname, err->message);
+        g_error_free(err);
+    }
 
-        g_free(name);
+    json_builder_begin_object(jb);
 
-        if (found) break;
+    json_builder_set_member_name(jb, "name");
+    json_builder_add_string_value(jb, info.name);
+    json_builder_set_member_name(jb, "start");
+    json_builder_add_int_value(jb, info.start);
+    json_builder_set_member_name(jb, "size");
+    json_builder_add_int_value(jb, info.size);
+    json_builder_set_member_name(jb, "disk");
+    json_builder_add_string_value(jb, diskname);
+    if (device != NULL) {
+        json_builder_set_member_name(jb, "device");
+        json_builder_add_string_value(jb, device);
     }
-    g_array_unref(parts);
 
-    return found;
+    json_builder_end_object(jb);
+
+    g_free(device);
+    g_object_unref(part);
+
+    return TRUE;
 }
 
 gboolean
@@ -423,57 +635,42 @@ show_disk(LDM *const ldm, const gint argc, gchar ** const argv,
     LDMDiskGroup *dg = find_diskgroup(ldm, argv[0]);
     if (!dg) return FALSE;
 
-    GArray * const disks = ldm_disk_group_get_disks(dg);
+    LDMDisk * const disk = ldm_disk_group_find_disk(dg, argv[1]);
     g_object_unref(dg);
-    gboolean found = FALSE;
-    for (guint i = 0; i < disks->len; i++) {
-        LDMDisk * const disk = g_array_index(disks, LDMDisk *, i);
-
-        gchar *name = ldm_disk_get_name(disk);
-        if (g_strcmp0(name, argv[1]) == 0) {
-            found = TRUE;
-
-            gchar *guid = ldm_disk_get_guid(disk);
-            gchar *device = ldm_disk_get_device(disk);
-            guint64 data_start = ldm_disk_get_data_start(disk);
-            guint64 data_size = ldm_disk_get_data_size(disk);
-            guint64 metadata_start = ldm_disk_get_metadata_start(disk);
-            guint64 metadata_size = ldm_disk_get_metadata_size(disk);
-
-            json_builder_begin_object(jb);
-
-            json_builder_set_member_name(jb, "name");
-            json_builder_add_string_value(jb, name);
-            json_builder_set_member_name(jb, "guid");
-            json_builder_add_string_value(jb, guid);
-            json_builder_set_member_name(jb, "present");
-            json_builder_add_boolean_value(jb, device ? TRUE : FALSE);
-            if (device) {
-                json_builder_set_member_name(jb, "device");
-                json_builder_add_string_value(jb, device);
-                json_builder_set_member_name(jb, "data-start");
-                json_builder_add_int_value(jb, data_start);
-                json_builder_set_member_name(jb, "data-size");
-                json_builder_add_int_value(jb, data_size);
-                json_builder_set_member_name(jb, "metadata-start");
-                json_builder_add_int_value(jb, metadata_start);
-                json_builder_set_member_name(jb, "metadata-size");
-                json_builder_add_int_value(jb, metadata_size);
-            }
+    if (!disk) return FALSE;
 
-            json_builder_end_object(jb);
+    LDMDiskInfo info;
+    ldm_disk_get_info(disk, &info);
 
-            g_free(guid);
-            g_free(device);
-        }
+    char guid[37];
+    uuid_unparse(info.guid, guid);
 
-        g_free(name);
+    json_builder_begin_object(jb);
 
-        if (found) break;
+    json_builder_set_member_name(jb, "name");
+    json_builder_add_string_value(jb, info.name);
+    json_builder_set_member_name(jb, "guid");
+    json_builder_add_string_value(jb, guid);
+    json_builder_set_member_name(jb, "present");
+    json_builder_add_boolean_value(jb, info.device ? TRUE : FALSE);
+    if (info.device) {
+        json_builder_set_member_name(jb, "device");
+        json_builder_add_string_value(jb, info.device);
+        json_builder_set_member_name(jb, "data-start");
+        json_builder_add_int_value(jb, info.data_start);
+        json_builder_set_member_name(jb, "data-size");
+        json_builder_add_int_value(jb, info.data_size);
+        json_builder_set_member_name(jb, "metadata-start");
+        json_builder_add_int_value(jb, info.metadata_start);
+        json_builder_set_member_name(jb, "metadata-size");
+        json_builder_add_int_value(jb, info.metadata_size);
     }
-    g_array_unref(disks);
 
-    return found;
+    json_builder_end_object(jb);
+
+    g_object_unref(disk);
+
+    return TRUE;
 }
 
 gboolean
@@ -497,48 +694,47 @@ ldm_show(LDM *const ldm, const gint argc, gchar ** const argv,
 
 typedef gboolean (*_usage_t)();
 typedef gboolean (*_vol_action_t)(const LDMVolume *, GString **, GError **);
+typedef GArray * (*_all_action_t)(LDM *, GError **);
 
 static gboolean
 _ldm_vol_action(LDM *const ldm, const gint argc, gchar ** const argv,
                 JsonBuilder * const jb,
                 const gchar * const action_desc,
-                _usage_t const usage, _vol_action_t const action)
+                _usage_t const usage, _vol_action_t const action,
+                _all_action_t const all_action)
 {
     json_builder_begin_array(jb);
 
     if (argc == 1) {
         if (g_strcmp0(argv[0], "all") != 0) return (*usage)();
 
-        GArray *dgs = ldm_get_disk_groups(ldm);
-        for (guint i = 0; i < dgs->len; i++) {
-            LDMDiskGroup * const dg = g_array_index(dgs, LDMDiskGroup *, i);
-
-            GArray *volumes = ldm_disk_group_get_volumes(dg);
-            for (guint j = 0; j < volumes->len; j++) {
-                LDMVolume * const vol = g_array_index(volumes, LDMVolume *, j);
-
-                GError *err = NULL;
-                GString *device = NULL;
-                if (!(*action)(vol, &device, &err)) {
-                    gchar *vol_name = ldm_volume_get_name(vol);
-                    gchar *dg_guid = ldm_disk_group_get_guid(dg);
+        GError *err = NULL;
+        GArray * const results = (*all_action)(ldm, &err);
+        if (results == NULL) {
+            g_warning("Unable to %s volumes: %s", action_desc, err->message);
+            g_error_free(err);
+            return FALSE;
+        }
 
-                    g_warning("Unable to %s volume %s in disk group %s: %s",
-                              action_desc, vol_name, dg_guid, err->message);
+        for (guint i = 0; i < results->len; i++) {
+            const LDMDmResult * const result =
+                &g_array_index(results, LDMDmResult, i);
 
-                    g_free(vol_name);
-                    g_free(dg_guid);
+            if (result->error) {
+                char dg_guid[37];
+                uuid_unparse(ldm_disk_group_get_guid_bytes(result->disk_group),
+                             dg_guid);
 
-                    g_error_free(err); err = NULL;
-                }
+                g_warning("Unable to %s volume %s in disk group %s: %s",
+                          action_desc, ldm_volume_peek_name(result->volume),
+                          dg_guid, result->error->message);
+            }
 
-                if (device) {
-                    json_builder_add_string_value(jb, device->str);
-                    g_string_free(device, TRUE);
-                }
+            if (result->device) {
+                json_builder_add_string_value(jb, result->device->str);
             }
         }
-        g_array_unref(dgs);
+        g_array_unref(results);
     }
 
     else if (argc == 3) {
@@ -547,19 +743,8 @@ _ldm_vol_action(LDM *const ldm, const gint argc, gchar ** const argv,
         LDMDiskGroup * const dg = find_diskgroup(ldm, argv[1]);
         if (!dg) return FALSE;
 
-        GArray * const volumes = ldm_disk_group_get_volumes(dg);
-        LDMVolume *vol = NULL;
-        for (guint i = 0; i < volumes->len; i++) {
-            LDMVolume * const o = g_array_index(volumes, LDMVolume *, i);
-
-            gchar *name = ldm_volume_get_name(o);
-            if (g_strcmp0(name, argv[2]) == 0) vol = o;
-            g_free(name);
-
-            if (vol) break;
-        }
+        LDMVolume * const vol = ldm_disk_group_find_volume(dg, argv[2]);
         g_object_unref(dg);
-        g_array_unref(volumes);
 
         if (!vol) {
             g_warning("Disk group %s doesn't contain volume %s",
@@ -569,7 +754,9 @@ _ldm_vol_action(LDM *const ldm, const gint argc, gchar ** const argv,
 
         GError *err = NULL;
         GString *device = NULL;
-        if (!(*action)(vol, &device, &err)) {
+        gboolean r = (*action)(vol, &device, &err);
+        g_object_unref(vol);
+        if (!r) {
             g_warning("Unable to %s volume %s in disk group %s: %s",
                       action_desc, argv[2], argv[1], err->message);
             g_error_free(err); err = NULL;
@@ -591,12 +778,208 @@ _ldm_vol_action(LDM *const ldm, const gint argc, gchar ** const argv,
     return TRUE;
 }
 
+/* The raid tuning options, or NULL if none was given */
+static const LDMRaidParams *
+_raid_params(void)
+{
+    return raid_params_set ? &raid_params : NULL;
+}
+
+static gboolean
+_create_volume(const LDMVolume * const vol, GString ** const created,
+               GError ** const err)
+{
+    return ldm_volume_dm_create_full(vol, create_flags, _raid_params(),
+                                     created, err);
+}
+
+static GArray *
+_create_all(LDM * const ldm, GError ** const err)
+{
+    return ldm_dm_create_all_full(ldm, create_flags, _raid_params(), err);
+}
+
+static gboolean
+_refresh_volume(const LDMVolume * const vol, GString ** const refreshed,
+                GError ** const err)
+{
+    return ldm_volume_dm_refresh(vol, create_flags, _raid_params(),
+                                 refreshed, err);
+}
+
+static GArray *
+_refresh_all(LDM * const ldm, GError ** const err)
+{
+    return ldm_dm_refresh_all(ldm, create_flags, _raid_params(), err);
+}
+
+/* Append str to concise, escaping the separators of dmsetup's concise
+ * format */
+static void
+_concise_append(GString * const concise, const gchar * const str)
+{
+    for (const gchar *c = str; *c != '\0'; c++) {
+        if (*c == ',' || *c == ';' || *c == '\\') {
+            g_string_append_c(concise, '\\');
+        }
+        g_string_append_c(concise, *c);
+    }
+}
+
+static void
+_show_planned_device(JsonBuilder * const jb, const LDMDmDevice * const device)
+{
+    if (create_concise) {
+        GString * const concise = g_string_new("");
+        _concise_append(concise, device->name);
+        g_string_append_c(concise, ',');
+        _concise_append(concise, device->uuid);
+        g_string_append_printf(concise, ",,%s",
+                               device->read_only ? "ro" : "rw");
+
+        for (guint i = 0; i < device->targets->len; i++) {
+            const LDMDmTarget * const target =
+                &g_array_index(device->targets, LDMDmTarget, i);
+
+            gchar * const line =
+                g_strdup_printf("%" PRIu64 " %" PRIu64 " %s %s",
+                                target->start, target->size,
+                                target->type, target->params);
+            g_string_append_c(concise, ',');
+            _concise_append(concise, line);
+            g_free(line);
+        }
+
+        json_builder_add_string_value(jb, concise->str);
+        g_string_free(concise, TRUE);
+        return;
+    }
+
+    json_builder_begin_object(jb);
+
+    json_builder_set_member_name(jb, "name");
+    json_builder_add_string_value(jb, device->name);
+    json_builder_set_member_name(jb, "uuid");
+    json_builder_add_string_value(jb, device->uuid);
+    json_builder_set_member_name(jb, "read-only");
+    json_builder_add_boolean_value(jb, device->read_only);
+
+    json_builder_set_member_name(jb, "targets");
+    json_builder_begin_array(jb);
+    for (guint i = 0; i < device->targets->len; i++) {
+        const LDMDmTarget * const target =
+            &g_array_index(device->targets, LDMDmTarget, i);
+
+        json_builder_begin_object(jb);
+        json_builder_set_member_name(jb, "start");
+        json_builder_add_int_value(jb, target->start);
+        json_builder_set_member_name(jb, "size");
+        json_builder_add_int_value(jb, target->size);
+        json_builder_set_member_name(jb, "type");
+        json_builder_add_string_value(jb, target->type);
+        json_builder_set_member_name(jb, "params");
+        json_builder_add_string_value(jb, target->params);
+        json_builder_end_object(jb);
+    }
+    json_builder_end_array(jb);
+
+    json_builder_end_object(jb);
+}
+
+static gboolean
+_plan_volume(JsonBuilder * const jb, const LDMVolume * const vol,
+             GError ** const err)
+{
+    GArray * const devices =
+        ldm_volume_dm_plan(vol, create_flags, _raid_params(), err);
+    if (devices == NULL) return FALSE;
+
+    for (guint i = 0; i < devices->len; i++) {
+        _show_planned_device(jb, &g_array_index(devices, LDMDmDevice, i));
+    }
+    g_array_unref(devices);
+
+    return TRUE;
+}
+
+/* create --dry-run: list the devices which would be created, in order */
+static gboolean
+_ldm_plan(LDM * const ldm, const gint argc, gchar ** const argv,
+          JsonBuilder * const jb)
+{
+    json_builder_begin_array(jb);
+
+    if (argc == 1) {
+        if (g_strcmp0(argv[0], "all") != 0) return usage_create();
+
+        GArray * const dgs = ldm_get_disk_groups(ldm);
+        for (guint i = 0; dgs && i < dgs->len; i++) {
+            LDMDiskGroup * const dg = g_array_index(dgs, LDMDiskGroup *, i);
+
+            GArray * const volumes = ldm_disk_group_get_volumes(dg);
+            for (guint j = 0; j < volumes->len; j++) {
+                LDMVolume * const vol = g_array_index(volumes, LDMVolume *, j);
+
+                GError *err = NULL;
+                if (!_plan_volume(jb, vol, &err)) {
+                    char dg_guid[37];
+                    uuid_unparse(ldm_disk_group_get_guid_bytes(dg), dg_guid);
+
+                    g_warning("Unable to plan volume %s in disk group %s: %s",
+                              ldm_volume_peek_name(vol), dg_guid,
+                              err->message);
+                    g_error_free(err);
+                }
+            }
+            g_array_unref(volumes);
+        }
+        if (dgs) g_array_unref(dgs);
+    }
+
+    else if (argc == 3) {
+        if (g_strcmp0(argv[0], "volume") != 0) return usage_create();
+
+        LDMDiskGroup * const dg = find_diskgroup(ldm, argv[1]);
+        if (!dg) return FALSE;
+
+        LDMVolume * const vol = ldm_disk_group_find_volume(dg, argv[2]);
+        g_object_unref(dg);
+
+        if (!vol) {
+            g_warning("Disk group %s doesn't contain volume %s",
+                      argv[1], argv[2]);
+            return FALSE;
+        }
+
+        GError *err = NULL;
+        const gboolean r = _plan_volume(jb, vol, &err);
+        g_object_unref(vol);
+        if (!r) {
+            g_warning("Unable to plan volume %s in disk group %s: %s",
+                      argv[2], argv[1], err->message);
+            g_error_free(err);
+            return FALSE;
+        }
+    }
+
+    else {
+        return usage_create();
+    }
+
+    json_builder_end_array(jb);
+
+    return TRUE;
+}
+
 gboolean
 ldm_create(LDM *const ldm, const gint argc, gchar ** const argv,
            JsonBuilder * const jb)
 {
+    if (create_dry_run) return _ldm_plan(ldm, argc, argv, jb);
+
     return _ldm_vol_action(ldm, argc, argv, jb,
-                           "create", usage_create, ldm_volume_dm_create);
+                           "create", usage_create, _create_volume,
+                           _create_all);
 }
 
 gboolean
@@ -604,11 +987,174 @@ ldm_remove(LDM *const ldm, const gint argc, gchar ** const argv,
            JsonBuilder * const jb)
 {
     return _ldm_vol_action(ldm, argc, argv, jb,
-                           "remove", usage_remove, ldm_volume_dm_remove);
+                           "remove", usage_remove, ldm_volume_dm_remove,
+                           ldm_dm_remove_all);
+}
+
+gboolean
+ldm_refresh(LDM *const ldm, const gint argc, gchar ** const argv,
+            JsonBuilder * const jb)
+{
+    return _ldm_vol_action(ldm, argc, argv, jb,
+                           "refresh", usage_refresh, _refresh_volume,
+                           _refresh_all);
+}
+
+gboolean
+ldm_verify(LDM *const ldm, const gint argc, gchar ** const argv,
+           JsonBuilder * const jb)
+{
+    if (argc != 3 || g_strcmp0(argv[0], "volume") != 0) return usage_verify();
+
+    LDMDiskGroup * const dg = find_diskgroup(ldm, argv[1]);
+    if (!dg) return FALSE;
+
+    LDMVolume * const vol = ldm_disk_group_find_volume(dg, argv[2]);
+    g_object_unref(dg);
+
+    if (!vol) {
+        g_warning("Disk group %s doesn't contain volume %s", argv[1], argv[2]);
+        return FALSE;
+    }
+
+    GError *err = NULL;
+    const gboolean r = verify_volume(vol, &verify_options, jb, &err);
+    g_object_unref(vol);
+    if (!r) {
+        g_warning("Unable to verify volume %s in disk group %s: %s",
+                  argv[2], argv[1], err->message);
+        g_error_free(err);
+    }
+
+    return r;
 }
 
 gboolean
-shell(LDM * const ldm, gchar ** const devices,
+ldm_export(LDM *const ldm, const gint argc, gchar ** const argv,
+           JsonBuilder * const jb)
+{
+    if (argc != 4 || g_strcmp0(argv[0], "volume") != 0) return usage_export();
+
+    LDMDiskGroup * const dg = find_diskgroup(ldm, argv[1]);
+    if (!dg) return FALSE;
+
+    LDMVolume * const vol = ldm_disk_group_find_volume(dg, argv[2]);
+    g_object_unref(dg);
+
+    if (!vol) {
+        g_warning("Disk group %s doesn't contain volume %s", argv[1], argv[2]);
+        return FALSE;
+    }
+
+    GError *err = NULL;
+    const gboolean r = export_volume(vol, argv[3], &export_options, jb, &err);
+    g_object_unref(vol);
+    if (!r) {
+        g_warning("Unable to export volume %s in disk group %s to %s: %s",
+                  argv[2], argv[1], argv[3], err->message);
+        g_error_free(err);
+    }
+
+    return r;
+}
+
+gboolean
+ldm_nbd(LDM *const ldm, const gint argc, gchar ** const argv,
+        JsonBuilder * const jb)
+{
+    if (argc != 3 || g_strcmp0(argv[0], "volume") != 0) return usage_nbd();
+
+    if (nbd_options.socket == NULL) {
+        g_warning("nbd requires --socket");
+        return FALSE;
+    }
+
+    LDMDiskGroup * const dg = find_diskgroup(ldm, argv[1]);
+    if (!dg) return FALSE;
+
+    LDMVolume * const vol = ldm_disk_group_find_volume(dg, argv[2]);
+    g_object_unref(dg);
+
+    if (!vol) {
+        g_warning("Disk group %s doesn't contain volume %s", argv[1], argv[2]);
+        return FALSE;
+    }
+
+    GError *err = NULL;
+    const gboolean r = nbd_serve(vol, &nbd_options, jb, &err);
+    g_object_unref(vol);
+    if (!r) {
+        g_warning("Unable to serve volume %s in disk group %s: %s",
+                  argv[2], argv[1], err->message);
+        g_error_free(err);
+    }
+
+    return r;
+}
+
+/* Parse a byte count with an optional K, M or G suffix */
+static gboolean
+_parse_size(const gchar * const str, guint64 * const size)
+{
+    gchar *end;
+    errno = 0;
+    guint64 v = g_ascii_strtoull(str, &end, 10);
+    if (errno != 0 || end == str) return FALSE;
+
+    switch (g_ascii_toupper(*end)) {
+    case 'G':
+        v *= 1024;
+        /* fall through */
+    case 'M':
+        v *= 1024;
+        /* fall through */
+    case 'K':
+        v *= 1024;
+        end++;
+    }
+
+    if (*end != '\0') return FALSE;
+
+    *size = v;
+    return TRUE;
+}
+
+/* Parse a rate with an optional K, M or G suffix into KiB/s */
+static gboolean
+_parse_recovery_rate(const gchar * const str, guint32 * const rate)
+{
+    guint64 v;
+    if (!_parse_size(str, &v) || v / 1024 > G_MAXUINT32) return FALSE;
+
+    *rate = v / 1024;
+    return TRUE;
+}
+
+/* Parse a comma separated list of partition indices into a bit mask */
+static gboolean
+_parse_write_mostly(const gchar * const str, guint64 * const mask)
+{
+    gchar ** const indices = g_strsplit(str, ",", 0);
+    gboolean r = TRUE;
+
+    *mask = 0;
+    for (gchar **i = indices; *i != NULL; i++) {
+        gchar *end;
+        errno = 0;
+        const guint64 v = g_ascii_strtoull(*i, &end, 10);
+        if (errno != 0 || end == *i || *end != '\0' || v >= 64) {
+            r = FALSE;
+            break;
+        }
+        *mask |= UINT64_C(1) << v;
+    }
+
+    g_strfreev(indices);
+    return r;
+}
+
+gboolean
+shell(LDM * const ldm, gchar ** const devices, const _format_t format,
       JsonGenerator * const jg, GOutputStream * const out)
 {
     int history_len = 0;
@@ -659,7 +1205,7 @@ shell(LDM * const ldm, gchar ** const devices,
         free(line);
 
         gboolean result = FALSE;
-        if (!do_command(ldm, argc, argv, &result, out, jg, jb)) {
+        if (!do_command(ldm, argc, argv, &result, format, out, jg, jb)) {
             if (g_strcmp0("quit", argv[0]) == 0 ||
                 g_strcmp0("exit", argv[0]) == 0)
             {
@@ -739,7 +1285,7 @@ get_devices(void)
 }
 
 gboolean
-cmdline(LDM * const ldm, gchar **devices,
+cmdline(LDM * const ldm, gchar **devices, const _format_t format,
         JsonGenerator * const jg, GOutputStream * const out,
         const int argc, char *argv[])
 {
@@ -755,7 +1301,7 @@ cmdline(LDM * const ldm, gchar **devices,
 
     jb = json_builder_new();
     gboolean result;
-    if (!do_command(ldm, argc, argv, &result, out, jg, jb)) {
+    if (!do_command(ldm, argc, argv, &result, format, out, jg, jb)) {
         g_warning("Unrecognised command: %s", argv[0]);
         goto error;
     }
@@ -787,11 +1333,67 @@ int
 main(int argc, char *argv[])
 {
     static gchar **devices = NULL;
+    static gchar *format_name = NULL;
+    static gint threads = 0;
+    static gchar *rate = NULL;
+    static gchar *checkpoint = NULL;
+    static gchar *socket_path = NULL;
+    static gboolean read_only = FALSE;
+    static gchar *region_size = NULL;
+    static gchar *min_recovery_rate = NULL;
+    static gchar *max_recovery_rate = NULL;
+    static gchar *write_mostly = NULL;
+    static gint daemon_sleep = 0;
+    static gint stripe_cache = 0;
 
     static const GOptionEntry entries[] =
     {
         { "device", 'd', 0, G_OPTION_ARG_FILENAME_ARRAY,
           &devices, "Block device to scan for LDM metadata", NULL },
+        { "format", 'f', 0, G_OPTION_ARG_STRING,
+          &format_name, "Output format: json (default), jsonl or cbor",
+          "FORMAT" },
+        { "threads", 't', 0, G_OPTION_ARG_INT,
+          &threads, "Number of threads used by verify, export and nbd", "N" },
+        { "rate", 'r', 0, G_OPTION_ARG_STRING,
+          &rate, "Limit the rate at which verify reads disks, in bytes per "
+          "second with an optional K, M or G suffix", "RATE" },
+        { "checkpoint", 'c', 0, G_OPTION_ARG_FILENAME,
+          &checkpoint, "Save the progress of verify to FILE, and resume from "
+          "it if it exists", "FILE" },
+        { "socket", 's', 0, G_OPTION_ARG_FILENAME,
+          &socket_path, "Unix socket on which nbd listens", "PATH" },
+        { "read-only", 'R', 0, G_OPTION_ARG_NONE,
+          &read_only, "Create read-only devices which are never resynced",
+          NULL },
+        { "region-size", 0, 0, G_OPTION_ARG_STRING,
+          &region_size, "Region size of created mirrored and RAID5 devices, "
+          "in bytes with an optional K, M or G suffix", "SIZE" },
+        { "min-recovery-rate", 0, 0, G_OPTION_ARG_STRING,
+          &min_recovery_rate, "Minimum resync rate of created mirrored and "
+          "RAID5 devices, in bytes per second per disk", "RATE" },
+        { "max-recovery-rate", 0, 0, G_OPTION_ARG_STRING,
+          &max_recovery_rate, "Maximum resync rate of created mirrored and "
+          "RAID5 devices, in bytes per second per disk", "RATE" },
+        { "write-mostly", 0, 0, G_OPTION_ARG_STRING,
+          &write_mostly, "Comma separated indices of the partitions of "
+          "created mirrored devices which are only read if no other is "
+          "available", "LIST" },
+        { "daemon-sleep", 0, 0, G_OPTION_ARG_INT,
+          &daemon_sleep, "Interval in milliseconds of the bitmap daemon of "
+          "created mirrored and RAID5 devices", "MS" },
+        { "stripe-cache", 0, 0, G_OPTION_ARG_INT,
+          &stripe_cache, "Number of stripe cache entries of created RAID5 "
+          "devices", "N" },
+        { "dry-run", 'n', 0, G_OPTION_ARG_NONE,
+          &create_dry_run, "Make create list the devices it would create "
+          "instead of creating them", NULL },
+        { "concise", 0, 0, G_OPTION_ARG_NONE,
+          &create_concise, "List devices for create --dry-run in the format "
+          "of dmsetup create --concise", NULL },
+        { "probe", 'p', 0, G_OPTION_ARG_NONE,
+          &show_probe, "Make show volume identify the filesystem of the "
+          "volume by reading its member disks", NULL },
         { NULL }
     };
 
@@ -811,6 +1413,96 @@ main(int argc, char *argv[])
     }
     g_option_context_free(context);
 
+    _format_t format;
+    if (format_name == NULL || g_strcmp0(format_name, "json") == 0) {
+        format = FORMAT_JSON;
+    } else if (g_strcmp0(format_name, "jsonl") == 0) {
+        format = FORMAT_JSONL;
+    } else if (g_strcmp0(format_name, "cbor") == 0) {
+        format = FORMAT_CBOR;
+    } else {
+        g_warning("Unknown output format: %s", format_name);
+        return 1;
+    }
+    g_free(format_name);
+
+    if (threads < 0) {
+        g_warning("Invalid number of threads: %i", threads);
+        return 1;
+    }
+    verify_options.threads = threads;
+    export_options.threads = threads;
+    nbd_options.threads = threads;
+
+    if (rate && !_parse_size(rate, &verify_options.rate)) {
+        g_warning("Invalid rate: %s", rate);
+        return 1;
+    }
+    g_free(rate);
+
+    verify_options.checkpoint = checkpoint;
+    nbd_options.socket = socket_path;
+
+    if (read_only) create_flags |= LDM_DM_READ_ONLY;
+
+    if (region_size) {
+        guint64 v;
+        if (!_parse_size(region_size, &v) || v == 0 || v % 512 != 0 ||
+            v / 512 > G_MAXUINT32 || (v & (v - 1)) != 0)
+        {
+            g_warning("Invalid region size: %s", region_size);
+            return 1;
+        }
+        raid_params.region_size = v / 512;
+        g_free(region_size);
+        raid_params_set = TRUE;
+    }
+
+    if (min_recovery_rate) {
+        if (!_parse_recovery_rate(min_recovery_rate,
+                                  &raid_params.min_recovery_rate))
+        {
+            g_warning("Invalid recovery rate: %s", min_recovery_rate);
+            return 1;
+        }
+        g_free(min_recovery_rate);
+        raid_params_set = TRUE;
+    }
+
+    if (max_recovery_rate) {
+        if (!_parse_recovery_rate(max_recovery_rate,
+                                  &raid_params.max_recovery_rate))
+        {
+            g_warning("Invalid recovery rate: %s", max_recovery_rate);
+            return 1;
+        }
+        g_free(max_recovery_rate);
+        raid_params_set = TRUE;
+    }
+
+    if (write_mostly) {
+        if (!_parse_write_mostly(write_mostly, &raid_params.write_mostly)) {
+            g_warning("Invalid list of partitions: %s", write_mostly);
+            return 1;
+        }
+        g_free(write_mostly);
+        raid_params_set = TRUE;
+    }
+
+    if (daemon_sleep < 0) {
+        g_warning("Invalid daemon sleep: %i", daemon_sleep);
+        return 1;
+    }
+    if (stripe_cache < 0) {
+        g_warning("Invalid stripe cache size: %i", stripe_cache);
+        return 1;
+    }
+    if (daemon_sleep > 0 || stripe_cache > 0) {
+        raid_params.daemon_sleep = daemon_sleep;
+        raid_params.stripe_cache = stripe_cache;
+        raid_params_set = TRUE;
+    }
+
 #if !GLIB_CHECK_VERSION(2,35,0)
     g_type_init();
 #endif
@@ -822,21 +1514,25 @@ main(int argc, char *argv[])
     GOutputStream *out = g_unix_output_stream_new(STDOUT_FILENO, FALSE);
 
     JsonGenerator *jg = json_generator_new();
-    json_generator_set_pretty(jg, TRUE);
-    json_generator_set_indent(jg, 2);
+    if (format == FORMAT_JSON) {
+        json_generator_set_pretty(jg, TRUE);
+        json_generator_set_indent(jg, 2);
+    }
 
     if (argc > 1) {
-        if (!cmdline(ldm, devices, jg, out, argc - 1, argv + 1)) {
+        if (!cmdline(ldm, devices, format, jg, out, argc - 1, argv + 1)) {
             ret = 1;
         }
     } else {
-        if (!shell(ldm, devices, jg, out)) {
+        if (!shell(ldm, devices, format, jg, out)) {
             ret = 1;
         }
     }
 
     g_object_unref(jg);
     g_strfreev(devices);
+    g_free(checkpoint);
+    g_free(socket_path);
     g_object_unref(ldm);
 
     if (!g_output_stream_close(out, NULL, &err)) {
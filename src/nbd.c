@@ -0,0 +1,931 @@
+/* libldm
+ * Copyright 2012 Red Hat Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+
+#include <endian.h>
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "nbd.h"
+#include "simd.h"
+
+#define SECTOR_SIZE UINT64_C(512)
+
+/* Protocol constants, from the NBD protocol specification */
+#define NBD_MAGIC               UINT64_C(0x4e42444d41474943) /* NBDMAGIC */
+#define NBD_OPTS_MAGIC          UINT64_C(0x49484156454f5054) /* IHAVEOPT */
+#define NBD_REP_MAGIC           UINT64_C(0x0003e889045565a9)
+#define NBD_REQUEST_MAGIC       UINT32_C(0x25609513)
+#define NBD_SIMPLE_REPLY_MAGIC  UINT32_C(0x67446698)
+#define NBD_STRUCTURED_REPLY_MAGIC UINT32_C(0x668e33ef)
+
+#define NBD_FLAG_FIXED_NEWSTYLE 0x0001
+#define NBD_FLAG_NO_ZEROES      0x0002
+
+#define NBD_FLAG_C_FIXED_NEWSTYLE 0x00000001
+#define NBD_FLAG_C_NO_ZEROES    0x00000002
+
+#define NBD_FLAG_HAS_FLAGS      0x0001
+#define NBD_FLAG_READ_ONLY      0x0002
+#define NBD_FLAG_SEND_DF        0x0080
+#define NBD_FLAG_CAN_MULTI_CONN 0x0100
+
+#define NBD_OPT_EXPORT_NAME     1
+#define NBD_OPT_ABORT           2
+#define NBD_OPT_LIST            3
+#define NBD_OPT_INFO            6
+#define NBD_OPT_GO              7
+#define NBD_OPT_STRUCTURED_REPLY 8
+#define NBD_OPT_LIST_META_CONTEXT 9
+#define NBD_OPT_SET_META_CONTEXT 10
+
+#define NBD_REP_ACK             1
+#define NBD_REP_SERVER          2
+#define NBD_REP_INFO            3
+#define NBD_REP_META_CONTEXT    4
+#define NBD_REP_ERR_UNSUP       UINT32_C(0x80000001)
+#define NBD_REP_ERR_INVALID     UINT32_C(0x80000003)
+#define NBD_REP_ERR_UNKNOWN     UINT32_C(0x80000006)
+
+#define NBD_INFO_EXPORT         0
+#define NBD_INFO_BLOCK_SIZE     3
+
+#define NBD_CMD_READ            0
+#define NBD_CMD_WRITE           1
+#define NBD_CMD_DISC            2
+#define NBD_CMD_FLUSH           3
+#define NBD_CMD_BLOCK_STATUS    7
+
+#define NBD_CMD_FLAG_DF         0x0002
+#define NBD_CMD_FLAG_REQ_ONE    0x0008
+
+#define NBD_REPLY_FLAG_DONE     0x0001
+
+#define NBD_REPLY_TYPE_NONE     0
+#define NBD_REPLY_TYPE_OFFSET_DATA 1
+#define NBD_REPLY_TYPE_OFFSET_HOLE 2
+#define NBD_REPLY_TYPE_BLOCK_STATUS 5
+#define NBD_REPLY_TYPE_ERROR    0x8001
+
+#define NBD_STATE_HOLE          0x0001
+#define NBD_STATE_ZERO          0x0002
+
+#define NBD_EPERM               1
+#define NBD_EIO                 5
+#define NBD_EINVAL              22
+
+/* The only metadata context we support, and its id */
+#define META_BASE_ALLOCATION    "base:allocation"
+#define META_BASE_ALLOCATION_ID 1
+
+/* The largest option payload accepted during the handshake */
+#define MAX_OPTION_LENGTH 4096
+
+/* The largest read, and the most data inspected by one block status request */
+#define MAX_REQUEST (32 * 1024 * 1024)
+#define MAX_BLOCK_STATUS (4 * 1024 * 1024)
+
+/* Zeros are reported as holes at this granularity */
+#define HOLE_BLOCK 4096
+
+struct _nbd_server
+{
+    LDMVolumeHandle *h;
+    const gchar *name;
+    guint64 size;
+
+    GThreadPool *pool;
+
+    GMutex lock;
+    GPtrArray *conns;
+    guint n_conns;
+    guint64 n_requests;
+};
+
+struct _nbd_conn
+{
+    struct _nbd_server *s;
+    int fd;
+    gint refs;
+
+    gboolean structured;        /* Structured replies were negotiated */
+    gboolean allocation;        /* base:allocation was selected */
+
+    GThread *thread;
+    gint finished;              /* The reader thread has exited */
+    GMutex write_lock;
+};
+
+struct _nbd_request
+{
+    struct _nbd_conn *conn;
+    guint16 flags;
+    guint16 type;
+    guint64 handle;
+    guint64 offset;
+    guint32 length;
+};
+
+static volatile sig_atomic_t _stop = 0;
+
+static void
+_stop_handler(const int sig)
+{
+    _stop = 1;
+}
+
+static void
+_put16(guint8 * const buf, const guint16 v)
+{
+    const guint16 be = htobe16(v);
+    memcpy(buf, &be, sizeof(be));
+}
+
+static void
+_put32(guint8 * const buf, const guint32 v)
+{
+    const guint32 be = htobe32(v);
+    memcpy(buf, &be, sizeof(be));
+}
+
+static void
+_put64(guint8 * const buf, const guint64 v)
+{
+    const guint64 be = htobe64(v);
+    memcpy(buf, &be, sizeof(be));
+}
+
+static guint16
+_get16(const guint8 * const buf)
+{
+    guint16 be;
+    memcpy(&be, buf, sizeof(be));
+    return be16toh(be);
+}
+
+static guint32
+_get32(const guint8 * const buf)
+{
+    guint32 be;
+    memcpy(&be, buf, sizeof(be));
+    return be32toh(be);
+}
+
+static guint64
+_get64(const guint8 * const buf)
+{
+    guint64 be;
+    memcpy(&be, buf, sizeof(be));
+    return be64toh(be);
+}
+
+static gboolean
+_recv_all(const int fd, void * const buf, const gsize len)
+{
+    gsize done = 0;
+    while (done < len) {
+        const ssize_t in = recv(fd, (guint8 *) buf + done, len - done, 0);
+        if (in == -1 && errno == EINTR) continue;
+        if (in <= 0) return FALSE;
+        done += in;
+    }
+    return TRUE;
+}
+
+/* Discard len bytes of input */
+static gboolean
+_recv_skip(const int fd, gsize len)
+{
+    guint8 buf[4096];
+    while (len > 0) {
+        const gsize n = MIN(len, sizeof(buf));
+        if (!_recv_all(fd, buf, n)) return FALSE;
+        len -= n;
+    }
+    return TRUE;
+}
+
+static gboolean
+_send_all(const int fd, const void * const buf, const gsize len)
+{
+    gsize done = 0;
+    while (done < len) {
+        const ssize_t out = send(fd, (const guint8 *) buf + done, len - done,
+                                 MSG_NOSIGNAL);
+        if (out == -1 && errno == EINTR) continue;
+        if (out <= 0) return FALSE;
+        done += out;
+    }
+    return TRUE;
+}
+
+static void
+_conn_unref(struct _nbd_conn * const c)
+{
+    if (!g_atomic_int_dec_and_test(&c->refs)) return;
+
+    close(c->fd);
+    g_mutex_clear(&c->write_lock);
+    g_free(c);
+}
+
+/* Handshake */
+
+static gboolean
+_opt_reply(const struct _nbd_conn * const c, const guint32 option,
+           const guint32 type, const void * const data, const guint32 len)
+{
+    guint8 head[20];
+    _put64(head, NBD_REP_MAGIC);
+    _put32(head + 8, option);
+    _put32(head + 12, type);
+    _put32(head + 16, len);
+
+    return _send_all(c->fd, head, sizeof(head)) &&
+           (len == 0 || _send_all(c->fd, data, len));
+}
+
+static guint16
+_transmission_flags(const struct _nbd_conn * const c)
+{
+    guint16 flags = NBD_FLAG_HAS_FLAGS | NBD_FLAG_READ_ONLY |
+                    NBD_FLAG_CAN_MULTI_CONN;
+    if (c->structured) flags |= NBD_FLAG_SEND_DF;
+    return flags;
+}
+
+static gboolean
+_known_export(const struct _nbd_conn * const c, const guint8 * const name,
+              const guint32 len)
+{
+    /* The empty name selects the default export */
+    return len == 0 ||
+           (len == strlen(c->s->name) && memcmp(name, c->s->name, len) == 0);
+}
+
+/* NBD_OPT_INFO and NBD_OPT_GO */
+static gboolean
+_opt_info(const struct _nbd_conn * const c, const guint32 option,
+          const guint8 * const data, const guint32 len, gboolean * const go)
+{
+    *go = FALSE;
+
+    if (len < 6) {
+        return _opt_reply(c, option, NBD_REP_ERR_INVALID, NULL, 0);
+    }
+    const guint32 name_len = _get32(data);
+    if (name_len > len - 6 ||
+        len != 6 + name_len + 2 * (guint32) _get16(data + 4 + name_len))
+    {
+        return _opt_reply(c, option, NBD_REP_ERR_INVALID, NULL, 0);
+    }
+
+    if (!_known_export(c, data + 4, name_len)) {
+        return _opt_reply(c, option, NBD_REP_ERR_UNKNOWN, NULL, 0);
+    }
+
+    /* Export and block size information are sent whether requested or not */
+    guint8 info[14];
+    _put16(info, NBD_INFO_EXPORT);
+    _put64(info + 2, c->s->size);
+    _put16(info + 10, _transmission_flags(c));
+    if (!_opt_reply(c, option, NBD_REP_INFO, info, 12)) return FALSE;
+
+    _put16(info, NBD_INFO_BLOCK_SIZE);
+    _put32(info + 2, 1);
+    _put32(info + 6, HOLE_BLOCK);
+    _put32(info + 10, MAX_REQUEST);
+    if (!_opt_reply(c, option, NBD_REP_INFO, info, 14)) return FALSE;
+
+    if (!_opt_reply(c, option, NBD_REP_ACK, NULL, 0)) return FALSE;
+
+    *go = option == NBD_OPT_GO;
+    return TRUE;
+}
+
+/* NBD_OPT_LIST_META_CONTEXT and NBD_OPT_SET_META_CONTEXT */
+static gboolean
+_opt_meta_context(struct _nbd_conn * const c, const guint32 option,
+                  const guint8 * const data, const guint32 len)
+{
+    if (!c->structured || len < 8) {
+        return _opt_reply(c, option, NBD_REP_ERR_INVALID, NULL, 0);
+    }
+
+    const guint32 name_len = _get32(data);
+    if (name_len > len - 8) {
+        return _opt_reply(c, option, NBD_REP_ERR_INVALID, NULL, 0);
+    }
+    if (!_known_export(c, data + 4, name_len)) {
+        return _opt_reply(c, option, NBD_REP_ERR_UNKNOWN, NULL, 0);
+    }
+
+    const guint32 n_queries = _get32(data + 4 + name_len);
+    guint32 pos = 8 + name_len;
+
+    /* Listing with no queries returns every context */
+    gboolean found = option == NBD_OPT_LIST_META_CONTEXT && n_queries == 0;
+    for (guint32 i = 0; i < n_queries; i++) {
+        if (len - pos < 4 || _get32(data + pos) > len - pos - 4) {
+            return _opt_reply(c, option, NBD_REP_ERR_INVALID, NULL, 0);
+        }
+        const guint32 q_len = _get32(data + pos);
+        const guint8 * const q = data + pos + 4;
+        pos += 4 + q_len;
+
+        if (q_len == strlen(META_BASE_ALLOCATION) &&
+            memcmp(q, META_BASE_ALLOCATION, q_len) == 0) found = TRUE;
+
+        /* A namespace on its own lists all its contexts */
+        if (option == NBD_OPT_LIST_META_CONTEXT && q_len == 5 &&
+            memcmp(q, "base:", 5) == 0) found = TRUE;
+    }
+
+    if (option == NBD_OPT_SET_META_CONTEXT) c->allocation = found;
+
+    if (found) {
+        guint8 reply[4 + sizeof(META_BASE_ALLOCATION) - 1];
+        _put32(reply, META_BASE_ALLOCATION_ID);
+        memcpy(reply + 4, META_BASE_ALLOCATION, sizeof(reply) - 4);
+        if (!_opt_reply(c, option, NBD_REP_META_CONTEXT,
+                        reply, sizeof(reply))) return FALSE;
+    }
+
+    return _opt_reply(c, option, NBD_REP_ACK, NULL, 0);
+}
+
+/* Returns TRUE if the client entered the transmission phase */
+static gboolean
+_negotiate(struct _nbd_conn * const c)
+{
+    guint8 greeting[18];
+    _put64(greeting, NBD_MAGIC);
+    _put64(greeting + 8, NBD_OPTS_MAGIC);
+    _put16(greeting + 16, NBD_FLAG_FIXED_NEWSTYLE | NBD_FLAG_NO_ZEROES);
+    if (!_send_all(c->fd, greeting, sizeof(greeting))) return FALSE;
+
+    guint8 client[4];
+    if (!_recv_all(c->fd, client, sizeof(client))) return FALSE;
+    const guint32 client_flags = _get32(client);
+    if (client_flags & ~(NBD_FLAG_C_FIXED_NEWSTYLE | NBD_FLAG_C_NO_ZEROES)) {
+        return FALSE;
+    }
+    const gboolean no_zeroes = client_flags & NBD_FLAG_C_NO_ZEROES;
+
+    guint8 * const data = g_malloc(MAX_OPTION_LENGTH);
+    gboolean r = FALSE;
+
+    for (;;) {
+        guint8 head[16];
+        if (!_recv_all(c->fd, head, sizeof(head))) break;
+        if (_get64(head) != NBD_OPTS_MAGIC) break;
+
+        const guint32 option = _get32(head + 8);
+        const guint32 len = _get32(head + 12);
+
+        if (len > MAX_OPTION_LENGTH) {
+            if (!_recv_skip(c->fd, len) ||
+                !_opt_reply(c, option, NBD_REP_ERR_INVALID, NULL, 0)) break;
+            continue;
+        }
+        if (!_recv_all(c->fd, data, len)) break;
+
+        gboolean ok = TRUE;
+        gboolean go = FALSE;
+        switch (option) {
+        case NBD_OPT_EXPORT_NAME:
+        {
+            if (!_known_export(c, data, len)) goto out;
+
+            guint8 reply[10 + 124] = { 0, };
+            _put64(reply, c->s->size);
+            _put16(reply + 8, _transmission_flags(c));
+            r = _send_all(c->fd, reply, no_zeroes ? 10 : sizeof(reply));
+            goto out;
+        }
+
+        case NBD_OPT_ABORT:
+            _opt_reply(c, option, NBD_REP_ACK, NULL, 0);
+            goto out;
+
+        case NBD_OPT_LIST:
+        {
+            if (len != 0) {
+                ok = _opt_reply(c, option, NBD_REP_ERR_INVALID, NULL, 0);
+                break;
+            }
+
+            const guint32 name_len = strlen(c->s->name);
+            guint8 * const server = g_malloc(4 + name_len);
+            _put32(server, name_len);
+            memcpy(server + 4, c->s->name, name_len);
+            ok = _opt_reply(c, option, NBD_REP_SERVER, server, 4 + name_len) &&
+                 _opt_reply(c, option, NBD_REP_ACK, NULL, 0);
+            g_free(server);
+            break;
+        }
+
+        case NBD_OPT_INFO:
+        case NBD_OPT_GO:
+            ok = _opt_info(c, option, data, len, &go);
+            if (ok && go) {
+                r = TRUE;
+                goto out;
+            }
+            break;
+
+        case NBD_OPT_STRUCTURED_REPLY:
+            if (len != 0) {
+                ok = _opt_reply(c, option, NBD_REP_ERR_INVALID, NULL, 0);
+            } else {
+                c->structured = TRUE;
+                ok = _opt_reply(c, option, NBD_REP_ACK, NULL, 0);
+            }
+            break;
+
+        case NBD_OPT_LIST_META_CONTEXT:
+        case NBD_OPT_SET_META_CONTEXT:
+            ok = _opt_meta_context(c, option, data, len);
+            break;
+
+        default:
+            ok = _opt_reply(c, option, NBD_REP_ERR_UNSUP, NULL, 0);
+        }
+
+        if (!ok) break;
+    }
+
+out:
+    g_free(data);
+    return r;
+}
+
+/* Transmission */
+
+static gboolean
+_simple_reply(struct _nbd_conn * const c, const guint64 handle,
+              const guint32 error, const void * const data, const gsize len)
+{
+    guint8 head[16];
+    _put32(head, NBD_SIMPLE_REPLY_MAGIC);
+    _put32(head + 4, error);
+    _put64(head + 8, handle);
+
+    g_mutex_lock(&c->write_lock);
+    const gboolean r = _send_all(c->fd, head, sizeof(head)) &&
+                       (len == 0 || _send_all(c->fd, data, len));
+    g_mutex_unlock(&c->write_lock);
+    return r;
+}
+
+/* Send one chunk of a structured reply. The caller holds write_lock so that
+ * the chunks of a reply aren't interleaved with other replies. */
+static gboolean
+_chunk(struct _nbd_conn * const c, const guint64 handle, const guint16 flags,
+       const guint16 type, const void * const head, const gsize head_len,
+       const void * const data, const gsize len)
+{
+    guint8 chunk[20];
+    _put32(chunk, NBD_STRUCTURED_REPLY_MAGIC);
+    _put16(chunk + 4, flags);
+    _put16(chunk + 6, type);
+    _put64(chunk + 8, handle);
+    _put32(chunk + 16, head_len + len);
+
+    return _send_all(c->fd, chunk, sizeof(chunk)) &&
+           (head_len == 0 || _send_all(c->fd, head, head_len)) &&
+           (len == 0 || _send_all(c->fd, data, len));
+}
+
+static gboolean
+_error_reply(struct _nbd_conn * const c, const struct _nbd_request * const req,
+             const guint32 error)
+{
+    if (!c->structured) return _simple_reply(c, req->handle, error, NULL, 0);
+
+    guint8 payload[6];
+    _put32(payload, error);
+    _put16(payload + 4, 0);
+
+    g_mutex_lock(&c->write_lock);
+    const gboolean r = _chunk(c, req->handle, NBD_REPLY_FLAG_DONE,
+                              NBD_REPLY_TYPE_ERROR, payload, sizeof(payload),
+                              NULL, 0);
+    g_mutex_unlock(&c->write_lock);
+    return r;
+}
+
+/* Send a read as data and hole chunks, so that the client needn't receive
+ * zeros */
+static gboolean
+_read_reply_structured(struct _nbd_conn * const c,
+                       const struct _nbd_request * const req,
+                       const guint8 * const buf)
+{
+    gboolean r = TRUE;
+    guint8 head[12];
+
+    g_mutex_lock(&c->write_lock);
+
+    if (req->flags & NBD_CMD_FLAG_DF) {
+        _put64(head, req->offset);
+        r = _chunk(c, req->handle, NBD_REPLY_FLAG_DONE,
+                   NBD_REPLY_TYPE_OFFSET_DATA, head, 8, buf, req->length);
+        goto out;
+    }
+
+    guint32 pos = 0;
+    while (r && pos < req->length) {
+        const gboolean zero =
+            _ldm_simd_is_zero(buf + pos, MIN(HOLE_BLOCK, req->length - pos));
+
+        /* Extend the run while blocks have the same kind */
+        guint32 end = pos;
+        do {
+            end += MIN(HOLE_BLOCK, req->length - end);
+        } while (end < req->length &&
+                 _ldm_simd_is_zero(buf + end,
+                                   MIN(HOLE_BLOCK, req->length - end)) == zero);
+
+        _put64(head, req->offset + pos);
+        if (zero) {
+            _put32(head + 8, end - pos);
+            r = _chunk(c, req->handle, 0, NBD_REPLY_TYPE_OFFSET_HOLE,
+                       head, 12, NULL, 0);
+        } else {
+            r = _chunk(c, req->handle, 0, NBD_REPLY_TYPE_OFFSET_DATA,
+                       head, 8, buf + pos, end - pos);
+        }
+        pos = end;
+    }
+
+    if (r) {
+        r = _chunk(c, req->handle, NBD_REPLY_FLAG_DONE, NBD_REPLY_TYPE_NONE,
+                   NULL, 0, NULL, 0);
+    }
+
+out:
+    g_mutex_unlock(&c->write_lock);
+    return r;
+}
+
+static gboolean
+_cmd_read(struct _nbd_conn * const c, const struct _nbd_request * const req)
+{
+    if (req->length == 0 || req->length > MAX_REQUEST ||
+        req->offset > c->s->size || req->length > c->s->size - req->offset)
+    {
+        return _error_reply(c, req, NBD_EINVAL);
+    }
+
+    guint8 * const buf = g_try_malloc(req->length);
+    if (buf == NULL) return _error_reply(c, req, NBD_EIO);
+
+    GError *err = NULL;
+    gboolean r;
+    if (ldm_volume_pread(c->s->h, buf, req->length, req->offset, &err) == -1) {
+        g_warning("%s", err->message);
+        g_error_free(err);
+        r = _error_reply(c, req, NBD_EIO);
+    } else if (c->structured) {
+        r = _read_reply_structured(c, req, buf);
+    } else {
+        r = _simple_reply(c, req->handle, 0, buf, req->length);
+    }
+
+    g_free(buf);
+    return r;
+}
+
+/* Report runs of zeros as holes. There is no allocation information below the
+ * volume, so the data has to be read. */
+static gboolean
+_cmd_block_status(struct _nbd_conn * const c,
+                  const struct _nbd_request * const req)
+{
+    if (!c->allocation || req->length == 0 ||
+        req->offset > c->s->size || req->length > c->s->size - req->offset)
+    {
+        return _error_reply(c, req, NBD_EINVAL);
+    }
+
+    /* The reply may cover less than was asked for */
+    const guint32 len = MIN(req->length, MAX_BLOCK_STATUS);
+    guint8 * const buf = g_malloc(len);
+
+    GError *err = NULL;
+    if (ldm_volume_pread(c->s->h, buf, len, req->offset, &err) == -1) {
+        g_warning("%s", err->message);
+        g_error_free(err);
+        g_free(buf);
+        return _error_reply(c, req, NBD_EIO);
+    }
+
+    GByteArray * const descs = g_byte_array_new();
+    guint8 id[4];
+    _put32(id, META_BASE_ALLOCATION_ID);
+    g_byte_array_append(descs, id, sizeof(id));
+
+    guint32 pos = 0;
+    while (pos < len) {
+        const gboolean zero =
+            _ldm_simd_is_zero(buf + pos, MIN(HOLE_BLOCK, len - pos));
+
+        guint32 end = pos;
+        do {
+            end += MIN(HOLE_BLOCK, len - end);
+        } while (end < len &&
+                 _ldm_simd_is_zero(buf + end,
+                                   MIN(HOLE_BLOCK, len - end)) == zero);
+
+        guint8 desc[8];
+        _put32(desc, end - pos);
+        _put32(desc + 4, zero ? NBD_STATE_HOLE | NBD_STATE_ZERO : 0);
+        g_byte_array_append(descs, desc, sizeof(desc));
+
+        if (req->flags & NBD_CMD_FLAG_REQ_ONE) break;
+        pos = end;
+    }
+    g_free(buf);
+
+    g_mutex_lock(&c->write_lock);
+    const gboolean r = _chunk(c, req->handle, NBD_REPLY_FLAG_DONE,
+                              NBD_REPLY_TYPE_BLOCK_STATUS,
+                              descs->data, descs->len, NULL, 0);
+    g_mutex_unlock(&c->write_lock);
+
+    g_byte_array_unref(descs);
+    return r;
+}
+
+static void
+_request_run(gpointer const data, gpointer const user_data)
+{
+    struct _nbd_request * const req = data;
+    struct _nbd_conn * const c = req->conn;
+
+    gboolean r;
+    switch (req->type) {
+    case NBD_CMD_READ:
+        r = _cmd_read(c, req);
+        break;
+
+    case NBD_CMD_FLUSH:
+        r = _simple_reply(c, req->handle, 0, NULL, 0);
+        break;
+
+    case NBD_CMD_BLOCK_STATUS:
+        r = _cmd_block_status(c, req);
+        break;
+
+    case NBD_CMD_WRITE:
+        r = _error_reply(c, req, NBD_EPERM);
+        break;
+
+    default:
+        r = _error_reply(c, req, NBD_EINVAL);
+    }
+
+    /* The client has gone away. Stop the reader too. */
+    if (!r) shutdown(c->fd, SHUT_RDWR);
+
+    _conn_unref(c);
+    g_free(req);
+}
+
+/* Read requests from a connection and queue them for the workers */
+static gpointer
+_conn_run(gpointer const data)
+{
+    struct _nbd_conn * const c = data;
+    struct _nbd_server * const s = c->s;
+
+    if (!_negotiate(c)) goto out;
+
+    for (;;) {
+        guint8 head[28];
+        if (!_recv_all(c->fd, head, sizeof(head))) break;
+        if (_get32(head) != NBD_REQUEST_MAGIC) break;
+
+        struct _nbd_request * const req = g_new(struct _nbd_request, 1);
+        req->conn = c;
+        req->flags = _get16(head + 4);
+        req->type = _get16(head + 6);
+        req->handle = _get64(head + 8);
+        req->offset = _get64(head + 16);
+        req->length = _get32(head + 24);
+
+        if (req->type == NBD_CMD_DISC) {
+            g_free(req);
+            break;
+        }
+
+        /* The payload of a write must be consumed before it is refused */
+        if (req->type == NBD_CMD_WRITE && !_recv_skip(c->fd, req->length)) {
+            g_free(req);
+            break;
+        }
+
+        g_mutex_lock(&s->lock);
+        s->n_requests++;
+        g_mutex_unlock(&s->lock);
+
+        g_atomic_int_inc(&c->refs);
+        g_thread_pool_push(s->pool, req, NULL);
+    }
+
+out:
+    g_atomic_int_set(&c->finished, TRUE);
+    _conn_unref(c);
+    return NULL;
+}
+
+/* Release connections whose clients have disconnected */
+static void
+_reap(struct _nbd_server * const s)
+{
+    for (guint i = 0; i < s->conns->len;) {
+        struct _nbd_conn * const c = g_ptr_array_index(s->conns, i);
+        if (!g_atomic_int_get(&c->finished)) {
+            i++;
+            continue;
+        }
+
+        g_thread_join(c->thread);
+        _conn_unref(c);
+        g_ptr_array_remove_index_fast(s->conns, i);
+    }
+}
+
+static int
+_listen(const gchar * const path, GError ** const err)
+{
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        g_set_error(err, LDM_ERROR, LDM_ERROR_INVALID,
+                    "Socket path %s is too long", path);
+        return -1;
+    }
+    strcpy(addr.sun_path, path);
+
+    /* Replace a stale socket, but nothing else */
+    struct stat st;
+    if (lstat(path, &st) == 0) {
+        if (!S_ISSOCK(st.st_mode)) {
+            g_set_error(err, LDM_ERROR, LDM_ERROR_INVALID,
+                        "%s exists and is not a socket", path);
+            return -1;
+        }
+        unlink(path);
+    }
+
+    const int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd == -1) {
+        g_set_error(err, LDM_ERROR, LDM_ERROR_IO,
+                    "Error creating socket: %m");
+        return -1;
+    }
+
+    if (bind(fd, (struct sockaddr *) &addr, sizeof(addr)) == -1 ||
+        listen(fd, SOMAXCONN) == -1)
+    {
+        g_set_error(err, LDM_ERROR, LDM_ERROR_IO,
+                    "Error listening on %s: %m", path);
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+gboolean
+nbd_serve(LDMVolume * const vol, const NbdOptions * const opts,
+          JsonBuilder * const jb, GError ** const err)
+{
+    struct _nbd_server s = { 0, };
+    s.name = ldm_volume_peek_name(vol);
+    s.size = ldm_volume_get_size(vol) * SECTOR_SIZE;
+
+    s.h = ldm_volume_open(vol, err);
+    if (s.h == NULL) return FALSE;
+
+    const int listener = _listen(opts->socket, err);
+    if (listener == -1) {
+        ldm_volume_close(s.h);
+        return FALSE;
+    }
+
+    /* SIGINT and SIGTERM are only delivered while waiting for a connection,
+     * so that they interrupt the wait rather than a worker */
+    sigset_t stop_set, wait_set;
+    sigemptyset(&stop_set);
+    sigaddset(&stop_set, SIGINT);
+    sigaddset(&stop_set, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &stop_set, &wait_set);
+    sigdelset(&wait_set, SIGINT);
+    sigdelset(&wait_set, SIGTERM);
+
+    struct sigaction sa = { .sa_handler = _stop_handler };
+    struct sigaction old_int, old_term;
+    sigaction(SIGINT, &sa, &old_int);
+    sigaction(SIGTERM, &sa, &old_term);
+    _stop = 0;
+
+    const guint threads = opts->threads > 0 ? opts->threads
+                                            : g_get_num_processors();
+    s.pool = g_thread_pool_new(_request_run, NULL, threads, FALSE, err);
+    gboolean r = s.pool != NULL;
+
+    g_mutex_init(&s.lock);
+    s.conns = g_ptr_array_new();
+
+    while (r && !_stop) {
+        struct pollfd pfd = { .fd = listener, .events = POLLIN };
+        if (ppoll(&pfd, 1, NULL, &wait_set) == -1) {
+            if (errno == EINTR) continue;
+            g_set_error(err, LDM_ERROR, LDM_ERROR_IO,
+                        "Error waiting for connections: %m");
+            r = FALSE;
+            break;
+        }
+
+        const int fd = accept4(listener, NULL, NULL, SOCK_CLOEXEC);
+        if (fd == -1) {
+            if (errno == EINTR || errno == ECONNABORTED) continue;
+            g_set_error(err, LDM_ERROR, LDM_ERROR_IO,
+                        "Error accepting connection: %m");
+            r = FALSE;
+            break;
+        }
+
+        _reap(&s);
+
+        struct _nbd_conn * const c = g_new0(struct _nbd_conn, 1);
+        c->s = &s;
+        c->fd = fd;
+        c->refs = 2;            /* The reader thread, and the server */
+        g_mutex_init(&c->write_lock);
+        c->thread = g_thread_new("nbd-conn", _conn_run, c);
+
+        g_ptr_array_add(s.conns, c);
+        s.n_conns++;
+    }
+
+    /* Disconnect every client, and wait for outstanding requests */
+    for (guint i = 0; i < s.conns->len; i++) {
+        struct _nbd_conn * const c = g_ptr_array_index(s.conns, i);
+        shutdown(c->fd, SHUT_RDWR);
+        g_thread_join(c->thread);
+    }
+    if (s.pool) g_thread_pool_free(s.pool, FALSE, TRUE);
+    for (guint i = 0; i < s.conns->len; i++) {
+        _conn_unref(g_ptr_array_index(s.conns, i));
+    }
+    g_ptr_array_unref(s.conns);
+
+    sigaction(SIGINT, &old_int, NULL);
+    sigaction(SIGTERM, &old_term, NULL);
+    pthread_sigmask(SIG_UNBLOCK, &stop_set, NULL);
+
+    close(listener);
+    unlink(opts->socket);
+    ldm_volume_close(s.h);
+    g_mutex_clear(&s.lock);
+
+    if (!r) return FALSE;
+
+    json_builder_begin_object(jb);
+    json_builder_set_member_name(jb, "name");
+    json_builder_add_string_value(jb, s.name);
+    json_builder_set_member_name(jb, "socket");
+    json_builder_add_string_value(jb, opts->socket);
+    json_builder_set_member_name(jb, "connections");
+    json_builder_add_int_value(jb, s.n_conns);
+    json_builder_set_member_name(jb, "requests");
+    json_builder_add_int_value(jb, s.n_requests);
+    json_builder_end_object(jb);
+
+    return TRUE;
+}
@@ -0,0 +1,36 @@
+/* libldm
+ * Copyright 2012 Red Hat Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* A read-only NBD server for a single volume, listening on a Unix socket.
+ * Clients use the fixed newstyle handshake, and may negotiate structured
+ * replies and the base:allocation metadata context. */
+
+#include <glib.h>
+#include <json-glib/json-glib.h>
+
+#include "ldm.h"
+
+typedef struct {
+    const gchar *socket;        /* The path of the socket to listen on */
+    guint threads;              /* Worker threads, 0 for one per CPU */
+} NbdOptions;
+
+/* Serve vol until SIGINT or SIGTERM is received. The export is named after
+ * the volume, and is also the default export. A summary is added to jb as an
+ * object. */
+gboolean nbd_serve(LDMVolume *vol, const NbdOptions *opts, JsonBuilder *jb,
+                   GError **err);
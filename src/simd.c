@@ -0,0 +1,221 @@
+/* libldm
+ * Copyright 2012 Red Hat Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define SIMD_X86
+#endif
+
+#include "simd.h"
+
+typedef void (*_xor_fn)(uint8_t *dst, const uint8_t *src, size_t len);
+typedef int (*_is_zero_fn)(const uint8_t *buf, size_t len);
+
+struct _impl {
+    const char *name;
+    _xor_fn xor;
+    _is_zero_fn is_zero;
+};
+
+/* Handles the tail which is too short for a vector, and is the whole
+ * implementation on other architectures */
+static void
+_xor_generic(uint8_t *dst, const uint8_t *src, size_t len)
+{
+    while (len >= sizeof(uint64_t)) {
+        uint64_t d, s;
+        memcpy(&d, dst, sizeof(d));
+        memcpy(&s, src, sizeof(s));
+        d ^= s;
+        memcpy(dst, &d, sizeof(d));
+
+        dst += sizeof(d);
+        src += sizeof(s);
+        len -= sizeof(d);
+    }
+
+    while (len > 0) {
+        *dst++ ^= *src++;
+        len--;
+    }
+}
+
+static int
+_is_zero_generic(const uint8_t *buf, size_t len)
+{
+    for (; len >= sizeof(uint64_t); buf += sizeof(uint64_t),
+                                    len -= sizeof(uint64_t))
+    {
+        uint64_t v;
+        memcpy(&v, buf, sizeof(v));
+        if (v != 0) return 0;
+    }
+
+    for (; len > 0; buf++, len--) {
+        if (*buf != 0) return 0;
+    }
+
+    return 1;
+}
+
+#ifdef SIMD_X86
+
+__attribute__((target("sse2")))
+static void
+_xor_sse2(uint8_t *dst, const uint8_t *src, size_t len)
+{
+    for (; len >= 64; dst += 64, src += 64, len -= 64) {
+        for (int i = 0; i < 64; i += 16) {
+            const __m128i d = _mm_loadu_si128((const __m128i *)(dst + i));
+            const __m128i s = _mm_loadu_si128((const __m128i *)(src + i));
+            _mm_storeu_si128((__m128i *)(dst + i), _mm_xor_si128(d, s));
+        }
+    }
+    _xor_generic(dst, src, len);
+}
+
+__attribute__((target("sse2")))
+static int
+_is_zero_sse2(const uint8_t *buf, size_t len)
+{
+    for (; len >= 64; buf += 64, len -= 64) {
+        __m128i acc = _mm_loadu_si128((const __m128i *) buf);
+        for (int i = 16; i < 64; i += 16) {
+            acc = _mm_or_si128(acc,
+                               _mm_loadu_si128((const __m128i *)(buf + i)));
+        }
+        if (_mm_movemask_epi8(_mm_cmpeq_epi8(acc, _mm_setzero_si128()))
+            != 0xffff) return 0;
+    }
+    return _is_zero_generic(buf, len);
+}
+
+__attribute__((target("avx2")))
+static void
+_xor_avx2(uint8_t *dst, const uint8_t *src, size_t len)
+{
+    for (; len >= 128; dst += 128, src += 128, len -= 128) {
+        for (int i = 0; i < 128; i += 32) {
+            const __m256i d = _mm256_loadu_si256((const __m256i *)(dst + i));
+            const __m256i s = _mm256_loadu_si256((const __m256i *)(src + i));
+            _mm256_storeu_si256((__m256i *)(dst + i), _mm256_xor_si256(d, s));
+        }
+    }
+    _xor_generic(dst, src, len);
+}
+
+__attribute__((target("avx2")))
+static int
+_is_zero_avx2(const uint8_t *buf, size_t len)
+{
+    for (; len >= 128; buf += 128, len -= 128) {
+        __m256i acc = _mm256_loadu_si256((const __m256i *) buf);
+        for (int i = 32; i < 128; i += 32) {
+            acc = _mm256_or_si256(acc,
+                _mm256_loadu_si256((const __m256i *)(buf + i)));
+        }
+        if (!_mm256_testz_si256(acc, acc)) return 0;
+    }
+    return _is_zero_generic(buf, len);
+}
+
+__attribute__((target("avx512f")))
+static void
+_xor_avx512(uint8_t *dst, const uint8_t *src, size_t len)
+{
+    for (; len >= 256; dst += 256, src += 256, len -= 256) {
+        for (int i = 0; i < 256; i += 64) {
+            const __m512i d = _mm512_loadu_si512((const void *)(dst + i));
+            const __m512i s = _mm512_loadu_si512((const void *)(src + i));
+            _mm512_storeu_si512((void *)(dst + i), _mm512_xor_si512(d, s));
+        }
+    }
+    _xor_generic(dst, src, len);
+}
+
+__attribute__((target("avx512f")))
+static int
+_is_zero_avx512(const uint8_t *buf, size_t len)
+{
+    for (; len >= 256; buf += 256, len -= 256) {
+        __m512i acc = _mm512_loadu_si512((const void *) buf);
+        for (int i = 64; i < 256; i += 64) {
+            acc = _mm512_or_si512(acc,
+                                  _mm512_loadu_si512((const void *)(buf + i)));
+        }
+        if (_mm512_test_epi64_mask(acc, acc) != 0) return 0;
+    }
+    return _is_zero_generic(buf, len);
+}
+
+#endif /* SIMD_X86 */
+
+static const struct _impl *
+_select(void)
+{
+    static const struct _impl generic =
+        { "generic", _xor_generic, _is_zero_generic };
+#ifdef SIMD_X86
+    static const struct _impl sse2 = { "sse2", _xor_sse2, _is_zero_sse2 };
+    static const struct _impl avx2 = { "avx2", _xor_avx2, _is_zero_avx2 };
+    static const struct _impl avx512 =
+        { "avx512", _xor_avx512, _is_zero_avx512 };
+
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f")) return &avx512;
+    if (__builtin_cpu_supports("avx2")) return &avx2;
+    if (__builtin_cpu_supports("sse2")) return &sse2;
+#endif
+    return &generic;
+}
+
+/* Selection is idempotent, so racing threads at worst select twice */
+static const struct _impl *
+_impl(void)
+{
+    static const struct _impl *impl = NULL;
+
+    const struct _impl *r = __atomic_load_n(&impl, __ATOMIC_ACQUIRE);
+    if (r == NULL) {
+        r = _select();
+        __atomic_store_n(&impl, r, __ATOMIC_RELEASE);
+    }
+    return r;
+}
+
+void
+_ldm_simd_xor(void * const dst, const void * const src, const size_t len)
+{
+    _impl()->xor(dst, src, len);
+}
+
+int
+_ldm_simd_is_zero(const void * const buf, const size_t len)
+{
+    return _impl()->is_zero(buf, len);
+}
+
+const char *
+_ldm_simd_name(void)
+{
+    return _impl()->name;
+}
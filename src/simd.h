@@ -0,0 +1,33 @@
+/* libldm
+ * Copyright 2012 Red Hat Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stddef.h>
+
+/* These are built into both libldm and ldmtool, and are not part of libldm's
+ * ABI */
+#define _LDM_SIMD_PRIVATE __attribute__((visibility("hidden")))
+
+/* XOR len bytes of src into dst. The fastest implementation supported by the
+ * CPU is chosen on first use. */
+_LDM_SIMD_PRIVATE void _ldm_simd_xor(void *dst, const void *src, size_t len);
+
+/* Whether all len bytes of buf are zero */
+_LDM_SIMD_PRIVATE int _ldm_simd_is_zero(const void *buf, size_t len);
+
+/* The name of the implementation used by _ldm_simd_xor and _ldm_simd_is_zero:
+ * "avx512", "avx2", "sse2" or "generic" */
+_LDM_SIMD_PRIVATE const char *_ldm_simd_name(void);
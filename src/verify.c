@@ -0,0 +1,585 @@
+/* libldm
+ * Copyright 2012 Red Hat Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <string.h>
+#include <unistd.h>
+#include <uuid/uuid.h>
+
+#include <glib/gstdio.h>
+
+#include "simd.h"
+#include "verify.h"
+
+#define SECTOR_SIZE UINT64_C(512)
+
+/* The amount of volume data checked by a single work unit */
+#define VERIFY_UNIT (1024 * 1024)
+
+/* Mirror legs are compared in blocks of this size */
+#define VERIFY_BLOCK 4096
+
+/* Progress is saved at most this often, in seconds */
+#define CHECKPOINT_INTERVAL 5
+
+struct _mismatch
+{
+    guint64 offset;
+    guint64 length;
+    const gchar *partition;     /* The differing mirror leg, or NULL */
+};
+
+struct _verify
+{
+    LDMVolume *vol;
+    LDMVolumeInfo info;
+    gchar guid[37];
+
+    GArray *parts;
+    int *fds;                   /* Per column */
+
+    guint64 size;               /* In bytes */
+    guint64 end;                /* The end of the range which can be checked */
+    guint64 stripe;             /* Data bytes per RAID5 stripe */
+    guint64 unit;               /* Bytes of volume data per work unit */
+
+    GMutex lock;
+    GCond cond;
+};
+
+struct _verify_unit
+{
+    struct _verify *v;
+    guint64 offset;
+    guint64 length;
+
+    GArray *mismatches;
+    GError *err;
+    gboolean done;
+};
+
+static void
+_add_mismatch(GArray * const mismatches, const guint64 offset,
+              const guint64 length, const gchar * const partition)
+{
+    if (mismatches->len > 0) {
+        struct _mismatch * const last =
+            &g_array_index(mismatches, struct _mismatch, mismatches->len - 1);
+
+        if (last->partition == partition &&
+            last->offset + last->length == offset)
+        {
+            last->length += length;
+            return;
+        }
+    }
+
+    const struct _mismatch m = { offset, length, partition };
+    g_array_append_val(mismatches, m);
+}
+
+/* Map a range of the volume, returning all its extents */
+static LDMExtent *
+_map(const struct _verify * const v, const guint64 offset,
+     const guint64 length, gsize * const n, GError ** const err)
+{
+    const gssize count = ldm_volume_map(v->vol, offset, length, NULL, 0, err);
+    if (count == -1) return NULL;
+
+    LDMExtent * const extents = g_new(LDMExtent, count);
+    if (ldm_volume_map(v->vol, offset, length, extents, count, err) == -1) {
+        g_free(extents);
+        return NULL;
+    }
+
+    *n = count;
+    return extents;
+}
+
+static gboolean
+_read_extent(const struct _verify * const v, const LDMExtent * const e,
+             guint8 * const buf, GError ** const err)
+{
+    gsize read = 0;
+    while (read < e->length) {
+        const ssize_t in = pread(v->fds[e->column], buf + read,
+                                 e->length - read, e->disk_offset + read);
+        if (in == 0) {
+            g_set_error(err, LDM_ERROR, LDM_ERROR_IO,
+                        "Unexpected end of %s at offset %" PRIu64,
+                        ldm_disk_peek_device(e->disk), e->disk_offset + read);
+            return FALSE;
+        }
+
+        if (in == -1) {
+            if (errno == EINTR) continue;
+            g_set_error(err, LDM_ERROR, LDM_ERROR_IO,
+                        "Error reading from %s: %m",
+                        ldm_disk_peek_device(e->disk));
+            return FALSE;
+        }
+
+        read += in;
+    }
+
+    return TRUE;
+}
+
+/* Compare every leg of a mirror with the first */
+static gboolean
+_verify_mirrored(struct _verify_unit * const u, GError ** const err)
+{
+    const struct _verify * const v = u->v;
+
+    gsize n;
+    LDMExtent * const extents = _map(v, u->offset, u->length, &n, err);
+    if (extents == NULL) return FALSE;
+
+    gboolean r = FALSE;
+    guint8 * const first = g_malloc(u->length);
+    guint8 * const other = g_malloc(u->length);
+
+    if (!_read_extent(v, &extents[0], first, err)) goto out;
+
+    for (gsize i = 1; i < n; i++) {
+        const LDMExtent * const e = &extents[i];
+        if (!_read_extent(v, e, other, err)) goto out;
+
+        const gchar * const name = ldm_partition_peek_name(e->partition);
+        for (guint64 j = 0; j < e->length; j += VERIFY_BLOCK) {
+            const gsize len = MIN(VERIFY_BLOCK, e->length - j);
+            if (memcmp(first + j, other + j, len) != 0) {
+                _add_mismatch(u->mismatches, e->offset + j, len, name);
+            }
+        }
+    }
+    r = TRUE;
+
+out:
+    g_free(other);
+    g_free(first);
+    g_free(extents);
+    return r;
+}
+
+/* The XOR of every column of a RAID5 stripe, data and parity, is zero */
+static gboolean
+_verify_raid5(struct _verify_unit * const u, GError ** const err)
+{
+    const struct _verify * const v = u->v;
+    const guint64 chunk = v->info.chunk_size * SECTOR_SIZE;
+
+    guint8 * const acc = g_malloc(chunk);
+    guint8 * const col = g_malloc(chunk);
+    gboolean r = TRUE;
+
+    for (guint64 offset = u->offset; r && offset < u->offset + u->length;
+         offset += v->stripe)
+    {
+        gsize n;
+        LDMExtent * const extents = _map(v, offset, v->stripe, &n, err);
+        if (extents == NULL) {
+            r = FALSE;
+            break;
+        }
+
+        /* Every data extent is followed by the parity extent of its
+         * stripe. Only the first of those needs to be read. */
+        gboolean have_parity = FALSE;
+        gboolean have_first = FALSE;
+        for (gsize i = 0; r && i < n; i++) {
+            const LDMExtent * const e = &extents[i];
+            if (e->type == LDM_EXTENT_TYPE_PARITY) {
+                if (have_parity) continue;
+                have_parity = TRUE;
+            }
+
+            if (!have_first) {
+                r = _read_extent(v, e, acc, err);
+                have_first = TRUE;
+            } else if ((r = _read_extent(v, e, col, err))) {
+                _ldm_simd_xor(acc, col, e->length);
+            }
+        }
+        g_free(extents);
+
+        if (r && !_ldm_simd_is_zero(acc, chunk)) {
+            _add_mismatch(u->mismatches, offset, v->stripe, NULL);
+        }
+    }
+
+    g_free(col);
+    g_free(acc);
+    return r;
+}
+
+static void
+_verify_unit_run(gpointer const data, gpointer const user_data)
+{
+    struct _verify_unit * const u = data;
+    struct _verify * const v = u->v;
+
+    GError *err = NULL;
+    if (v->info.type == LDM_VOLUME_TYPE_MIRRORED) {
+        _verify_mirrored(u, &err);
+    } else {
+        _verify_raid5(u, &err);
+    }
+
+    g_mutex_lock(&v->lock);
+    u->err = err;
+    u->done = TRUE;
+    g_cond_broadcast(&v->cond);
+    g_mutex_unlock(&v->lock);
+}
+
+static void
+_verify_unit_free(struct _verify_unit * const u)
+{
+    g_array_unref(u->mismatches);
+    if (u->err) g_error_free(u->err);
+    g_free(u);
+}
+
+static JsonNode *
+_mismatch_to_json(const struct _mismatch * const m)
+{
+    JsonObject * const o = json_object_new();
+    json_object_set_int_member(o, "offset", m->offset);
+    json_object_set_int_member(o, "length", m->length);
+    if (m->partition) {
+        json_object_set_string_member(o, "partition", m->partition);
+    }
+
+    JsonNode * const node = json_node_new(JSON_NODE_OBJECT);
+    json_node_take_object(node, o);
+    return node;
+}
+
+/* Load the progress of an earlier run. A missing file is not an error. */
+static gboolean
+_checkpoint_load(const struct _verify * const v, const gchar * const path,
+                 guint64 * const offset, JsonArray ** const found,
+                 GError ** const err)
+{
+    if (!g_file_test(path, G_FILE_TEST_EXISTS)) return TRUE;
+
+    JsonParser * const parser = json_parser_new();
+    gboolean r = FALSE;
+
+    if (!json_parser_load_from_file(parser, path, err)) goto out;
+
+    JsonNode * const root = json_parser_get_root(parser);
+    JsonObject * const o =
+        JSON_NODE_HOLDS_OBJECT(root) ? json_node_get_object(root) : NULL;
+    if (o == NULL ||
+        !json_object_has_member(o, "volume") ||
+        !json_object_has_member(o, "size") ||
+        !json_object_has_member(o, "offset") ||
+        !json_object_has_member(o, "mismatches"))
+    {
+        g_set_error(err, LDM_ERROR, LDM_ERROR_INVALID,
+                    "%s is not a verify checkpoint", path);
+        goto out;
+    }
+
+    if (g_strcmp0(json_object_get_string_member(o, "volume"), v->guid) != 0 ||
+        (guint64) json_object_get_int_member(o, "size") != v->size)
+    {
+        g_set_error(err, LDM_ERROR, LDM_ERROR_INCONSISTENT,
+                    "Checkpoint %s belongs to a different volume", path);
+        goto out;
+    }
+
+    const guint64 saved = json_object_get_int_member(o, "offset");
+    if (saved > v->end) {
+        g_set_error(err, LDM_ERROR, LDM_ERROR_INVALID,
+                    "Checkpoint %s is beyond the end of the volume", path);
+        goto out;
+    }
+
+    *offset = saved;
+    json_array_unref(*found);
+    *found = json_array_ref(json_object_get_array_member(o, "mismatches"));
+    r = TRUE;
+
+out:
+    g_object_unref(parser);
+    return r;
+}
+
+static gboolean
+_checkpoint_save(const struct _verify * const v, const gchar * const path,
+                 const guint64 offset, JsonArray * const found,
+                 GError ** const err)
+{
+    JsonObject * const o = json_object_new();
+    json_object_set_string_member(o, "volume", v->guid);
+    json_object_set_int_member(o, "size", v->size);
+    json_object_set_int_member(o, "offset", offset);
+    json_object_set_array_member(o, "mismatches", json_array_ref(found));
+
+    JsonNode * const root = json_node_new(JSON_NODE_OBJECT);
+    json_node_take_object(root, o);
+
+    JsonGenerator * const jg = json_generator_new();
+    json_generator_set_root(jg, root);
+    gsize len;
+    gchar * const data = json_generator_to_data(jg, &len);
+    g_object_unref(jg);
+    json_node_free(root);
+
+    /* The file is replaced atomically, so an interrupted run always leaves a
+     * usable checkpoint */
+    const gboolean r = g_file_set_contents(path, data, len, err);
+    g_free(data);
+    return r;
+}
+
+/* Pace reads to the requested rate */
+static void
+_throttle(const guint64 rate, const gint64 start, guint64 * const consumed,
+          const guint64 cost)
+{
+    if (rate == 0) return;
+
+    *consumed += cost;
+    const gint64 due = start + (gint64)
+        ((gdouble) *consumed / rate * G_USEC_PER_SEC);
+    const gint64 now = g_get_monotonic_time();
+    if (due > now) g_usleep(due - now);
+}
+
+static gboolean
+_verify_init(struct _verify * const v, LDMVolume * const vol,
+             GError ** const err)
+{
+    g_mutex_init(&v->lock);
+    g_cond_init(&v->cond);
+
+    v->vol = vol;
+    ldm_volume_get_info(vol, &v->info);
+    uuid_unparse(v->info.guid, v->guid);
+
+    v->size = v->info.size * SECTOR_SIZE;
+    v->parts = ldm_volume_get_partitions(vol);
+    v->fds = g_new(int, v->parts->len);
+    for (guint i = 0; i < v->parts->len; i++) v->fds[i] = -1;
+
+    if (v->info.type == LDM_VOLUME_TYPE_MIRRORED) {
+        v->end = v->size;
+        v->stripe = VERIFY_BLOCK;
+        v->unit = VERIFY_UNIT;
+    } else if (v->info.type == LDM_VOLUME_TYPE_RAID5) {
+        /* Only complete stripes are protected by parity */
+        v->stripe = v->info.chunk_size * SECTOR_SIZE * (v->parts->len - 1);
+        v->end = v->size - v->size % v->stripe;
+        v->unit = MAX(v->stripe, VERIFY_UNIT - VERIFY_UNIT % v->stripe);
+    } else {
+        g_set_error(err, LDM_ERROR, LDM_ERROR_NOTSUPPORTED,
+                    "Volume %s has no redundancy to verify", v->info.name);
+        return FALSE;
+    }
+
+    for (guint i = 0; i < v->parts->len; i++) {
+        LDMPartition * const part = g_array_index(v->parts, LDMPartition *, i);
+        LDMPartitionInfo part_info;
+        ldm_partition_get_info(part, &part_info);
+
+        const gchar * const device = ldm_disk_peek_device(part_info.disk);
+        if (device == NULL) {
+            g_set_error(err, LDM_ERROR, LDM_ERROR_MISSING_DISK,
+                        "Disk %s required by volume %s is missing",
+                        ldm_disk_peek_name(part_info.disk), v->info.name);
+            return FALSE;
+        }
+
+        v->fds[i] = open(device, O_RDONLY | O_CLOEXEC);
+        if (v->fds[i] == -1) {
+            g_set_error(err, LDM_ERROR, LDM_ERROR_IO,
+                        "Error opening %s for reading: %m", device);
+            return FALSE;
+        }
+    }
+
+    return TRUE;
+}
+
+static void
+_verify_clear(struct _verify * const v)
+{
+    for (guint i = 0; i < v->parts->len; i++) {
+        if (v->fds[i] != -1) close(v->fds[i]);
+    }
+    g_free(v->fds);
+    g_array_unref(v->parts);
+    g_mutex_clear(&v->lock);
+    g_cond_clear(&v->cond);
+}
+
+gboolean
+verify_volume(LDMVolume * const vol, const VerifyOptions * const opts,
+              JsonBuilder * const jb, GError ** const err)
+{
+    struct _verify v = { 0, };
+    if (!_verify_init(&v, vol, err)) {
+        _verify_clear(&v);
+        return FALSE;
+    }
+
+    JsonArray *found = json_array_new();
+    guint64 checked = 0;
+    if (opts->checkpoint &&
+        !_checkpoint_load(&v, opts->checkpoint, &checked, &found, err))
+    {
+        json_array_unref(found);
+        _verify_clear(&v);
+        return FALSE;
+    }
+    const guint64 resumed = checked;
+
+    const guint threads = opts->threads > 0 ? opts->threads : v.parts->len;
+    GThreadPool * const pool = g_thread_pool_new(_verify_unit_run, NULL,
+                                                 threads, FALSE, err);
+    if (pool == NULL) {
+        json_array_unref(found);
+        _verify_clear(&v);
+        return FALSE;
+    }
+
+    /* Units are dispatched in order to a bounded queue, and retired in order
+     * so that the checkpoint only ever covers fully checked data */
+    GQueue queue = G_QUEUE_INIT;
+    GError *failed = NULL;
+    guint64 next = checked;
+    guint64 consumed = 0;
+    const gint64 start = g_get_monotonic_time();
+    gint64 saved = start;
+
+    while (next < v.end || !g_queue_is_empty(&queue)) {
+        while (failed == NULL && next < v.end &&
+               g_queue_get_length(&queue) < threads * 2)
+        {
+            struct _verify_unit * const u = g_new0(struct _verify_unit, 1);
+            u->v = &v;
+            u->offset = next;
+            u->length = MIN(v.unit, v.end - next);
+            u->mismatches = g_array_new(FALSE, FALSE, sizeof(struct _mismatch));
+            next += u->length;
+
+            /* Every leg of a mirror, or every column of a stripe, are read */
+            const guint64 cost = v.info.type == LDM_VOLUME_TYPE_MIRRORED ?
+                u->length * v.parts->len :
+                u->length / (v.parts->len - 1) * v.parts->len;
+            _throttle(opts->rate, start, &consumed, cost);
+
+            g_queue_push_tail(&queue, u);
+            g_thread_pool_push(pool, u, NULL);
+        }
+
+        struct _verify_unit * const u = g_queue_pop_head(&queue);
+        if (u == NULL) break;
+
+        g_mutex_lock(&v.lock);
+        while (!u->done) g_cond_wait(&v.cond, &v.lock);
+        g_mutex_unlock(&v.lock);
+
+        if (u->err && failed == NULL) {
+            failed = u->err;
+            u->err = NULL;
+        } else if (failed == NULL) {
+            for (guint i = 0; i < u->mismatches->len; i++) {
+                json_array_add_element(found, _mismatch_to_json(
+                    &g_array_index(u->mismatches, struct _mismatch, i)));
+            }
+            checked = u->offset + u->length;
+        }
+        _verify_unit_free(u);
+
+        const gint64 now = g_get_monotonic_time();
+        if (opts->checkpoint && failed == NULL &&
+            now - saved >= CHECKPOINT_INTERVAL * G_USEC_PER_SEC)
+        {
+            GError *save_err = NULL;
+            if (!_checkpoint_save(&v, opts->checkpoint, checked, found,
+                                  &save_err))
+            {
+                g_warning("Unable to save checkpoint: %s", save_err->message);
+                g_error_free(save_err);
+            }
+            saved = now;
+        }
+    }
+
+    g_thread_pool_free(pool, FALSE, TRUE);
+
+    if (failed) {
+        if (opts->checkpoint) {
+            GError *save_err = NULL;
+            if (!_checkpoint_save(&v, opts->checkpoint, checked, found,
+                                  &save_err))
+            {
+                g_warning("Unable to save checkpoint: %s", save_err->message);
+                g_error_free(save_err);
+            }
+        }
+
+        g_propagate_error(err, failed);
+        json_array_unref(found);
+        _verify_clear(&v);
+        return FALSE;
+    }
+
+    if (opts->checkpoint && g_unlink(opts->checkpoint) == -1 &&
+        errno != ENOENT)
+    {
+        g_warning("Unable to remove checkpoint %s: %m", opts->checkpoint);
+    }
+
+    json_builder_begin_object(jb);
+
+    json_builder_set_member_name(jb, "name");
+    json_builder_add_string_value(jb, v.info.name);
+    json_builder_set_member_name(jb, "guid");
+    json_builder_add_string_value(jb, v.guid);
+    json_builder_set_member_name(jb, "checked");
+    json_builder_add_int_value(jb, checked);
+    if (resumed > 0) {
+        json_builder_set_member_name(jb, "resumed-from");
+        json_builder_add_int_value(jb, resumed);
+    }
+    if (v.end < v.size) {
+        json_builder_set_member_name(jb, "unchecked");
+        json_builder_add_int_value(jb, v.size - v.end);
+    }
+    json_builder_set_member_name(jb, "consistent");
+    json_builder_add_boolean_value(jb, json_array_get_length(found) == 0);
+
+    JsonNode * const mismatches = json_node_new(JSON_NODE_ARRAY);
+    json_node_take_array(mismatches, found);
+    json_builder_set_member_name(jb, "mismatches");
+    json_builder_add_value(jb, mismatches);
+
+    json_builder_end_object(jb);
+
+    _verify_clear(&v);
+    return TRUE;
+}
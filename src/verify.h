@@ -0,0 +1,40 @@
+/* libldm
+ * Copyright 2012 Red Hat Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Consistency check of the redundancy of mirrored and RAID5 volumes, reading
+ * directly from the member disks. */
+
+#include <glib.h>
+#include <json-glib/json-glib.h>
+
+#include "ldm.h"
+
+typedef struct {
+    guint threads;              /* Worker threads, 0 for one per partition */
+    guint64 rate;               /* Bytes read per second, 0 for no limit */
+    const gchar *checkpoint;    /* Progress file, or NULL for none */
+} VerifyOptions;
+
+/* Compare the legs of a mirrored volume, or check the parity of every full
+ * stripe of a RAID5 volume. The result, including the extents which failed,
+ * is added to jb as an object.
+ *
+ * If a checkpoint file is given, progress is saved to it periodically and a
+ * later run resumes from where it left off. The file is removed when the
+ * check completes. */
+gboolean verify_volume(LDMVolume *vol, const VerifyOptions *opts,
+                       JsonBuilder *jb, GError **err);
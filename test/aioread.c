@@ -0,0 +1,234 @@
+/* aioread
+ * Copyright 2012 Red Hat Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Reads a whole volume with ldm_volume_read_async(), keeping several reads in
+ * flight, and checks that it reads the same as ldm_volume_pread(). The reads
+ * aren't aligned to sectors, chunks or stripes, and the last one runs past
+ * the end of the volume. The volume is read once with io_uring, if libldm was
+ * built with it and the kernel allows it, and once with the thread pools.
+ *
+ * Choosing the engine needs the internals of libldm, so this includes ldm.c
+ * rather than only linking against it. */
+
+#include "ldm.c"
+
+#include <stdio.h>
+
+/* An odd length, so that reads start and end part way through sectors */
+#define READ_SIZE (192 * 1024 + 1543)
+#define N_INFLIGHT 8
+#define BUF_SIZE (1024 * 1024)
+#define SECTOR_SIZE UINT64_C(512)
+
+struct read
+{
+    guint64 offset;
+    gsize expected;
+    guint *inflight;
+    guint *failures;
+};
+
+static void
+read_done(LDMVolumeHandle * const h, const gssize result,
+          const GError * const err, const gpointer user_data)
+{
+    struct read * const r = user_data;
+
+    if (result == -1) {
+        fprintf(stderr, "Error reading %" G_GSIZE_FORMAT " bytes at %"
+                        G_GUINT64_FORMAT ": %s\n",
+                r->expected, r->offset, err->message);
+        (*r->failures)++;
+    } else if ((gsize) result != r->expected) {
+        fprintf(stderr, "Read %" G_GSSIZE_FORMAT " bytes at %" G_GUINT64_FORMAT
+                        ", expected %" G_GSIZE_FORMAT "\n",
+                result, r->offset, r->expected);
+        (*r->failures)++;
+    }
+
+    (*r->inflight)--;
+    g_free(r);
+}
+
+/* Read the whole volume asynchronously into buf, which must have room for
+ * READ_SIZE bytes past its end. io_uring is only used if uring is true, and
+ * engine is set to the engine which was used. */
+static gboolean
+read_async(LDMVolume * const vol, guint8 * const buf, const guint64 size,
+           const gboolean uring, const gchar ** const engine,
+           GError ** const err)
+{
+#ifdef HAVE_LIBURING
+    _aio_use_uring = uring;
+#endif
+
+    LDMVolumeHandle * const h = ldm_volume_open(vol, err);
+    if (h == NULL) return FALSE;
+
+    guint inflight = 0;
+    guint failures = 0;
+    guint64 offset = 0;
+    gboolean ret = TRUE;
+
+    while (offset < size || inflight > 0) {
+        while (offset < size && inflight < N_INFLIGHT) {
+            struct read * const r = g_new(struct read, 1);
+            r->offset = offset;
+            r->expected = MIN(READ_SIZE, size - offset);
+            r->inflight = &inflight;
+            r->failures = &failures;
+
+            if (!ldm_volume_read_async(h, buf + offset, READ_SIZE, offset,
+                                       read_done, r, err))
+            {
+                g_free(r);
+                ret = FALSE;
+                goto out;
+            }
+
+            inflight++;
+            offset += r->expected;
+        }
+
+        ldm_volume_handle_dispatch(h, TRUE);
+    }
+
+    /* io_uring may be unavailable even if libldm was built with it, but the
+     * thread pools must be used when it isn't allowed */
+    LDMVolumeStats stats;
+    ldm_volume_handle_get_stats(h, &stats);
+    *engine = stats.aio_engine;
+    if (!uring && g_strcmp0(stats.aio_engine, "threads") != 0) {
+        fprintf(stderr, "Read with %s instead of threads\n",
+                stats.aio_engine);
+        failures++;
+    }
+
+    if (failures > 0) {
+        g_set_error(err, LDM_ERROR, LDM_ERROR_IO,
+                    "%u asynchronous reads failed", failures);
+        ret = FALSE;
+    }
+
+out:
+    /* Wait for the reads started before an error */
+    while (inflight > 0) ldm_volume_handle_dispatch(h, TRUE);
+    ldm_volume_close(h);
+
+    return ret;
+}
+
+int main(int argc, const char *argv[])
+{
+    if (argc < 4) {
+        fprintf(stderr, "Usage: %s <disk group guid> <volume> <drive> "
+                        "[<drive> ...]\n", argv[0]);
+        return 1;
+    }
+
+#if !GLIB_CHECK_VERSION(2,35,0)
+    g_type_init();
+#endif
+
+    LDM * const ldm = ldm_new();
+    LDMDiskGroup *dg = NULL;
+    LDMVolume *vol = NULL;
+    LDMVolumeHandle *h = NULL;
+    guint8 *expected = NULL;
+    guint8 *actual = NULL;
+    GError *err = NULL;
+    int ret = 1;
+
+    for (int i = 3; i < argc; i++) {
+        if (!ldm_add(ldm, argv[i], &err)) {
+            fprintf(stderr, "Error reading LDM: %s\n", err->message);
+            goto out;
+        }
+    }
+
+    dg = ldm_find_disk_group(ldm, argv[1]);
+    if (dg == NULL) {
+        fprintf(stderr, "Disk group %s not found\n", argv[1]);
+        goto out;
+    }
+
+    vol = ldm_disk_group_find_volume(dg, argv[2]);
+    if (vol == NULL) {
+        fprintf(stderr, "Volume %s not found\n", argv[2]);
+        goto out;
+    }
+
+    h = ldm_volume_open(vol, &err);
+    if (h == NULL) {
+        fprintf(stderr, "Error opening %s: %s\n", argv[2], err->message);
+        goto out;
+    }
+
+    const guint64 size = ldm_volume_get_size(vol) * SECTOR_SIZE;
+    expected = g_malloc(size);
+    actual = g_malloc(size + READ_SIZE);
+
+    for (guint64 offset = 0; offset < size;) {
+        const gssize n = ldm_volume_pread(h, expected + offset,
+                                          MIN(BUF_SIZE, size - offset),
+                                          offset, &err);
+        if (n == -1) {
+            fprintf(stderr, "Error reading %s: %s\n", argv[2], err->message);
+            goto out;
+        }
+        if (n == 0) {
+            fprintf(stderr, "Short read of %s at %" G_GUINT64_FORMAT "\n",
+                    argv[2], offset);
+            goto out;
+        }
+        offset += n;
+    }
+
+    ret = 0;
+    for (int uring = 1; uring >= 0; uring--) {
+        const gchar *engine = uring ? "io_uring" : "threads";
+
+        memset(actual, 0xa5, size);
+        if (!read_async(vol, actual, size, uring, &engine, &err)) {
+            fprintf(stderr, "Error reading %s with %s: %s\n",
+                    argv[2], engine, err->message);
+            g_error_free(err); err = NULL;
+            ret = 1;
+            continue;
+        }
+
+        for (guint64 i = 0; i < size; i++) {
+            if (actual[i] == expected[i]) continue;
+
+            fprintf(stderr, "Reading %s with %s differs at %" G_GUINT64_FORMAT
+                            "\n", argv[2], engine, i);
+            ret = 1;
+            break;
+        }
+    }
+
+out:
+    if (err) g_error_free(err);
+    ldm_volume_close(h);
+    if (vol) g_object_unref(vol);
+    if (dg) g_object_unref(dg);
+    g_object_unref(ldm);
+    g_free(expected);
+    g_free(actual);
+
+    return ret;
+}
@@ -0,0 +1,100 @@
+#!/usr/bin/perl
+
+# libldm
+# Copyright 2012 Red Hat Inc.
+#
+# This program is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+# Exports a volume to a file with ldmtool export, with one thread and with
+# several. The file must have the size of the volume, its SHA-256 must be the
+# expected checksum given by volread, and the blocks of zeros in the volume
+# must have been left as holes.
+#
+# The file is written next to the drives, so that ldmtool can copy between
+# them with copy_file_range. If all the disks of the volume are present and on
+# the same file system as the file, the summary must say that something was
+# copied.
+
+use strict;
+use warnings;
+
+use Digest::SHA;
+use File::Basename;
+use File::Temp qw(tempdir);
+use JSON::PP;
+
+my $builddir = shift @ARGV;
+my $expected = shift @ARGV;
+my $dg = shift @ARGV;
+my $vol = shift @ARGV;
+my @drives = map { ('-d', $_) } @ARGV;
+
+my $dir = tempdir(DIR => dirname($ARGV[0]), CLEANUP => 1);
+my $failed = 0;
+
+sub ldmtool
+{
+    open(my $out, '-|', "$builddir/ldmtool", @drives, @_)
+        or die("Unable to run ldmtool");
+    local $/;
+    my $result = <$out>;
+    close($out) or die("ldmtool @_ failed");
+
+    return decode_json($result);
+}
+
+sub fail
+{
+    print STDERR "$vol: ", @_, "\n";
+    $failed = 1;
+}
+
+my $info = ldmtool('show', 'volume', $dg, $vol);
+my $size = $info->{size} * 512;
+
+# Whether every disk of the volume is present on the file system of the file
+my $copy = 1;
+foreach my $part_name (@{$info->{partitions}}) {
+    my $part = ldmtool('show', 'partition', $dg, $part_name);
+    my $disk = ldmtool('show', 'disk', $dg, $part->{disk});
+    my $device = $disk->{device};
+    $copy = 0 unless (defined($device) &&
+                      (stat($device))[0] == (stat($dir))[0]);
+}
+
+foreach my $threads (1, 4) {
+    my $file = "$dir/export-$threads";
+    my $result = ldmtool('-t', $threads, 'export', 'volume', $dg, $vol, $file);
+    my $what = "export with $threads threads";
+
+    my @st = stat($file) or die("Unable to stat $file: $!");
+    fail("$what has size $st[7], expected $size") unless ($st[7] == $size);
+    fail("$what uses $st[12] blocks of 512 bytes, which isn't sparse")
+        unless ($st[12] * 512 < $size);
+
+    my $sha = Digest::SHA->new(256)->addfile($file, 'b')->hexdigest();
+    fail("$what has checksum $sha, expected $expected")
+        unless ($sha eq $expected);
+
+    my $total = $result->{written} + $result->{copied} + $result->{holes};
+    fail("$what accounted for $total bytes, expected $size")
+        unless ($result->{size} == $size && $total == $size);
+    fail("$what found no holes") unless ($result->{holes} > 0);
+    fail("$what didn't copy with copy_file_range")
+        if ($copy && $result->{copied} == 0);
+
+    unlink($file);
+}
+
+exit($failed);
@@ -0,0 +1,166 @@
+#!/usr/bin/perl
+
+# libldm
+# Copyright 2012 Red Hat Inc.
+#
+# This program is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+# Runs ldmtool show for a disk group and each of its volumes, partitions and
+# disks with -f json, -f jsonl and -f cbor, and checks that the jsonl and cbor
+# output decodes to the same result as the json output. In cbor, the value of
+# a guid member must be a tagged binary UUID, and nothing else may be.
+
+use strict;
+use warnings;
+
+use Encode qw(decode_utf8);
+use JSON::PP;
+
+my $builddir = shift @ARGV;
+my $dg = shift @ARGV;
+my @drives = map { ('-d', $_) } @ARGV;
+
+my $canonical = JSON::PP->new()->canonical();
+my $failed = 0;
+
+sub ldmtool
+{
+    my $format = shift;
+
+    open(my $out, '-|', "$builddir/ldmtool", @drives, '-f', $format, @_)
+        or die("Unable to run ldmtool");
+    binmode($out);
+    local $/;
+    my $result = <$out>;
+    close($out) or die("ldmtool -f $format @_ failed");
+
+    return $result;
+}
+
+# Whether the value of a member is a GUID
+sub guid_member
+{
+    my $name = shift;
+
+    return $name eq 'guid' || $name =~ /-guid$/;
+}
+
+sub cbor_item
+{
+    my ($data, $pos, $guid) = @_;
+
+    die("Truncated CBOR") if ($$pos >= length($$data));
+    my $initial = ord(substr($$data, $$pos++, 1));
+    my $major = $initial >> 5;
+    my $info = $initial & 0x1f;
+
+    if ($major == 7) {
+        die("GUID which isn't a UUID") if ($guid);
+        return JSON::PP::false if ($info == 20);
+        return JSON::PP::true if ($info == 21);
+        return undef if ($info == 22);
+        if ($info == 27) {
+            my $v = unpack('d>', substr($$data, $$pos, 8));
+            $$pos += 8;
+            return $v;
+        }
+        die("Unexpected CBOR simple value $info");
+    }
+
+    my $arg = $info;
+    if ($info >= 24 && $info <= 27) {
+        my $len = 1 << ($info - 24);
+        my $fmt = { 1 => 'C', 2 => 'n', 4 => 'N', 8 => 'Q>' }->{$len};
+        $arg = unpack($fmt, substr($$data, $$pos, $len));
+        $$pos += $len;
+    } elsif ($info > 27) {
+        die("Indefinite length CBOR item");
+    }
+
+    if ($major == 6) {
+        die("Tag $arg") unless ($arg == 37);
+        die("UUID which isn't the value of a guid member") unless ($guid);
+
+        my $bytes = ord(substr($$data, $$pos++, 1));
+        die("UUID isn't 16 bytes") unless ($bytes == 0x50);
+        my @b = unpack('H8 H4 H4 H4 H12', substr($$data, $$pos, 16));
+        $$pos += 16;
+        return join('-', @b);
+    }
+
+    if ($major == 0 || $major == 1) {
+        die("GUID which isn't a UUID") if ($guid);
+        return $major == 0 ? $arg : -1 - $arg;
+    }
+
+    if ($major == 2 || $major == 3) {
+        die("Unexpected byte string") if ($major == 2);
+        die("GUID written as a string") if ($guid);
+        my $str = substr($$data, $$pos, $arg);
+        $$pos += $arg;
+        return decode_utf8($str);
+    }
+
+    if ($major == 4) {
+        return [ map { cbor_item($data, $pos, $guid) } 1 .. $arg ];
+    }
+
+    if ($major == 5) {
+        die("GUID which isn't a UUID") if ($guid);
+        my %map;
+        for (1 .. $arg) {
+            my $name = cbor_item($data, $pos, 0);
+            $map{$name} = cbor_item($data, $pos, guid_member($name));
+        }
+        return \%map;
+    }
+}
+
+sub check
+{
+    my $json = decode_json(ldmtool('json', @_));
+    my $expected = $canonical->encode($json);
+
+    my @lines = split(/\n/, ldmtool('jsonl', @_));
+    my $jsonl = scalar(@lines) == 1 ?
+        $canonical->encode(decode_json($lines[0])) : "@lines";
+
+    my $data = ldmtool('cbor', @_);
+    my $pos = 0;
+    my $cbor = eval {
+        my $item = cbor_item(\$data, \$pos, 0);
+        die("Trailing data") unless ($pos == length($data));
+        $canonical->encode($item);
+    } // "$@";
+
+    foreach ([ 'jsonl', $jsonl ], [ 'cbor', $cbor ]) {
+        my ($format, $result) = @$_;
+        next if ($result eq $expected);
+
+        print STDERR "ldmtool @_ differs in $format:\n".
+                     "$result\nexpected:\n$expected\n";
+        $failed = 1;
+    }
+
+    return $json;
+}
+
+my $info = check('show', 'diskgroup', $dg);
+foreach my $vol (@{$info->{volumes}}) {
+    my $vol_info = check('show', 'volume', $dg, $vol);
+    check('show', 'partition', $dg, $_) foreach (@{$vol_info->{partitions}});
+}
+check('show', 'disk', $dg, $_) foreach (@{$info->{disks}});
+
+exit($failed);
@@ -0,0 +1,143 @@
+#!/usr/bin/perl
+
+# libldm
+# Copyright 2012 Red Hat Inc.
+#
+# This program is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+# Runs ldmtool verify on a mirrored or RAID5 volume, which must be consistent.
+# Then corrupts the second leg or column of the volume in copies of its disks,
+# and checks that verify reports exactly the corrupted extent, both from the
+# start and when resuming from a checkpoint before or after it.
+
+use strict;
+use warnings;
+
+use File::Copy;
+use File::Basename;
+use File::Temp qw(tempdir);
+use JSON::PP;
+
+my $builddir = shift @ARGV;
+my $dg = shift @ARGV;
+my $vol = shift @ARGV;
+
+my $dir = tempdir(CLEANUP => 1);
+my $failed = 0;
+
+sub ldmtool
+{
+    open(my $out, '-|', "$builddir/ldmtool", @_)
+        or die("Unable to run ldmtool");
+    local $/;
+    my $result = <$out>;
+    close($out) or die("ldmtool @_ failed");
+
+    return decode_json($result);
+}
+
+sub fail
+{
+    print STDERR "$vol: ", @_, "\n";
+    $failed = 1;
+}
+
+sub verify
+{
+    my ($drives, @options) = @_;
+
+    return ldmtool(@$drives, @options, 'verify', 'volume', $dg, $vol);
+}
+
+sub check_mismatches
+{
+    my ($what, $result, $expected) = @_;
+
+    my $json = JSON::PP->new()->canonical();
+    my $found = $json->encode($result->{mismatches});
+    my $want = $json->encode($expected);
+
+    fail("$what found $found, expected $want") unless ($found eq $want);
+    fail("$what is ", $result->{consistent} ? '' : 'not ', 'consistent')
+        if (($result->{consistent} ? 1 : 0) != (@$expected ? 0 : 1));
+}
+
+my @drives = map { ('-d', $_) } @ARGV;
+
+my $info = ldmtool(@drives, 'show', 'volume', $dg, $vol);
+my $size = $info->{size} * 512;
+my $result = verify(\@drives);
+check_mismatches('Intact volume', $result, []);
+fail("checked $result->{checked} bytes of $size") if ($result->{checked} == 0);
+
+# Corrupt a block half way through the second partition, in copies
+my @copies = map { ('-d', "$dir/" . basename($_)) } @ARGV;
+copy($_, $dir) or die("Unable to copy $_: $!") foreach (@ARGV);
+
+my $part_name = $info->{partitions}[1];
+my $part = ldmtool(@copies, 'show', 'partition', $dg, $part_name);
+my $disk = ldmtool(@copies, 'show', 'disk', $dg, $part->{disk});
+
+my $expected;
+my $resume_before;
+my $resume_after;
+my $part_offset;
+if (lc($info->{type}) eq 'mirrored') {
+    # A corrupted block of a leg is reported in the leg
+    $part_offset = int($size / 2 / 4096) * 4096;
+    $expected = { offset => $part_offset, length => 4096,
+                  partition => $part_name };
+    $resume_before = $part_offset - 4096;
+    $resume_after = $part_offset + 4096;
+} else {
+    # A corrupted chunk of a column is reported as its whole stripe
+    my $chunk = $info->{'chunk-size'} * 512;
+    my $stripe = $chunk * (scalar(@{$info->{partitions}}) - 1);
+    my $row = int($size / $stripe / 2);
+    $part_offset = $row * $chunk;
+    $expected = { offset => $row * $stripe, length => $stripe };
+    $resume_before = ($row - 1) * $stripe;
+    $resume_after = ($row + 1) * $stripe;
+}
+
+my $disk_offset = ($disk->{'data-start'} + $part->{start}) * 512 + $part_offset;
+open(my $fh, '+<', $disk->{device}) or die("Unable to open $disk->{device}");
+binmode($fh);
+seek($fh, $disk_offset, 0);
+read($fh, my $data, 16) == 16 or die("Unable to read $disk->{device}");
+seek($fh, $disk_offset, 0);
+print $fh ($data ^ ("\xff" x 16));
+close($fh) or die("Unable to write $disk->{device}");
+
+check_mismatches('Corrupted volume', verify(\@copies), [ $expected ]);
+
+# Resume from a checkpoint before the corruption, and from one after it which
+# has already found it
+my $checkpoint = "$dir/checkpoint";
+foreach ([ $resume_before, [] ], [ $resume_after, [ $expected ] ]) {
+    my ($offset, $found) = @$_;
+
+    open(my $cp, '>', $checkpoint) or die("Unable to write $checkpoint");
+    print $cp encode_json({ volume => $info->{guid}, size => $size,
+                            offset => $offset, mismatches => $found });
+    close($cp);
+
+    my $result = verify(\@copies, '--checkpoint', $checkpoint);
+    check_mismatches("Resumed from $offset", $result, [ $expected ]);
+    my $resumed = $result->{'resumed-from'} // 0;
+    fail("resumed from $resumed, expected $offset") unless ($resumed == $offset);
+    fail("checkpoint left behind") if (-e $checkpoint);
+}
+
+exit($failed);
@@ -0,0 +1,262 @@
+/* dmbench
+ * Copyright 2012 Red Hat Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Measures device mapper activation against the in-memory mock backend, so it
+ * needs neither root nor loop devices. For each volume type it reports the
+ * ioctls needed to create and remove one volume, then the time taken to
+ * create, refresh and remove every volume at once. Nothing has changed when
+ * the volumes are refreshed, so refreshing should only read their tables. */
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <glib-object.h>
+
+#include "ldm.h"
+#include "dmmock.h"
+
+#define N_TYPES (LDM_VOLUME_TYPE_RAID5 + 1)
+
+struct type_stats
+{
+    guint volumes;
+    guint create_ioctls;
+    guint remove_ioctls;
+};
+
+static gboolean
+check_results(GArray * const results, GError * const err, const char *op)
+{
+    if (results == NULL) {
+        fprintf(stderr, "%s: %s\n", op, err->message);
+        g_error_free(err);
+        return FALSE;
+    }
+
+    gboolean r = TRUE;
+    for (guint i = 0; i < results->len; i++) {
+        const LDMDmResult * const result =
+            &g_array_index(results, LDMDmResult, i);
+        if (result->error) {
+            fprintf(stderr, "%s: %s\n", op, result->error->message);
+            r = FALSE;
+        }
+    }
+    g_array_unref(results);
+
+    return r;
+}
+
+/* Count the ioctls of creating and removing each volume on its own. The
+ * cached device list is primed first, so only the operation itself counts. */
+static gboolean
+per_volume(LDM * const ldm, dm_backend_t * const mock,
+           struct type_stats * const stats)
+{
+    gboolean r = TRUE;
+
+    GArray * const dgs = ldm_get_disk_groups(ldm);
+    for (guint i = 0; r && i < dgs->len; i++) {
+        LDMDiskGroup * const dg = g_array_index(dgs, LDMDiskGroup *, i);
+
+        GArray * const vols = ldm_disk_group_get_volumes(dg);
+        for (guint j = 0; r && j < vols->len; j++) {
+            LDMVolume * const vol = g_array_index(vols, LDMVolume *, j);
+            struct type_stats * const type =
+                &stats[ldm_volume_get_voltype(vol)];
+            dm_mock_stats_t mock_stats;
+            GError *err = NULL;
+
+            g_free(ldm_volume_dm_get_device(vol, NULL));
+            dm_mock_reset_stats(mock);
+            if (!ldm_volume_dm_create(vol, NULL, &err)) {
+                fprintf(stderr, "create: %s\n", err->message);
+                g_error_free(err);
+                r = FALSE;
+                break;
+            }
+            dm_mock_get_stats(mock, &mock_stats);
+            type->create_ioctls += mock_stats.ioctls;
+
+            g_free(ldm_volume_dm_get_device(vol, NULL));
+            dm_mock_reset_stats(mock);
+            if (!ldm_volume_dm_remove(vol, NULL, &err)) {
+                fprintf(stderr, "remove: %s\n", err->message);
+                g_error_free(err);
+                r = FALSE;
+                break;
+            }
+            dm_mock_get_stats(mock, &mock_stats);
+            type->remove_ioctls += mock_stats.ioctls;
+
+            type->volumes++;
+        }
+        g_array_unref(vols);
+    }
+    g_array_unref(dgs);
+
+    return r;
+}
+
+int main(int argc, char *argv[])
+{
+    gint existing = 2000;
+    gint ioctl_usec = 50;
+    gint udev_usec = 5000;
+    gint rounds = 10;
+
+    const GOptionEntry entries[] = {
+        { "existing", 'e', 0, G_OPTION_ARG_INT, &existing,
+          "Devices already on the simulated host", "N" },
+        { "ioctl-latency", 'i', 0, G_OPTION_ARG_INT, &ioctl_usec,
+          "Time taken by each ioctl", "USEC" },
+        { "udev-latency", 'u', 0, G_OPTION_ARG_INT, &udev_usec,
+          "Time taken by udev to process a cookie's events", "USEC" },
+        { "rounds", 'r', 0, G_OPTION_ARG_INT, &rounds,
+          "Times to create, refresh and remove every volume", "N" },
+        { NULL }
+    };
+
+    GOptionContext * const context = g_option_context_new("<drive> ...");
+    g_option_context_add_main_entries(context, entries, NULL);
+
+    GError *err = NULL;
+    if (!g_option_context_parse(context, &argc, &argv, &err) || argc < 2) {
+        if (err) {
+            fprintf(stderr, "%s\n", err->message);
+            g_error_free(err);
+        } else {
+            fprintf(stderr, "Usage: %s [OPTION...] <drive> [<drive> ...]\n",
+                    argv[0]);
+        }
+        g_option_context_free(context);
+        return 1;
+    }
+    g_option_context_free(context);
+
+#if !GLIB_CHECK_VERSION(2,35,0)
+    g_type_init();
+#endif
+
+    dm_backend_t * const mock = dm_mock_new(existing, ioctl_usec, udev_usec);
+    _ldm_dm_backend_set(mock);
+
+    LDM *ldm = ldm_new();
+    int ret = 1;
+
+    for (int i = 1; i < argc; i++) {
+        if (!ldm_add(ldm, argv[i], &err)) {
+            fprintf(stderr, "Error reading LDM: %s\n", err->message);
+            g_error_free(err);
+            goto out;
+        }
+    }
+
+    struct type_stats stats[N_TYPES] = { { 0 } };
+    if (!per_volume(ldm, mock, stats)) goto out;
+
+    GEnumClass * const types = g_type_class_ref(LDM_TYPE_VOLUME_TYPE);
+    guint n_vols = 0;
+    printf("%-10s %7s %14s %14s\n",
+           "Type", "Volumes", "Create ioctls", "Remove ioctls");
+    for (int i = 0; i < N_TYPES; i++) {
+        if (stats[i].volumes == 0) continue;
+
+        printf("%-10s %7u %14.1f %14.1f\n",
+               g_enum_get_value(types, i)->value_nick, stats[i].volumes,
+               (double) stats[i].create_ioctls / stats[i].volumes,
+               (double) stats[i].remove_ioctls / stats[i].volumes);
+        n_vols += stats[i].volumes;
+    }
+    g_type_class_unref(types);
+
+    /* Each round starts from a dropped cache, as a fresh ldmtool would */
+    gint64 create_usec = 0, refresh_usec = 0, remove_usec = 0;
+    guint create_ioctls = 0, refresh_ioctls = 0, remove_ioctls = 0;
+    guint udev_waits = 0;
+    for (int i = 0; i < rounds; i++) {
+        dm_mock_stats_t mock_stats;
+        GArray *results;
+
+        ldm_dm_refresh_cache(ldm);
+        dm_mock_reset_stats(mock);
+        gint64 start = g_get_monotonic_time();
+        results = ldm_dm_create_all(ldm, &err);
+        if (!check_results(results, err, "create all")) goto out;
+        create_usec += g_get_monotonic_time() - start;
+        dm_mock_get_stats(mock, &mock_stats);
+        create_ioctls += mock_stats.ioctls;
+        udev_waits += mock_stats.udev_waits;
+
+        ldm_dm_refresh_cache(ldm);
+        dm_mock_reset_stats(mock);
+        start = g_get_monotonic_time();
+        results = ldm_dm_refresh_all(ldm, 0, NULL, &err);
+        if (!check_results(results, err, "refresh all")) goto out;
+        refresh_usec += g_get_monotonic_time() - start;
+        dm_mock_get_stats(mock, &mock_stats);
+        refresh_ioctls += mock_stats.ioctls;
+        udev_waits += mock_stats.udev_waits;
+
+        ldm_dm_refresh_cache(ldm);
+        dm_mock_reset_stats(mock);
+        start = g_get_monotonic_time();
+        results = ldm_dm_remove_all(ldm, &err);
+        if (!check_results(results, err, "remove all")) goto out;
+        remove_usec += g_get_monotonic_time() - start;
+        dm_mock_get_stats(mock, &mock_stats);
+        remove_ioctls += mock_stats.ioctls;
+        udev_waits += mock_stats.udev_waits;
+    }
+
+    if (rounds > 0 && n_vols > 0) {
+        printf("\n%d rounds of %u volumes with %d existing devices\n",
+               rounds, n_vols, existing);
+        printf("create all: %8.1f ms/round %8.1f volumes/s %8u ioctls/round\n",
+               create_usec / 1000.0 / rounds,
+               n_vols * rounds * 1000000.0 / MAX(create_usec, 1),
+               create_ioctls / rounds);
+        printf("refresh all: %7.1f ms/round %8.1f volumes/s %8u ioctls/round\n",
+               refresh_usec / 1000.0 / rounds,
+               n_vols * rounds * 1000000.0 / MAX(refresh_usec, 1),
+               refresh_ioctls / rounds);
+        printf("remove all: %8.1f ms/round %8.1f volumes/s %8u ioctls/round\n",
+               remove_usec / 1000.0 / rounds,
+               n_vols * rounds * 1000000.0 / MAX(remove_usec, 1),
+               remove_ioctls / rounds);
+        printf("udev waits: %8.1f/round\n", (double) udev_waits / rounds);
+    }
+
+    dm_mock_stats_t mock_stats;
+    dm_mock_get_stats(mock, &mock_stats);
+    if (mock_stats.devices != (guint) existing) {
+        fprintf(stderr, "%u devices left behind\n",
+                mock_stats.devices - existing);
+        goto out;
+    }
+
+    ret = 0;
+
+out:
+    g_object_unref(ldm);
+    _ldm_dm_backend_set(NULL);
+    dm_mock_free(mock);
+
+    return ret;
+}
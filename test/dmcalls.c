@@ -0,0 +1,201 @@
+/* dmcalls
+ * Copyright 2012 Red Hat Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Creates, refreshes and removes every volume against the in-memory mock
+ * backend, and checks that each step creates, reloads and removes exactly the
+ * devices it should. Repeating a step, or refreshing volumes which haven't
+ * changed, must do nothing. Refreshing with different flags must reload the
+ * devices the volume keeps, create the ones it gains and remove the ones it
+ * no longer uses. */
+
+#include <config.h>
+
+#include <stdio.h>
+#include <string.h>
+
+#include <glib-object.h>
+
+#include "ldm.h"
+#include "dmmock.h"
+
+#define N_EXISTING 100
+
+static int failures = 0;
+
+/* Returns the volumes which were operated on successfully */
+static GPtrArray *
+check_results(GArray * const results, GError * const err, const char *op)
+{
+    if (results == NULL) {
+        fprintf(stderr, "%s: %s\n", op, err->message);
+        g_error_free(err);
+        failures++;
+        return NULL;
+    }
+
+    GPtrArray * const vols = g_ptr_array_new_with_free_func(g_object_unref);
+    for (guint i = 0; i < results->len; i++) {
+        const LDMDmResult * const result =
+            &g_array_index(results, LDMDmResult, i);
+        if (result->error == NULL) {
+            g_ptr_array_add(vols, g_object_ref(result->volume));
+        }
+    }
+    g_array_unref(results);
+
+    return vols;
+}
+
+/* Add the uuids of the devices planned for vol with flags to uuids */
+static void
+add_plan(GHashTable * const uuids, LDMVolume * const vol,
+         const LDMDmFlags flags)
+{
+    GError *err = NULL;
+    GArray * const devices = ldm_volume_dm_plan(vol, flags, NULL, &err);
+    if (devices == NULL) {
+        fprintf(stderr, "plan: %s\n", err->message);
+        g_error_free(err);
+        failures++;
+        return;
+    }
+
+    for (guint i = 0; i < devices->len; i++) {
+        const LDMDmDevice * const device =
+            &g_array_index(devices, LDMDmDevice, i);
+        g_hash_table_add(uuids, g_strdup(device->uuid));
+    }
+    g_array_unref(devices);
+}
+
+static void
+expect(dm_backend_t * const mock, const char * const op, const guint creates,
+       const guint reloads, const guint removes)
+{
+    dm_mock_stats_t stats;
+    dm_mock_get_stats(mock, &stats);
+    dm_mock_reset_stats(mock);
+
+    if (stats.creates != creates || stats.reloads != reloads ||
+        stats.removes != removes)
+    {
+        fprintf(stderr, "%s: %u creates, %u reloads and %u removes, "
+                        "expected %u, %u and %u\n", op,
+                stats.creates, stats.reloads, stats.removes,
+                creates, reloads, removes);
+        failures++;
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc < 2) {
+        fprintf(stderr, "Usage: %s <drive> [<drive> ...]\n", argv[0]);
+        return 1;
+    }
+
+#if !GLIB_CHECK_VERSION(2,35,0)
+    g_type_init();
+#endif
+
+    dm_backend_t * const mock = dm_mock_new(N_EXISTING, 0, 0);
+    _ldm_dm_backend_set(mock);
+
+    LDM * const ldm = ldm_new();
+    GPtrArray *vols = NULL;
+    GHashTable * const rw =
+        g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+    GHashTable * const ro =
+        g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+    GError *err = NULL;
+
+    for (int i = 1; i < argc; i++) {
+        if (!ldm_add(ldm, argv[i], &err)) {
+            fprintf(stderr, "Error reading LDM: %s\n", err->message);
+            g_error_free(err);
+            failures++;
+            goto out;
+        }
+    }
+
+    vols = check_results(ldm_dm_create_all(ldm, &err), err, "create all");
+    if (vols == NULL) goto out;
+    if (vols->len == 0) {
+        fprintf(stderr, "No volume was created\n");
+        failures++;
+        goto out;
+    }
+
+    for (guint i = 0; i < vols->len; i++) {
+        add_plan(rw, g_ptr_array_index(vols, i), 0);
+        add_plan(ro, g_ptr_array_index(vols, i), LDM_DM_READ_ONLY);
+    }
+    expect(mock, "create all", g_hash_table_size(rw), 0, 0);
+
+    GPtrArray *again;
+    again = check_results(ldm_dm_create_all(ldm, &err), err, "create again");
+    if (again) g_ptr_array_unref(again);
+    expect(mock, "create again", 0, 0, 0);
+
+    again = check_results(ldm_dm_refresh_all(ldm, 0, NULL, &err),
+                          err, "refresh");
+    if (again) g_ptr_array_unref(again);
+    expect(mock, "refresh", 0, 0, 0);
+
+    /* Every device is reloaded read-only, or created or removed if a
+     * mirror is mapped directly onto a partition */
+    guint kept = 0;
+    GHashTableIter iter;
+    gpointer uuid;
+    g_hash_table_iter_init(&iter, ro);
+    while (g_hash_table_iter_next(&iter, &uuid, NULL)) {
+        if (g_hash_table_contains(rw, uuid)) kept++;
+    }
+    again = check_results(ldm_dm_refresh_all(ldm, LDM_DM_READ_ONLY, NULL,
+                                             &err), err, "refresh read-only");
+    if (again) g_ptr_array_unref(again);
+    expect(mock, "refresh read-only", g_hash_table_size(ro) - kept, kept,
+           g_hash_table_size(rw) - kept);
+
+    again = check_results(ldm_dm_refresh_all(ldm, LDM_DM_READ_ONLY, NULL,
+                                             &err),
+                          err, "refresh read-only again");
+    if (again) g_ptr_array_unref(again);
+    expect(mock, "refresh read-only again", 0, 0, 0);
+
+    again = check_results(ldm_dm_remove_all(ldm, &err), err, "remove all");
+    if (again) g_ptr_array_unref(again);
+    expect(mock, "remove all", 0, 0, g_hash_table_size(ro));
+
+    dm_mock_stats_t stats;
+    dm_mock_get_stats(mock, &stats);
+    if (stats.devices != N_EXISTING) {
+        fprintf(stderr, "%u devices left behind\n",
+                stats.devices - N_EXISTING);
+        failures++;
+    }
+
+out:
+    if (vols) g_ptr_array_unref(vols);
+    g_hash_table_unref(rw);
+    g_hash_table_unref(ro);
+    g_object_unref(ldm);
+    _ldm_dm_backend_set(NULL);
+    dm_mock_free(mock);
+
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,671 @@
+/* libldm
+ * Copyright 2012 Red Hat Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+
+#include <glib-object.h>
+
+#include "ldm.h"
+#include "dmmock.h"
+
+/* The ioctls libdevmapper issues for each operation */
+#define MOCK_IOCTLS_LIST        1   /* DM_DEVICE_LIST */
+#define MOCK_IOCTLS_LIST_DEV    2   /* DM_DEVICE_INFO, DM_DEVICE_DEPS */
+#define MOCK_IOCTLS_CREATE_DEV  3   /* DM_DEVICE_CREATE, _RELOAD, _RESUME */
+#define MOCK_IOCTLS_REMOVE      1   /* DM_DEVICE_REMOVE */
+#define MOCK_IOCTLS_REMOVE_DEV  2   /* DM_DEVICE_INFO, DM_DEVICE_REMOVE */
+#define MOCK_IOCTLS_TABLE       1   /* DM_DEVICE_TABLE */
+#define MOCK_IOCTLS_RELOAD_DEV  2   /* DM_DEVICE_RELOAD, DM_DEVICE_RESUME */
+
+struct _mock_dev
+{
+    gchar *name;
+    gchar *uuid;
+    guint minor;            /* Its device number is 253:minor */
+    gchar *table;           /* As the kernel reports it, or NULL for devices
+                             * not created from a plan */
+    gboolean read_only;
+    GPtrArray *deps;        /* The uuids of the devices it is stacked on */
+    guint holders;          /* The number of devices stacked on it */
+};
+
+struct _mock
+{
+    dm_backend_t backend;   /* Must be first */
+
+    gulong ioctl_usec;
+    gulong udev_usec;
+
+    GMutex lock;
+    GHashTable *devices;    /* uuid -> struct _mock_dev */
+    GHashTable *names;      /* name -> struct _mock_dev */
+    GHashTable *disks;      /* path -> disk number */
+    guint next_minor;
+    GHashTable *cookies;    /* Cookies with outstanding udev events */
+    uint32_t next_cookie;
+    dm_mock_stats_t stats;
+};
+
+static void
+_mock_dev_free(gpointer const data)
+{
+    struct _mock_dev * const dev = data;
+
+    g_free(dev->name);
+    g_free(dev->uuid);
+    g_free(dev->table);
+    g_ptr_array_unref(dev->deps);
+    g_free(dev);
+}
+
+static struct _mock_dev *
+_mock_dev_add(struct _mock * const mock, const gchar * const name,
+              const gchar * const uuid)
+{
+    struct _mock_dev * const dev = g_new0(struct _mock_dev, 1);
+    dev->name = g_strdup(name);
+    dev->uuid = g_strdup(uuid);
+    dev->deps = g_ptr_array_new_with_free_func(g_free);
+    dev->minor = mock->next_minor++;
+
+    g_hash_table_insert(mock->devices, dev->uuid, dev);
+    g_hash_table_insert(mock->names, dev->name, dev);
+    mock->stats.devices++;
+    mock->stats.creates++;
+
+    return dev;
+}
+
+/* Disks are sd devices, numbered in the order they are first seen. Called
+ * with the lock held. */
+static void
+_mock_disk_number(struct _mock * const mock, const gchar * const disk,
+                  guint * const major, guint * const minor)
+{
+    gpointer n;
+    if (!g_hash_table_lookup_extended(mock->disks, disk, NULL, &n)) {
+        n = GUINT_TO_POINTER(g_hash_table_size(mock->disks));
+        g_hash_table_insert(mock->disks, g_strdup(disk), n);
+    }
+
+    *major = 8;
+    *minor = GPOINTER_TO_UINT(n) * 16;
+}
+
+static void
+_mock_append_area(struct _mock * const mock, GString * const table,
+                  const GArray * const plan,
+                  const struct _dm_plan_area * const area)
+{
+    guint major, minor;
+
+    if (area->disk) {
+        _mock_disk_number(mock, area->disk, &major, &minor);
+        g_string_append_printf(table, "%u:%u", major, minor);
+    } else if (area->dev >= 0) {
+        const struct _mock_dev * const dep =
+            g_hash_table_lookup(mock->devices,
+                g_array_index(plan, struct _dm_plan_dev, area->dev).uuid->str);
+        g_string_append_printf(table, "253:%u", dep->minor);
+    } else {
+        g_string_append_c(table, '-');
+    }
+}
+
+/* A device's table as the kernel reports it once pdev is loaded. dm-raid
+ * doesn't give back the parameters it was given: raid1 has a chunk size of 0,
+ * and the options follow the order of raid_status(). Called with the lock
+ * held, once the devices pdev is stacked on exist. */
+static gchar *
+_mock_table(struct _mock * const mock, const GArray * const plan,
+            const struct _dm_plan_dev * const pdev)
+{
+    GString * const table = g_string_new("");
+    guint64 start = 0;
+
+    for (guint i = 0; i < pdev->segs->len; i++) {
+        const struct _dm_plan_seg * const seg =
+            &g_array_index(pdev->segs, struct _dm_plan_seg, i);
+        const struct dm_tree_node_raid_params * const raid = &seg->raid;
+
+        g_string_append_printf(table, "%" G_GUINT64_FORMAT " %"
+                               G_GUINT64_FORMAT, start, seg->size);
+        start += seg->size;
+
+        if (seg->type == _DM_SEG_RAID) {
+            GString * const opts = g_string_new("");
+            guint argc = 1;
+
+            if (raid->flags & DM_NOSYNC) {
+                g_string_append(opts, " nosync");
+                argc++;
+            }
+            if (raid->sync_daemon_sleep) {
+                g_string_append_printf(opts, " daemon_sleep %u",
+                                       raid->sync_daemon_sleep);
+                argc += 2;
+            }
+            if (raid->min_recovery_rate) {
+                g_string_append_printf(opts, " min_recovery_rate %u",
+                                       raid->min_recovery_rate);
+                argc += 2;
+            }
+            if (raid->max_recovery_rate) {
+                g_string_append_printf(opts, " max_recovery_rate %u",
+                                       raid->max_recovery_rate);
+                argc += 2;
+            }
+            for (guint j = 0; j < seg->areas->len; j++) {
+                if (raid->writemostly & (UINT64_C(1) << j)) {
+                    g_string_append_printf(opts, " write_mostly %u", j);
+                    argc += 2;
+                }
+            }
+            if (raid->stripe_cache) {
+                g_string_append_printf(opts, " stripe_cache %u",
+                                       raid->stripe_cache);
+                argc += 2;
+            }
+            if (raid->region_size) {
+                g_string_append_printf(opts, " region_size %u",
+                                       raid->region_size);
+                argc += 2;
+            }
+
+            g_string_append_printf(table, " raid %s %u %u%s %u",
+                raid->raid_type, argc,
+                g_str_equal(raid->raid_type, "raid1") ? 0 : raid->stripe_size,
+                opts->str, seg->areas->len);
+            g_string_free(opts, TRUE);
+
+            for (guint j = 0; j < seg->areas->len; j++) {
+                g_string_append(table, " - ");
+                _mock_append_area(mock, table, plan,
+                    &g_array_index(seg->areas, struct _dm_plan_area, j));
+            }
+        } else {
+            if (seg->type == _DM_SEG_STRIPED) {
+                g_string_append_printf(table, " striped %u %u",
+                                       seg->areas->len, seg->stripe_size);
+            } else {
+                g_string_append(table, " linear");
+            }
+
+            for (guint j = 0; j < seg->areas->len; j++) {
+                const struct _dm_plan_area * const area =
+                    &g_array_index(seg->areas, struct _dm_plan_area, j);
+
+                g_string_append_c(table, ' ');
+                _mock_append_area(mock, table, plan, area);
+                g_string_append_printf(table, " %" G_GUINT64_FORMAT,
+                                       area->offset);
+            }
+        }
+
+        g_string_append_c(table, '\n');
+    }
+
+    return g_string_free(table, FALSE);
+}
+
+static gboolean
+_mock_has_raid(const struct _dm_plan_dev * const pdev)
+{
+    for (guint i = 0; i < pdev->segs->len; i++) {
+        if (g_array_index(pdev->segs, struct _dm_plan_seg, i).type ==
+            _DM_SEG_RAID)
+            return TRUE;
+    }
+
+    return FALSE;
+}
+
+/* Give dev the table of pdev, taking ownership of table, and stack it on the
+ * planned devices the table refers to. Called with the lock held. */
+static void
+_mock_dev_link(struct _mock * const mock, struct _mock_dev * const dev,
+               const GArray * const plan,
+               const struct _dm_plan_dev * const pdev, gchar * const table)
+{
+    g_free(dev->table);
+    dev->table = table;
+    dev->read_only = pdev->read_only;
+
+    for (guint i = 0; i < pdev->segs->len; i++) {
+        const struct _dm_plan_seg * const seg =
+            &g_array_index(pdev->segs, struct _dm_plan_seg, i);
+
+        for (guint j = 0; j < seg->areas->len; j++) {
+            const struct _dm_plan_area * const area =
+                &g_array_index(seg->areas, struct _dm_plan_area, j);
+            if (area->disk || area->dev < 0) continue;
+
+            const struct _dm_plan_dev * const under =
+                &g_array_index(plan, struct _dm_plan_dev, area->dev);
+            struct _mock_dev * const dep =
+                g_hash_table_lookup(mock->devices, under->uuid->str);
+            dep->holders++;
+            g_ptr_array_add(dev->deps, g_strdup(under->uuid->str));
+        }
+    }
+}
+
+/* Release the devices dev is stacked on. Called with the lock held. */
+static void
+_mock_dev_unlink(struct _mock * const mock, struct _mock_dev * const dev)
+{
+    for (guint i = 0; i < dev->deps->len; i++) {
+        struct _mock_dev * const dep =
+            g_hash_table_lookup(mock->devices, g_ptr_array_index(dev->deps, i));
+        if (dep) dep->holders--;
+    }
+    g_ptr_array_set_size(dev->deps, 0);
+}
+
+/* Remove dev and, if cascade, every device under it which is no longer held.
+ * Returns the number of ioctls it took. Called with the lock held. */
+static guint
+_mock_dev_remove(struct _mock * const mock, struct _mock_dev * const dev,
+                 const gboolean cascade)
+{
+    guint ioctls = 0;
+    for (guint i = 0; i < dev->deps->len; i++) {
+        struct _mock_dev * const dep =
+            g_hash_table_lookup(mock->devices, g_ptr_array_index(dev->deps, i));
+        if (dep == NULL) continue;
+
+        dep->holders--;
+        if (cascade && dep->holders == 0) {
+            ioctls += MOCK_IOCTLS_REMOVE_DEV +
+                      _mock_dev_remove(mock, dep, TRUE);
+        }
+    }
+
+    g_hash_table_remove(mock->names, dev->name);
+    g_hash_table_remove(mock->devices, dev->uuid);
+    mock->stats.devices--;
+    mock->stats.removes++;
+
+    return ioctls;
+}
+
+/* Account for n ioctls made on behalf of cookie. Called with the lock held. */
+static void
+_mock_ioctls(struct _mock * const mock, const guint n, const uint32_t cookie)
+{
+    mock->stats.ioctls += n;
+    if (cookie && n > 0)
+        g_hash_table_add(mock->cookies, GUINT_TO_POINTER(cookie));
+}
+
+/* Take the time n ioctls would. Called without the lock, so that the stats
+ * can be read meanwhile. */
+static void
+_mock_wait(const struct _mock * const mock, const guint n)
+{
+    if (mock->ioctl_usec > 0 && n > 0) g_usleep(mock->ioctl_usec * n);
+}
+
+static gpointer
+_mock_list(const dm_backend_t * const backend, GError ** const err)
+{
+    struct _mock * const mock = (struct _mock *) backend;
+    GHashTable * const snapshot =
+        g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+
+    g_mutex_lock(&mock->lock);
+    GHashTableIter iter;
+    gpointer key, value;
+    g_hash_table_iter_init(&iter, mock->devices);
+    while (g_hash_table_iter_next(&iter, &key, &value)) {
+        const struct _mock_dev * const dev = value;
+        g_hash_table_insert(snapshot, g_strdup(dev->uuid),
+                                      g_strdup(dev->name));
+    }
+    const guint n = MOCK_IOCTLS_LIST +
+                    MOCK_IOCTLS_LIST_DEV * g_hash_table_size(snapshot);
+    _mock_ioctls(mock, n, 0);
+    g_mutex_unlock(&mock->lock);
+
+    _mock_wait(mock, n);
+    return snapshot;
+}
+
+static void
+_mock_list_free(const dm_backend_t * const backend, const gpointer snapshot)
+{
+    g_hash_table_unref(snapshot);
+}
+
+static const gchar *
+_mock_info(const dm_backend_t * const backend, const gpointer snapshot,
+           const gchar * const uuid)
+{
+    return g_hash_table_lookup(snapshot, uuid);
+}
+
+static gboolean
+_mock_create(const dm_backend_t * const backend, const GArray * const plan,
+             const uint32_t cookie, GError ** const err)
+{
+    struct _mock * const mock = (struct _mock *) backend;
+    gboolean r = TRUE;
+    guint n = 0;
+
+    g_mutex_lock(&mock->lock);
+    guint created = 0;
+    for (; created < plan->len; created++) {
+        const struct _dm_plan_dev * const pdev =
+            &g_array_index(plan, struct _dm_plan_dev, created);
+
+        if (g_hash_table_contains(mock->devices, pdev->uuid->str) ||
+            g_hash_table_contains(mock->names, pdev->name->str))
+        {
+            g_set_error(err, LDM_ERROR, LDM_ERROR_EXTERNAL,
+                        "DM_DEVICE_CREATE(%s): Device or resource busy",
+                        pdev->name->str);
+            n++;
+            r = FALSE;
+            break;
+        }
+
+        struct _mock_dev * const dev =
+            _mock_dev_add(mock, pdev->name->str, pdev->uuid->str);
+        _mock_dev_link(mock, dev, plan, pdev, _mock_table(mock, plan, pdev));
+        n += MOCK_IOCTLS_CREATE_DEV;
+    }
+
+    /* Roll back in reverse order, so each device is removed after the ones
+     * stacked on it */
+    if (!r) {
+        while (created-- > 0) {
+            const struct _dm_plan_dev * const pdev =
+                &g_array_index(plan, struct _dm_plan_dev, created);
+            _mock_dev_remove(mock,
+                g_hash_table_lookup(mock->devices, pdev->uuid->str), FALSE);
+            n += MOCK_IOCTLS_REMOVE_DEV;
+        }
+    }
+
+    _mock_ioctls(mock, n, cookie);
+    g_mutex_unlock(&mock->lock);
+
+    _mock_wait(mock, n);
+    return r;
+}
+
+static gboolean
+_mock_remove(const dm_backend_t * const backend, const gpointer snapshot,
+             const gchar * const uuid, const uint32_t cookie,
+             GError ** const err)
+{
+    struct _mock * const mock = (struct _mock *) backend;
+    gboolean r = TRUE;
+    guint n = MOCK_IOCTLS_REMOVE;
+
+    g_mutex_lock(&mock->lock);
+    struct _mock_dev * const dev = g_hash_table_lookup(mock->devices, uuid);
+    if (dev == NULL) {
+        g_set_error(err, LDM_ERROR, LDM_ERROR_EXTERNAL,
+                    "DM_DEVICE_REMOVE(%s): No such device or address",
+                    (const gchar *) g_hash_table_lookup(snapshot, uuid));
+        r = FALSE;
+    } else if (dev->holders > 0) {
+        g_set_error(err, LDM_ERROR, LDM_ERROR_EXTERNAL,
+                    "Device is still mounted");
+        r = FALSE;
+    } else {
+        n += _mock_dev_remove(mock, dev, TRUE);
+    }
+    _mock_ioctls(mock, n, cookie);
+    g_mutex_unlock(&mock->lock);
+
+    _mock_wait(mock, n);
+    return r;
+}
+
+static gchar *
+_mock_table_get(const dm_backend_t * const backend, const gpointer snapshot,
+                const gchar * const uuid, gboolean * const read_only)
+{
+    struct _mock * const mock = (struct _mock *) backend;
+    gchar *table = NULL;
+
+    g_mutex_lock(&mock->lock);
+    const struct _mock_dev * const dev =
+        g_hash_table_lookup(mock->devices, uuid);
+    if (dev && dev->table) {
+        table = g_strdup(dev->table);
+        *read_only = dev->read_only;
+    }
+    _mock_ioctls(mock, MOCK_IOCTLS_TABLE, 0);
+    g_mutex_unlock(&mock->lock);
+
+    _mock_wait(mock, MOCK_IOCTLS_TABLE);
+    return table;
+}
+
+static gboolean
+_mock_dev_number(const dm_backend_t * const backend, const gpointer snapshot,
+                 const gchar * const disk, const gchar * const uuid,
+                 guint * const major, guint * const minor)
+{
+    struct _mock * const mock = (struct _mock *) backend;
+    gboolean r = TRUE;
+
+    g_mutex_lock(&mock->lock);
+    if (disk) {
+        _mock_disk_number(mock, disk, major, minor);
+    } else {
+        const struct _mock_dev * const dev =
+            g_hash_table_contains(snapshot, uuid) ?
+            g_hash_table_lookup(mock->devices, uuid) : NULL;
+        if (dev) {
+            *major = 253;
+            *minor = dev->minor;
+        } else {
+            r = FALSE;
+        }
+    }
+    g_mutex_unlock(&mock->lock);
+
+    return r;
+}
+
+static gboolean
+_mock_reload(const dm_backend_t * const backend, const gpointer snapshot,
+             const GArray * const plan, gboolean * const changed,
+             const uint32_t cookie, GError ** const err)
+{
+    struct _mock * const mock = (struct _mock *) backend;
+    const struct _dm_plan_dev * const pvol =
+        &g_array_index(plan, struct _dm_plan_dev, plan->len - 1);
+    guint n = 0;
+
+    *changed = FALSE;
+
+    g_mutex_lock(&mock->lock);
+    struct _mock_dev * const vol =
+        g_hash_table_lookup(mock->devices, pvol->uuid->str);
+    if (vol == NULL) {
+        g_mutex_unlock(&mock->lock);
+        return TRUE;
+    }
+
+    /* dm_tree_add_dev() of the volume and the devices under it */
+    n += MOCK_IOCTLS_LIST_DEV * (1 + vol->deps->len);
+
+    GPtrArray * const old_deps = g_ptr_array_new_with_free_func(g_free);
+    for (guint i = 0; i < vol->deps->len; i++)
+        g_ptr_array_add(old_deps, g_strdup(g_ptr_array_index(vol->deps, i)));
+
+    for (guint i = 0; i < plan->len; i++) {
+        const struct _dm_plan_dev * const pdev =
+            &g_array_index(plan, struct _dm_plan_dev, i);
+        struct _mock_dev *dev =
+            g_hash_table_lookup(mock->devices, pdev->uuid->str);
+        if (dev == NULL) {
+            dev = _mock_dev_add(mock, pdev->name->str, pdev->uuid->str);
+            _mock_dev_link(mock, dev, plan, pdev,
+                           _mock_table(mock, plan, pdev));
+            n += MOCK_IOCTLS_CREATE_DEV;
+            *changed = TRUE;
+            continue;
+        }
+
+        /* Identical reloads are suppressed after reading the live table.
+         * libdevmapper compares the table it would load as text, which for
+         * raid is never the kernel's. */
+        gchar * const table = _mock_table(mock, plan, pdev);
+        n += MOCK_IOCTLS_TABLE;
+        if (g_strcmp0(dev->table, table) == 0 &&
+            !dev->read_only == !pdev->read_only && !_mock_has_raid(pdev))
+        {
+            g_free(table);
+            continue;
+        }
+
+        _mock_dev_unlink(mock, dev);
+        _mock_dev_link(mock, dev, plan, pdev, table);
+        n += MOCK_IOCTLS_RELOAD_DEV;
+        mock->stats.reloads++;
+        *changed = TRUE;
+    }
+
+    for (guint i = 0; i < old_deps->len; i++) {
+        struct _mock_dev * const dep =
+            g_hash_table_lookup(mock->devices, g_ptr_array_index(old_deps, i));
+        if (dep == NULL || dep->holders > 0) continue;
+
+        _mock_dev_remove(mock, dep, FALSE);
+        n += MOCK_IOCTLS_REMOVE;
+        *changed = TRUE;
+    }
+    g_ptr_array_unref(old_deps);
+
+    _mock_ioctls(mock, n, cookie);
+    g_mutex_unlock(&mock->lock);
+
+    _mock_wait(mock, n);
+    return TRUE;
+}
+
+static gboolean
+_mock_cookie_create(const dm_backend_t * const backend,
+                    uint32_t * const cookie, GError ** const err)
+{
+    struct _mock * const mock = (struct _mock *) backend;
+
+    g_mutex_lock(&mock->lock);
+    *cookie = ++mock->next_cookie;
+    g_mutex_unlock(&mock->lock);
+
+    return TRUE;
+}
+
+static void
+_mock_udev_wait(const dm_backend_t * const backend, const uint32_t cookie)
+{
+    struct _mock * const mock = (struct _mock *) backend;
+
+    g_mutex_lock(&mock->lock);
+    const gboolean used =
+        g_hash_table_remove(mock->cookies, GUINT_TO_POINTER(cookie));
+    if (used) mock->stats.udev_waits++;
+    g_mutex_unlock(&mock->lock);
+
+    if (used && mock->udev_usec > 0) g_usleep(mock->udev_usec);
+}
+
+dm_backend_t *
+dm_mock_new(const guint n_existing, const gulong ioctl_usec,
+            const gulong udev_usec)
+{
+    struct _mock * const mock = g_new0(struct _mock, 1);
+
+    mock->backend.list = _mock_list;
+    mock->backend.list_free = _mock_list_free;
+    mock->backend.info = _mock_info;
+    mock->backend.create = _mock_create;
+    mock->backend.remove = _mock_remove;
+    mock->backend.table = _mock_table_get;
+    mock->backend.dev_number = _mock_dev_number;
+    mock->backend.reload = _mock_reload;
+    mock->backend.cookie_create = _mock_cookie_create;
+    mock->backend.udev_wait = _mock_udev_wait;
+
+    mock->ioctl_usec = ioctl_usec;
+    mock->udev_usec = udev_usec;
+
+    g_mutex_init(&mock->lock);
+    mock->devices = g_hash_table_new_full(g_str_hash, g_str_equal,
+                                          NULL, _mock_dev_free);
+    mock->names = g_hash_table_new(g_str_hash, g_str_equal);
+    mock->disks = g_hash_table_new_full(g_str_hash, g_str_equal,
+                                        g_free, NULL);
+    mock->cookies = g_hash_table_new(g_direct_hash, g_direct_equal);
+
+    /* Devices of other subsystems, named and identified the way LVM's are */
+    for (guint i = 0; i < n_existing; i++) {
+        gchar * const name = g_strdup_printf("vg%u-lv%u", i / 256, i % 256);
+        gchar * const uuid = g_strdup_printf("LVM-mock%08u", i);
+        _mock_dev_add(mock, name, uuid);
+        g_free(name);
+        g_free(uuid);
+    }
+    mock->stats.creates = 0;
+
+    return &mock->backend;
+}
+
+void
+dm_mock_free(dm_backend_t * const backend)
+{
+    struct _mock * const mock = (struct _mock *) backend;
+
+    g_hash_table_unref(mock->names);
+    g_hash_table_unref(mock->devices);
+    g_hash_table_unref(mock->disks);
+    g_hash_table_unref(mock->cookies);
+    g_mutex_clear(&mock->lock);
+    g_free(mock);
+}
+
+void
+dm_mock_get_stats(const dm_backend_t * const backend,
+                  dm_mock_stats_t * const stats)
+{
+    struct _mock * const mock = (struct _mock *) backend;
+
+    g_mutex_lock(&mock->lock);
+    *stats = mock->stats;
+    g_mutex_unlock(&mock->lock);
+}
+
+void
+dm_mock_reset_stats(dm_backend_t * const backend)
+{
+    struct _mock * const mock = (struct _mock *) backend;
+
+    g_mutex_lock(&mock->lock);
+    mock->stats.ioctls = 0;
+    mock->stats.udev_waits = 0;
+    mock->stats.creates = 0;
+    mock->stats.reloads = 0;
+    mock->stats.removes = 0;
+    g_mutex_unlock(&mock->lock);
+}
@@ -0,0 +1,40 @@
+/* libldm
+ * Copyright 2012 Red Hat Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "dmbackend.h"
+
+/* An in-memory backend which simulates a host with n_existing devices not
+ * belonging to LDM. Every simulated ioctl takes ioctl_usec, and waiting on a
+ * udev cookie which was used takes udev_usec. It counts the ioctls
+ * libdevmapper would have issued for each operation. */
+dm_backend_t *dm_mock_new(guint n_existing, gulong ioctl_usec,
+                          gulong udev_usec);
+void dm_mock_free(dm_backend_t *backend);
+
+typedef struct {
+    guint ioctls;       /* Device mapper ioctls issued */
+    guint udev_waits;   /* Waits on a cookie which was used */
+    guint devices;      /* Devices currently on the simulated host */
+
+    /* Devices created, live tables reloaded and devices removed */
+    guint creates;
+    guint reloads;
+    guint removes;
+} dm_mock_stats_t;
+
+void dm_mock_get_stats(const dm_backend_t *backend, dm_mock_stats_t *stats);
+void dm_mock_reset_stats(dm_backend_t *backend);
@@ -0,0 +1,357 @@
+/* dmplan
+ * Copyright 2012 Red Hat Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Checks the device mapper plan of a volume, both writable and read-only,
+ * against what the planner should have made of it: a mirror with one member
+ * present or which is read-only is mapped directly onto a partition, no
+ * partition device is left which nothing is stacked on, and no two
+ * consecutive linear targets map contiguous sectors of the same device.
+ *
+ * None of the test images has a volume with partitions which follow each
+ * other on a disk, so the merging of extents is also checked on a plan built
+ * by hand. That needs the planner's private functions, so this includes
+ * ldm.c rather than only linking against libldm. */
+
+#include "ldm.c"
+
+#include <stdio.h>
+
+static int failures = 0;
+
+static void
+fail(const gchar * const volume, const gboolean ro, const gchar * const fmt,
+     ...)
+{
+    va_list ap;
+
+    fprintf(stderr, "%s%s: ", volume, ro ? " (read-only)" : "");
+    va_start(ap, fmt);
+    vfprintf(stderr, fmt, ap);
+    va_end(ap);
+    fprintf(stderr, "\n");
+
+    failures++;
+}
+
+static void
+dump_plan(const GArray * const devices)
+{
+    for (guint i = 0; i < devices->len; i++) {
+        const LDMDmDevice * const device =
+            &g_array_index(devices, LDMDmDevice, i);
+
+        fprintf(stderr, "  %s%s\n", device->name,
+                device->read_only ? " (ro)" : "");
+        for (guint j = 0; j < device->targets->len; j++) {
+            const LDMDmTarget * const target =
+                &g_array_index(device->targets, LDMDmTarget, j);
+            fprintf(stderr, "    %" PRIu64 " %" PRIu64 " %s %s\n",
+                    target->start, target->size, target->type,
+                    target->params);
+        }
+    }
+}
+
+/* Split the params of a linear target into its device and offset */
+static gboolean
+parse_linear(const LDMDmTarget * const target, gchar ** const device,
+             guint64 * const offset)
+{
+    if (g_strcmp0(target->type, "linear") != 0) return FALSE;
+
+    gchar ** const fields = g_strsplit(target->params, " ", 0);
+    const gboolean r = g_strv_length(fields) == 2;
+    if (r) {
+        *device = g_strdup(fields[0]);
+        *offset = g_ascii_strtoull(fields[1], NULL, 10);
+    }
+    g_strfreev(fields);
+
+    return r;
+}
+
+/* Checks which hold for the plan of any volume */
+static void
+check_common(const gchar * const volume, const gboolean ro,
+             const GArray * const devices)
+{
+    gchar * const dir = g_strconcat(dm_dir(), "/", NULL);
+
+    for (guint i = 0; i < devices->len; i++) {
+        const LDMDmDevice * const device =
+            &g_array_index(devices, LDMDmDevice, i);
+
+        if (device->read_only != ro) {
+            fail(volume, ro, "%s has the wrong mode", device->name);
+        }
+
+        /* Every device but the volume's own must be used by a later one */
+        if (i + 1 < devices->len) {
+            gchar * const path = g_strconcat(dir, device->name, NULL);
+            gboolean used = FALSE;
+            for (guint j = i + 1; !used && j < devices->len; j++) {
+                const GArray * const targets =
+                    g_array_index(devices, LDMDmDevice, j).targets;
+                for (guint k = 0; !used && k < targets->len; k++) {
+                    const gchar * const params =
+                        g_array_index(targets, LDMDmTarget, k).params;
+                    used = strstr(params, path) != NULL;
+                }
+            }
+            if (!used) fail(volume, ro, "%s is not used", device->name);
+            g_free(path);
+        }
+
+        for (guint j = 1; j < device->targets->len; j++) {
+            const LDMDmTarget * const a =
+                &g_array_index(device->targets, LDMDmTarget, j - 1);
+            const LDMDmTarget * const b =
+                &g_array_index(device->targets, LDMDmTarget, j);
+            gchar *a_dev, *b_dev;
+            guint64 a_off, b_off;
+
+            if (!parse_linear(a, &a_dev, &a_off)) continue;
+            if (parse_linear(b, &b_dev, &b_off)) {
+                if (strcmp(a_dev, b_dev) == 0 && a_off + a->size == b_off) {
+                    fail(volume, ro, "%s has targets %u and %u unmerged",
+                         device->name, j - 1, j);
+                }
+                g_free(b_dev);
+            }
+            g_free(a_dev);
+        }
+    }
+
+    g_free(dir);
+}
+
+/* Returns the device of the first partition of vol whose disk is present, and
+ * counts the present partitions */
+static gchar *
+first_present(LDMVolume * const vol, guint * const present)
+{
+    gchar *first = NULL;
+    *present = 0;
+
+    GArray * const parts = ldm_volume_get_partitions(vol);
+    for (guint i = 0; i < parts->len; i++) {
+        LDMPartition * const part = g_array_index(parts, LDMPartition *, i);
+        LDMDisk * const disk = ldm_partition_get_disk(part);
+        gchar * const device = ldm_disk_get_device(disk);
+        g_object_unref(disk);
+
+        if (device == NULL) continue;
+        (*present)++;
+        if (first == NULL) first = device;
+        else g_free(device);
+    }
+    g_array_unref(parts);
+
+    return first;
+}
+
+static void
+check_volume(LDMVolume * const vol, const gboolean ro)
+{
+    gchar * const name = ldm_volume_get_name(vol);
+    GError *err = NULL;
+
+    GArray * const devices =
+        ldm_volume_dm_plan(vol, ro ? LDM_DM_READ_ONLY : 0, NULL, &err);
+    if (devices == NULL) {
+        fail(name, ro, "%s", err->message);
+        g_error_free(err);
+        g_free(name);
+        return;
+    }
+
+    const int before = failures;
+    check_common(name, ro, devices);
+
+    guint present;
+    gchar * const first = first_present(vol, &present);
+    const LDMDmDevice * const top =
+        &g_array_index(devices, LDMDmDevice, devices->len - 1);
+    const LDMDmTarget * const target =
+        &g_array_index(top->targets, LDMDmTarget, 0);
+
+    switch (ldm_volume_get_voltype(vol)) {
+    case LDM_VOLUME_TYPE_SIMPLE:
+    case LDM_VOLUME_TYPE_SPANNED:
+    case LDM_VOLUME_TYPE_STRIPED:
+        if (devices->len != 1) {
+            fail(name, ro, "expected a single device");
+        }
+        break;
+
+    case LDM_VOLUME_TYPE_MIRRORED:
+        if (present == 1 || ro) {
+            gchar *device;
+            guint64 offset;
+
+            if (devices->len != 1 || top->targets->len != 1 ||
+                !parse_linear(target, &device, &offset))
+            {
+                fail(name, ro, "expected a single linear target");
+                break;
+            }
+            if (strcmp(device, first) != 0) {
+                fail(name, ro, "expected a mapping onto %s", first);
+            }
+            g_free(device);
+        } else {
+            if (devices->len != present + 1 ||
+                !g_str_has_prefix(target->params, "raid1 "))
+            {
+                fail(name, ro, "expected raid1 on %u partitions", present);
+            }
+        }
+        break;
+
+    case LDM_VOLUME_TYPE_RAID5:
+        /* Every present member is used, including when read-only */
+        if (devices->len != present + 1 ||
+            !g_str_has_prefix(target->params, "raid5_ls "))
+        {
+            fail(name, ro, "expected raid5_ls on %u partitions", present);
+        }
+        if ((strstr(target->params, " nosync ") != NULL) != ro) {
+            fail(name, ro, "expected nosync only when read-only");
+        }
+        break;
+    }
+
+    if (failures != before) dump_plan(devices);
+
+    g_free(first);
+    g_array_unref(devices);
+    g_free(name);
+}
+
+/* A spanned volume on two disks whose partitions partly follow each other,
+ * and a partition device which nothing uses */
+static void
+check_merge(void)
+{
+    static const struct {
+        const gchar *disk;
+        guint64 offset;
+        guint64 size;
+    } extents[] = {
+        { "/dev/a", 100, 50 },
+        { "/dev/a", 150, 20 },
+        { "/dev/b", 170, 30 },
+        { "/dev/a", 170, 10 },
+        { "/dev/a", 180, 5 }
+    };
+    static const gchar * const expected[] = {
+        "0 70 linear /dev/a 100",
+        "70 30 linear /dev/b 170",
+        "100 15 linear /dev/a 170"
+    };
+
+    GArray * const plan = _dm_plan_new();
+
+    const gint part = _dm_plan_add_dev(plan, g_string_new("part"),
+                                       g_string_new("LDM-part"), 0);
+    struct _dm_plan_seg *seg = _dm_plan_add_seg(plan, part, _DM_SEG_LINEAR, 10);
+    _dm_seg_add_area(seg, "/dev/c", -1, 0);
+
+    const gint vol = _dm_plan_add_dev(plan, g_string_new("vol"),
+                                      g_string_new("LDM-vol"), 0);
+    for (guint i = 0; i < G_N_ELEMENTS(extents); i++) {
+        seg = _dm_plan_add_seg(plan, vol, _DM_SEG_LINEAR, extents[i].size);
+        _dm_seg_add_area(seg, extents[i].disk, -1, extents[i].offset);
+    }
+
+    _dm_plan_optimise(plan, 0);
+    GArray * const devices = _dm_plan_export(plan);
+    g_array_unref(plan);
+
+    gboolean ok = devices->len == 1;
+    const GArray * const targets =
+        g_array_index(devices, LDMDmDevice, devices->len - 1).targets;
+    ok = ok && targets->len == G_N_ELEMENTS(expected);
+    for (guint i = 0; ok && i < targets->len; i++) {
+        const LDMDmTarget * const target =
+            &g_array_index(targets, LDMDmTarget, i);
+        gchar * const line =
+            g_strdup_printf("%" PRIu64 " %" PRIu64 " %s %s", target->start,
+                            target->size, target->type, target->params);
+        ok = strcmp(line, expected[i]) == 0;
+        g_free(line);
+    }
+
+    if (!ok) {
+        fail("merge", FALSE, "unexpected plan");
+        dump_plan(devices);
+    }
+    g_array_unref(devices);
+}
+
+int main(int argc, const char *argv[])
+{
+    if (argc < 4) {
+        fprintf(stderr, "Usage: %s <disk group guid> <volume> <drive> "
+                        "[<drive> ...]\n", argv[0]);
+        return 1;
+    }
+
+#if !GLIB_CHECK_VERSION(2,35,0)
+    g_type_init();
+#endif
+
+    check_merge();
+
+    LDM * const ldm = ldm_new();
+    LDMDiskGroup *dg = NULL;
+    LDMVolume *vol = NULL;
+    GError *err = NULL;
+
+    for (int i = 3; i < argc; i++) {
+        if (!ldm_add(ldm, argv[i], &err)) {
+            fprintf(stderr, "Error reading LDM: %s\n", err->message);
+            g_error_free(err);
+            failures++;
+            goto out;
+        }
+    }
+
+    dg = ldm_find_disk_group(ldm, argv[1]);
+    if (dg == NULL) {
+        fprintf(stderr, "Disk group %s not found\n", argv[1]);
+        failures++;
+        goto out;
+    }
+
+    vol = ldm_disk_group_find_volume(dg, argv[2]);
+    if (vol == NULL) {
+        fprintf(stderr, "Volume %s not found\n", argv[2]);
+        failures++;
+        goto out;
+    }
+
+    check_volume(vol, FALSE);
+    check_volume(vol, TRUE);
+
+out:
+    if (vol) g_object_unref(vol);
+    if (dg) g_object_unref(dg);
+    g_object_unref(ldm);
+
+    return failures == 0 ? 0 : 1;
+}
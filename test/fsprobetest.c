@@ -0,0 +1,197 @@
+/* fsprobetest
+ * Copyright 2012 Red Hat Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Probes crafted boot sectors, including ones with invalid fields which must
+ * be rejected rather than trusted. */
+
+#include <config.h>
+
+#include <stdio.h>
+#include <string.h>
+
+#include "fsprobe.h"
+
+#define IMAGE_SIZE (128 * 1024)
+
+static uint8_t image[IMAGE_SIZE];
+
+static int
+read_image(void * const data, void * const buf, const size_t len,
+           const uint64_t offset)
+{
+    if (offset > IMAGE_SIZE || IMAGE_SIZE - offset < len) return -1;
+    memcpy(buf, image + offset, len);
+    return 0;
+}
+
+static void
+put16(uint8_t * const p, const uint16_t v)
+{
+    p[0] = v; p[1] = v >> 8;
+}
+
+static void
+put32(uint8_t * const p, const uint32_t v)
+{
+    put16(p, v); put16(p + 2, v >> 16);
+}
+
+static void
+put64(uint8_t * const p, const uint64_t v)
+{
+    put32(p, v); put32(p + 4, v >> 32);
+}
+
+/* A boot sector with a BIOS parameter block */
+static void
+boot_sector(const char * const oem, const uint16_t bps, const uint8_t spc)
+{
+    memset(image, 0, sizeof(image));
+    image[0] = 0xEB; image[1] = 0x52; image[2] = 0x90;
+    memcpy(image + 3, oem, 8);
+    put16(image + 11, bps);
+    image[13] = spc;
+    image[510] = 0x55; image[511] = 0xAA;
+}
+
+/* An NTFS volume with 512 byte sectors, whose $Volume record, at the given
+ * offset in the MFT, has the label "Data". The attribute is placed at an odd
+ * offset in the record. */
+static void
+ntfs(const uint8_t spc, const int8_t clusters_per_record)
+{
+    boot_sector("NTFS    ", 512, spc);
+    image[0x40] = clusters_per_record;
+    put64(image + 0x30, 8);                         /* MFT LCN */
+    put64(image + 0x48, UINT64_C(0x5A3C1F2E3C1F0583));
+
+    /* 4096 byte clusters and 1024 byte records */
+    uint8_t * const rec = image + 8 * 4096 + 3 * 1024;
+    memcpy(rec, "FILE", 4);
+    put16(rec + 4, 0x30);                           /* Update sequence */
+    put16(rec + 6, 3);
+    put16(rec + 0x30, 0x0001);
+    memcpy(rec + 0x32, rec + 510, 2);
+    memcpy(rec + 0x34, rec + 1022, 2);
+    put16(rec + 510, 0x0001);
+    put16(rec + 1022, 0x0001);
+
+    put16(rec + 0x14, 0x39);                        /* First attribute */
+    uint8_t * const attr = rec + 0x39;
+    put32(attr, 0x60);                              /* $VOLUME_NAME */
+    put32(attr + 4, 0x20);
+    attr[8] = 0;                                    /* Resident */
+    put32(attr + 0x10, 8);
+    put16(attr + 0x14, 0x18);
+    const char label[] = "Data";
+    for (int i = 0; i < 4; i++) put16(attr + 0x18 + i * 2, label[i]);
+    put32(attr + 0x20, 0xFFFFFFFF);
+}
+
+static int failures = 0;
+
+static void
+check(const char * const name, const fsprobe_type_t type,
+      const char * const label, const uint64_t serial,
+      const uint32_t cluster_size)
+{
+    fsprobe_t fs;
+    const int r = fsprobe(read_image, NULL, IMAGE_SIZE, &fs);
+
+    if (r != 0 || fs.type != type || strcmp(fs.label, label) != 0 ||
+        fs.serial != serial || fs.cluster_size != cluster_size)
+    {
+        fprintf(stderr, "%s: got %d type %d label '%s' serial %llX "
+                        "cluster size %u\n", name, r, fs.type, fs.label,
+                        (unsigned long long) fs.serial, fs.cluster_size);
+        failures++;
+    }
+}
+
+int main(void)
+{
+    ntfs(8, -10);
+    check("ntfs", FSPROBE_NTFS, "Data", UINT64_C(0x5A3C1F2E3C1F0583), 4096);
+
+    /* 2^12 sectors per cluster */
+    ntfs(0xF4, -10);
+    check("ntfs 2MiB clusters", FSPROBE_NTFS, "",
+          UINT64_C(0x5A3C1F2E3C1F0583), 2 * 1024 * 1024);
+
+    /* Cluster sizes which can't be represented, and a record size which
+     * would shift by more than the width of the type */
+    ntfs(0xE0, -10);
+    check("ntfs shift 32", FSPROBE_NTFS, "",
+          UINT64_C(0x5A3C1F2E3C1F0583), 0);
+    ntfs(0x81, -10);
+    check("ntfs shift 127", FSPROBE_NTFS, "",
+          UINT64_C(0x5A3C1F2E3C1F0583), 0);
+    ntfs(8, -128);
+    check("ntfs record shift 128", FSPROBE_NTFS, "",
+          UINT64_C(0x5A3C1F2E3C1F0583), 4096);
+
+    /* A label whose length would wrap around */
+    ntfs(8, -10);
+    put32(image + 8 * 4096 + 3 * 1024 + 0x39 + 0x10, 0xFFFFFFF0);
+    check("ntfs label length", FSPROBE_NTFS, "",
+          UINT64_C(0x5A3C1F2E3C1F0583), 4096);
+
+    boot_sector("MSDOS5.0", 512, 8);
+    put16(image + 14, 32);                          /* Reserved sectors */
+    image[16] = 2;                                  /* FATs */
+    put32(image + 32, 1000000);                     /* Sectors */
+    put32(image + 36, 1000);                        /* FAT size */
+    image[66] = 0x29;
+    put32(image + 67, 0x1234ABCD);
+    memcpy(image + 71, "MYDISK     ", 11);
+    check("fat32", FSPROBE_FAT32, "MYDISK", 0x1234ABCD, 4096);
+
+    boot_sector("MSDOS5.0", 512, 4);
+    put16(image + 14, 1);
+    image[16] = 2;
+    put16(image + 17, 512);                         /* Root entries */
+    put32(image + 32, 100000);
+    put16(image + 22, 100);
+    image[38] = 0x29;
+    put32(image + 39, 0x0BADF00D);
+    memcpy(image + 43, "NO NAME    ", 11);
+    check("fat16", FSPROBE_FAT16, "", 0x0BADF00D, 2048);
+
+    /* A FAT boot sector with a sector size which isn't a power of 2 */
+    put16(image + 11, 768);
+    check("fat invalid", FSPROBE_UNKNOWN, "", 0, 0);
+
+    boot_sector("EXFAT   ", 0, 0);
+    put32(image + 88, 128);                         /* Cluster heap */
+    put32(image + 96, 4);                           /* Root cluster */
+    put32(image + 100, 0xC0FFEE00);
+    image[108] = 9;
+    image[109] = 3;
+    uint8_t * const entry = image + 128 * 512 + 2 * 4096;
+    entry[0] = 0x83;
+    entry[1] = 4;
+    for (int i = 0; i < 4; i++) put16(entry + 2 + i * 2, "Data"[i]);
+    check("exfat", FSPROBE_EXFAT, "Data", 0xC0FFEE00, 4096);
+
+    boot_sector("-FVE-FS-", 512, 0x81);
+    check("bitlocker", FSPROBE_BITLOCKER, "", 0, 0);
+
+    memset(image, 0, sizeof(image));
+    check("empty", FSPROBE_UNKNOWN, "", 0, 0);
+
+    return failures == 0 ? 0 : 1;
+}
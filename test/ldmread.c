@@ -19,6 +19,7 @@
 
 #include <stdio.h>
 #include <fcntl.h>
+#include <uuid/uuid.h>
 
 #include <glib-object.h>
 
@@ -55,16 +56,14 @@ int main(int argc, const char *argv[])
         LDMDiskGroup * const dg = g_array_index(dgs, LDMDiskGroup *, i);
 
         {
-            gchar *guid;
-            gchar *name;
+            LDMDiskGroupInfo info;
+            ldm_disk_group_get_info(dg, &info);
 
-            g_object_get(dg, "guid", &guid, "name", &name, NULL);
+            char guid[37];
+            uuid_unparse(info.guid, guid);
 
-            printf("Disk Group: %s\n", name);
+            printf("Disk Group: %s\n", info.name);
             printf("  GUID:   %s\n", guid);
-
-            g_free(guid);
-            g_free(name);
         }
 
         GArray *vols = ldm_disk_group_get_volumes(dg);
@@ -72,38 +71,28 @@ int main(int argc, const char *argv[])
             LDMVolume * const vol = g_array_index(vols, LDMVolume *, j);
 
             {
-                gchar *name;
-                gchar *guid;
-                LDMVolumeType type;
-                guint64 size;
-                guint32 part_type;
-                gchar *hint;
-                guint64 chunk_size;
-
-                g_object_get(vol, "name", &name, "type", &type,
-                                  "guid", &guid, "size", &size,
-                                  "part-type", &part_type, "hint", &hint,
-                                  "chunk-size", &chunk_size, NULL);
+                LDMVolumeInfo info;
+                ldm_volume_get_info(vol, &info);
+
+                char guid[37];
+                uuid_unparse(info.guid, guid);
 
                 GEnumValue * const type_v =
                     g_enum_get_value(g_type_class_peek(LDM_TYPE_VOLUME_TYPE),
-                                     type);
+                                     info.type);
 
                 GError *err = NULL;
                 gchar *device = ldm_volume_dm_get_device(vol, &err);
 
-                printf("  Volume: %s\n", name);
+                printf("  Volume: %s\n", info.name);
                 printf("    GUID:       %s\n", guid);
                 printf("    Type:       %s\n", type_v->value_nick);
-                printf("    Size:       %lu\n", size);
-                printf("    Part Type:  %hhu\n", part_type);
-                printf("    Hint:       %s\n", hint);
-                printf("    Chunk Size: %lu\n", chunk_size);
+                printf("    Size:       %lu\n", info.size);
+                printf("    Part Type:  %hhu\n", info.part_type);
+                printf("    Hint:       %s\n", info.hint);
+                printf("    Chunk Size: %lu\n", info.chunk_size);
                 printf("    Device:     %s\n", device);
 
-                g_free(name);
-                g_free(guid);
-                g_free(hint);
                 g_free(device);
                 if (err) g_error_free(err);
             }
@@ -113,60 +102,39 @@ int main(int argc, const char *argv[])
                 LDMPartition * const part =
                     g_array_index(parts, LDMPartition *, k);
 
-                {
-                    gchar *name;
-                    guint64 start;
-                    guint64 size;
-
-                    g_object_get(part, "name", &name, "start", &start,
-                                       "size", &size, NULL);
+                LDMPartitionInfo part_info;
+                ldm_partition_get_info(part, &part_info);
 
+                {
                     GError *err = NULL;
                     gchar *device = ldm_partition_dm_get_device(part, &err);
 
-                    printf("    Partition: %s\n", name);
-                    printf("        Start:  %lu\n", start);
-                    printf("        Size:   %lu\n", size);
+                    printf("    Partition: %s\n", part_info.name);
+                    printf("        Start:  %lu\n", part_info.start);
+                    printf("        Size:   %lu\n", part_info.size);
                     printf("        Device: %s\n", device);
 
-                    g_free(name);
                     g_free(device);
                     if (err) g_error_free(err);
                 }
 
-                LDMDisk * const disk = ldm_partition_get_disk(part);
-
                 {
-                    gchar *name;
-                    gchar *guid;
-                    gchar *device;
-                    guint64 data_start;
-                    guint64 data_size;
-                    guint64 metadata_start;
-                    guint64 metadata_size;
-
-                    g_object_get(disk, "name", &name, "guid", &guid,
-                                       "device", &device,
-                                       "data-start", &data_start,
-                                       "data-size", &data_size,
-                                       "metadata-start", &metadata_start,
-                                       "metadata-size", &metadata_size,
-                                       NULL);
-
-                    printf("        Disk: %s\n", name);
+                    LDMDiskInfo info;
+                    ldm_disk_get_info(part_info.disk, &info);
+
+                    char guid[37];
+                    uuid_unparse(info.guid, guid);
+
+                    printf("        Disk: %s\n", info.name);
                     printf("          GUID:           %s\n", guid);
-                    printf("          Device:         %s\n", device);
-                    printf("          Data Start:     %lu\n", data_start);
-                    printf("          Data Size:      %lu\n", data_size);
-                    printf("          Metadata Start: %lu\n", metadata_start);
-                    printf("          Metadata Size:  %lu\n", metadata_size);
-
-                    g_free(name);
-                    g_free(guid);
-                    g_free(device);
+                    printf("          Device:         %s\n", info.device);
+                    printf("          Data Start:     %lu\n", info.data_start);
+                    printf("          Data Size:      %lu\n", info.data_size);
+                    printf("          Metadata Start: %lu\n",
+                           info.metadata_start);
+                    printf("          Metadata Size:  %lu\n",
+                           info.metadata_size);
                 }
-
-                g_object_unref(disk);
             }
             g_array_unref(parts);
         }
@@ -0,0 +1,172 @@
+/* ldmthreads
+ * Copyright 2012 Red Hat Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Walks the disk groups of an LDM object from several threads while another
+ * thread keeps adding the same drives again. Each is added under two spellings
+ * of its path in turn, so that every add records a new device for the disk and
+ * publishes a new state. Every walk must see the disk groups as they were after the first
+ * scan, and the writer must get through all of its rounds while the readers
+ * keep walking. */
+
+#include <config.h>
+
+#include <stdio.h>
+#include <string.h>
+
+#include <glib-object.h>
+
+#include "ldm.h"
+
+#define N_READERS 4
+#define N_ROUNDS 200
+
+static LDM *ldm;
+static const char **drives;
+static int n_drives;
+static gchar *expected;
+static gint done = 0;
+static gint failures = 0;
+
+/* A description of everything reachable from the disk groups of ldm */
+static gchar *
+describe(void)
+{
+    GString * const s = g_string_new("");
+
+    GArray * const dgs = ldm_get_disk_groups(ldm);
+    for (guint i = 0; i < dgs->len; i++) {
+        LDMDiskGroup * const dg = g_array_index(dgs, LDMDiskGroup *, i);
+        gchar * const dg_name = ldm_disk_group_get_name(dg);
+        g_string_append_printf(s, "%s\n", dg_name);
+        g_free(dg_name);
+
+        GArray * const vols = ldm_disk_group_get_volumes(dg);
+        for (guint j = 0; j < vols->len; j++) {
+            LDMVolume * const vol = g_array_index(vols, LDMVolume *, j);
+            gchar * const vol_name = ldm_volume_get_name(vol);
+            g_string_append_printf(s, " %s %" G_GUINT64_FORMAT "\n",
+                                   vol_name, ldm_volume_get_size(vol));
+            g_free(vol_name);
+
+            GArray * const parts = ldm_volume_get_partitions(vol);
+            for (guint k = 0; k < parts->len; k++) {
+                LDMPartition * const part =
+                    g_array_index(parts, LDMPartition *, k);
+                LDMDisk * const disk = ldm_partition_get_disk(part);
+                gchar * const part_name = ldm_partition_get_name(part);
+                gchar * const device = ldm_disk_get_device(disk);
+
+                g_string_append_printf(s, "  %s %" G_GUINT64_FORMAT " %s\n",
+                                       part_name, ldm_partition_get_start(part),
+                                       device ? "present" : "missing");
+
+                g_free(device);
+                g_free(part_name);
+                g_object_unref(disk);
+            }
+            g_array_unref(parts);
+        }
+        g_array_unref(vols);
+    }
+    g_array_unref(dgs);
+
+    return g_string_free(s, FALSE);
+}
+
+static gpointer
+reader(gpointer const data)
+{
+    /* Walk at least once after the writer has finished */
+    for (gboolean last = FALSE; !last;) {
+        last = g_atomic_int_get(&done);
+
+        gchar * const seen = describe();
+        if (strcmp(seen, expected) != 0) {
+            fprintf(stderr, "A reader saw:\n%s", seen);
+            g_atomic_int_inc(&failures);
+        }
+        g_free(seen);
+    }
+
+    return NULL;
+}
+
+static gpointer
+writer(gpointer const data)
+{
+    gchar ** const other = g_new0(gchar *, n_drives + 1);
+    for (int i = 0; i < n_drives; i++) {
+        other[i] = g_strconcat(g_path_is_absolute(drives[i]) ? "/" : "./",
+                               drives[i], NULL);
+    }
+
+    for (guint i = 0; i < N_ROUNDS; i++) {
+        for (int j = 0; j < n_drives; j++) {
+            const gchar * const path = i % 2 == 0 ? other[j] : drives[j];
+            GError *err = NULL;
+            if (!ldm_add(ldm, path, &err)) {
+                fprintf(stderr, "Error adding %s: %s\n", path, err->message);
+                g_error_free(err);
+                g_atomic_int_inc(&failures);
+            }
+        }
+    }
+    g_strfreev(other);
+
+    g_atomic_int_set(&done, TRUE);
+    return NULL;
+}
+
+int main(int argc, const char *argv[])
+{
+    if (argc < 2) {
+        fprintf(stderr, "Usage: %s <drive> [<drive> ...]\n", argv[0]);
+        return 1;
+    }
+
+#if !GLIB_CHECK_VERSION(2,35,0)
+    g_type_init();
+#endif
+
+    ldm = ldm_new();
+    drives = argv + 1;
+    n_drives = argc - 1;
+
+    for (int i = 0; i < n_drives; i++) {
+        GError *err = NULL;
+        if (!ldm_add(ldm, drives[i], &err)) {
+            fprintf(stderr, "Error reading LDM: %s\n", err->message);
+            g_error_free(err);
+            g_object_unref(ldm);
+            return 1;
+        }
+    }
+    expected = describe();
+
+    GThread *readers[N_READERS];
+    for (guint i = 0; i < N_READERS; i++)
+        readers[i] = g_thread_new("reader", reader, NULL);
+    GThread * const w = g_thread_new("writer", writer, NULL);
+
+    g_thread_join(w);
+    for (guint i = 0; i < N_READERS; i++) g_thread_join(readers[i]);
+
+    g_free(expected);
+    g_object_unref(ldm);
+
+    return failures == 0 ? 0 : 1;
+}
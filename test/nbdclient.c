@@ -0,0 +1,594 @@
+/* nbdclient
+ * Copyright 2012 Red Hat Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* A minimal NBD client for ldmtool nbd. It negotiates structured replies and
+ * the base:allocation metadata context, checks the size of the export, then
+ * reads all of it. Every block of zeros must be sent as a hole and every other
+ * block as data, and the block status of the export must agree. A write must
+ * be refused with EPERM. Prints the SHA-256 of the export's contents, which
+ * must be the same as volread's. */
+
+#include <config.h>
+
+#include <endian.h>
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <glib.h>
+
+#define SECTOR_SIZE UINT64_C(512)
+
+#define NBD_MAGIC               UINT64_C(0x4e42444d41474943)
+#define NBD_OPTS_MAGIC          UINT64_C(0x49484156454f5054)
+#define NBD_REP_MAGIC           UINT64_C(0x0003e889045565a9)
+#define NBD_REQUEST_MAGIC       UINT32_C(0x25609513)
+#define NBD_STRUCTURED_REPLY_MAGIC UINT32_C(0x668e33ef)
+
+#define NBD_FLAG_FIXED_NEWSTYLE 0x0001
+#define NBD_FLAG_C_FIXED_NEWSTYLE 0x00000001
+#define NBD_FLAG_C_NO_ZEROES    0x00000002
+
+#define NBD_FLAG_READ_ONLY      0x0002
+#define NBD_FLAG_SEND_DF        0x0080
+
+#define NBD_OPT_GO              7
+#define NBD_OPT_STRUCTURED_REPLY 8
+#define NBD_OPT_SET_META_CONTEXT 10
+
+#define NBD_REP_ACK             1
+#define NBD_REP_INFO            3
+#define NBD_REP_META_CONTEXT    4
+#define NBD_INFO_EXPORT         0
+
+#define NBD_CMD_READ            0
+#define NBD_CMD_WRITE           1
+#define NBD_CMD_DISC            2
+#define NBD_CMD_BLOCK_STATUS    7
+#define NBD_CMD_FLAG_DF         0x0002
+
+#define NBD_REPLY_FLAG_DONE     0x0001
+#define NBD_REPLY_TYPE_NONE     0
+#define NBD_REPLY_TYPE_OFFSET_DATA 1
+#define NBD_REPLY_TYPE_OFFSET_HOLE 2
+#define NBD_REPLY_TYPE_BLOCK_STATUS 5
+#define NBD_REPLY_TYPE_ERROR    0x8001
+
+#define NBD_STATE_HOLE          0x0001
+#define NBD_STATE_ZERO          0x0002
+#define NBD_EPERM               1
+
+#define META_BASE_ALLOCATION    "base:allocation"
+
+/* The granularity at which the server reports zeros */
+#define HOLE_BLOCK 4096
+
+/* The size of each read, a multiple of HOLE_BLOCK */
+#define READ_SIZE (1024 * 1024)
+
+/* How each block of the export was sent */
+enum { BLOCK_UNSEEN, BLOCK_DATA, BLOCK_HOLE };
+
+static int fd;
+
+static void
+put16(guint8 * const buf, const guint16 v)
+{
+    const guint16 be = htobe16(v);
+    memcpy(buf, &be, sizeof(be));
+}
+
+static void
+put32(guint8 * const buf, const guint32 v)
+{
+    const guint32 be = htobe32(v);
+    memcpy(buf, &be, sizeof(be));
+}
+
+static void
+put64(guint8 * const buf, const guint64 v)
+{
+    const guint64 be = htobe64(v);
+    memcpy(buf, &be, sizeof(be));
+}
+
+static guint16
+get16(const guint8 * const buf)
+{
+    guint16 be;
+    memcpy(&be, buf, sizeof(be));
+    return be16toh(be);
+}
+
+static guint32
+get32(const guint8 * const buf)
+{
+    guint32 be;
+    memcpy(&be, buf, sizeof(be));
+    return be32toh(be);
+}
+
+static guint64
+get64(const guint8 * const buf)
+{
+    guint64 be;
+    memcpy(&be, buf, sizeof(be));
+    return be64toh(be);
+}
+
+static gboolean
+send_all(const void * const buf, const gsize len)
+{
+    for (gsize done = 0; done < len;) {
+        const ssize_t n = send(fd, (const guint8 *) buf + done, len - done,
+                               MSG_NOSIGNAL);
+        if (n == -1) {
+            if (errno == EINTR) continue;
+            fprintf(stderr, "Error sending: %m\n");
+            return FALSE;
+        }
+        done += n;
+    }
+    return TRUE;
+}
+
+static gboolean
+recv_all(void * const buf, const gsize len)
+{
+    for (gsize done = 0; done < len;) {
+        const ssize_t n = recv(fd, (guint8 *) buf + done, len - done, 0);
+        if (n == -1) {
+            if (errno == EINTR) continue;
+            fprintf(stderr, "Error receiving: %m\n");
+            return FALSE;
+        }
+        if (n == 0) {
+            fprintf(stderr, "The server closed the connection\n");
+            return FALSE;
+        }
+        done += n;
+    }
+    return TRUE;
+}
+
+static gboolean
+send_option(const guint32 option, const guint8 * const data, const guint32 len)
+{
+    guint8 head[16];
+    put64(head, NBD_OPTS_MAGIC);
+    put32(head + 8, option);
+    put32(head + 12, len);
+    return send_all(head, sizeof(head)) && (len == 0 || send_all(data, len));
+}
+
+/* Receive a reply to option. *data must be freed by the caller. */
+static gboolean
+recv_option_reply(const guint32 option, guint32 * const type,
+                  guint8 ** const data, guint32 * const len)
+{
+    guint8 head[20];
+    if (!recv_all(head, sizeof(head))) return FALSE;
+    if (get64(head) != NBD_REP_MAGIC || get32(head + 8) != option) {
+        fprintf(stderr, "Bad reply to option %u\n", option);
+        return FALSE;
+    }
+
+    *type = get32(head + 12);
+    *len = get32(head + 16);
+    *data = g_malloc(*len);
+    if (!recv_all(*data, *len)) {
+        g_free(*data);
+        return FALSE;
+    }
+    return TRUE;
+}
+
+/* Receive the replies to option up to its ack. Sets *meta_id from a meta
+ * context reply, and *size and *flags from an export information reply. */
+static gboolean
+recv_option_replies(const guint32 option, guint32 * const meta_id,
+                    guint64 * const size, guint16 * const flags)
+{
+    for (;;) {
+        guint32 type, len;
+        guint8 *data;
+        if (!recv_option_reply(option, &type, &data, &len)) return FALSE;
+
+        gboolean ok = TRUE;
+        if (type == NBD_REP_META_CONTEXT && meta_id && len > 4) {
+            ok = len - 4 == strlen(META_BASE_ALLOCATION) &&
+                 memcmp(data + 4, META_BASE_ALLOCATION, len - 4) == 0;
+            *meta_id = get32(data);
+        } else if (type == NBD_REP_INFO && size && len >= 2 &&
+                   get16(data) == NBD_INFO_EXPORT)
+        {
+            ok = len == 12;
+            if (ok) {
+                *size = get64(data + 2);
+                *flags = get16(data + 10);
+            }
+        } else if (type != NBD_REP_ACK && type != NBD_REP_INFO) {
+            ok = FALSE;
+        }
+        g_free(data);
+
+        if (!ok) {
+            fprintf(stderr, "Unexpected reply %#x to option %u\n",
+                    type, option);
+            return FALSE;
+        }
+        if (type == NBD_REP_ACK) return TRUE;
+    }
+}
+
+/* Append an export name to data */
+static void
+append_name(GByteArray * const data, const gchar * const name)
+{
+    guint8 len[4];
+    put32(len, strlen(name));
+    g_byte_array_append(data, len, sizeof(len));
+    g_byte_array_append(data, (const guint8 *) name, strlen(name));
+}
+
+static gboolean
+negotiate(const gchar * const name, guint32 * const meta_id,
+          guint64 * const size, guint16 * const flags)
+{
+    guint8 greeting[18];
+    if (!recv_all(greeting, sizeof(greeting))) return FALSE;
+    if (get64(greeting) != NBD_MAGIC || get64(greeting + 8) != NBD_OPTS_MAGIC ||
+        !(get16(greeting + 16) & NBD_FLAG_FIXED_NEWSTYLE))
+    {
+        fprintf(stderr, "Bad greeting\n");
+        return FALSE;
+    }
+
+    guint8 client[4];
+    put32(client, NBD_FLAG_C_FIXED_NEWSTYLE | NBD_FLAG_C_NO_ZEROES);
+    if (!send_all(client, sizeof(client))) return FALSE;
+
+    if (!send_option(NBD_OPT_STRUCTURED_REPLY, NULL, 0) ||
+        !recv_option_replies(NBD_OPT_STRUCTURED_REPLY, NULL, NULL, NULL))
+    {
+        return FALSE;
+    }
+
+    GByteArray * const data = g_byte_array_new();
+    guint8 n[4];
+    gboolean r;
+
+    *meta_id = 0;
+    append_name(data, name);
+    put32(n, 1);
+    g_byte_array_append(data, n, sizeof(n));
+    append_name(data, META_BASE_ALLOCATION);
+    r = send_option(NBD_OPT_SET_META_CONTEXT, data->data, data->len) &&
+        recv_option_replies(NBD_OPT_SET_META_CONTEXT, meta_id, NULL, NULL);
+    if (r && *meta_id == 0) {
+        fprintf(stderr, "%s wasn't selected\n", META_BASE_ALLOCATION);
+        r = FALSE;
+    }
+
+    /* Go to the named export with no particular information requests */
+    *size = G_MAXUINT64;
+    g_byte_array_set_size(data, 0);
+    append_name(data, name);
+    put16(n, 0);
+    g_byte_array_append(data, n, 2);
+    r = r && send_option(NBD_OPT_GO, data->data, data->len) &&
+             recv_option_replies(NBD_OPT_GO, NULL, size, flags);
+    if (r && *size == G_MAXUINT64) {
+        fprintf(stderr, "The export's size wasn't sent\n");
+        r = FALSE;
+    }
+
+    g_byte_array_unref(data);
+    return r;
+}
+
+static gboolean
+send_request(const guint16 flags, const guint16 type, const guint64 handle,
+             const guint64 offset, const guint32 length)
+{
+    guint8 head[28];
+    put32(head, NBD_REQUEST_MAGIC);
+    put16(head + 4, flags);
+    put16(head + 6, type);
+    put64(head + 8, handle);
+    put64(head + 16, offset);
+    put32(head + 24, length);
+    return send_all(head, sizeof(head));
+}
+
+/* Receive one chunk of the structured reply to handle. *payload must be freed
+ * by the caller. */
+static gboolean
+recv_chunk(const guint64 handle, guint16 * const flags, guint16 * const type,
+           guint8 ** const payload, guint32 * const len)
+{
+    guint8 head[20];
+    if (!recv_all(head, sizeof(head))) return FALSE;
+    if (get32(head) != NBD_STRUCTURED_REPLY_MAGIC || get64(head + 8) != handle)
+    {
+        fprintf(stderr, "Bad reply chunk for request %" G_GUINT64_FORMAT "\n",
+                handle);
+        return FALSE;
+    }
+
+    *flags = get16(head + 4);
+    *type = get16(head + 6);
+    *len = get32(head + 16);
+    *payload = g_malloc(*len);
+    if (!recv_all(*payload, *len)) {
+        g_free(*payload);
+        return FALSE;
+    }
+    return TRUE;
+}
+
+/* Read length bytes at offset into buf, recording how each block of the
+ * export was sent in blocks. offset is a multiple of HOLE_BLOCK. */
+static gboolean
+read_range(const guint64 handle, const guint64 offset, const guint32 length,
+           guint8 * const buf, guint8 * const blocks)
+{
+    if (!send_request(0, NBD_CMD_READ, handle, offset, length)) return FALSE;
+
+    for (;;) {
+        guint16 flags, type;
+        guint8 *payload;
+        guint32 len;
+        if (!recv_chunk(handle, &flags, &type, &payload, &len)) return FALSE;
+
+        gboolean ok = TRUE;
+        guint64 start = 0, end = 0;
+        if (type == NBD_REPLY_TYPE_OFFSET_DATA && len > 8) {
+            start = get64(payload);
+            end = start + len - 8;
+        } else if (type == NBD_REPLY_TYPE_OFFSET_HOLE && len == 12) {
+            start = get64(payload);
+            end = start + get32(payload + 8);
+        } else if (type != NBD_REPLY_TYPE_NONE) {
+            ok = FALSE;
+        }
+
+        if (ok && start != end) {
+            /* A chunk starts on a block, and ends on one or at the end of
+             * the read */
+            ok = start >= offset && end <= offset + length && start < end &&
+                 (start - offset) % HOLE_BLOCK == 0 &&
+                 ((end - offset) % HOLE_BLOCK == 0 || end == offset + length);
+        }
+
+        if (ok && start != end) {
+            if (type == NBD_REPLY_TYPE_OFFSET_DATA) {
+                memcpy(buf + (start - offset), payload + 8, end - start);
+            } else {
+                memset(buf + (start - offset), 0, end - start);
+            }
+            for (guint64 b = start / HOLE_BLOCK;
+                 b < (end + HOLE_BLOCK - 1) / HOLE_BLOCK; b++)
+            {
+                if (blocks[b] != BLOCK_UNSEEN) ok = FALSE;
+                blocks[b] = type == NBD_REPLY_TYPE_OFFSET_DATA ? BLOCK_DATA
+                                                               : BLOCK_HOLE;
+            }
+        }
+        g_free(payload);
+
+        if (!ok) {
+            fprintf(stderr, "Bad reply chunk of type %u to read of %u bytes "
+                            "at %" G_GUINT64_FORMAT "\n", type, length, offset);
+            return FALSE;
+        }
+        if (flags & NBD_REPLY_FLAG_DONE) return TRUE;
+    }
+}
+
+/* Check that the block status of the whole export agrees with how its data
+ * was sent */
+static gboolean
+check_block_status(guint64 * const handle, const guint32 meta_id,
+                   const guint64 size, const guint8 * const blocks)
+{
+    for (guint64 offset = 0; offset < size; (*handle)++) {
+        /* The server may describe less than was asked for */
+        const guint32 length = MIN(size - offset, UINT32_C(64) * 1024 * 1024);
+        if (!send_request(0, NBD_CMD_BLOCK_STATUS, *handle, offset, length)) {
+            return FALSE;
+        }
+
+        guint16 flags, type;
+        guint8 *payload;
+        guint32 len;
+        if (!recv_chunk(*handle, &flags, &type, &payload, &len)) return FALSE;
+
+        gboolean ok = type == NBD_REPLY_TYPE_BLOCK_STATUS &&
+                      (flags & NBD_REPLY_FLAG_DONE) &&
+                      len >= 12 && (len - 4) % 8 == 0 &&
+                      get32(payload) == meta_id;
+
+        const guint64 start = offset;
+        for (guint32 i = 4; ok && i < len; i += 8) {
+            const guint32 extent = get32(payload + i);
+            const guint32 state = get32(payload + i + 4);
+            const gboolean hole = state & NBD_STATE_HOLE;
+
+            ok = extent > 0 && extent <= start + length - offset &&
+                 (extent % HOLE_BLOCK == 0 || offset + extent == size) &&
+                 hole == !!(state & NBD_STATE_ZERO);
+
+            for (guint64 b = offset / HOLE_BLOCK;
+                 ok && b < (offset + extent + HOLE_BLOCK - 1) / HOLE_BLOCK; b++)
+            {
+                if (blocks[b] != (hole ? BLOCK_HOLE : BLOCK_DATA)) {
+                    fprintf(stderr, "Block status of block %" G_GUINT64_FORMAT
+                                    " differs from its read\n", b);
+                    ok = FALSE;
+                }
+            }
+            offset += extent;
+        }
+        g_free(payload);
+
+        if (!ok) {
+            fprintf(stderr, "Bad block status at %" G_GUINT64_FORMAT "\n",
+                    start);
+            return FALSE;
+        }
+    }
+
+    return TRUE;
+}
+
+/* Check that a read with the don't fragment flag is sent as a single data
+ * chunk, even if it is all zeros */
+static gboolean
+check_read_df(const guint64 handle, const guint64 size)
+{
+    const guint32 length = MIN(size, HOLE_BLOCK);
+    if (!send_request(NBD_CMD_FLAG_DF, NBD_CMD_READ, handle, 0, length)) {
+        return FALSE;
+    }
+
+    guint16 flags, type;
+    guint8 *payload;
+    guint32 len;
+    if (!recv_chunk(handle, &flags, &type, &payload, &len)) return FALSE;
+
+    const gboolean ok = type == NBD_REPLY_TYPE_OFFSET_DATA &&
+                        (flags & NBD_REPLY_FLAG_DONE) &&
+                        len == 8 + length && get64(payload) == 0;
+    g_free(payload);
+
+    if (!ok) fprintf(stderr, "Read with DF wasn't sent as a single chunk\n");
+    return ok;
+}
+
+/* Check that a write is refused with EPERM */
+static gboolean
+check_write(const guint64 handle)
+{
+    guint8 data[HOLE_BLOCK] = { 0, };
+    if (!send_request(0, NBD_CMD_WRITE, handle, 0, sizeof(data)) ||
+        !send_all(data, sizeof(data)))
+    {
+        return FALSE;
+    }
+
+    guint16 flags, type;
+    guint8 *payload;
+    guint32 len;
+    if (!recv_chunk(handle, &flags, &type, &payload, &len)) return FALSE;
+
+    const gboolean ok = type == NBD_REPLY_TYPE_ERROR &&
+                        (flags & NBD_REPLY_FLAG_DONE) &&
+                        len >= 6 && get32(payload) == NBD_EPERM;
+    g_free(payload);
+
+    if (!ok) fprintf(stderr, "Write wasn't refused with EPERM\n");
+    return ok;
+}
+
+int main(int argc, const char *argv[])
+{
+    if (argc != 4) {
+        fprintf(stderr, "Usage: %s <socket> <export> <size in sectors>\n",
+                argv[0]);
+        return 1;
+    }
+
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+    g_strlcpy(addr.sun_path, argv[1], sizeof(addr.sun_path));
+    fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd == -1 || connect(fd, (struct sockaddr *) &addr, sizeof(addr)) == -1)
+    {
+        fprintf(stderr, "Error connecting to %s: %m\n", argv[1]);
+        return 1;
+    }
+
+    GChecksum * const checksum = g_checksum_new(G_CHECKSUM_SHA256);
+    guint8 * const buf = g_malloc(READ_SIZE);
+    guint8 *blocks = NULL;
+    guint64 handle = 1;
+    int ret = 1;
+
+    guint32 meta_id;
+    guint64 size;
+    guint16 flags;
+    if (!negotiate(argv[2], &meta_id, &size, &flags)) goto out;
+
+    const guint64 expected = g_ascii_strtoull(argv[3], NULL, 10) * SECTOR_SIZE;
+    if (size != expected) {
+        fprintf(stderr, "Export size is %" G_GUINT64_FORMAT ", expected %"
+                        G_GUINT64_FORMAT "\n", size, expected);
+        goto out;
+    }
+    if ((flags & (NBD_FLAG_READ_ONLY | NBD_FLAG_SEND_DF)) !=
+        (NBD_FLAG_READ_ONLY | NBD_FLAG_SEND_DF))
+    {
+        fprintf(stderr, "Unexpected transmission flags %#x\n", flags);
+        goto out;
+    }
+
+    blocks = g_malloc0((size + HOLE_BLOCK - 1) / HOLE_BLOCK);
+    for (guint64 offset = 0; offset < size; offset += READ_SIZE) {
+        const guint32 length = MIN(size - offset, READ_SIZE);
+        if (!read_range(handle++, offset, length, buf, blocks)) goto out;
+
+        /* Every block was sent once, and only blocks of zeros as holes */
+        for (guint32 pos = 0; pos < length; pos += HOLE_BLOCK) {
+            const guint32 n = MIN(HOLE_BLOCK, length - pos);
+            const guint64 b = (offset + pos) / HOLE_BLOCK;
+
+            gboolean zero = TRUE;
+            for (guint32 i = 0; zero && i < n; i++) zero = buf[pos + i] == 0;
+
+            if (blocks[b] == BLOCK_UNSEEN ||
+                (blocks[b] == BLOCK_DATA && zero))
+            {
+                fprintf(stderr, "Block %" G_GUINT64_FORMAT " was %s\n", b,
+                        blocks[b] == BLOCK_UNSEEN ? "not sent"
+                                                  : "zeros sent as data");
+                goto out;
+            }
+        }
+
+        g_checksum_update(checksum, buf, length);
+    }
+
+    if (!check_block_status(&handle, meta_id, size, blocks)) goto out;
+    if (!check_read_df(handle++, size)) goto out;
+    if (!check_write(handle++)) goto out;
+
+    if (!send_request(0, NBD_CMD_DISC, handle++, 0, 0)) goto out;
+
+    printf("%s\n", g_checksum_get_string(checksum));
+    ret = 0;
+
+out:
+    close(fd);
+    g_checksum_free(checksum);
+    g_free(buf);
+    g_free(blocks);
+
+    return ret;
+}
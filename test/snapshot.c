@@ -0,0 +1,237 @@
+/* snapshot
+ * Copyright 2012 Red Hat Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Saves a snapshot of a scan of some drives, loads it again, and checks that
+ * the loaded object describes the same disk groups, volumes, partitions and
+ * disks as the scan. It then changes the committed sequence number in the
+ * VMDB of the first drive, which must make loading the snapshot fail as out
+ * of date. The drives are modified, so they should be copies.
+ *
+ * Finding the VMDB needs the metadata structures, so this includes ldm.c
+ * rather than only linking against libldm. */
+
+#include "ldm.c"
+
+#include <stdio.h>
+
+/* Everything ldmread prints of ldm, except the device mapper devices */
+static gchar *
+describe(LDM * const ldm)
+{
+    GString * const s = g_string_new("");
+    char guid[37];
+
+    GArray * const dgs = ldm_get_disk_groups(ldm);
+    for (guint i = 0; i < dgs->len; i++) {
+        LDMDiskGroup * const dg = g_array_index(dgs, LDMDiskGroup *, i);
+
+        LDMDiskGroupInfo dg_info;
+        ldm_disk_group_get_info(dg, &dg_info);
+        uuid_unparse(dg_info.guid, guid);
+        g_string_append_printf(s, "Disk Group: %s\n", dg_info.name);
+        g_string_append_printf(s, "  GUID:   %s\n", guid);
+
+        GArray * const vols = ldm_disk_group_get_volumes(dg);
+        for (guint j = 0; j < vols->len; j++) {
+            LDMVolume * const vol = g_array_index(vols, LDMVolume *, j);
+
+            LDMVolumeInfo info;
+            ldm_volume_get_info(vol, &info);
+            uuid_unparse(info.guid, guid);
+            g_string_append_printf(s, "  Volume: %s\n", info.name);
+            g_string_append_printf(s, "    GUID:       %s\n", guid);
+            g_string_append_printf(s, "    Type:       %d\n", info.type);
+            g_string_append_printf(s, "    Size:       %" G_GUINT64_FORMAT
+                                      "\n", info.size);
+            g_string_append_printf(s, "    Part Type:  %hhu\n",
+                                   info.part_type);
+            g_string_append_printf(s, "    Hint:       %s\n",
+                                   info.hint ? info.hint : "(null)");
+            g_string_append_printf(s, "    Chunk Size: %" G_GUINT64_FORMAT
+                                      "\n", info.chunk_size);
+
+            GArray * const parts = ldm_volume_get_partitions(vol);
+            for (guint k = 0; k < parts->len; k++) {
+                LDMPartition * const part =
+                    g_array_index(parts, LDMPartition *, k);
+
+                LDMPartitionInfo part_info;
+                ldm_partition_get_info(part, &part_info);
+                g_string_append_printf(s, "    Partition: %s\n",
+                                       part_info.name);
+                g_string_append_printf(s, "        Start:  %" G_GUINT64_FORMAT
+                                          "\n", part_info.start);
+                g_string_append_printf(s, "        Size:   %" G_GUINT64_FORMAT
+                                          "\n", part_info.size);
+
+                LDMDiskInfo disk_info;
+                ldm_disk_get_info(part_info.disk, &disk_info);
+                uuid_unparse(disk_info.guid, guid);
+                g_string_append_printf(s, "        Disk: %s\n",
+                                       disk_info.name);
+                g_string_append_printf(s, "          GUID:           %s\n",
+                                       guid);
+                g_string_append_printf(s, "          Device:         %s\n",
+                                       disk_info.device ? disk_info.device
+                                                        : "(null)");
+                g_string_append_printf(s, "          Data Start:     %"
+                                          G_GUINT64_FORMAT "\n",
+                                       disk_info.data_start);
+                g_string_append_printf(s, "          Data Size:      %"
+                                          G_GUINT64_FORMAT "\n",
+                                       disk_info.data_size);
+                g_string_append_printf(s, "          Metadata Start: %"
+                                          G_GUINT64_FORMAT "\n",
+                                       disk_info.metadata_start);
+                g_string_append_printf(s, "          Metadata Size:  %"
+                                          G_GUINT64_FORMAT "\n",
+                                       disk_info.metadata_size);
+            }
+            g_array_unref(parts);
+        }
+        g_array_unref(vols);
+    }
+    g_array_unref(dgs);
+
+    return g_string_free(s, FALSE);
+}
+
+/* Add 1 to the committed sequence number in the VMDB of the drive at path */
+static gboolean
+bump_committed_seq(const gchar * const path, GError ** const err)
+{
+    const int fd = open(path, O_RDWR);
+    if (fd == -1) {
+        g_set_error(err, LDM_ERROR, LDM_ERROR_IO,
+                    "Error opening %s for writing: %m", path);
+        return FALSE;
+    }
+
+    const guint secsize = 512;
+    struct _privhead privhead;
+    struct _tocblock tocblock;
+    struct _vmdb vmdb;
+    uint64_t vmdb_start = 0;
+    gboolean r = FALSE;
+
+    if (!_read_privhead(fd, path, secsize, &privhead, err)) goto out;
+
+    const uint64_t config_start =
+        be64toh(privhead.ldm_config_start) * secsize;
+    if (!_pread_all(fd, path, &tocblock, sizeof(tocblock),
+                    config_start + secsize * 2, err)) goto out;
+    for (int i = 0; i < 2; i++) {
+        const struct _tocblock_bitmap * const bitmap = &tocblock.bitmap[i];
+        if (strncmp(bitmap->name, "config", sizeof(bitmap->name)) == 0) {
+            vmdb_start = config_start + be64toh(bitmap->start) * secsize;
+        }
+    }
+    if (vmdb_start == 0) {
+        g_set_error(err, LDM_ERROR, LDM_ERROR_INVALID,
+                    "Didn't find the VMDB of %s", path);
+        goto out;
+    }
+
+    if (!_pread_all(fd, path, &vmdb, sizeof(vmdb), vmdb_start, err)) goto out;
+    vmdb.committed_seq = htobe64(be64toh(vmdb.committed_seq) + 1);
+    if (pwrite(fd, &vmdb, sizeof(vmdb), vmdb_start) != sizeof(vmdb)) {
+        g_set_error(err, LDM_ERROR, LDM_ERROR_IO,
+                    "Error writing to %s: %m", path);
+        goto out;
+    }
+    r = TRUE;
+
+out:
+    close(fd);
+    return r;
+}
+
+int main(int argc, const char *argv[])
+{
+    if (argc < 3) {
+        fprintf(stderr, "Usage: %s <snapshot> <drive> [<drive> ...]\n",
+                argv[0]);
+        return 1;
+    }
+
+#if !GLIB_CHECK_VERSION(2,35,0)
+    g_type_init();
+#endif
+
+    const gchar * const path = argv[1];
+    LDM * const ldm = ldm_new();
+    LDM *loaded = NULL;
+    gchar *scanned = NULL;
+    gchar *described = NULL;
+    GError *err = NULL;
+    int ret = 1;
+
+    for (int i = 2; i < argc; i++) {
+        if (!ldm_add(ldm, argv[i], &err)) {
+            fprintf(stderr, "Error reading LDM: %s\n", err->message);
+            goto out;
+        }
+    }
+    scanned = describe(ldm);
+
+    if (!ldm_save_snapshot(ldm, path, &err)) {
+        fprintf(stderr, "Error saving snapshot: %s\n", err->message);
+        goto out;
+    }
+
+    loaded = ldm_load_snapshot(path, &err);
+    if (loaded == NULL) {
+        fprintf(stderr, "Error loading snapshot: %s\n", err->message);
+        goto out;
+    }
+    described = describe(loaded);
+    g_object_unref(loaded); loaded = NULL;
+
+    if (strcmp(scanned, described) != 0) {
+        fprintf(stderr, "Scanned:\n%sLoaded from snapshot:\n%s",
+                scanned, described);
+        goto out;
+    }
+
+    if (!bump_committed_seq(argv[2], &err)) {
+        fprintf(stderr, "%s\n", err->message);
+        goto out;
+    }
+
+    loaded = ldm_load_snapshot(path, &err);
+    if (loaded != NULL) {
+        fprintf(stderr, "Loaded an out of date snapshot\n");
+        goto out;
+    }
+    if (!g_error_matches(err, LDM_ERROR, LDM_ERROR_INCONSISTENT)) {
+        fprintf(stderr, "Unexpected error loading an out of date snapshot: "
+                        "%s\n", err->message);
+        goto out;
+    }
+    g_error_free(err); err = NULL;
+
+    ret = 0;
+
+out:
+    if (err) g_error_free(err);
+    if (loaded) g_object_unref(loaded);
+    g_object_unref(ldm);
+    g_free(scanned);
+    g_free(described);
+
+    return ret;
+}
@@ -0,0 +1,408 @@
+/* volmap
+ * Copyright 2012 Red Hat Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Maps a whole volume with ldm_volume_map_batch(), in ranges which aren't
+ * aligned to chunks, and in ranges which straddle each boundary between
+ * partitions of a spanned volume or between the first chunks of a striped or
+ * RAID5 volume. Each range must map to the same extents with ldm_volume_map().
+ *
+ * The data extents of a range must cover it in order, and what the disks
+ * hold at each data and mirror extent must be what ldm_volume_pread() reads
+ * from the volume there. Each parity extent must follow the data extent it
+ * protects, at the same offset in another column, and the data and parity of
+ * every column must XOR to zero there. Parity must be placed in the left
+ * symmetric layout, and rotate through every column. All the disks of the
+ * volume must be present. */
+
+#include <config.h>
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <glib-object.h>
+
+#include "ldm.h"
+
+/* Not a multiple of any chunk size */
+#define RANGE_SIZE (96 * 1024 + 1536)
+#define BOUNDARY_SIZE 4096
+#define SECTOR_SIZE UINT64_C(512)
+
+static LDMVolumeHandle *h;
+static LDMVolumeType type;
+static guint64 chunk;
+static guint n_parts;
+static LDMPartition **parts;
+static int *fds;
+static guint64 *bases;      /* Byte offset of each partition on its device */
+static guint64 parity_columns = 0;
+static int failures = 0;
+
+static void
+fail(const LDMRange * const range, const char * const msg)
+{
+    fprintf(stderr, "Range %" G_GUINT64_FORMAT "+%" G_GUINT64_FORMAT ": %s\n",
+            range->offset, range->length, msg);
+    failures++;
+}
+
+static gboolean
+read_disk(const guint column, guint8 * const buf, const gsize len,
+          const guint64 offset)
+{
+    if (pread(fds[column], buf, len, offset) != (gssize) len) {
+        fprintf(stderr, "Error reading column %u at %" G_GUINT64_FORMAT
+                        ": %m\n", column, offset);
+        return FALSE;
+    }
+    return TRUE;
+}
+
+/* The data and parity of every column at offset in the partitions XOR to
+ * zero */
+static gboolean
+check_parity(const guint64 offset, const gsize len)
+{
+    guint8 * const sum = g_malloc0(len);
+    guint8 * const buf = g_malloc(len);
+    gboolean r = TRUE;
+
+    for (guint i = 0; r && i < n_parts; i++) {
+        r = read_disk(i, buf, len, bases[i] + offset);
+        for (gsize j = 0; r && j < len; j++) sum[j] ^= buf[j];
+    }
+    for (gsize j = 0; r && j < len; j++) {
+        if (sum[j] != 0) r = FALSE;
+    }
+
+    g_free(sum);
+    g_free(buf);
+    return r;
+}
+
+static void
+check_extents(const LDMRange * const range, const LDMExtent * const extents,
+              const gsize n, const gboolean boundary)
+{
+    guint64 next = range->offset;
+    guint n_data = 0;
+    const LDMExtent *data = NULL;
+
+    for (gsize i = 0; i < n; i++) {
+        const LDMExtent * const e = &extents[i];
+
+        if (e->column >= n_parts || e->partition != parts[e->column]) {
+            fail(range, "extent in the wrong partition");
+            continue;
+        }
+        LDMDisk * const disk = ldm_partition_get_disk(parts[e->column]);
+        g_object_unref(disk);
+        if (e->disk != disk) fail(range, "extent on the wrong disk");
+
+        guint8 * const expected = g_malloc(e->length);
+        guint8 * const actual = g_malloc(e->length);
+
+        switch (e->type) {
+        case LDM_EXTENT_TYPE_DATA:
+        case LDM_EXTENT_TYPE_MIRROR:
+            if (e->type == LDM_EXTENT_TYPE_DATA) {
+                if (e->offset != next) {
+                    fail(range, "data extents out of order");
+                }
+                next = e->offset + e->length;
+                n_data++;
+                data = e;
+            } else if (type != LDM_VOLUME_TYPE_MIRRORED ||
+                       data == NULL || e->offset != data->offset ||
+                       e->length != data->length)
+            {
+                fail(range, "unexpected mirror extent");
+            }
+
+            if (ldm_volume_pread(h, expected, e->length, e->offset, NULL) !=
+                    (gssize) e->length ||
+                !read_disk(e->column, actual, e->length, e->disk_offset))
+            {
+                fail(range, "unable to read extent");
+            } else if (memcmp(expected, actual, e->length) != 0) {
+                fail(range, "extent doesn't hold the volume's data");
+            }
+            break;
+
+        case LDM_EXTENT_TYPE_PARITY:
+        {
+            if (type != LDM_VOLUME_TYPE_RAID5 || data == NULL ||
+                &extents[i - 1] != data || e->offset != data->offset ||
+                e->length != data->length || e->column == data->column ||
+                e->disk_offset - bases[e->column] !=
+                    data->disk_offset - bases[data->column])
+            {
+                fail(range, "parity extent doesn't match its data extent");
+                break;
+            }
+
+            /* Windows uses the left symmetric layout, in which parity
+             * rotates backwards from the last column and data starts in the
+             * column following parity */
+            const guint64 row = (e->disk_offset - bases[e->column]) / chunk;
+            const guint64 chunk_no = e->offset / chunk;
+            const guint parity = n_parts - 1 - row % n_parts;
+            if (e->column != parity ||
+                data->column != (parity + 1 + chunk_no % (n_parts - 1)) %
+                                n_parts)
+            {
+                fail(range, "not in the left symmetric layout");
+            }
+
+            if (!check_parity(e->disk_offset - bases[e->column], e->length)) {
+                fail(range, "parity doesn't protect the data");
+            }
+            parity_columns |= UINT64_C(1) << e->column;
+            break;
+        }
+        }
+
+        g_free(expected);
+        g_free(actual);
+    }
+
+    if (next != range->offset + range->length) {
+        fail(range, "data extents don't cover the range");
+    }
+
+    /* A range across a boundary must go to two different columns */
+    if (boundary && type != LDM_VOLUME_TYPE_MIRRORED) {
+        const LDMExtent *first = NULL;
+        const LDMExtent *second = NULL;
+        for (gsize i = 0; i < n; i++) {
+            if (extents[i].type != LDM_EXTENT_TYPE_DATA) continue;
+            if (first == NULL) first = &extents[i];
+            else second = &extents[i];
+        }
+        if (n_data != 2 || first->column == second->column ||
+            first->length != BOUNDARY_SIZE / 2)
+        {
+            fail(range, "not split at the boundary");
+        }
+    }
+}
+
+static void
+add_boundary(GArray * const ranges, const guint64 boundary, const guint64 size)
+{
+    if (boundary < BOUNDARY_SIZE / 2 || boundary + BOUNDARY_SIZE / 2 > size)
+        return;
+
+    const LDMRange range = { boundary - BOUNDARY_SIZE / 2, BOUNDARY_SIZE };
+    g_array_append_val(ranges, range);
+}
+
+int main(int argc, const char *argv[])
+{
+    if (argc < 4) {
+        fprintf(stderr, "Usage: %s <disk group guid> <volume> <drive> "
+                        "[<drive> ...]\n", argv[0]);
+        return 1;
+    }
+
+#if !GLIB_CHECK_VERSION(2,35,0)
+    g_type_init();
+#endif
+
+    LDM * const ldm = ldm_new();
+    LDMDiskGroup *dg = NULL;
+    LDMVolume *vol = NULL;
+    GArray *part_array = NULL;
+    GArray *ranges = NULL;
+    GArray *extents = NULL;
+    gsize *first = NULL;
+    GError *err = NULL;
+    int ret = 1;
+
+    for (int i = 3; i < argc; i++) {
+        if (!ldm_add(ldm, argv[i], &err)) {
+            fprintf(stderr, "Error reading LDM: %s\n", err->message);
+            goto out;
+        }
+    }
+
+    dg = ldm_find_disk_group(ldm, argv[1]);
+    if (dg == NULL) {
+        fprintf(stderr, "Disk group %s not found\n", argv[1]);
+        goto out;
+    }
+
+    vol = ldm_disk_group_find_volume(dg, argv[2]);
+    if (vol == NULL) {
+        fprintf(stderr, "Volume %s not found\n", argv[2]);
+        goto out;
+    }
+
+    h = ldm_volume_open(vol, &err);
+    if (h == NULL) {
+        fprintf(stderr, "Error opening %s: %s\n", argv[2], err->message);
+        goto out;
+    }
+
+    type = ldm_volume_get_voltype(vol);
+    chunk = ldm_volume_get_chunk_size(vol) * SECTOR_SIZE;
+    part_array = ldm_volume_get_partitions(vol);
+    n_parts = part_array->len;
+    parts = (LDMPartition **) part_array->data;
+    fds = g_new(int, n_parts);
+    bases = g_new(guint64, n_parts);
+    for (guint i = 0; i < n_parts; i++) fds[i] = -1;
+
+    for (guint i = 0; i < n_parts; i++) {
+        LDMDisk * const disk = ldm_partition_get_disk(parts[i]);
+        gchar * const device = ldm_disk_get_device(disk);
+        bases[i] = (ldm_disk_get_data_start(disk) +
+                    ldm_partition_get_start(parts[i])) * SECTOR_SIZE;
+        g_object_unref(disk);
+
+        if (device == NULL) {
+            fprintf(stderr, "A disk of %s is missing\n", argv[2]);
+            goto out;
+        }
+        fds[i] = open(device, O_RDONLY);
+        if (fds[i] == -1) {
+            fprintf(stderr, "Error opening %s: %m\n", device);
+            g_free(device);
+            goto out;
+        }
+        g_free(device);
+    }
+
+    /* The whole volume, then each boundary */
+    const guint64 size = ldm_volume_get_size(vol) * SECTOR_SIZE;
+    ranges = g_array_new(FALSE, FALSE, sizeof(LDMRange));
+    for (guint64 offset = 0; offset < size; offset += RANGE_SIZE) {
+        const LDMRange range = { offset, MIN(RANGE_SIZE, size - offset) };
+        g_array_append_val(ranges, range);
+    }
+    const guint n_walk = ranges->len;
+
+    switch (type) {
+    case LDM_VOLUME_TYPE_SIMPLE:
+    case LDM_VOLUME_TYPE_SPANNED:
+    {
+        guint64 end = 0;
+        for (guint i = 0; i + 1 < n_parts; i++) {
+            end += ldm_partition_get_size(parts[i]) * SECTOR_SIZE;
+            add_boundary(ranges, end, size);
+        }
+        break;
+    }
+
+    case LDM_VOLUME_TYPE_STRIPED:
+    case LDM_VOLUME_TYPE_RAID5:
+        for (guint i = 1; i <= n_parts * 2; i++) {
+            add_boundary(ranges, i * chunk, size);
+        }
+        break;
+
+    case LDM_VOLUME_TYPE_MIRRORED:
+        break;
+    }
+
+    first = g_new(gsize, ranges->len + 1);
+    extents = ldm_volume_map_batch(vol, (LDMRange *) ranges->data,
+                                   ranges->len, first, &err);
+    if (extents == NULL) {
+        fprintf(stderr, "Error mapping %s: %s\n", argv[2], err->message);
+        goto out;
+    }
+    if (first[ranges->len] != extents->len) {
+        fprintf(stderr, "Mapped %u extents, but the total is %" G_GSIZE_FORMAT
+                        "\n", extents->len, first[ranges->len]);
+        failures++;
+    }
+
+    for (guint i = 0; i < ranges->len; i++) {
+        const LDMRange * const range = &g_array_index(ranges, LDMRange, i);
+        const LDMExtent * const batch =
+            &g_array_index(extents, LDMExtent, first[i]);
+        const gsize n = first[i + 1] - first[i];
+
+        const gssize n_single = ldm_volume_map(vol, range->offset,
+                                               range->length, NULL, 0, &err);
+        if (n_single == -1) {
+            fprintf(stderr, "Error mapping %s: %s\n", argv[2], err->message);
+            goto out;
+        }
+
+        LDMExtent * const single = g_new0(LDMExtent, n_single);
+        ldm_volume_map(vol, range->offset, range->length, single, n_single,
+                       NULL);
+        if ((gsize) n_single != n) {
+            fail(range, "ldm_volume_map and ldm_volume_map_batch differ");
+        } else {
+            for (gsize j = 0; j < n; j++) {
+                if (single[j].offset != batch[j].offset ||
+                    single[j].length != batch[j].length ||
+                    single[j].type != batch[j].type ||
+                    single[j].column != batch[j].column ||
+                    single[j].disk_offset != batch[j].disk_offset)
+                {
+                    fail(range, "ldm_volume_map and ldm_volume_map_batch "
+                                "differ");
+                    break;
+                }
+            }
+        }
+        g_free(single);
+
+        check_extents(range, batch, n, i >= n_walk);
+    }
+
+    if (type == LDM_VOLUME_TYPE_RAID5 &&
+        parity_columns != (UINT64_C(1) << n_parts) - 1)
+    {
+        fprintf(stderr, "Parity doesn't rotate through every column\n");
+        failures++;
+    }
+
+    /* A range past the end of the volume can't be mapped */
+    if (ldm_volume_map(vol, size - SECTOR_SIZE, SECTOR_SIZE * 2,
+                       NULL, 0, NULL) != -1)
+    {
+        fprintf(stderr, "Mapped a range past the end of %s\n", argv[2]);
+        failures++;
+    }
+
+    ret = failures == 0 ? 0 : 1;
+
+out:
+    if (err) g_error_free(err);
+    for (guint i = 0; fds && i < n_parts; i++) {
+        if (fds[i] != -1) close(fds[i]);
+    }
+    g_free(fds);
+    g_free(bases);
+    g_free(first);
+    if (extents) g_array_unref(extents);
+    if (ranges) g_array_unref(ranges);
+    if (part_array) g_array_unref(part_array);
+    ldm_volume_close(h);
+    if (vol) g_object_unref(vol);
+    if (dg) g_object_unref(dg);
+    g_object_unref(ldm);
+
+    return ret;
+}
@@ -0,0 +1,123 @@
+/* volread
+ * Copyright 2012 Red Hat Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Reads a whole volume with the userspace reader and prints the SHA-256 of its
+ * contents. Reading a volume with a disk missing must give the same checksum
+ * as reading it with every disk present. Every other buffer is read with
+ * ldm_volume_preadv(), scattered into pieces which don't line up with sectors
+ * or chunks. */
+
+#include <config.h>
+
+#include <stdio.h>
+
+#include <glib-object.h>
+
+#include "ldm.h"
+
+#define BUF_SIZE (1024 * 1024)
+#define PIECE_SIZE (60 * 1024 + 7)
+#define SECTOR_SIZE UINT64_C(512)
+
+int main(int argc, const char *argv[])
+{
+    if (argc < 4) {
+        fprintf(stderr, "Usage: %s <disk group guid> <volume> <drive> "
+                        "[<drive> ...]\n", argv[0]);
+        return 1;
+    }
+
+#if !GLIB_CHECK_VERSION(2,35,0)
+    g_type_init();
+#endif
+
+    LDM * const ldm = ldm_new();
+    LDMDiskGroup *dg = NULL;
+    LDMVolume *vol = NULL;
+    LDMVolumeHandle *h = NULL;
+    GChecksum * const checksum = g_checksum_new(G_CHECKSUM_SHA256);
+    guint8 * const buf = g_malloc(BUF_SIZE);
+    GError *err = NULL;
+    int ret = 1;
+
+    for (int i = 3; i < argc; i++) {
+        if (!ldm_add(ldm, argv[i], &err)) {
+            fprintf(stderr, "Error reading LDM: %s\n", err->message);
+            goto out;
+        }
+    }
+
+    dg = ldm_find_disk_group(ldm, argv[1]);
+    if (dg == NULL) {
+        fprintf(stderr, "Disk group %s not found\n", argv[1]);
+        goto out;
+    }
+
+    vol = ldm_disk_group_find_volume(dg, argv[2]);
+    if (vol == NULL) {
+        fprintf(stderr, "Volume %s not found\n", argv[2]);
+        goto out;
+    }
+
+    h = ldm_volume_open(vol, &err);
+    if (h == NULL) {
+        fprintf(stderr, "Error opening %s: %s\n", argv[2], err->message);
+        goto out;
+    }
+
+    const guint64 size = ldm_volume_get_size(vol) * SECTOR_SIZE;
+    for (guint64 offset = 0, i = 0; offset < size; i++) {
+        gssize n;
+        if (i % 2 == 0) {
+            n = ldm_volume_pread(h, buf, BUF_SIZE, offset, &err);
+        } else {
+            struct iovec iov[BUF_SIZE / PIECE_SIZE + 1];
+            int iovcnt = 0;
+            for (gsize pos = 0; pos < BUF_SIZE; pos += PIECE_SIZE) {
+                iov[iovcnt].iov_base = buf + pos;
+                iov[iovcnt++].iov_len = MIN(PIECE_SIZE, BUF_SIZE - pos);
+            }
+            n = ldm_volume_preadv(h, iov, iovcnt, offset, &err);
+        }
+        if (n == -1) {
+            fprintf(stderr, "Error reading %s: %s\n", argv[2], err->message);
+            goto out;
+        }
+        if (n == 0) {
+            fprintf(stderr, "Short read of %s at %" G_GUINT64_FORMAT "\n",
+                    argv[2], offset);
+            goto out;
+        }
+
+        g_checksum_update(checksum, buf, n);
+        offset += n;
+    }
+
+    printf("%s\n", g_checksum_get_string(checksum));
+    ret = 0;
+
+out:
+    if (err) g_error_free(err);
+    ldm_volume_close(h);
+    if (vol) g_object_unref(vol);
+    if (dg) g_object_unref(dg);
+    g_object_unref(ldm);
+    g_checksum_free(checksum);
+    g_free(buf);
+
+    return ret;
+}
@@ -0,0 +1,188 @@
+/* volwrite
+ * Copyright 2012 Red Hat Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Fills a volume with a pattern using the userspace writer, then scans the
+ * drives again and reads the volume back. The drives are overwritten, so this
+ * must be run on copies of the test images. */
+
+#include <config.h>
+
+#include <stdio.h>
+#include <string.h>
+
+#include <glib-object.h>
+
+#include "ldm.h"
+
+#define BUF_SIZE (1024 * 1024)
+#define SECTOR_SIZE UINT64_C(512)
+
+static guint8
+pattern(const guint64 offset)
+{
+    return (offset >> 9) ^ (offset * 0x9E) ^ 0x5A;
+}
+
+static LDMVolume *
+find_volume(LDM * const ldm, const char * const dg_guid,
+            const char * const name, const char ** const drives,
+            const int n_drives)
+{
+    for (int i = 0; i < n_drives; i++) {
+        GError *err = NULL;
+        if (!ldm_add(ldm, drives[i], &err)) {
+            fprintf(stderr, "Error reading LDM: %s\n", err->message);
+            g_error_free(err);
+            return NULL;
+        }
+    }
+
+    LDMDiskGroup * const dg = ldm_find_disk_group(ldm, dg_guid);
+    if (dg == NULL) {
+        fprintf(stderr, "Disk group %s not found\n", dg_guid);
+        return NULL;
+    }
+
+    LDMVolume * const vol = ldm_disk_group_find_volume(dg, name);
+    g_object_unref(dg);
+    if (vol == NULL) fprintf(stderr, "Volume %s not found\n", name);
+
+    return vol;
+}
+
+/* Write the whole volume in pieces of varying length, so that writes start
+ * and end at every alignment and some cross chunk and partition boundaries */
+static gboolean
+write_volume(LDMVolumeHandle * const h, const guint64 size,
+             guint8 * const buf)
+{
+    static const gsize lengths[] = { 512, 77, 65536, 4096 * 3 + 512, 1,
+                                     BUF_SIZE, 1000 };
+
+    guint64 offset = 0;
+    for (guint i = 0; offset < size; i++) {
+        const gsize len = MIN(lengths[i % G_N_ELEMENTS(lengths)],
+                              size - offset);
+        for (gsize j = 0; j < len; j++) buf[j] = pattern(offset + j);
+
+        GError *err = NULL;
+        if (ldm_volume_pwrite(h, buf, len, offset, &err) != (gssize) len) {
+            fprintf(stderr, "Error writing at %" G_GUINT64_FORMAT ": %s\n",
+                    offset, err ? err->message : "short write");
+            if (err) g_error_free(err);
+            return FALSE;
+        }
+        offset += len;
+    }
+
+    GError *err = NULL;
+    if (!ldm_volume_flush(h, &err)) {
+        fprintf(stderr, "Error flushing: %s\n", err->message);
+        g_error_free(err);
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+static gboolean
+check_volume(LDMVolumeHandle * const h, const guint64 size,
+             guint8 * const buf)
+{
+    for (guint64 offset = 0; offset < size;) {
+        GError *err = NULL;
+        const gssize n = ldm_volume_pread(h, buf, BUF_SIZE, offset, &err);
+        if (n <= 0) {
+            fprintf(stderr, "Error reading at %" G_GUINT64_FORMAT ": %s\n",
+                    offset, err ? err->message : "short read");
+            if (err) g_error_free(err);
+            return FALSE;
+        }
+
+        for (gssize j = 0; j < n; j++) {
+            if (buf[j] != pattern(offset + j)) {
+                fprintf(stderr, "Mismatch at %" G_GUINT64_FORMAT "\n",
+                        offset + j);
+                return FALSE;
+            }
+        }
+        offset += n;
+    }
+
+    return TRUE;
+}
+
+int main(int argc, const char *argv[])
+{
+    if (argc < 4) {
+        fprintf(stderr, "Usage: %s <disk group guid> <volume> <drive> "
+                        "[<drive> ...]\n", argv[0]);
+        return 1;
+    }
+
+#if !GLIB_CHECK_VERSION(2,35,0)
+    g_type_init();
+#endif
+
+    guint8 * const buf = g_malloc(BUF_SIZE);
+    int ret = 1;
+
+    LDM *ldm = ldm_new();
+    LDMVolume *vol = find_volume(ldm, argv[1], argv[2], argv + 3, argc - 3);
+    if (vol == NULL) goto out;
+
+    const guint64 size = ldm_volume_get_size(vol) * SECTOR_SIZE;
+
+    GError *err = NULL;
+    LDMVolumeHandle *h = ldm_volume_open_rw(vol, &err);
+    if (h == NULL) {
+        fprintf(stderr, "Error opening %s for writing: %s\n",
+                argv[2], err->message);
+        g_error_free(err);
+        goto out;
+    }
+    const gboolean written = write_volume(h, size, buf);
+    ldm_volume_close(h);
+    if (!written) goto out;
+
+    /* Read back through a fresh scan, which also checks that the metadata
+     * survived */
+    g_object_unref(vol);
+    g_object_unref(ldm);
+    ldm = ldm_new();
+    vol = find_volume(ldm, argv[1], argv[2], argv + 3, argc - 3);
+    if (vol == NULL) goto out;
+
+    h = ldm_volume_open(vol, &err);
+    if (h == NULL) {
+        fprintf(stderr, "Error opening %s: %s\n", argv[2], err->message);
+        g_error_free(err);
+        goto out;
+    }
+    const gboolean checked = check_volume(h, size, buf);
+    ldm_volume_close(h);
+    if (!checked) goto out;
+
+    ret = 0;
+
+out:
+    if (vol) g_object_unref(vol);
+    g_object_unref(ldm);
+    g_free(buf);
+
+    return ret;
+}